@@ -38,13 +38,24 @@
 #include <udp.h>
 #include <uart.h>
 #include <stsn.h>
+#include <xdp.h>
+#include <uring.h>
+#include <shm.h>
+#include <thread.h>
+#include <unix.h>
+#include <icmp.h>
+#include <selftest.h>
 #include <ftrace.h>
+#include <qdisc.h>
+#include <irq.h>
+#include <preflight.h>
+#include <sweep.h>
 
 #ifdef HAVE_NETMAP
 #include <netmap.h>
 #endif
 
-int run=1;
+int run=1, terminated;
 int abort_fd=0, latency_target_fd;
 
 static struct cyclicping_module modules[] = {
@@ -56,6 +67,19 @@ static struct cyclicping_module modules[] = {
 		uart_usage },
 	{ "stsn", stsn_init, stsn_client, stsn_server, stsn_deinit,
 		stsn_usage },
+	{ "xdp", xdp_init, xdp_client, xdp_server, xdp_deinit,
+		xdp_usage },
+	{ "uring", uring_init, uring_client, uring_server, uring_deinit,
+		uring_usage },
+	{ "shm", shm_init, shm_client, shm_server, shm_deinit,
+		shm_usage },
+	/* the server is a thread of the client */
+	{ "thread", thread_init, thread_client, NULL, thread_deinit,
+		thread_usage },
+	{ "unix", unix_init, unix_client, unix_server, unix_deinit,
+		unix_usage },
+	{ "icmp", icmp_init, icmp_client, icmp_server, icmp_deinit,
+		icmp_usage },
 #ifdef HAVE_NETMAP
 	{ "netmap", netmap_init, netmap_client, netmap_server, netmap_deinit,
 		netmap_usage },
@@ -116,22 +140,94 @@ int client_wait(struct cyclicping_cfg *cfg, struct timespec tfrom)
 	}
 	clock_nanosleep(cfg->opts.clock, TIMER_ABSTIME, &tfrom, NULL);
 
+	perf_start(cfg);
+
 	return 0;
 }
 
 /**
- * Runs the cyclicping main loop by either calling the server or client
- * run functions of the interface module.
+ * Get packet- and payload buffers.
+ *
+ * \param cfg Cyclicping config data.
+ */
+void allocate_buffers(struct cyclicping_cfg *cfg)
+{
+	cfg->recv_packet=(char*)malloc(cfg->opts.length);
+	if(cfg->recv_packet==NULL) {
+		perror("failed to allocate receive memory\n");
+		exit(1);
+	}
+
+	cfg->send_packet=(char*)malloc(cfg->opts.length);
+	if(cfg->send_packet==NULL) {
+		perror("failed to allocate send memory\n");
+		exit(1);
+	}
+}
+
+/**
+ * Get statistic-, histogram- and dump buffers. Called after the interface
+ * module was initialized, as the module decides about the number of
+ * responders.
+ *
+ * \param cfg Cyclicping config data.
+ */
+void allocate_stats(struct cyclicping_cfg *cfg)
+{
+	int i;
+
+	cfg->nstats=STAT_RESPONDER(cfg->responders);
+	cfg->stat=(struct tstats*)calloc(cfg->nstats, sizeof(struct tstats));
+	if(cfg->stat==NULL) {
+		perror("failed to allocate statistic memory\n");
+		exit(1);
+	}
+
+	/* histogram buffers for each statistic */
+	if(cfg->opts.histogram) {
+		for(i=0; i<cfg->nstats; i++) {
+			cfg->stat[i].histogram_data=(uint32_t*)malloc(
+				cfg->opts.histogram*sizeof(uint32_t));
+			if(cfg->stat[i].histogram_data==NULL) {
+				perror("failed to allocate histogram memory\n");
+				exit(1);
+			}
+			memset(cfg->stat[i].histogram_data, 0,
+				cfg->opts.histogram*sizeof(uint32_t));
+
+		}
+	}
+
+	init_stats(cfg);
+
+	/* data for each packet if packet dump was requested */
+	if(cfg->opts.dumpfile) {
+		cfg->dump=(uint32_t*)calloc((size_t)cfg->opts.number*
+			cfg->nstats, sizeof(uint32_t));
+		if(cfg->dump==NULL) {
+			perror("failed to allocate dump memory\n");
+			exit(1);
+		}
+	}
+}
+
+/**
+ * Split the interface module arguments and initialize the module. The
+ * qdisc is set up once the module knows how it sends. If that fails, the
+ * module is released again.
  *
  * \param cfg Cyclicping config data.
  * \return 0 on success.
  */
-int run_cyclicping(struct cyclicping_cfg *cfg)
+int init_module(struct cyclicping_cfg *cfg)
 {
-	int i, ret=0;
+	int i;
 	char *modargv[MAX_MOD_ARG];
 	char *saveptr=NULL;
 
+	if(qdisc_parse(cfg))
+		return 1;
+
 	/* get args for interface module */
 	modargv[0]=strtok_r(cfg->opts.opt_mod, ":", &saveptr);
 	for(i=1; i<MAX_MOD_ARG; i++) {
@@ -143,6 +239,60 @@ int run_cyclicping(struct cyclicping_cfg *cfg)
 	if(cfg->current_mod->init(cfg, modargv, i))
 		return 1;
 
+	/* the module is up, release it as at the end of a run */
+	if(qdisc_setup(cfg)) {
+		if(abort_fd) {
+			close(abort_fd);
+			abort_fd=0;
+		}
+
+		if(cfg->current_mod->deinit)
+			cfg->current_mod->deinit(cfg);
+
+		qdisc_restore(cfg);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Runs the cyclicping main loop by either calling the server or client
+ * run functions of the interface module.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success.
+ */
+int run_cyclicping(struct cyclicping_cfg *cfg)
+{
+	int ret=0;
+
+	if(init_module(cfg))
+		return 1;
+
+	/* the module might have set up further queues and their IRQs, the
+	 * audit sees the IRQ placement in effect */
+	if(irq_setup(cfg) || preflight_check(cfg)) {
+		ret=1;
+		goto out;
+	}
+
+	/* counters of the measuring thread */
+	if(!cfg->opts.server && perf_open(cfg)) {
+		ret=1;
+		goto out;
+	}
+	perf_start(cfg);
+
+	/* background traffic sharing the link with the measurement */
+	if(load_start(cfg)) {
+		ret=1;
+		goto out;
+	}
+
+	allocate_stats(cfg);
+
 	gettimeofday(&cfg->test_start, NULL);
 
 	if(cfg->opts.ftrace)
@@ -163,64 +313,24 @@ int run_cyclicping(struct cyclicping_cfg *cfg)
 
 	gettimeofday(&cfg->test_end, NULL);
 
-	if(abort_fd)
-		close(abort_fd);
-
-	if(cfg->current_mod->deinit)
-		cfg->current_mod->deinit(cfg);
-
-	return ret;
-}
-
-/**
- * Get histogram-, packet- and payload buffers.
- *
- * \param cfg Cyclicping config data.
- */
-void allocate_buffers(struct cyclicping_cfg *cfg)
-{
-	int i;
-
-	/* histogram buffers for send, recv, and roundtrip */
-	if(cfg->opts.histogram) {
-		for(i=0; i<=STAT_ALL; i++) {
-			cfg->stat[i].histogram_data=(uint32_t*)malloc(
-				cfg->opts.histogram*sizeof(uint32_t));
-			if(cfg->stat[i].histogram_data==NULL) {
-				perror("failed to allocate histogram memory\n");
-				exit(1);
-			}
-			memset(cfg->stat[i].histogram_data, 0,
-				cfg->opts.histogram*sizeof(uint32_t));
+	perf_close(cfg);
 
-		}
+out:
+	/* every exit after the module is up drops its abort descriptor */
+	if(abort_fd) {
+		close(abort_fd);
+		abort_fd=0;
 	}
 
-	for(i=0; i<=STAT_ALL; i++) {
-		cfg->stat[i].min=UINT32_MAX;
-	}
+	load_stop(cfg);
 
-	cfg->recv_packet=(char*)malloc(cfg->opts.length);
-	if(cfg->recv_packet==NULL) {
-		perror("failed to allocate receive memory\n");
-		exit(1);
-	}
+	if(cfg->current_mod->deinit)
+		cfg->current_mod->deinit(cfg);
 
-	cfg->send_packet=(char*)malloc(cfg->opts.length);
-	if(cfg->send_packet==NULL) {
-		perror("failed to allocate send memory\n");
-		exit(1);
-	}
+	qdisc_restore(cfg);
+	irq_restore(cfg);
 
-	/* data for each packet if packet dump was requested */
-	if(cfg->opts.dumpfile) {
-		cfg->dump=(struct pdump*)malloc(
-			cfg->opts.number*sizeof(struct pdump));
-		if(cfg->dump==NULL) {
-			perror("failed to allocate dump memory\n");
-			exit(1);
-		}
-	}
+	return ret;
 }
 
 /**
@@ -259,15 +369,21 @@ void cleanup_cfg(struct cyclicping_cfg *cfg)
 	if(cfg->opts.dumpfile)
 		free(cfg->opts.dumpfile);
 
-	for(i=0; i<=STAT_ALL; i++) {
+	for(i=0; i<cfg->nstats; i++) {
 		if(cfg->stat[i].histogram_data) {
 			free(cfg->stat[i].histogram_data);
 		}
 	}
 
+	if(cfg->stat)
+		free(cfg->stat);
+
 	if(cfg->dump) {
 		free(cfg->dump);
 	}
+
+	free(cfg->perf.windows);
+	free(cfg->sweep.points);
 }
 
 /**
@@ -278,6 +394,7 @@ void cleanup_cfg(struct cyclicping_cfg *cfg)
 void term_handler(int signum)
 {
 	run=0;
+	terminated=1;
 
 	/* An interface module might wait on a file descriptor. Close it to
 	 * make the module return. */
@@ -332,17 +449,26 @@ int main(int argc, char *argv[])
 
 	allocate_buffers(&cfg);
 
-	ret=run_cyclicping(&cfg);
+	if(cfg.sweep.enabled)
+		ret=run_sweep(&cfg);
+	else if(cfg.opts.selftest)
+		ret=run_selftest(&cfg);
+	else
+		ret=run_cyclicping(&cfg);
 
 	if(!cfg.opts.quiet)
 		printf("\n\n\n");
 
 	if(!ret) {
-		if(cfg.opts.histogram) {
+		if(cfg.sweep.enabled) {
+			sweep_print(&cfg, stdout, argc, argv);
+		} else if(cfg.opts.histogram) {
 			if(cfg.opts.gnuplot)
 				print_gnuplot_histogram(&cfg, argc, argv);
 			else
 				print_histogram(&cfg, argc, argv);
+		} else {
+			perf_print_summary(&cfg, stdout);
 		}
 	}
 
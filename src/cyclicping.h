@@ -24,6 +24,12 @@
 
 #include <stats.h>
 #include <opts.h>
+#include <qdisc.h>
+#include <irq.h>
+#include <preflight.h>
+#include <perf.h>
+#include <load.h>
+#include <sweep.h>
 
 #define VERSION         "0.1.0"
 
@@ -44,8 +50,24 @@ struct cyclicping_cfg {
 	char *send_packet;
 
 	uint64_t cnt;
-	struct tstats stat[STAT_ALL+1];
-	struct pdump *dump;
+	uint32_t seq;
+	struct seq_stats seqs;
+	int responders;
+	int echo_only;
+	int frame_timing;
+	uint64_t wire_time;
+	char wire_info[80];
+	/* interface the wire time is computed for */
+	char wire_ifname[16];
+	struct qdisc_cfg qdisc;
+	struct irq_cfg irq;
+	struct preflight_cfg preflight;
+	struct perf_cfg perf;
+	struct load_cfg load;
+	struct sweep_cfg sweep;
+	int nstats;
+	struct tstats *stat;
+	uint32_t *dump;
 
 	struct timeval test_start;
 	struct timeval test_end;
@@ -55,5 +77,10 @@ struct cyclicping_cfg {
 };
 
 int client_wait(struct cyclicping_cfg *cfg, struct timespec tfrom);
+void allocate_buffers(struct cyclicping_cfg *cfg);
+void allocate_stats(struct cyclicping_cfg *cfg);
+int init_module(struct cyclicping_cfg *cfg);
+int run_cyclicping(struct cyclicping_cfg *cfg);
+void cleanup_cfg(struct cyclicping_cfg *cfg);
 
 #endif
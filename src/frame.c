@@ -0,0 +1,440 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <frame.h>
+
+/**
+ * Ones' complement sum of a buffer. The 16 bit words are summed in memory
+ * order, which gives the checksum in network byte order on any host (RFC
+ * 1071). 32 bit words are added into 64 bit accumulators, two at a time
+ * with SSE2, and folded at the end, as 2^16 = 1 in ones' complement
+ * arithmetic.
+ *
+ * \param data Data to sum, starting at an even offset of the checksummed
+ *             range.
+ * \param len Length of data.
+ * \param sum Current sum value.
+ * \return New sum, not yet folded to 16 bit.
+ */
+static uint32_t csum_partial(const void *data, int len, uint32_t sum)
+{
+	const uint8_t *p=data;
+	uint64_t acc=sum;
+	uint32_t word;
+	uint16_t half=0;
+#ifdef __SSE2__
+	__m128i zero=_mm_setzero_si128();
+	__m128i vsum=zero, v;
+	uint64_t lanes[2];
+
+	for(; len>=16; p+=16, len-=16) {
+		v=_mm_loadu_si128((const __m128i*)p);
+		vsum=_mm_add_epi64(vsum, _mm_unpacklo_epi32(v, zero));
+		vsum=_mm_add_epi64(vsum, _mm_unpackhi_epi32(v, zero));
+	}
+
+	_mm_storeu_si128((__m128i*)lanes, vsum);
+	acc+=(lanes[0]&0xffffffff)+(lanes[0]>>32);
+	acc+=(lanes[1]&0xffffffff)+(lanes[1]>>32);
+#endif
+
+	for(; len>=4; p+=4, len-=4) {
+		memcpy(&word, p, sizeof(word));
+		acc+=word;
+	}
+
+	if(len>=2) {
+		memcpy(&half, p, sizeof(half));
+		acc+=half;
+		p+=2;
+		len-=2;
+	}
+
+	/* a single byte left over is the first byte of a zero padded word */
+	if(len) {
+		half=0;
+		memcpy(&half, p, 1);
+		acc+=half;
+	}
+
+	acc=(acc&0xffffffff)+(acc>>32);
+	acc=(acc&0xffffffff)+(acc>>32);
+
+	return acc;
+}
+
+/**
+ * Fold sum to 16 bit.
+ *
+ * \param sum Sum to fold.
+ * \return Folded sum (not complemented).
+ */
+static uint16_t csum_fold(uint32_t sum)
+{
+	sum=(sum&0xffff)+(sum>>16);
+	sum=(sum&0xffff)+(sum>>16);
+
+	return sum;
+}
+
+/**
+ * Compute the internet checksum of a buffer.
+ *
+ * \param data Data to checksum.
+ * \param len Length of data.
+ * \return Checksum in network byte order.
+ */
+uint16_t frame_checksum(const void *data, uint16_t len)
+{
+	return ~csum_fold(csum_partial(data, len, 0));
+}
+
+/**
+ * Compute the UDP checksum of a frame, including pseudo header and
+ * payload. The payload has to follow the header in memory.
+ *
+ * \param pkt Frame with IP addresses and UDP length set.
+ * \param length UDP payload length.
+ */
+void frame_udp_checksum(struct pkt *pkt, int length)
+{
+	uint32_t sum;
+	uint16_t csum;
+
+	/* pseudo header: addresses, protocol and UDP length. The sum of the
+	 * addresses is folded first, adding to it could overflow. */
+	sum=csum_fold(csum_partial(&pkt->ip.ip_src,
+		2*sizeof(struct in_addr), 0));
+	sum+=htons(IPPROTO_UDP);
+	sum+=pkt->udp.uh_ulen;
+
+	pkt->udp.uh_sum=0;
+	sum=csum_partial(&pkt->udp, sizeof(struct udphdr)+length, sum);
+
+	/* zero means no checksum, send all ones instead */
+	csum=~csum_fold(sum);
+	pkt->udp.uh_sum=csum?csum:0xffff;
+}
+
+/**
+ * Update a checksum for modified data without summing up the unmodified
+ * rest (RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m')).
+ *
+ * \param csum Checksum to update, in network byte order.
+ * \param old Data before the modification.
+ * \param new Data after the modification.
+ * \param len Length of the modified range, starting at an even offset.
+ * \return Updated checksum.
+ */
+uint16_t frame_checksum_update(uint16_t csum, const void *old,
+	const void *new, int len)
+{
+	uint32_t sum;
+
+	sum=(uint16_t)~csum;
+	sum+=(uint16_t)~csum_fold(csum_partial(old, len, 0));
+	sum+=csum_fold(csum_partial(new, len, 0));
+
+	return ~csum_fold(sum);
+}
+
+/**
+ * Update the UDP checksum of a frame after part of the payload was
+ * modified. Frames without checksum are left alone.
+ *
+ * \param pkt Frame.
+ * \param old Payload data before the modification.
+ * \param new Payload data after the modification.
+ * \param len Length of the modified range, starting at an even payload
+ *            offset.
+ */
+void frame_udp_update(struct pkt *pkt, const void *old, const void *new,
+	int len)
+{
+	uint16_t csum;
+
+	if(!pkt->udp.uh_sum)
+		return;
+
+	csum=frame_checksum_update(pkt->udp.uh_sum, old, new, len);
+	pkt->udp.uh_sum=csum?csum:0xffff;
+}
+
+/**
+ * Get IP and MAC address of the network interface and store them in the
+ * packet header of the outgoing packet.
+ *
+ * \param device Network interface name.
+ * \param pkt Packet header to fill in.
+ * \return 0 on success.
+ */
+int frame_interface_info(const char *device, struct pkt *pkt)
+{
+	struct sockaddr *hwaddr;
+	struct sockaddr_in *inaddr;
+	int fd;
+	struct ifreq ifr;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd<0) {
+		perror("failed to open socket");
+		return 1;
+	}
+
+	/* set protocol family and interface name for ioctl request */
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_addr.sa_family = AF_INET;
+	strncpy(ifr.ifr_name, device, IFNAMSIZ-1);
+
+	/* request ip address if the interface */
+	if(ioctl(fd, SIOCGIFADDR, &ifr)!=0) {
+		fprintf(stderr, "failed to retrieve interface address for %s\n",
+			device);
+		close(fd);
+		return 1;
+	}
+
+	inaddr=(struct sockaddr_in*)&ifr.ifr_addr;
+	memcpy(&pkt->ip.ip_src, &inaddr->sin_addr, sizeof(struct in_addr));
+
+	/* request hardware address */
+	if(ioctl(fd, SIOCGIFHWADDR, &ifr)!=0) {
+		fprintf(stderr, "failed to retrieve interface hw address\n");
+		close(fd);
+		return 1;
+	}
+
+	hwaddr=(struct sockaddr*)&ifr.ifr_addr;
+	memcpy(&pkt->eh.ether_shost, hwaddr->sa_data, ETH_ALEN);
+	close(fd);
+
+	return 0;
+}
+
+/**
+ * Initializes some basic packet data in the ethernet, ip and udp header
+ * of the outgoing packet. Source addresses have to be set before via
+ * frame_interface_info().
+ *
+ * \param pkt Packet header to initialize.
+ * \param dest_hwaddr Destination MAC address.
+ * \param dest_addr Destination IP address.
+ * \param port UDP source and destination port.
+ * \param length UDP payload length.
+ */
+void frame_init(struct pkt *pkt, const struct ether_addr *dest_hwaddr,
+	const struct in_addr *dest_addr, int port, int length)
+{
+	/* prepare the headers */
+	pkt->ip.ip_v = IPVERSION;
+	pkt->ip.ip_hl = 5;
+	pkt->ip.ip_id = 0;
+	pkt->ip.ip_tos = IPTOS_LOWDELAY;
+	pkt->ip.ip_len = ntohs(length + sizeof(struct udphdr) +
+		sizeof(pkt->ip));
+	pkt->ip.ip_off = htons(IP_DF); /* Don't fragment */
+	pkt->ip.ip_ttl = IPDEFTTL;
+	pkt->ip.ip_p = IPPROTO_UDP;
+	pkt->ip.ip_dst.s_addr = dest_addr->s_addr;
+	pkt->ip.ip_sum = 0;
+	pkt->ip.ip_sum = frame_checksum(&pkt->ip, sizeof(pkt->ip));
+
+	pkt->udp.uh_sport = htons(port);
+	pkt->udp.uh_dport = htons(port);
+	pkt->udp.uh_ulen = htons(length + sizeof(struct udphdr));
+	pkt->udp.uh_sum = 0;
+
+	memcpy(pkt->eh.ether_dhost, dest_hwaddr, sizeof(struct ether_addr));
+	pkt->eh.ether_type = htons(ETHERTYPE_IP);
+}
+
+/**
+ * Turn a received packet into a reply in place by swapping source and
+ * destination addresses and ports. Neither the IP nor the UDP checksum
+ * change by swapping, as the ones' complement sum doesn't depend on the
+ * order of the words. Payload modifications have to be accounted for with
+ * frame_udp_update().
+ *
+ * \param pkt Header of the received packet.
+ */
+void frame_swap(struct pkt *pkt)
+{
+	struct ether_addr hwaddr;
+	struct in_addr addr;
+	uint16_t port;
+
+	memcpy(&hwaddr, pkt->eh.ether_dhost, sizeof(hwaddr));
+	memcpy(pkt->eh.ether_dhost, pkt->eh.ether_shost, sizeof(hwaddr));
+	memcpy(pkt->eh.ether_shost, &hwaddr, sizeof(hwaddr));
+
+	addr=pkt->ip.ip_dst;
+	pkt->ip.ip_dst=pkt->ip.ip_src;
+	pkt->ip.ip_src=addr;
+
+	port=pkt->udp.uh_dport;
+	pkt->udp.uh_dport=pkt->udp.uh_sport;
+	pkt->udp.uh_sport=port;
+}
+
+/**
+ * Check if a received frame is a cyclicping UDP frame for us.
+ *
+ * \param pkt Header of the received frame.
+ * \param len Length of the received frame.
+ * \param port Local UDP port.
+ * \param length Expected UDP payload length.
+ * \return 1 if the frame matches, else 0.
+ */
+int frame_match(const struct pkt *pkt, int len, int port, int length)
+{
+	/* size doesn't match, not for us */
+	if(len!=sizeof(struct pkt)+length)
+		return 0;
+
+	if(pkt->eh.ether_type!=htons(ETHERTYPE_IP) ||
+		pkt->ip.ip_p!=IPPROTO_UDP)
+		return 0;
+
+	/* ports dont't match, still not for us */
+	if(pkt->udp.uh_dport!=htons(port))
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Set an empty tag configuration.
+ *
+ * \param vlan Tag configuration.
+ */
+void vlan_cfg_init(struct vlan_cfg *vlan)
+{
+	vlan->vid=-1;
+	vlan->pcp=-1;
+}
+
+/**
+ * Parse a vlan=<vid> or pcp=<priority> module flag.
+ *
+ * \param vlan Tag configuration.
+ * \param flag Flag to parse.
+ * \return 1 if the flag was parsed, 0 if it's no tag flag, -1 if the value
+ * is invalid.
+ */
+int vlan_parse_flag(struct vlan_cfg *vlan, const char *flag)
+{
+	if(sscanf(flag, "vlan=%d", &vlan->vid)==1) {
+		if(vlan->vid<0 || vlan->vid>FRAME_VLAN_MAX_VID) {
+			fprintf(stderr, "invalid vlan id %d\n", vlan->vid);
+			return -1;
+		}
+		return 1;
+	}
+
+	if(sscanf(flag, "pcp=%d", &vlan->pcp)==1) {
+		if(vlan->pcp<0 || vlan->pcp>FRAME_VLAN_MAX_PCP) {
+			fprintf(stderr, "invalid vlan priority %d\n",
+				vlan->pcp);
+			return -1;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Get the tag control information of a tag configuration. A priority
+ * without vlan id gives a priority tag (vlan id 0).
+ *
+ * \param vlan Tag configuration.
+ * \return Tag control information or -1 for untagged frames.
+ */
+int vlan_tci(const struct vlan_cfg *vlan)
+{
+	if(vlan->vid<0 && vlan->pcp<0)
+		return -1;
+
+	return (vlan->pcp<0?0:vlan->pcp)<<FRAME_VLAN_PCP_SHIFT |
+		(vlan->vid<0?0:vlan->vid);
+}
+
+/**
+ * Remove the 802.1Q tag of a received frame in place. Only the MAC
+ * addresses are moved, the frame then starts FRAME_VLAN_LEN bytes later.
+ *
+ * \param frame Received frame.
+ * \param len Frame length, reduced by the tag length.
+ * \param tci Expected tag control information or -1 for untagged frames.
+ * \return Frame without tag or NULL if the tag is missing or has another
+ * vlan id.
+ */
+struct pkt *frame_vlan_pop(char *frame, int *len, int tci)
+{
+	struct vlan_tag *tag=(struct vlan_tag*)(frame+2*ETH_ALEN);
+
+	if(tci<0)
+		return (struct pkt*)frame;
+
+	if(*len<FRAME_VLAN_LEN+sizeof(struct pkt) ||
+		tag->tpid!=htons(ETHERTYPE_VLAN) ||
+		(ntohs(tag->tci) & FRAME_VLAN_VID_MASK)!=
+		(tci & FRAME_VLAN_VID_MASK))
+		return NULL;
+
+	memmove(frame+FRAME_VLAN_LEN, frame, 2*ETH_ALEN);
+	*len-=FRAME_VLAN_LEN;
+
+	return (struct pkt*)(frame+FRAME_VLAN_LEN);
+}
+
+/**
+ * Insert an 802.1Q tag in place. The frame has to be preceded by
+ * FRAME_VLAN_LEN bytes of headroom (e.g. left by frame_vlan_pop()).
+ *
+ * \param pkt Untagged frame.
+ * \param tci Tag control information or -1 for untagged frames.
+ * \return Start of the tagged frame.
+ */
+char *frame_vlan_push(struct pkt *pkt, int tci)
+{
+	char *frame=(char*)pkt-FRAME_VLAN_LEN;
+	struct vlan_tag *tag=(struct vlan_tag*)(frame+2*ETH_ALEN);
+
+	if(tci<0)
+		return (char*)pkt;
+
+	memmove(frame, pkt, 2*ETH_ALEN);
+	tag->tpid=htons(ETHERTYPE_VLAN);
+	tag->tci=htons(tci);
+
+	return frame;
+}
@@ -0,0 +1,73 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+
+/* Ethernet, IP and UDP header of the frames built by kernel bypass
+ * modules */
+struct pkt {
+        struct ether_header eh;
+        struct ip ip;
+        struct udphdr udp;
+} __attribute__((__packed__));
+
+/* 802.1Q tag, inserted after the MAC addresses */
+struct vlan_tag {
+	uint16_t tpid;
+	uint16_t tci;
+} __attribute__((__packed__));
+
+#define FRAME_VLAN_LEN		sizeof(struct vlan_tag)
+#define FRAME_VLAN_MAX_VID	4094
+#define FRAME_VLAN_MAX_PCP	7
+#define FRAME_VLAN_PCP_SHIFT	13
+/* only the vlan id is verified on receive, bridges may remap the
+ * priority */
+#define FRAME_VLAN_VID_MASK	0x0fff
+
+/* tag configuration of a module, -1 if not set */
+struct vlan_cfg {
+	int vid;
+	int pcp;
+};
+
+void vlan_cfg_init(struct vlan_cfg *vlan);
+int vlan_parse_flag(struct vlan_cfg *vlan, const char *flag);
+int vlan_tci(const struct vlan_cfg *vlan);
+struct pkt *frame_vlan_pop(char *frame, int *len, int tci);
+char *frame_vlan_push(struct pkt *pkt, int tci);
+int frame_interface_info(const char *device, struct pkt *pkt);
+void frame_init(struct pkt *pkt, const struct ether_addr *dest_hwaddr,
+	const struct in_addr *dest_addr, int port, int length);
+void frame_swap(struct pkt *pkt);
+int frame_match(const struct pkt *pkt, int len, int port, int length);
+uint16_t frame_checksum(const void *data, uint16_t len);
+uint16_t frame_checksum_update(uint16_t csum, const void *old,
+	const void *new, int len);
+void frame_udp_checksum(struct pkt *pkt, int length);
+void frame_udp_update(struct pkt *pkt, const void *old, const void *new,
+	int len);
+
+#endif
@@ -0,0 +1,52 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <futex.h>
+
+/**
+ * Sleep as long as a futex word contains the expected value. The futex is
+ * not private, so it works on shared memory between processes.
+ *
+ * \param uaddr Futex word.
+ * \param val Expected value.
+ * \param timeout Relative timeout or NULL to wait forever.
+ * \return 0 if woken up, -1 on timeout, interruption or value mismatch
+ *         (see errno).
+ */
+int futex_wait(uint32_t *uaddr, uint32_t val, const struct timespec *timeout)
+{
+	return syscall(SYS_futex, uaddr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+/**
+ * Wake up waiters sleeping on a futex word.
+ *
+ * \param uaddr Futex word.
+ * \param nr Maximum number of waiters to wake.
+ * \return Number of woken waiters or -1 on error.
+ */
+int futex_wake(uint32_t *uaddr, int nr)
+{
+	return syscall(SYS_futex, uaddr, FUTEX_WAKE, nr, NULL, NULL, 0);
+}
@@ -0,0 +1,355 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <sys/select.h>
+
+#include <cyclicping.h>
+#include <opts.h>
+#include <stats.h>
+#include <socket.h>
+#include <proto.h>
+#include <frame.h>
+#include <icmp.h>
+
+extern int run;
+extern int abort_fd;
+
+/**
+ * Open ICMP socket. Unprivileged ping sockets are preferred, raw sockets
+ * are used if requested or if ping sockets are not permitted
+ * (net.ipv4.ping_group_range).
+ *
+ * \param icfg ICMP module config.
+ * \param mode "raw", "dgram" or NULL for automatic selection.
+ * \return 0 on success.
+ */
+static int icmp_open_socket(struct icmp_cfg *icfg, const char *mode)
+{
+	struct icmp_filter filter;
+
+	if(mode==NULL || strcmp(mode, "dgram")==0) {
+		icfg->socket=socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP);
+		if(icfg->socket>=0)
+			return 0;
+
+		if(mode!=NULL || (errno!=EACCES && errno!=EPERM)) {
+			perror("failed to create ping socket");
+			return 1;
+		}
+	} else if(strcmp(mode, "raw")) {
+		fprintf(stderr, "unknown icmp socket type %s\n", mode);
+		return 1;
+	}
+
+	icfg->socket=socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+	if(icfg->socket<0) {
+		perror("failed to create raw socket");
+		return 1;
+	}
+	icfg->raw=1;
+
+	/* only echo replies are of interest */
+	filter.data=~(1U<<ICMP_ECHOREPLY);
+	if(setsockopt(icfg->socket, SOL_RAW, ICMP_FILTER, &filter,
+		sizeof(filter))<0) {
+		perror("failed to set icmp filter");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Attach a socket filter to a raw socket, which only passes echo replies
+ * of the target to this client.
+ *
+ * \param icfg ICMP module config.
+ * \return 0 on success, else 1.
+ */
+static int icmp_attach_filter(struct icmp_cfg *icfg)
+{
+	struct sock_filter code[]={
+		/* source address of the IP header */
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 12),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K,
+			ntohl(icfg->dest_addr.sin_addr.s_addr), 0, 5),
+		/* skip the IP header, type and id of the echo reply */
+		BPF_STMT(BPF_LDX|BPF_B|BPF_MSH, 0),
+		BPF_STMT(BPF_LD|BPF_B|BPF_IND, 0),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ICMP_ECHOREPLY, 0, 2),
+		BPF_STMT(BPF_LD|BPF_H|BPF_IND, 4),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, icfg->id, 1, 0),
+		BPF_STMT(BPF_RET|BPF_K, 0),
+		BPF_STMT(BPF_RET|BPF_K, UINT32_MAX),
+	};
+
+	return set_socket_filter(icfg->socket, code,
+		sizeof(code)/sizeof(code[0]));
+}
+
+/**
+ * Init ICMP module. Parse module args. Open socket and prepare echo
+ * request.
+ *
+ * \param cfg Cyclicping config data.
+ * \param argv Interface module arguments.
+ * \param argc Interface module count.
+ * \return 0 on success.
+ */
+int icmp_init(struct cyclicping_cfg *cfg, char **argv, int argc)
+{
+	struct icmp_cfg *icfg;
+	struct icmphdr *icmp;
+
+	icfg=(struct icmp_cfg*)calloc(1, sizeof(struct icmp_cfg));
+	if(icfg==NULL) {
+		perror("failed to allocate memory for icmp cfg");
+		return 1;
+	}
+
+	cfg->current_mod->modcfg=icfg;
+
+	if(cfg->opts.server) {
+		fprintf(stderr, "icmp module has no server mode, the target "
+			"answers echo requests\n");
+		return 1;
+	}
+
+	if(argc<2) {
+		fprintf(stderr, "destination address requiered for icmp\n");
+		return 1;
+	}
+
+	if(inet_aton(argv[1], &icfg->dest_addr.sin_addr)==0) {
+		fprintf(stderr, "failed to convert destination address\n");
+		return 1;
+	}
+	icfg->dest_addr.sin_family=AF_INET;
+
+	if(icmp_open_socket(icfg, argc>=3?argv[2]:NULL))
+		return 1;
+
+	if(set_socket_priority(icfg->socket, cfg->opts.sopriority)) {
+		return 1;
+	}
+
+	if(set_socket_tos(icfg->socket, cfg->opts.tos)) {
+		return 1;
+	}
+
+	abort_fd=icfg->socket;
+
+	/* the target returns the payload unchanged, there are no server
+	 * time stamps */
+	cfg->echo_only=1;
+
+	/* echo request and reply (reply may include the IP header) */
+	icfg->packet=(char*)calloc(1, sizeof(struct icmphdr)+
+		cfg->opts.length);
+	icfg->reply_len=60+sizeof(struct icmphdr)+cfg->opts.length;
+	icfg->reply=(char*)malloc(icfg->reply_len);
+	if(icfg->packet==NULL || icfg->reply==NULL) {
+		perror("failed to allocate icmp packet memory");
+		return 1;
+	}
+
+	/* ping sockets replace the id with their local port */
+	icfg->id=getpid()&0xffff;
+
+	icmp=(struct icmphdr*)icfg->packet;
+	icmp->type=ICMP_ECHO;
+	icmp->code=0;
+	icmp->un.echo.id=htons(icfg->id);
+
+	/* a raw socket gets a copy of every ICMP packet of the host */
+	if(icfg->raw && icmp_attach_filter(icfg))
+		return 1;
+
+	hdr_init(icfg->packet+sizeof(struct icmphdr), cfg->opts.length);
+
+	return 0;
+}
+
+/**
+ * Check if a received packet is an echo reply of this client.
+ *
+ * \param cfg Cyclicping config data.
+ * \param len Length of the received packet.
+ * \return Pointer to the echo payload or NULL.
+ */
+static char *icmp_match(struct cyclicping_cfg *cfg, int len)
+{
+	struct icmp_cfg *icfg=cfg->current_mod->modcfg;
+	struct icmphdr *icmp;
+	char *data=icfg->reply;
+	int hlen;
+
+	/* raw sockets deliver the IP header */
+	if(icfg->raw) {
+		hlen=(data[0]&0x0f)*4;
+		if(len<hlen)
+			return NULL;
+		data+=hlen;
+		len-=hlen;
+	}
+
+	if(len<sizeof(struct icmphdr)+cfg->opts.length)
+		return NULL;
+
+	icmp=(struct icmphdr*)data;
+	if(icmp->type!=ICMP_ECHOREPLY)
+		return NULL;
+
+	if(icfg->raw && ntohs(icmp->un.echo.id)!=icfg->id)
+		return NULL;
+
+	data+=sizeof(struct icmphdr);
+	if(hdr_check(data, cfg->opts.length))
+		return NULL;
+
+	return data;
+}
+
+/**
+ * ICMP client.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+int icmp_client(struct cyclicping_cfg *cfg)
+{
+	struct icmp_cfg *icfg=cfg->current_mod->modcfg;
+	struct icmphdr *icmp=(struct icmphdr*)icfg->packet;
+	int selectResult, len, plen=sizeof(struct icmphdr)+cfg->opts.length;
+	struct timespec tsend, trecv, left;
+	struct timeval timeout;
+	char *payload;
+	fd_set set;
+
+	icmp->un.echo.sequence=htons(cfg->seq&0xffff);
+	icmp->checksum=0;
+
+	/* take timestamp and copy it to send packet */
+	hdr_stamp_request(icfg->packet+sizeof(struct icmphdr), cfg->seq,
+		cfg->opts.clock, &tsend);
+
+	/* ping sockets fill in the checksum */
+	if(icfg->raw)
+		icmp->checksum=frame_checksum(icfg->packet, plen);
+
+	if(sendto(icfg->socket, icfg->packet, plen, 0,
+		(const struct sockaddr *)&icfg->dest_addr,
+		sizeof(icfg->dest_addr))==-1) {
+		perror("icmp client failed to send packet");
+		return 1;
+	}
+
+	/* skip replies of other pings on the host, late replies to earlier
+	 * requests are counted and skipped */
+	while(run) {
+		if(reply_timeout(cfg, &tsend, &left)) {
+			reply_lost(cfg);
+			break;
+		}
+		timeout.tv_sec=left.tv_sec;
+		timeout.tv_usec=left.tv_nsec/1000;
+
+		FD_ZERO(&set);
+		FD_SET(icfg->socket, &set);
+		selectResult=select(icfg->socket+1, &set, NULL, NULL,
+			&timeout);
+		if(selectResult==0)
+			continue;
+		if(selectResult<0) {
+			if(errno==EINTR)
+				continue;
+			fprintf(stderr, "icmp client select failed\n");
+			return 1;
+		}
+
+		if((len=recv(icfg->socket, icfg->reply, icfg->reply_len,
+			0))==-1) {
+			perror("icmp client failed to receive packet");
+			return 1;
+		}
+		clock_gettime(cfg->opts.clock, &trecv);
+
+		payload=icmp_match(cfg, len);
+		if(payload==NULL || match_reply(cfg, hdr_get_seq(payload))!=
+			REPLY_CURRENT)
+			continue;
+
+		/* add packet time to statistics */
+		if(add_packet_stats(cfg, &tsend, payload, &trecv))
+			return 1;
+
+		break;
+	}
+
+	cfg->seq++;
+
+	/* wait until next inverval */
+	return client_wait(cfg, tsend);
+}
+
+/**
+ * ICMP server. Not supported, targets answer with their own stack.
+ *
+ * \param cfg Cyclicping config data.
+ * \return Always 1.
+ */
+int icmp_server(struct cyclicping_cfg *cfg)
+{
+	return 1;
+}
+
+/**
+ * Clean up ICMP module ressources.
+ *
+ * \param cfg Cyclicping config data.
+ */
+void icmp_deinit(struct cyclicping_cfg *cfg)
+{
+	struct icmp_cfg *icfg=cfg->current_mod->modcfg;
+
+	if(icfg->packet)
+		free(icfg->packet);
+	if(icfg->reply)
+		free(icfg->reply);
+
+	free(icfg);
+}
+
+/**
+ * Ouput ICMP interface module usage.
+ */
+void icmp_usage(void)
+{
+	printf("  icmp - Use ICMP echo requests, no cyclicping server "
+		"needed\n");
+	printf("    icmp:targetip[:raw|dgram] ICMP client\n");
+}
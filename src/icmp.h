@@ -0,0 +1,44 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __ICMP_H__
+#define __ICMP_H__
+
+/* linux/icmp.h pulls in linux/if.h, which only coexists with net/if.h
+ * (used by netmap and others) if the libc header comes first */
+#include <net/if.h>
+#include <linux/icmp.h>
+
+struct icmp_cfg {
+	struct sockaddr_in dest_addr;
+	int socket;
+	int raw;
+	uint16_t id;
+	char *packet;
+	char *reply;
+	int reply_len;
+};
+
+int icmp_init(struct cyclicping_cfg *cfg, char **argv, int argc);
+int icmp_client(struct cyclicping_cfg *cfg);
+int icmp_server(struct cyclicping_cfg *cfg);
+void icmp_deinit(struct cyclicping_cfg *cfg);
+void icmp_usage(void);
+
+#endif
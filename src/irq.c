@@ -0,0 +1,489 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sched.h>
+#include <limits.h>
+#include <libgen.h>
+
+#include <cyclicping.h>
+#include <irq.h>
+
+/* IRQ threads run above the measuring thread by default */
+#define IRQ_PRIO_OFFSET		1
+
+/**
+ * Parse the IRQ option (interface[:flags]).
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success.
+ */
+static int irq_parse(struct cyclicping_cfg *cfg)
+{
+	struct irq_cfg *q=&cfg->irq;
+	char *args, *ifname, *flags, *flag;
+	char *saveptr=NULL, *flagptr=NULL;
+	int ret=1;
+
+	args=strdup(cfg->opts.opt_irq);
+	if(args==NULL) {
+		perror("failed to allocate memory for irq args");
+		return 1;
+	}
+
+	q->prio_offset=IRQ_PRIO_OFFSET;
+	q->cpu=cfg->opts.opt_affinity?cfg->opts.affinity:-1;
+
+	ifname=strtok_r(args, ":", &saveptr);
+	flags=strtok_r(NULL, ":", &saveptr);
+
+	if(ifname==NULL || strlen(ifname)>=sizeof(q->ifname)) {
+		fprintf(stderr, "invalid irq interface\n");
+		goto out;
+	}
+	strcpy(q->ifname, ifname);
+
+	for(flag=flags?strtok_r(flags, ",", &flagptr):NULL; flag;
+		flag=strtok_r(NULL, ",", &flagptr)) {
+		if(sscanf(flag, "prio=%d", &q->prio_offset)==1)
+			continue;
+
+		if(sscanf(flag, "cpu=%d", &q->cpu)==1 && q->cpu>=0)
+			continue;
+
+		fprintf(stderr, "unknown irq flag %s\n", flag);
+		goto out;
+	}
+
+	ret=0;
+out:
+	free(args);
+
+	return ret;
+}
+
+/**
+ * Add an IRQ of the interface, if not known yet.
+ *
+ * \param q IRQ config.
+ * \param irq IRQ number.
+ */
+static void irq_add(struct irq_cfg *q, int irq)
+{
+	int i;
+
+	for(i=0; i<q->nlines; i++)
+		if(q->lines[i].irq==irq)
+			return;
+
+	if(q->nlines==IRQ_MAX)
+		return;
+
+	q->lines[q->nlines].irq=irq;
+	q->lines[q->nlines].mask[0]=0;
+	q->nlines++;
+}
+
+/**
+ * Compare IRQ numbers for sorting.
+ *
+ * \param a First IRQ line.
+ * \param b Second IRQ line.
+ * \return Difference of the IRQ numbers.
+ */
+static int irq_cmp(const void *a, const void *b)
+{
+	return ((const struct irq_line*)a)->irq-
+		((const struct irq_line*)b)->irq;
+}
+
+/**
+ * Check if an action name of /proc/interrupts belongs to the interface.
+ * Drivers name per queue vectors after the interface (eth0-TxRx-0,
+ * eth0-rx-1, ...).
+ *
+ * \param name Action name.
+ * \param ifname Interface name.
+ * \return 1 if it belongs to the interface.
+ */
+static int irq_name_match(const char *name, const char *ifname)
+{
+	size_t len=strlen(ifname);
+
+	if(strncmp(name, ifname, len))
+		return 0;
+
+	return name[len]==0 || name[len]=='-' || name[len]=='@' ||
+		name[len]==':';
+}
+
+/**
+ * Add the MSI vectors of a device.
+ *
+ * \param q IRQ config.
+ * \param path Device's msi_irqs directory.
+ */
+static void irq_add_msi(struct irq_cfg *q, const char *path)
+{
+	struct dirent *ent;
+	DIR *dir;
+
+	dir=opendir(path);
+	if(dir==NULL)
+		return;
+
+	while((ent=readdir(dir)))
+		if(isdigit(ent->d_name[0]))
+			irq_add(q, atoi(ent->d_name));
+
+	closedir(dir);
+}
+
+/**
+ * Find the IRQs of an interface. MSI vectors and the legacy IRQ of its
+ * device come from sysfs, virtio devices have them at their parent. IRQs
+ * without a device link (platform devices) are found by the action names
+ * in /proc/interrupts, which carry the interface or the device name.
+ *
+ * \param q IRQ config.
+ */
+static void irq_find_lines(struct irq_cfg *q)
+{
+	char path[128], dev[PATH_MAX], line[4096];
+	char *tok, *devname=NULL, *saveptr;
+	FILE *f;
+	int irq;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device", q->ifname);
+	if(realpath(path, dev))
+		devname=basename(dev);
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/msi_irqs",
+		q->ifname);
+	irq_add_msi(q, path);
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/../msi_irqs",
+		q->ifname);
+	irq_add_msi(q, path);
+
+	if(!q->nlines) {
+		snprintf(path, sizeof(path), "/sys/class/net/%s/device/irq",
+			q->ifname);
+		f=fopen(path, "r");
+		if(f) {
+			if(fscanf(f, "%d", &irq)==1 && irq>0)
+				irq_add(q, irq);
+			fclose(f);
+		}
+	}
+
+	f=fopen("/proc/interrupts", "r");
+	if(f==NULL)
+		return;
+
+	while(fgets(line, sizeof(line), f)) {
+		if(sscanf(line, " %d:", &irq)!=1)
+			continue;
+
+		for(tok=strtok_r(line, " \t\n,", &saveptr); tok;
+			tok=strtok_r(NULL, " \t\n,", &saveptr)) {
+			if(irq_name_match(tok, q->ifname) ||
+				(devname && irq_name_match(tok, devname))) {
+				irq_add(q, irq);
+				break;
+			}
+		}
+	}
+
+	fclose(f);
+}
+
+/**
+ * Find the threaded handlers of the IRQs. Kernel threads are named
+ * irq/<nr>-<action>, the action part is truncated or renamed by some
+ * drivers, so only the IRQ number is matched.
+ *
+ * \param q IRQ config.
+ */
+static void irq_find_threads(struct irq_cfg *q)
+{
+	char path[288], comm[32];
+	struct dirent *ent;
+	DIR *dir;
+	FILE *f;
+	int i, irq;
+
+	dir=opendir("/proc");
+	if(dir==NULL)
+		return;
+
+	while((ent=readdir(dir)) && q->nthreads<IRQ_MAX) {
+		if(!isdigit(ent->d_name[0]))
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/%s/comm", ent->d_name);
+		f=fopen(path, "r");
+		if(f==NULL)
+			continue;
+		if(fgets(comm, sizeof(comm), f)==NULL)
+			comm[0]=0;
+		fclose(f);
+
+		if(sscanf(comm, "irq/%d-", &irq)!=1)
+			continue;
+
+		for(i=0; i<q->nlines; i++) {
+			if(q->lines[i].irq!=irq)
+				continue;
+
+			q->threads[q->nthreads].pid=atoi(ent->d_name);
+			q->threads[q->nthreads].irq=irq;
+			q->threads[q->nthreads].changed=0;
+			q->nthreads++;
+			break;
+		}
+	}
+
+	closedir(dir);
+}
+
+/**
+ * Read or write a procfs file of an IRQ.
+ *
+ * \param irq IRQ number.
+ * \param file File below /proc/irq/<nr>.
+ * \param buf Buffer, read if len is non zero, else written.
+ * \param len Buffer size for reading.
+ * \return 0 on success, else 1.
+ */
+static int irq_proc(int irq, const char *file, char *buf, int len)
+{
+	char path[64];
+	FILE *f;
+	int ret=0;
+
+	snprintf(path, sizeof(path), "/proc/irq/%d/%s", irq, file);
+	f=fopen(path, len?"r":"w");
+	if(f==NULL)
+		return 1;
+
+	if(len) {
+		if(fgets(buf, len, f)==NULL)
+			ret=1;
+		else
+			buf[strcspn(buf, "\n")]=0;
+	} else if(fputs(buf, f)<0) {
+		ret=1;
+	}
+
+	/* the write is done (and might fail) on close */
+	if(fclose(f))
+		ret=1;
+
+	return ret;
+}
+
+/**
+ * Move the IRQs of the interface to the configured CPU. Their threads
+ * follow the IRQ affinity on their own. Managed IRQs (spread over the
+ * CPUs by the kernel) can't be moved.
+ *
+ * \param q IRQ config.
+ * \return Number of IRQs that couldn't be moved.
+ */
+static int irq_set_affinity(struct irq_cfg *q)
+{
+	struct irq_line *l;
+	char cpu[16];
+	int i, failed=0;
+
+	snprintf(cpu, sizeof(cpu), "%d\n", q->cpu);
+
+	for(i=0; i<q->nlines; i++) {
+		l=&q->lines[i];
+
+		if(irq_proc(l->irq, "smp_affinity", l->mask,
+			sizeof(l->mask))) {
+			l->mask[0]=0;
+			failed++;
+			continue;
+		}
+
+		if(irq_proc(l->irq, "smp_affinity_list", cpu, 0)) {
+			l->mask[0]=0;
+			failed++;
+		}
+	}
+
+	return failed;
+}
+
+/**
+ * Set the priority of the IRQ threads.
+ *
+ * \param q IRQ config.
+ * \param prio SCHED_FIFO priority.
+ * \return Number of threads whose priority couldn't be set.
+ */
+static int irq_set_prio(struct irq_cfg *q, int prio)
+{
+	struct sched_param param;
+	struct irq_thread *t;
+	int i, failed=0;
+
+	for(i=0; i<q->nthreads; i++) {
+		t=&q->threads[i];
+
+		t->policy=sched_getscheduler(t->pid);
+		if(t->policy<0 || sched_getparam(t->pid, &param)) {
+			failed++;
+			continue;
+		}
+		t->prio=param.sched_priority;
+
+		param.sched_priority=prio;
+		if(sched_setscheduler(t->pid, SCHED_FIFO, &param)) {
+			failed++;
+			continue;
+		}
+		t->changed=1;
+	}
+
+	return failed;
+}
+
+/**
+ * Set priority and affinity of the IRQs of the interface under test and
+ * their threaded handlers relative to the measuring thread. Their
+ * previous settings are restored on exit.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success.
+ */
+int irq_setup(struct cyclicping_cfg *cfg)
+{
+	struct irq_cfg *q=&cfg->irq;
+	int i, len, prio=0, failed=0;
+
+	if(!cfg->opts.opt_irq)
+		return 0;
+
+	if(irq_parse(cfg))
+		return 1;
+
+	q->lines=(struct irq_line*)calloc(IRQ_MAX, sizeof(struct irq_line));
+	q->threads=(struct irq_thread*)calloc(IRQ_MAX,
+		sizeof(struct irq_thread));
+	if(q->lines==NULL || q->threads==NULL) {
+		perror("failed to allocate memory for irqs");
+		irq_restore(cfg);
+		return 1;
+	}
+
+	irq_find_lines(q);
+	qsort(q->lines, q->nlines, sizeof(struct irq_line), irq_cmp);
+	irq_find_threads(q);
+
+	if(!q->nlines && !cfg->opts.quiet)
+		printf("no irqs found for %s\n", q->ifname);
+
+	if(q->cpu>=0)
+		failed+=irq_set_affinity(q);
+
+	/* without a realtime measuring thread there is nothing to be
+	 * relative to */
+	if(cfg->opts.priority) {
+		prio=cfg->opts.priority+q->prio_offset;
+		if(prio<1)
+			prio=1;
+		if(prio>99)
+			prio=99;
+		failed+=irq_set_prio(q, prio);
+	}
+
+	len=snprintf(q->info, sizeof(q->info), "%s irqs", q->ifname);
+	for(i=0; i<q->nlines && len<(int)sizeof(q->info)-64; i++)
+		len+=snprintf(q->info+len, sizeof(q->info)-len, "%c%d",
+			i?',':' ', q->lines[i].irq);
+	if(i<q->nlines)
+		len+=snprintf(q->info+len, sizeof(q->info)-len, ",...");
+	if(!q->nlines)
+		len+=snprintf(q->info+len, sizeof(q->info)-len, " none");
+
+	len+=snprintf(q->info+len, sizeof(q->info)-len, ", %d threads",
+		q->nthreads);
+	if(prio)
+		len+=snprintf(q->info+len, sizeof(q->info)-len, ", prio %d",
+			prio);
+	if(q->cpu>=0)
+		len+=snprintf(q->info+len, sizeof(q->info)-len, ", cpu %d",
+			q->cpu);
+	if(failed)
+		snprintf(q->info+len, sizeof(q->info)-len, ", %d unchanged",
+			failed);
+
+	if(!cfg->opts.quiet)
+		printf("irq: %s\n", q->info);
+
+	return 0;
+}
+
+/**
+ * Restore priority and affinity of the IRQs and their threads.
+ *
+ * \param cfg Cyclicping config data.
+ */
+void irq_restore(struct cyclicping_cfg *cfg)
+{
+	struct irq_cfg *q=&cfg->irq;
+	struct sched_param param;
+	int i;
+
+	for(i=0; q->lines && i<q->nlines; i++) {
+		if(q->lines[i].mask[0] &&
+			irq_proc(q->lines[i].irq, "smp_affinity",
+			q->lines[i].mask, 0))
+			fprintf(stderr, "failed to restore affinity of irq "
+				"%d\n", q->lines[i].irq);
+	}
+
+	/* threads of removed IRQs are gone */
+	for(i=0; q->threads && i<q->nthreads; i++) {
+		if(!q->threads[i].changed)
+			continue;
+
+		param.sched_priority=q->threads[i].prio;
+		if(sched_setscheduler(q->threads[i].pid,
+			q->threads[i].policy, &param) && errno!=ESRCH)
+			fprintf(stderr, "failed to restore priority of irq "
+				"thread %d\n", q->threads[i].pid);
+	}
+
+	free(q->lines);
+	free(q->threads);
+	q->lines=NULL;
+	q->threads=NULL;
+	q->nlines=0;
+	q->nthreads=0;
+}
@@ -0,0 +1,64 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __IRQ_H__
+#define __IRQ_H__
+
+#include <sys/types.h>
+
+/* IRQs and threaded handlers handled per interface */
+#define IRQ_MAX			256
+/* smp_affinity mask as read from procfs */
+#define IRQ_MASK_LEN		256
+#define IRQ_IFNAMSIZ		16
+
+struct cyclicping_cfg;
+
+struct irq_line {
+	int irq;
+	/* affinity before we changed it, empty if untouched */
+	char mask[IRQ_MASK_LEN];
+};
+
+struct irq_thread {
+	pid_t pid;
+	int irq;
+	/* scheduling before we changed it */
+	int policy;
+	int prio;
+	int changed;
+};
+
+struct irq_cfg {
+	char ifname[IRQ_IFNAMSIZ];
+	/* priority of the IRQ threads relative to the measuring thread */
+	int prio_offset;
+	/* CPU for IRQs and their threads, -1 to keep them */
+	int cpu;
+	int nlines;
+	struct irq_line *lines;
+	int nthreads;
+	struct irq_thread *threads;
+	char info[256];
+};
+
+int irq_setup(struct cyclicping_cfg *cfg);
+void irq_restore(struct cyclicping_cfg *cfg);
+
+#endif
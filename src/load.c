@@ -0,0 +1,483 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/if_ether.h>
+
+#include <cyclicping.h>
+#include <socket.h>
+#include <wire.h>
+#include <load.h>
+
+static const char *load_names[]={
+	[LOAD_UDP]="udp",
+	[LOAD_TCP]="tcp",
+	[LOAD_RAW]="raw",
+};
+
+/**
+ * Parse comma separated load flags.
+ *
+ * \param l Load config.
+ * \param arg Flags argument.
+ * \return 0 on success.
+ */
+static int load_parse_flags(struct load_cfg *l, char *arg)
+{
+	char *saveptr=NULL;
+	char *flag;
+	int mbit;
+
+	for(flag=strtok_r(arg, ",", &saveptr); flag;
+		flag=strtok_r(NULL, ",", &saveptr)) {
+		if(sscanf(flag, "threads=%d", &l->nthreads)==1) {
+			if(l->nthreads<1 || l->nthreads>LOAD_MAX_THREADS) {
+				fprintf(stderr, "load threads have to be 1 to "
+					"%d\n", LOAD_MAX_THREADS);
+				return 1;
+			}
+		} else if(sscanf(flag, "rate=%d", &mbit)==1 && mbit>0) {
+			l->rate=(uint64_t)mbit*1000000;
+		} else if(sscanf(flag, "load=%d", &l->percent)==1 &&
+			l->percent>0 && l->percent<=100) {
+			continue;
+		} else if(sscanf(flag, "size=%d", &l->size)==1 &&
+			l->size>0) {
+			continue;
+		} else if(sscanf(flag, "prio=%d", &l->sopriority)==1 ||
+			sscanf(flag, "tos=%d", &l->tos)==1) {
+			continue;
+		} else if(sscanf(flag, "cpu=%d", &l->cpu)==1 && l->cpu>=0) {
+			continue;
+		} else {
+			fprintf(stderr, "invalid load flag %s\n", flag);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Parse the load option (proto:dest:port|mac[:flags]).
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success.
+ */
+static int load_parse(struct cyclicping_cfg *cfg)
+{
+	struct load_cfg *l=&cfg->load;
+	char *args, *proto, *dest, *port, *flags;
+	char *saveptr=NULL;
+	uint8_t *mac=l->ll.sll_addr;
+	int i, ret=1;
+
+	args=strdup(cfg->opts.opt_load);
+	if(args==NULL) {
+		perror("failed to allocate memory for load args");
+		return 1;
+	}
+
+	proto=strtok_r(args, ":", &saveptr);
+	dest=strtok_r(NULL, ":", &saveptr);
+	port=strtok_r(NULL, ":", &saveptr);
+	flags=strtok_r(NULL, ":", &saveptr);
+
+	if(proto==NULL || dest==NULL || port==NULL) {
+		fprintf(stderr, "load protocol, destination and port or mac "
+			"required\n");
+		goto out;
+	}
+
+	for(i=LOAD_UDP; i<=LOAD_RAW; i++)
+		if(strcmp(proto, load_names[i])==0)
+			l->proto=i;
+
+	l->size=LOAD_DEFAULT_SIZE;
+	l->nthreads=1;
+	l->cpu=cfg->opts.opt_affinity?cfg->opts.affinity+1:-1;
+
+	switch(l->proto) {
+		case LOAD_UDP :
+		case LOAD_TCP :
+			l->dest.sin_family=AF_INET;
+			l->dest.sin_port=htons(atoi(port));
+			if(inet_aton(dest, &l->dest.sin_addr)==0) {
+				fprintf(stderr, "failed to convert load "
+					"destination\n");
+				goto out;
+			}
+			if(wire_route_ifname(&l->dest, l->ifname))
+				l->ifname[0]=0;
+			break;
+		case LOAD_RAW :
+			if(strlen(dest)>=sizeof(l->ifname)) {
+				fprintf(stderr, "invalid load interface\n");
+				goto out;
+			}
+			strcpy(l->ifname, dest);
+			if(sscanf(port, "%hhx-%hhx-%hhx-%hhx-%hhx-%hhx",
+				&mac[0], &mac[1], &mac[2], &mac[3], &mac[4],
+				&mac[5])!=6) {
+				fprintf(stderr, "failed to convert load mac "
+					"address\n");
+				goto out;
+			}
+			l->ll.sll_family=AF_PACKET;
+			l->ll.sll_protocol=htons(LOAD_ETH_P);
+			l->ll.sll_halen=ETH_ALEN;
+			l->ll.sll_ifindex=if_nametoindex(l->ifname);
+			if(!l->ll.sll_ifindex) {
+				fprintf(stderr, "no such interface %s\n",
+					l->ifname);
+				goto out;
+			}
+			break;
+		default :
+			fprintf(stderr, "unknown load protocol %s\n", proto);
+			goto out;
+	}
+
+	if(flags && load_parse_flags(l, flags))
+		goto out;
+
+	ret=0;
+out:
+	free(args);
+
+	return ret;
+}
+
+/**
+ * Compute the bytes a load packet takes on the wire and the target rate.
+ *
+ * \param l Load config.
+ * \return 0 on success.
+ */
+static int load_set_rate(struct load_cfg *l)
+{
+	int speed=0;
+
+	if(l->ifname[0]) {
+		speed=wire_link_speed(l->ifname);
+
+		if(l->proto==LOAD_UDP)
+			l->wire_bytes=wire_eth_bytes(l->ifname, l->size+
+				sizeof(struct udphdr), sizeof(struct ip), 8, 0,
+				NULL);
+		else if(l->proto==LOAD_TCP)
+			/* segments with time stamp option */
+			l->wire_bytes=wire_eth_bytes(l->ifname, l->size,
+				sizeof(struct ip)+32, 1, 0, NULL);
+		else
+			l->wire_bytes=wire_eth_bytes(l->ifname, l->size, 0, 1,
+				0, NULL);
+	} else {
+		l->wire_bytes=l->size;
+	}
+
+	if(l->percent) {
+		if(!speed) {
+			fprintf(stderr, "no link speed for %s, use rate= "
+				"instead of load=\n", l->ifname[0]?l->ifname:
+				"load destination");
+			return 1;
+		}
+		l->rate=(uint64_t)speed*1000000*l->percent/100;
+	}
+
+	return 0;
+}
+
+/**
+ * Open the socket of a load thread.
+ *
+ * \param l Load config.
+ * \return Socket or -1 on error.
+ */
+static int load_socket(struct load_cfg *l)
+{
+	struct timeval timeout={ 0, 100000 };
+	int fd;
+
+	if(l->proto==LOAD_RAW)
+		fd=socket(AF_PACKET, SOCK_DGRAM, htons(LOAD_ETH_P));
+	else
+		fd=socket(AF_INET, l->proto==LOAD_TCP?SOCK_STREAM:SOCK_DGRAM,
+			0);
+	if(fd<0) {
+		perror("failed to open load socket");
+		return -1;
+	}
+
+	/* blocked sends have to notice the end of the measurement */
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	if(set_socket_priority(fd, l->sopriority) ||
+		(l->proto!=LOAD_RAW && set_socket_tos(fd, l->tos)))
+		goto err;
+
+	if(l->proto==LOAD_TCP && connect(fd, (struct sockaddr*)&l->dest,
+		sizeof(l->dest))<0) {
+		perror("failed to connect load socket");
+		goto err;
+	}
+
+	return fd;
+err:
+	close(fd);
+	return -1;
+}
+
+/**
+ * Get the CPU of a load thread. Threads run on the CPUs following the
+ * measuring CPU, skipping it.
+ *
+ * \param cfg Cyclicping config data.
+ * \param cpu Previous thread's CPU, -1 for the first thread.
+ * \return CPU, -1 if not pinned.
+ */
+static int load_next_cpu(struct cyclicping_cfg *cfg, int cpu)
+{
+	int ncpus=sysconf(_SC_NPROCESSORS_ONLN);
+
+	if(cfg->load.cpu<0)
+		return -1;
+
+	cpu=cpu<0?cfg->load.cpu:cpu+1;
+	cpu%=ncpus;
+	if(cfg->opts.opt_affinity && cpu==cfg->opts.affinity && ncpus>1)
+		cpu=(cpu+1)%ncpus;
+
+	return cpu;
+}
+
+/**
+ * Get the monotonic time.
+ *
+ * \return Time (ns).
+ */
+static uint64_t load_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return TSPEC_TO_NSEC((&now));
+}
+
+/**
+ * Load thread sending at its share of the rate.
+ *
+ * \param arg Load thread data.
+ * \return NULL.
+ */
+static void *load_thread(void *arg)
+{
+	struct load_thread *t=(struct load_thread*)arg;
+	struct load_cfg *l=t->load;
+	struct timespec ts;
+	uint64_t interval=0, next, now;
+	char *buf;
+	ssize_t ret;
+
+	buf=(char*)calloc(1, l->size);
+	if(buf==NULL)
+		return NULL;
+
+	if(l->rate)
+		interval=l->wire_bytes*8*NSEC_PER_SEC*l->nthreads/l->rate;
+	next=load_now();
+
+	while(!l->stop) {
+		if(interval) {
+			now=load_now();
+			if(next+LOAD_MAX_BACKLOG<now)
+				next=now-LOAD_MAX_BACKLOG;
+			if(next>now) {
+				ts.tv_sec=next/NSEC_PER_SEC;
+				ts.tv_nsec=next%NSEC_PER_SEC;
+				clock_nanosleep(CLOCK_MONOTONIC,
+					TIMER_ABSTIME, &ts, NULL);
+			}
+			next+=interval;
+		}
+
+		if(l->proto==LOAD_RAW)
+			ret=sendto(t->fd, buf, l->size, 0,
+				(struct sockaddr*)&l->ll, sizeof(l->ll));
+		else if(l->proto==LOAD_UDP)
+			ret=sendto(t->fd, buf, l->size, 0,
+				(struct sockaddr*)&l->dest, sizeof(l->dest));
+		else
+			ret=send(t->fd, buf, l->size, MSG_NOSIGNAL);
+
+		if(ret==l->size) {
+			t->packets++;
+			continue;
+		}
+
+		if(ret<0 && errno==EINTR)
+			continue;
+		t->errors++;
+
+		/* a broken connection doesn't come back */
+		if(l->proto==LOAD_TCP && ret<0 && errno!=EAGAIN)
+			break;
+	}
+
+	free(buf);
+
+	return NULL;
+}
+
+/**
+ * Start the background load threads. They run at normal priority on
+ * other CPUs than the measurement.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success.
+ */
+int load_start(struct cyclicping_cfg *cfg)
+{
+	struct load_cfg *l=&cfg->load;
+	struct load_thread *t;
+	pthread_attr_t attr;
+	cpu_set_t set;
+	int i, cpu=-1;
+
+	if(!cfg->opts.opt_load)
+		return 0;
+
+	if(load_parse(cfg) || load_set_rate(l))
+		return 1;
+
+	/* counts of an earlier run (sweep) don't belong to this one */
+	for(i=0; i<l->nthreads; i++) {
+		l->thread[i].packets=0;
+		l->thread[i].errors=0;
+	}
+
+	for(i=0; i<l->nthreads; i++) {
+		l->thread[i].fd=load_socket(l);
+		if(l->thread[i].fd<0)
+			goto err;
+	}
+
+	l->stop=0;
+	clock_gettime(CLOCK_MONOTONIC, &l->start);
+
+	for(i=0; i<l->nthreads; i++) {
+		t=&l->thread[i];
+		t->load=l;
+
+		pthread_attr_init(&attr);
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+
+		cpu=load_next_cpu(cfg, cpu);
+		t->cpu=cpu;
+		if(cpu>=0) {
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		}
+
+		if(pthread_create(&t->thread, &attr, load_thread, t)) {
+			perror("failed to start load thread");
+			pthread_attr_destroy(&attr);
+			goto err;
+		}
+		pthread_attr_destroy(&attr);
+		t->started=1;
+	}
+
+	return 0;
+err:
+	load_stop(cfg);
+	return 1;
+}
+
+/**
+ * Stop the load threads and record the achieved rate.
+ *
+ * \param cfg Cyclicping config data.
+ */
+void load_stop(struct cyclicping_cfg *cfg)
+{
+	struct load_cfg *l=&cfg->load;
+	uint64_t packets=0, errors=0, duration;
+	double achieved;
+	int i, len, started=0;
+
+	if(!l->proto)
+		return;
+
+	l->stop=1;
+
+	for(i=0; i<l->nthreads; i++) {
+		if(l->thread[i].started) {
+			pthread_join(l->thread[i].thread, NULL);
+			l->thread[i].started=0;
+			started=1;
+		}
+		if(l->thread[i].fd>0)
+			close(l->thread[i].fd);
+		l->thread[i].fd=0;
+
+		packets+=l->thread[i].packets;
+		errors+=l->thread[i].errors;
+	}
+
+	if(!started)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &l->end);
+	duration=TSPEC_TO_NSEC((&l->end))-TSPEC_TO_NSEC((&l->start));
+	achieved=duration?(double)packets*l->wire_bytes*8*1000/duration:0;
+
+	len=snprintf(l->info, sizeof(l->info), "%s, %d thread(s)",
+		cfg->opts.opt_load, l->nthreads);
+	if(l->cpu>=0)
+		len+=snprintf(l->info+len, sizeof(l->info)-len, " from cpu %d",
+			l->thread[0].cpu);
+	if(l->rate)
+		len+=snprintf(l->info+len, sizeof(l->info)-len, ", target "
+			"%.1f Mbit/s", (double)l->rate/1000000);
+	snprintf(l->info+len, sizeof(l->info)-len, ", achieved %.1f Mbit/s "
+		"on the wire, %" PRIu64 " packets, %" PRIu64 " errors",
+		achieved, packets, errors);
+
+	if(!cfg->opts.quiet)
+		printf("load: %s\n", l->info);
+}
@@ -0,0 +1,80 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __LOAD_H__
+#define __LOAD_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <linux/if_packet.h>
+
+#define LOAD_MAX_THREADS	16
+/* UDP payload filling a 1500 bytes MTU */
+#define LOAD_DEFAULT_SIZE	1472
+/* ethertype of raw load frames (IEEE local experimental) */
+#define LOAD_ETH_P		0x88b5
+/* a thread falling behind its rate catches up at most this much (ns) */
+#define LOAD_MAX_BACKLOG	1000000
+
+struct cyclicping_cfg;
+
+enum load_proto {
+	LOAD_NONE=0,
+	LOAD_UDP,
+	LOAD_TCP,
+	LOAD_RAW,
+};
+
+struct load_thread {
+	struct load_cfg *load;
+	pthread_t thread;
+	int started;
+	int fd;
+	int cpu;
+	uint64_t packets;
+	uint64_t errors;
+};
+
+struct load_cfg {
+	int proto;
+	struct sockaddr_in dest;
+	struct sockaddr_ll ll;
+	char ifname[16];
+	int size;
+	int nthreads;
+	int cpu;
+	int sopriority;
+	int tos;
+	/* total target rate on the wire (bit/s), 0 for as fast as possible */
+	uint64_t rate;
+	int percent;
+	/* bytes a packet takes on the wire */
+	uint64_t wire_bytes;
+	volatile int stop;
+	struct timespec start;
+	struct timespec end;
+	struct load_thread thread[LOAD_MAX_THREADS];
+	char info[192];
+};
+
+int load_start(struct cyclicping_cfg *cfg);
+void load_stop(struct cyclicping_cfg *cfg);
+
+#endif
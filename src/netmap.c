@@ -24,151 +24,316 @@
 #include <signal.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <errno.h>
 #include <netinet/ether.h>
 
 #include <sys/select.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 
 #include <cyclicping.h>
 #include <opts.h>
 #include <stats.h>
 #include <socket.h>
+#include <proto.h>
 #include <netmap.h>
+#include <wire.h>
 
 extern int run;
 extern int abort_fd;
 
 /**
- * Compute the checksum of the given ip header.
+ * Parse ring argument, a single ring pair "n", a range "first-last" or
+ * "all".
  *
- * \param data Data to checksum.
- * \param len Length of data.
- * \param sum Current sum value.
- * \return New checksum.
+ * \param ucfg Netmap module config data.
+ * \param arg Ring argument.
+ * \return 0 on success.
  */
-static uint16_t checksum(const void *data, uint16_t len, uint32_t sum)
+static int netmap_parse_rings(struct netmap_cfg *ucfg, const char *arg)
 {
-	const uint8_t *addr = data;
-	uint32_t i;
-
-	/* Checksum all the pairs of bytes first... */
-	for (i = 0; i < (len & ~1U); i += 2) {
-		sum += (u_int16_t)ntohs(*((u_int16_t *)(addr + i)));
-		if (sum > 0xFFFF)
-			sum -= 0xFFFF;
+	int n;
+
+	if(strcmp(arg, "all")==0)
+		return 0;
+
+	n=sscanf(arg, "%d-%d", &ucfg->first_ring, &ucfg->last_ring);
+	if(n==1)
+		ucfg->last_ring=ucfg->first_ring;
+
+	if(n<1 || ucfg->first_ring<0 || ucfg->last_ring<ucfg->first_ring) {
+		fprintf(stderr, "invalid netmap ring %s\n", arg);
+		return 1;
 	}
-	/*
-	 * If there's a single byte left over, checksum it, too.
-	 * Network byte order is big-endian, so the remaining byte is
-	 * the high byte.
-	 */
-	if (i < len) {
-		sum += addr[i] << 8;
-		if (sum > 0xFFFF)
-			sum -= 0xFFFF;
+
+	return 0;
+}
+
+/**
+ * Parse comma separated netmap module flags.
+ *
+ * \param ucfg Netmap module config data.
+ * \param arg Flags argument.
+ * \return 0 on success.
+ */
+static int netmap_parse_flags(struct netmap_cfg *ucfg, char *arg)
+{
+	char *saveptr=NULL;
+	char *flag;
+	int ret;
+
+	for(flag=strtok_r(arg, ",", &saveptr); flag;
+		flag=strtok_r(NULL, ",", &saveptr)) {
+		ret=vlan_parse_flag(&ucfg->vlan, flag);
+		if(ret<0)
+			return 1;
+		if(ret==0) {
+			fprintf(stderr, "unknown netmap flag %s\n", flag);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Open netmap descriptor of a worker.
+ *
+ * \param ucfg Netmap module config data.
+ * \param w Worker.
+ * \return 0 on success.
+ */
+static int netmap_open_worker(struct netmap_cfg *ucfg, struct netmap_worker *w)
+{
+	char nm_device[MAX_DEV_LEN];
+
+	/* "netmap:dev" binds all hw rings, "netmap:dev-n" ring pair n */
+	if(w->ring<0)
+		snprintf(nm_device, sizeof(nm_device), "netmap:%s",
+			ucfg->device);
+	else
+		snprintf(nm_device, sizeof(nm_device), "netmap:%s-%d",
+			ucfg->device, w->ring);
+
+	w->nmd=nm_open(nm_device, NULL, 0, 0);
+	if(w->nmd==NULL) {
+		fprintf(stderr, "failed to open netmap device %s\n",
+			nm_device);
+		return 1;
 	}
-	return sum;
+
+	/* get fd and tx ring reference */
+	w->fd=NETMAP_FD(w->nmd);
+	w->poll_fds.fd=w->fd;
+	w->nmtxring=NETMAP_TXRING(w->nmd->nifp, w->nmd->first_tx_ring);
+
+	return 0;
 }
 
 /**
- * Wraps checksum
+ * Check if the link of an interface is up.
  *
- * \param sum Sum to wrap.
- * \return Wrapped sum.
+ * \param device Interface name.
+ * \return 1 if link is up, 0 if not, -1 on error.
  */
-static u_int16_t wrapsum(u_int32_t sum)
+static int netmap_link_up(const char *device)
 {
-	sum = ~sum & 0xFFFF;
-	return (htons(sum));
+	struct ifreq ifr;
+	int fd, ret;
+
+	fd=socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd<0)
+		return -1;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, device, IFNAMSIZ-1);
+	ret=ioctl(fd, SIOCGIFFLAGS, &ifr);
+	close(fd);
+	if(ret<0)
+		return -1;
+
+	return (ifr.ifr_flags & (IFF_UP|IFF_RUNNING))==(IFF_UP|IFF_RUNNING);
 }
 
 /**
- * Get IP and MAC address of the network interface and store them in the
- * packet header of the outgoing packet.
+ * Wait until the device is usable after switching to netmap mode. Most
+ * drivers reset the NIC when a netmap descriptor gets registered, so wait
+ * for the link to come back and for every tx ring to offer free slots.
  *
  * \param cfg Cyclicping config data.
  * \return 0 on success.
  */
-int interface_info(struct cyclicping_cfg *cfg)
+static int netmap_wait_ready(struct cyclicping_cfg *cfg)
 {
 	struct netmap_cfg *ucfg=cfg->current_mod->modcfg;
-	struct pkt *pkt=&ucfg->out_pkt_header;
-	struct sockaddr *hwaddr;
-	struct sockaddr_in *inaddr;
-	int fd;
-	struct ifreq ifr;
+	struct timespec now, deadline;
+	int i, ready;
 
-	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec+=NETMAP_READY_TIMEOUT;
 
-	/* set protocol family and interface name for ioctl request */
-	ifr.ifr_addr.sa_family = AF_INET;
-	strncpy(ifr.ifr_name, ucfg->device, IFNAMSIZ-1);
+	while(run) {
+		ready=netmap_link_up(ucfg->device);
+		if(ready<0) {
+			perror("failed to get interface flags");
+			return 1;
+		}
 
-	/* request ip address if the interface */
-	if(ioctl(fd, SIOCGIFADDR, &ifr)!=0) {
-		fprintf(stderr, "failed to retrieve interface address for %s\n",
-			ucfg->device);
-		return 1;
+		for(i=0; i<ucfg->nworkers && ready; i++) {
+			if(ioctl(ucfg->workers[i].fd, NIOCTXSYNC, NULL)<0) {
+				perror("netmap tx sync failed");
+				return 1;
+			}
+			if(!nm_ring_space(ucfg->workers[i].nmtxring))
+				ready=0;
+		}
+
+		if(ready)
+			return 0;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(now.tv_sec>deadline.tv_sec || (now.tv_sec==deadline.tv_sec &&
+			now.tv_nsec>=deadline.tv_nsec)) {
+			fprintf(stderr, "netmap device %s not ready after %d "
+				"seconds\n", ucfg->device, NETMAP_READY_TIMEOUT);
+			return 1;
+		}
+
+		usleep(NETMAP_READY_POLL*1000);
+	}
+
+	return 1;
+}
+
+/**
+ * Reflect all requests waiting in a rx ring. The buffer of a request is
+ * swapped with the buffer of a free tx slot and turned into a reply in
+ * place, so no payload gets copied.
+ *
+ * \param w Worker.
+ * \param rxring Ring with received packets.
+ * \param trecv Receive timestamp of the batch.
+ * \return Number of replies queued.
+ */
+static int netmap_reflect(struct netmap_worker *w,
+	struct netmap_ring *rxring, const struct timespec *trecv)
+{
+	struct cyclicping_cfg *cfg=w->cfg;
+	struct netmap_cfg *ucfg=cfg->current_mod->modcfg;
+	struct netmap_ring *txring=w->nmtxring;
+	struct netmap_slot *rs, *ts;
+	struct pkt *pkt;
+	struct cp_hdr old;
+	uint32_t idx;
+	int n=0, len;
+
+	while(!nm_ring_empty(rxring)) {
+		rs=&rxring->slot[rxring->cur];
+		len=rs->len;
+		pkt=frame_vlan_pop(NETMAP_BUF(rxring, rs->buf_idx), &len,
+			ucfg->tci);
+
+		if(pkt && frame_match(pkt, len, ucfg->port,
+			cfg->opts.length) &&
+			!hdr_check((char*)pkt+sizeof(struct pkt),
+			cfg->opts.length)) {
+			/* no free tx slot, the remaining requests are handled
+			 * after the next sync */
+			if(nm_ring_empty(txring)) {
+				frame_vlan_push(pkt, ucfg->tci);
+				break;
+			}
+
+			/* swapping keeps the checksums, only the changed
+			 * wire header has to be accounted for */
+			frame_swap(pkt);
+			memcpy(&old, pkt+1, sizeof(old));
+			hdr_stamp_reply((char*)pkt+sizeof(struct pkt),
+				cfg->opts.clock, trecv);
+			frame_udp_update(pkt, &old, pkt+1, sizeof(old));
+			/* the reply carries our own priority */
+			frame_vlan_push(pkt, ucfg->tci);
+
+			ts=&txring->slot[txring->cur];
+			idx=ts->buf_idx;
+			ts->buf_idx=rs->buf_idx;
+			ts->len=rs->len;
+			ts->flags|=NS_BUF_CHANGED;
+			rs->buf_idx=idx;
+			rs->flags|=NS_BUF_CHANGED;
+
+			txring->head=txring->cur=
+				nm_ring_next(txring, txring->cur);
+			n++;
+		}
+
+		rxring->head=rxring->cur=nm_ring_next(rxring, rxring->cur);
 	}
 
-	inaddr=(struct sockaddr_in*)&ifr.ifr_addr;
-	memcpy(&pkt->ip.ip_src, &inaddr->sin_addr, sizeof(struct in_addr));
+	return n;
+}
+
+/**
+ * Serve the rings of a worker: all rx rings are drained per poll and the
+ * replies are pushed out with a single tx sync.
+ *
+ * \param w Worker.
+ * \param timeout Poll timeout (ms), -1 to wait forever.
+ * \return 0 on success, else 1.
+ */
+static int netmap_serve(struct netmap_worker *w, int timeout)
+{
+	struct nm_desc *nmd=w->nmd;
+	struct timespec trecv;
+	int i, ret, n=0;
+
+	w->poll_fds.events=POLLIN;
+	ret=poll(&w->poll_fds, 1, timeout);
+	if(ret==0)
+		return 0;
+	if(ret<0)
+		return (run && errno!=EINTR)?1:0;
 
-	/* request hardware address */
-	if(ioctl(fd, SIOCGIFHWADDR, &ifr)!=0) {
-		fprintf(stderr, "failed to retrieve interface hw address\n");
+	if(w->poll_fds.revents & POLLERR) {
+		fprintf(stderr, "poll error\n");
 		return 1;
 	}
 
-	hwaddr=(struct sockaddr*)&ifr.ifr_addr;
-	memcpy(&pkt->eh.ether_shost, hwaddr->sa_data, ETH_ALEN);
-	close(fd);
+	clock_gettime(w->cfg->opts.clock, &trecv);
+
+	for(i=nmd->first_rx_ring; i<=nmd->last_rx_ring; i++)
+		n+=netmap_reflect(w, NETMAP_RXRING(nmd->nifp, i), &trecv);
+
+	/* start transmission right away instead of with the next poll */
+	if(n && ioctl(w->fd, NIOCTXSYNC, NULL)<0) {
+		perror("netmap tx sync failed");
+		return 1;
+	}
 
 	return 0;
 }
 
 /**
- * Initializes some basic packet data in the ethernet, ip and udp header
- * of the outgoing packet.
+ * Server worker thread, serves one ring pair until the test ends.
  *
- * \param cfg Cyclicping config data.
- * \return 0 on success.
+ * \param arg Worker.
+ * \return NULL.
  */
-void initialize_packet(struct cyclicping_cfg *cfg)
+static void *netmap_worker_main(void *arg)
 {
-	struct netmap_cfg *ucfg=cfg->current_mod->modcfg;
-	struct pkt *pkt=&ucfg->out_pkt_header;
-	struct ether_header *eh;
-	struct ip *ip;
-	struct udphdr *udp;
-
-	/* prepare the headers */
-	ip = &pkt->ip;
-	ip->ip_v = IPVERSION;
-	ip->ip_hl = 5;
-	ip->ip_id = 0;
-	ip->ip_tos = IPTOS_LOWDELAY;
-	ip->ip_len = ntohs(cfg->opts.length
-		+ sizeof(struct udphdr) + sizeof(*ip));
-	ip->ip_id = 0;
-	ip->ip_off = htons(IP_DF); /* Don't fragment */
-	ip->ip_ttl = IPDEFTTL;
-	ip->ip_p = IPPROTO_UDP;
-	ip->ip_dst.s_addr = ucfg->dest_addr.sin_addr.s_addr;
-	ip->ip_sum = wrapsum(checksum(ip, sizeof(*ip), 0));
-
-	udp = &pkt->udp;
-	udp->uh_sport = htons(ucfg->port);
-	udp->uh_dport = htons(ucfg->port);
-	udp->uh_ulen = htons(cfg->opts.length + sizeof(struct udphdr));
-
-	eh = &pkt->eh;
-	memcpy(eh->ether_dhost, &ucfg->dest_hwaddr, sizeof(struct ether_addr));
-	eh->ether_type = htons(ETHERTYPE_IP);
+	struct netmap_worker *w=arg;
+
+	while(run) {
+		if(netmap_serve(w, NETMAP_WORKER_POLL))
+			break;
+	}
+
+	return NULL;
 }
 
 /**
- * Init Netmap connection module. Parse module args. Open netmap descriptor.
- * Init packet.
+ * Init Netmap connection module. Parse module args. Open a netmap
+ * descriptor for every ring pair to use. Init packet.
  *
  * \param cfg Cyclicping config data.
  * \param argv Interface module arguments.
@@ -178,6 +343,7 @@ void initialize_packet(struct cyclicping_cfg *cfg)
 int netmap_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 {
 	struct netmap_cfg *ucfg;
+	sigset_t set, oldset;
 	int port_arg_idx=2;
 	int i;
 
@@ -188,21 +354,16 @@ int netmap_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 	}
 
 	cfg->current_mod->modcfg=ucfg;
+	vlan_cfg_init(&ucfg->vlan);
 
 	if(argc<2) {
 		fprintf(stderr, "interface name requiered for netmap mode\n");
 		return 1;
 	}
 
-	/* Store device name which comes from first arg. The netmap device
-	 * name just prepend this with "netmap:". */
-	strcpy(ucfg->nm_device, "netmap:");
-	ucfg->device=ucfg->nm_device+strlen(ucfg->nm_device);
 	strncpy(ucfg->device, argv[1], IFNAMSIZ);
 
 	if(cfg->opts.client) {
-		int i;
-
 		if(argc<4) {
 			fprintf(stderr, "ip and hw address required for "
 				"netmap client mode\n");
@@ -239,99 +400,127 @@ int netmap_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 		ucfg->port=DEFAULT_PORT;
 	}
 
-	if(interface_info(cfg))
+	/* all rings with a single descriptor by default */
+	ucfg->first_ring=ucfg->last_ring=-1;
+	if(argc>=port_arg_idx+2 &&
+		netmap_parse_rings(ucfg, argv[port_arg_idx+1]))
+		return 1;
+
+	if(cfg->opts.client && ucfg->last_ring!=ucfg->first_ring) {
+		fprintf(stderr, "netmap client can only use a single ring\n");
+		return 1;
+	}
+
+	if(argc>=port_arg_idx+3 &&
+		netmap_parse_flags(ucfg, argv[port_arg_idx+2]))
+		return 1;
+	ucfg->tci=vlan_tci(&ucfg->vlan);
+
+	if(frame_interface_info(ucfg->device, &ucfg->out_pkt_header))
 		return 1;
 
-	initialize_packet(cfg);
+	frame_init(&ucfg->out_pkt_header, &ucfg->dest_hwaddr,
+		&ucfg->dest_addr.sin_addr, ucfg->port, cfg->opts.length);
+
+	hdr_init(cfg->send_packet, cfg->opts.length);
 
-	/* open the netmap device descriptor */
-	ucfg->nmd=nm_open(ucfg->nm_device, NULL, 0, 0);
-	if(ucfg->nmd==NULL) {
-		fprintf(stderr, "failed to open netmap device\n");
+	if(cfg->opts.client)
+		wire_set_eth(cfg, ucfg->device, sizeof(struct udphdr)+
+			cfg->opts.length, sizeof(struct ip), 8,
+			ucfg->tci<0?0:FRAME_VLAN_LEN);
+
+	/* one worker per ring pair */
+	ucfg->nworkers=ucfg->last_ring-ucfg->first_ring+1;
+	ucfg->workers=(struct netmap_worker*)calloc(ucfg->nworkers,
+		sizeof(struct netmap_worker));
+	if(ucfg->workers==NULL) {
+		perror("failed to allocate memory for netmap workers");
 		return 1;
 	}
 
-	/* get common fd and tx ring reference */
-	ucfg->fd=NETMAP_FD(ucfg->nmd);
-	ucfg->poll_fds.fd=ucfg->fd;
-	abort_fd=ucfg->fd;
-	ucfg->nmtxring=
-		NETMAP_TXRING(ucfg->nmd->nifp, ucfg->nmd->first_tx_ring);
-
-	if(!cfg->opts.quiet) {
-		printf("waiting 5 seconds for netmap device to become ready ");
-		fflush(stdout);
-		for(i=0; i<5; i++) {
-			printf(". ");
-			fflush(stdout);
-			sleep(1);
+	for(i=0; i<ucfg->nworkers; i++) {
+		ucfg->workers[i].cfg=cfg;
+		ucfg->workers[i].ring=ucfg->first_ring<0?-1:
+			ucfg->first_ring+i;
+		if(netmap_open_worker(ucfg, &ucfg->workers[i]))
+			return 1;
+	}
+
+	abort_fd=ucfg->workers[0].fd;
+	ucfg->fd_abort=1;
+
+	if(cfg->opts.verbose)
+		printf("waiting for netmap device to become ready\n");
+
+	if(netmap_wait_ready(cfg))
+		return 1;
+
+	/* worker 0 is served by the main loop, start threads for the
+	 * others */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, &oldset);
+	for(i=1; i<ucfg->nworkers; i++) {
+		if(pthread_create(&ucfg->workers[i].thread, NULL,
+			netmap_worker_main, &ucfg->workers[i])) {
+			fprintf(stderr, "failed to start netmap worker\n");
+			break;
 		}
-		printf("\n");
-	} else {
-		sleep(5);
+		ucfg->workers[i].started=1;
 	}
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
 
-	return 0;
+	return i<ucfg->nworkers;
 }
 
 /**
- * Send out packet via the netmap tx ring. Waits for ring to become ready and
+ * Send out request via the netmap tx ring. Waits for ring to become ready and
  * takes and copy timestamp to packet.
  *
  * \param cfg Cyclicping config data.
- * \param server 1 if we are running in server mode, else 0.
  * \param tsend Sending timestamp gets stored here.
  * \return 0 on success.
  */
-int netmap_send_packet(struct cyclicping_cfg *cfg, int server,
-	struct timespec *tsend)
+int netmap_send_packet(struct cyclicping_cfg *cfg, struct timespec *tsend)
 {
 	struct netmap_cfg *ucfg=cfg->current_mod->modcfg;
-	char *payload=server?cfg->recv_packet:cfg->send_packet;
+	struct netmap_worker *w=&ucfg->workers[0];
+	char *payload=cfg->send_packet;
 	struct netmap_slot *slot;
 	char *nmbuffer;
+	struct pkt *pkt;
+	int tag_len=ucfg->tci<0?0:FRAME_VLAN_LEN;
 
-	ucfg->poll_fds.events = POLLOUT;
-	if(poll(&ucfg->poll_fds, 1, 2000) <= 0) {
+	w->poll_fds.events = POLLOUT;
+	if(poll(&w->poll_fds, 1, 2000) <= 0) {
 		fprintf(stderr, "poll timeout waiting for pollout\n");
 		return 1;
 	}
 
-	if(ucfg->poll_fds.events & POLLERR) {
+	if(w->poll_fds.revents & POLLERR) {
 		fprintf(stderr, "poll error\n");
 		return 1;
 	}
 
 	/* take timestamp and copy it to packet */
-	clock_gettime(cfg->opts.clock, tsend);
-	if(server)
-		tspec2buffer(tsend, payload+2*sizeof(uint64_t));
-	else
-		tspec2buffer(tsend, payload);
-
-	/* Magic: taken from sbin/dhclient/packet.c */
-#if 0
-	udp->uh_sum = wrapsum(checksum(udp, sizeof(*udp),
-		checksum(payload, cfg->opts.length - sizeof(*udp),
-			checksum(&ip->ip_src, 2 * sizeof(ip->ip_src),
-			    IPPROTO_UDP + (u_int32_t)ntohs(udp->uh_ulen)
-				)
-			)
-		));
-#endif
+	hdr_stamp_request(payload, cfg->seq, cfg->opts.clock, tsend);
 
 	/* send packet to server */
-	slot=&ucfg->nmtxring->slot[ucfg->nmtxring->cur];
-	nmbuffer=NETMAP_BUF(ucfg->nmtxring, slot->buf_idx);
-	memcpy(nmbuffer, &ucfg->out_pkt_header, sizeof(struct pkt));
-	memcpy(nmbuffer+sizeof(struct pkt), payload,
-		cfg->opts.length);
+	slot=&w->nmtxring->slot[w->nmtxring->cur];
+	nmbuffer=NETMAP_BUF(w->nmtxring, slot->buf_idx);
+	/* leave room for the tag, it's inserted after the MAC addresses */
+	pkt=(struct pkt*)(nmbuffer+tag_len);
+	memcpy(pkt, &ucfg->out_pkt_header, sizeof(struct pkt));
+	memcpy(pkt+1, payload, cfg->opts.length);
+	frame_udp_checksum(pkt, cfg->opts.length);
+	frame_vlan_push(pkt, ucfg->tci);
 
-	slot->len=sizeof(struct pkt)+cfg->opts.length;
+	slot->len=tag_len+sizeof(struct pkt)+cfg->opts.length;
 
 	/* this starts the packet transmission */
-	ucfg->nmtxring->head=ucfg->nmtxring->cur=
-		nm_ring_next(ucfg->nmtxring, ucfg->nmtxring->cur);
+	w->nmtxring->head=w->nmtxring->cur=
+		nm_ring_next(w->nmtxring, w->nmtxring->cur);
 
 	return 0;
 }
@@ -349,44 +538,42 @@ enum recv_code netmap_receive_packet(struct cyclicping_cfg *cfg, int timeout,
 	struct timespec *trecv)
 {
 	struct netmap_cfg *ucfg=cfg->current_mod->modcfg;
+	struct netmap_worker *w=&ucfg->workers[0];
 	unsigned char *nmbuffer;
 	struct nm_pkthdr header;
 	struct pkt *tpkt;
+	int len;
 
-	ucfg->poll_fds.events = POLLIN;
+	w->poll_fds.events = POLLIN;
 
-	if(poll(&ucfg->poll_fds, 1, timeout) <= 0) {
-		fprintf(stderr, "poll timeout waiting for pollin\n");
+	if(poll(&w->poll_fds, 1, timeout) <= 0)
 		return NETMAP_RECV_TIMEOUT;
-	}
 
-	if(ucfg->poll_fds.events & POLLERR) {
+	if(w->poll_fds.revents & POLLERR) {
 		fprintf(stderr, "poll error\n");
 		return NETMAP_RECV_ERROR;
 	}
 
 	while(1) {
-		nmbuffer=nm_nextpkt(ucfg->nmd, &header);
-		if(nmbuffer==NULL) {
-			fprintf(stderr, "no packet found\n");
+		nmbuffer=nm_nextpkt(w->nmd, &header);
+		if(nmbuffer==NULL)
 			return NETMAP_RECV_NOPACKET;
-		}
 
-		/* size doesn't match, not for us */
-		if(header.len!=sizeof(struct pkt)+cfg->opts.length)
+		/* tag, size or ports don't match, not for us */
+		len=header.len;
+		tpkt=frame_vlan_pop((char*)nmbuffer, &len, ucfg->tci);
+		if(!tpkt || !frame_match(tpkt, len, ucfg->port,
+			cfg->opts.length))
 			continue;
 
-		/* ports dont't match, still not for us */
-		tpkt=(struct pkt*)nmbuffer;
-		if(tpkt->udp.uh_dport != htons(ucfg->port))
+		/* no cyclicping payload */
+		if(hdr_check((char*)(tpkt+1), cfg->opts.length))
 			continue;
 
 		clock_gettime(cfg->opts.clock, trecv);
 
-		/* copy header and payload */
-		memcpy(&ucfg->in_pkt_header, tpkt, sizeof(struct pkt));
-		memcpy(cfg->recv_packet, nmbuffer+sizeof(struct pkt),
-			cfg->opts.length);
+		/* copy payload */
+		memcpy(cfg->recv_packet, tpkt+1, cfg->opts.length);
 
 		break;
 	}
@@ -402,40 +589,47 @@ enum recv_code netmap_receive_packet(struct cyclicping_cfg *cfg, int timeout,
  */
 int netmap_client(struct cyclicping_cfg *cfg)
 {
-	struct timespec tsend, trecv, tserver;
+	struct timespec tsend, trecv, left;
 	enum recv_code recv_ret;
 
-	if(netmap_send_packet(cfg, 0, &tsend)!=0)
+	if(netmap_send_packet(cfg, &tsend)!=0)
 		return 1;
 
-	/* receive until we get a valid packet or a timeout */
-	do {
-		recv_ret=netmap_receive_packet(cfg, 1000, &trecv);
-	} while(recv_ret==NETMAP_RECV_NOPACKET);
+	/* receive until we get the reply to this request or a timeout, late
+	 * replies to earlier requests are counted and skipped */
+	while(run) {
+		if(reply_timeout(cfg, &tsend, &left)) {
+			reply_lost(cfg);
+			break;
+		}
 
-	if(recv_ret!=NETMAP_RECV_OK)
-		return 1;
+		recv_ret=netmap_receive_packet(cfg, left.tv_sec*1000+
+			(left.tv_nsec+999999)/1000000, &trecv);
+		if(recv_ret==NETMAP_RECV_ERROR)
+			return 1;
+		if(recv_ret!=NETMAP_RECV_OK)
+			continue;
 
-	/* add packet time to statistics */
-	if(add_stats(cfg, STAT_ALL, &tsend, &trecv))
-		return 1;
+		if(match_reply(cfg, hdr_get_seq(cfg->recv_packet))!=
+			REPLY_CURRENT)
+			continue;
 
-	if(cfg->opts.two_way) {
-		buffer2tspec(cfg->recv_packet+2*sizeof(uint64_t), &tserver);
-		if(add_stats(cfg, STAT_SEND, &tsend, &tserver))
-			return 1;
-		if(add_stats(cfg, STAT_RECV, &tserver, &trecv))
+		/* add packet time to statistics */
+		if(add_packet_stats(cfg, &tsend, cfg->recv_packet, &trecv))
 			return 1;
+
+		break;
 	}
 
-	print_stats(cfg, &tsend, &tserver, &trecv);
+	cfg->seq++;
 
 	/* wait until next inverval */
 	return client_wait(cfg, tsend);
 }
 
 /**
- * Netmap server.
+ * Netmap server. Works as a reflector, the first ring pair is served here,
+ * further ring pairs by worker threads.
  *
  * \param cfg Cyclicping config data.
  * \return 0 on success, else 1.
@@ -443,40 +637,8 @@ int netmap_client(struct cyclicping_cfg *cfg)
 int netmap_server(struct cyclicping_cfg *cfg)
 {
 	struct netmap_cfg *ucfg=cfg->current_mod->modcfg;
-	struct pkt *pkt=&ucfg->out_pkt_header;
-	struct udphdr *udp=&pkt->udp;
-	struct ip *ip=&pkt->ip;
-	struct ether_header *eh=&pkt->eh;
-	struct timespec tsend, trecv;
-	enum recv_code recv_ret;
 
-	recv_ret=netmap_receive_packet(cfg, -1, &trecv);
-
-	/* packets received but none for us, just start over */
-	if(recv_ret==NETMAP_RECV_NOPACKET)
-		return 0;
-
-	if(recv_ret==NETMAP_RECV_ERROR)
-		return 1;
-
-	/* make source ip addr of received paket to destination address
-	 * of the packet to send */
-	ip->ip_dst.s_addr = ucfg->in_pkt_header.ip.ip_src.s_addr;
-	ip->ip_sum = wrapsum(checksum(ip, sizeof(*ip), 0));
-
-	/* switch udp ports */
-	udp->uh_sport = ucfg->in_pkt_header.udp.uh_dport;
-	udp->uh_dport = ucfg->in_pkt_header.udp.uh_sport;
-
-	/* copy source mac address of received packet */
-	memcpy(eh->ether_dhost, ucfg->in_pkt_header.eh.ether_shost,
-		sizeof(struct ether_addr));
-
-	/* send out reply packet */
-	if(netmap_send_packet(cfg, 1, &tsend)!=0)
-		return 1;
-
-	return 0;
+	return netmap_serve(&ucfg->workers[0], -1);
 }
 
 /**
@@ -487,7 +649,30 @@ int netmap_server(struct cyclicping_cfg *cfg)
 void netmap_deinit(struct cyclicping_cfg *cfg)
 {
 	struct netmap_cfg *ucfg=cfg->current_mod->modcfg;
+	int i;
+
+	/* worker threads end with the test, which is also over if the
+	 * server loop failed */
+	run=0;
+
+	/* once it is abort_fd, the descriptor of the first worker is closed
+	 * as such at the end of the test, nm_close() must not close it (or
+	 * its reused number) again */
+	if(ucfg->fd_abort && ucfg->workers[0].nmd) {
+		if(abort_fd==ucfg->workers[0].fd)
+			abort_fd=0;
+		else
+			ucfg->workers[0].nmd->fd=-1;
+	}
+
+	for(i=0; ucfg->workers && i<ucfg->nworkers; i++) {
+		if(ucfg->workers[i].started)
+			pthread_join(ucfg->workers[i].thread, NULL);
+		if(ucfg->workers[i].nmd)
+			nm_close(ucfg->workers[i].nmd);
+	}
 
+	free(ucfg->workers);
 	free(ucfg);
 }
 
@@ -497,9 +682,15 @@ void netmap_deinit(struct cyclicping_cfg *cfg)
 void netmap_usage(void)
 {
 	printf("  netmap - Use a Netmap connection\n");
-	printf("    netmap:interface[:port]                    "
+	printf("    netmap:interface[:port[:rings[:flags]]]                   "
 		"Netmap server\n");
-	printf("    netmap:interface:servermac:serverip[:port] "
+	printf("    netmap:interface:servermac:serverip[:port[:ring[:flags]]] "
 		"Netmap client\n");
-	printf("    mac address has to use \"-\" as separator\n");
+	printf("    mac address has to use \"-\" as separator, rings is a "
+		"ring pair n, a\n");
+	printf("    range first-last served by one thread each or all "
+		"(default),\n");
+	printf("    flags: comma separated list of vlan=<id> and "
+		"pcp=<priority> (send\n");
+	printf("    and expect 802.1Q tagged frames)\n");
 }
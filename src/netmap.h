@@ -21,16 +21,22 @@
 #define __NETMAP_H__
 
 #include <poll.h>
-#include <netinet/ip.h>
-#include <netinet/udp.h>
-#include <net/ethernet.h>
-#include <netinet/in.h>
+#include <pthread.h>
+
+#include <frame.h>
 
 #define NETMAP_WITH_LIBS
 #include <net/netmap_user.h>
 
 #define MAX_DEV_LEN	32
 
+/* time to wait for link and rings after opening the device (s) */
+#define NETMAP_READY_TIMEOUT	10
+/* interval for checking link and rings (ms) */
+#define NETMAP_READY_POLL	10
+/* poll timeout of server worker threads, to notice the end of a test (ms) */
+#define NETMAP_WORKER_POLL	100
+
 enum recv_code {
 	NETMAP_RECV_OK=0,
 	NETMAP_RECV_TIMEOUT,
@@ -38,26 +44,33 @@ enum recv_code {
 	NETMAP_RECV_ERROR
 };
 
-struct pkt {
-        struct ether_header eh;
-        struct ip ip;
-        struct udphdr udp;
-} __attribute__((__packed__));
+/* descriptor bound to one ring pair (or all rings), served by one thread */
+struct netmap_worker {
+	struct cyclicping_cfg *cfg;
+	struct nm_desc *nmd;
+	int fd;
+	struct pollfd poll_fds;
+	struct netmap_ring *nmtxring;
+	int ring;
+	pthread_t thread;
+	int started;
+};
 
 struct netmap_cfg {
-	char nm_device[MAX_DEV_LEN];
-	char *device;
+	char device[IFNAMSIZ+1];
 	struct ether_addr dest_hwaddr;
 	struct sockaddr_in dest_addr;
-	struct sockaddr_in local_addr;
 	int port;
-	int fd;
-	struct pollfd poll_fds;
-	struct nm_desc *nmd;
-	struct pollfd fds;
-	struct netmap_ring *nmtxring;
+	int first_ring;
+	int last_ring;
+	int nworkers;
+	struct netmap_worker *workers;
+	/* the fd of the first worker was handed out as abort_fd */
+	int fd_abort;
 	struct pkt out_pkt_header;
-	struct pkt in_pkt_header;
+	struct vlan_cfg vlan;
+	/* tag control information, -1 for untagged frames */
+	int tci;
 };
 
 int netmap_init(struct cyclicping_cfg *cfg, char **argv, int argc);
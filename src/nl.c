@@ -0,0 +1,235 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include <nl.h>
+
+/**
+ * Open rtnetlink socket. The socket belongs to the network namespace of
+ * the calling thread.
+ *
+ * \return Socket or -1 on error.
+ */
+int nl_open(void)
+{
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd=socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE);
+	if(fd<0) {
+		perror("failed to open netlink socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family=AF_NETLINK;
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr))<0) {
+		perror("failed to bind netlink socket");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Initialize netlink request.
+ *
+ * \param req Request.
+ * \param type Message type (RTM_*).
+ * \param flags Additional NLM_F_* flags.
+ */
+void nl_init(struct nl_req *req, int type, int flags)
+{
+	size_t len;
+
+	/* attributes follow the family specific header */
+	switch(type) {
+		case RTM_NEWLINK :
+		case RTM_DELLINK :
+		case RTM_GETLINK :
+			len=sizeof(struct ifinfomsg);
+			break;
+		case RTM_NEWADDR :
+		case RTM_DELADDR :
+		case RTM_GETADDR :
+			len=sizeof(struct ifaddrmsg);
+			break;
+		default :
+			len=sizeof(struct tcmsg);
+			break;
+	}
+
+	memset(req, 0, sizeof(*req));
+	req->n.nlmsg_len=NLMSG_LENGTH(len);
+	req->n.nlmsg_type=type;
+	req->n.nlmsg_flags=NLM_F_REQUEST|NLM_F_ACK|flags;
+}
+
+/**
+ * Append attribute to netlink message.
+ *
+ * \param n Message, has to be part of a struct nl_req.
+ * \param type Attribute type.
+ * \param data Attribute data.
+ * \param len Data length.
+ * \return 0 on success, 1 if the message is full.
+ */
+int nl_addattr(struct nlmsghdr *n, int type, const void *data, int len)
+{
+	struct rtattr *rta;
+
+	if(NLMSG_ALIGN(n->nlmsg_len)+RTA_SPACE(len)>sizeof(struct nl_req)) {
+		fprintf(stderr, "netlink message too long\n");
+		return 1;
+	}
+
+	rta=(struct rtattr*)((char*)n+NLMSG_ALIGN(n->nlmsg_len));
+	rta->rta_type=type;
+	rta->rta_len=RTA_LENGTH(len);
+	if(len)
+		memcpy(RTA_DATA(rta), data, len);
+	n->nlmsg_len=NLMSG_ALIGN(n->nlmsg_len)+RTA_SPACE(len);
+
+	return 0;
+}
+
+/**
+ * Start nested attribute.
+ *
+ * \param n Message.
+ * \param type Attribute type.
+ * \return Nest to be closed with nl_nest_end().
+ */
+struct rtattr *nl_nest_start(struct nlmsghdr *n, int type)
+{
+	struct rtattr *nest=(struct rtattr*)((char*)n+
+		NLMSG_ALIGN(n->nlmsg_len));
+
+	nl_addattr(n, type, NULL, 0);
+
+	return nest;
+}
+
+/**
+ * Close nested attribute.
+ *
+ * \param n Message.
+ * \param nest Nest returned by nl_nest_start().
+ */
+void nl_nest_end(struct nlmsghdr *n, struct rtattr *nest)
+{
+	nest->rta_len=(char*)n+NLMSG_ALIGN(n->nlmsg_len)-(char*)nest;
+}
+
+/**
+ * Send netlink request and wait for the acknowledge.
+ *
+ * \param fd Netlink socket.
+ * \param n Request.
+ * \return 0 on success, else negative errno.
+ */
+int nl_talk(int fd, struct nlmsghdr *n)
+{
+	char buf[NL_BUFSIZE];
+	struct nlmsghdr *h;
+	struct nlmsgerr *err;
+	int len;
+
+	n->nlmsg_seq++;
+
+	if(send(fd, n, n->nlmsg_len, 0)<0)
+		return -errno;
+
+	while(1) {
+		len=recv(fd, buf, sizeof(buf), 0);
+		if(len<0) {
+			if(errno==EINTR)
+				continue;
+			return -errno;
+		}
+
+		for(h=(struct nlmsghdr*)buf; NLMSG_OK(h, len);
+			h=NLMSG_NEXT(h, len)) {
+			if(h->nlmsg_seq!=n->nlmsg_seq)
+				continue;
+
+			if(h->nlmsg_type==NLMSG_ERROR) {
+				err=(struct nlmsgerr*)NLMSG_DATA(h);
+				return err->error;
+			}
+		}
+	}
+}
+
+/**
+ * Send netlink dump request and pass every object to a callback.
+ *
+ * \param fd Netlink socket.
+ * \param n Request, NLM_F_DUMP is added.
+ * \param cb Callback, a non zero return stops the dump.
+ * \param arg Callback argument.
+ * \return 0 on success, else negative errno or the callback's return.
+ */
+int nl_dump(int fd, struct nlmsghdr *n,
+	int (*cb)(struct nlmsghdr *h, void *arg), void *arg)
+{
+	char buf[NL_DUMP_BUFSIZE];
+	struct nlmsghdr *h;
+	struct nlmsgerr *err;
+	int len, ret=0;
+
+	n->nlmsg_seq++;
+	n->nlmsg_flags=(n->nlmsg_flags|NLM_F_DUMP)&~NLM_F_ACK;
+
+	if(send(fd, n, n->nlmsg_len, 0)<0)
+		return -errno;
+
+	while(1) {
+		len=recv(fd, buf, sizeof(buf), 0);
+		if(len<0) {
+			if(errno==EINTR)
+				continue;
+			return -errno;
+		}
+
+		for(h=(struct nlmsghdr*)buf; NLMSG_OK(h, len);
+			h=NLMSG_NEXT(h, len)) {
+			if(h->nlmsg_seq!=n->nlmsg_seq)
+				continue;
+
+			if(h->nlmsg_type==NLMSG_DONE)
+				return ret;
+
+			if(h->nlmsg_type==NLMSG_ERROR) {
+				err=(struct nlmsgerr*)NLMSG_DATA(h);
+				return err->error;
+			}
+
+			/* the rest of the dump still has to be read */
+			if(!ret)
+				ret=cb(h, arg);
+		}
+	}
+}
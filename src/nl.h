@@ -0,0 +1,50 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __NL_H__
+#define __NL_H__
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define NL_BUFSIZE	4096
+/* dump replies are batched into larger messages */
+#define NL_DUMP_BUFSIZE	32768
+
+/* netlink request with room for attributes */
+struct nl_req {
+	struct nlmsghdr n;
+	union {
+		struct ifinfomsg ifi;
+		struct ifaddrmsg ifa;
+		struct tcmsg tcm;
+	};
+	char buf[NL_BUFSIZE];
+};
+
+int nl_open(void);
+void nl_init(struct nl_req *req, int type, int flags);
+int nl_addattr(struct nlmsghdr *n, int type, const void *data, int len);
+struct rtattr *nl_nest_start(struct nlmsghdr *n, int type);
+void nl_nest_end(struct nlmsghdr *n, struct rtattr *nest);
+int nl_talk(int fd, struct nlmsghdr *n);
+int nl_dump(int fd, struct nlmsghdr *n,
+	int (*cb)(struct nlmsghdr *h, void *arg), void *arg);
+
+#endif
@@ -24,6 +24,7 @@
 #include <getopt.h>
 
 #include <cyclicping.h>
+#include <proto.h>
 #include <opts.h>
 
 void help(struct cyclicping_cfg *cfg)
@@ -39,12 +40,28 @@ void help(struct cyclicping_cfg *cfg)
 	printf("                        (hosts have to be time "
 		"synchronized).\n");
 	printf("-a <nr> --affinity <nr> Run on processor <nr>.\n");
+	printf("-A <nr> --server-affinity <nr>\n");
+	printf("                        Run self-test server on processor "
+		"<nr>.\n");
 	printf("-b <t>  --breaktrace    Abort ftrace if latency is "
 		"greater <t>.\n");
+	printf("-B <l>  --load <l>      Send background traffic while "
+		"measuring:\n");
+	printf("                        udp|tcp:<ip>:<port>[:flags] or "
+		"raw:<if>:<mac>[:flags],\n");
+	printf("                        flags: threads, rate (Mbit/s), load "
+		"(%%), size, prio,\n");
+	printf("                        tos, cpu.\n");
 	printf("-c      --client        Run in client mode.\n");
 	printf("-C <c>  --clock <c>     Select clock (0 MONOTONIC, "
 		"1 REALTIME).\n");
 	printf("-d <f>  --dump <f>      Dump packet times to file <f>.\n");
+	printf("-e <w>  --perf <w>[:<s>]\n");
+	printf("                        Count perf events per packet, in "
+		"windows of <w>\n");
+	printf("                        packets, for spikes above <s> "
+		"(default: twice the\n");
+	printf("                        average).\n");
 	printf("-f      --ftrace        Enable ftrace.\n");
 	printf("-g      --gnuplot       Ouput gnuplot script with histogram.\n");
 	printf("-h      --help          Displays this information.\n");
@@ -52,6 +69,10 @@ void help(struct cyclicping_cfg *cfg)
 		"depth <h>.\n");
 	printf("-i <i>  --interval <i>  Packet interval in us "
 		"(default: %d).\n", DEFAULT_INTERVAL);
+	printf("-I <i>  --irq <i>       Set IRQs of interface <i> to the "
+		"CPU of -a, their\n");
+	printf("                        threads above -p, restored on exit.\n");
+	printf("                        <i>[:prio=<offset>,cpu=<nr>]\n");
 	printf("-l <l>  --loops <l>     Send <l> packets, then quit.\n");
 	printf("-L <l>  --length <l>    Packet length in bytes "
 		"(default: %d)\n", DEFAULT_LENGTH);
@@ -61,12 +82,49 @@ void help(struct cyclicping_cfg *cfg)
 	printf("-p <p>  --prio <p>      Process priority.\n");
 	printf("-P <p>  --so-prio <p>   Socket priority.\n");
 	printf("-q      --quiet         Don't print current statistic.\n");
+	printf("-Q <q>  --qdisc <q>     Set up qdisc <q> (mqprio, cbs, etf or "
+		"taprio) for the\n");
+	printf("                        stream on an interface, restored on "
+		"exit.\n");
+	printf("                        <q>:<if>[:offload,delta=<us>,"
+		"window=<us>]\n");
+	printf("-R <p>  --preflight <p> Audit the host for realtime before "
+		"starting, <p> is\n");
+	printf("                        off, warn (default) or strict "
+		"(refuse to start).\n");
 	printf("-s      --server        Run in server mode.\n");
+	printf("-S <g>  --sweep <g>     Measure -l packets for each point of "
+		"the grid\n");
+	printf("                        <lengths>[:<intervals>[:<bauds>]], "
+		"lists of values\n");
+	printf("                        and ranges <from>-<to>+<step> or "
+		"<from>-<to>*<factor>.\n");
+	printf("                        Prints percentiles per point and "
+		"fits a fixed plus\n");
+	printf("                        per byte cost. The server has to be "
+		"started with the\n");
+	printf("                        largest length (udp, unix) or "
+		"self-test is used.\n");
 	printf("-t <t>  --tos           Set TOS field in IP packets to <t>\n");
+	printf("-T <e>  --selftest <e>  Run server and client in one process "
+		"over lo, veth\n");
+	printf("                        (in own network namespaces) or pty "
+		"(uart). %%i, %%m,\n");
+	printf("                        %%a and %%d in the module arguments "
+		"are replaced by\n");
+	printf("                        the local interface, peer mac, peer "
+		"address and local\n");
+	printf("                        device.\n");
 	printf("-u mod  --use mod       Use input/output interface <mod>.\n");
+	printf("-U mod  --client-use mod\n");
+	printf("                        Self-test client interface args "
+		"(default: as -u).\n");
 	printf("-v      --verbose       Verbose mode on.\n");
 	printf("-V      --version       Displays cyclicpings version "
 		"number.\n");
+	printf("-W <t>  --timeout <t>   Reply timeout in us or auto (from "
+		"the round trip\n");
+	printf("                        time, default: 1 s).\n");
 
 	printf("\nThe following interfaces are available:\n");
 
@@ -106,6 +164,19 @@ int sanitize_cfg(struct cyclicping_cfg *cfg)
 		exit(0);
 	}
 
+	if(opts->selftest) {
+		if(opts->client || opts->server) {
+			fprintf(stderr, "self-test runs client and server, "
+				"don't use -c or -s\n");
+			exit(1);
+		}
+		opts->client=1;
+	} else if(opts->opt_client_mod || opts->opt_server_affinity) {
+		fprintf(stderr, "-U and -A are only valid in self-test "
+			"mode\n");
+		exit(1);
+	}
+
 	if(opts->client && opts->server) {
 		fprintf(stderr,
 			"can't be client and server at the same time\n");
@@ -140,7 +211,7 @@ int sanitize_cfg(struct cyclicping_cfg *cfg)
 	if(opts->length==0)
 		opts->length=DEFAULT_LENGTH;
 
-	if(opts->length<2*sizeof(struct timespec) || opts->length>1<<20) {
+	if(opts->length<sizeof(struct cp_hdr) || opts->length>1<<20) {
 		fprintf(stderr, "invalid packet length\n");
 		exit(1);
 	}
@@ -165,6 +236,17 @@ int sanitize_cfg(struct cyclicping_cfg *cfg)
 		exit(1);
 	}
 
+	if(opts->opt_server_affinity && opts->server_affinity<0) {
+		fprintf(stderr, "invalid server affinity\n");
+		exit(1);
+	}
+
+	if(opts->opt_timeout && !opts->timeout_auto &&
+		(opts->timeout<=0 || opts->timeout>REPLY_TIMEOUT/1000*60)) {
+		fprintf(stderr, "invalid reply timeout\n");
+		exit(1);
+	}
+
 	if(opts->histogram<0 || opts->histogram>1000000) {
 		fprintf(stderr, "invalid histogram size\n");
 		exit(1);
@@ -200,6 +282,22 @@ int sanitize_cfg(struct cyclicping_cfg *cfg)
 		exit(1);
 	}
 
+	if(cfg->sweep.enabled) {
+		if(opts->server || !opts->number) {
+			fprintf(stderr, "sweep requires client mode and loop "
+				"count (-l).\n");
+			exit(1);
+		}
+		if(opts->dumpfile || cfg->perf.enabled) {
+			fprintf(stderr, "sweep can't be combined with -d "
+				"or -e.\n");
+			exit(1);
+		}
+		/* percentiles are taken from the histogram */
+		if(!opts->histogram)
+			opts->histogram=SWEEP_HISTOGRAM;
+	}
+
 	if(opts->breaktrace<0) {
 		fprintf(stderr, "invalid value for breaktraceņ.\n");
 		exit(1);
@@ -216,14 +314,17 @@ int parse_cfg(int argc, char *argv[], struct cyclicping_cfg *cfg)
 {
 	struct cyclicping_opts *opts=&cfg->opts;
 	int next_option;
-	const char* const short_options = "2a:b:cC:d:fghH:i:l:L:mMp:P:qst:u:vV";
+	const char* const short_options = "2a:A:b:B:cC:d:e:fghH:i:I:l:L:mMp:P:qQ:R:sS:t:T:u:U:vVW:";
 	const struct option long_options[] = {
 		{ "two-way", 0, NULL, '2' },
 		{ "affinity", 1, NULL, 'a' },
+		{ "server-affinity", 1, NULL, 'A' },
 		{ "breaktrace", 1, NULL, 'b' },
+		{ "load", 1, NULL, 'B' },
 		{ "client", 0, NULL, 'c' },
 		{ "clock", 1, NULL, 'C' },
 		{ "dump", 0, NULL, 'd' },
+		{ "perf", 1, NULL, 'e' },
 		{ "ftrace", 0, NULL, 'f' },
 		{ "gnuplot", 0, NULL, 'g' },
 		{ "help", 0, NULL, 'h' },
@@ -231,16 +332,23 @@ int parse_cfg(int argc, char *argv[], struct cyclicping_cfg *cfg)
 		{ "loops", 1, NULL, 'l' },
 		{ "length", 1, NULL, 'L' },
 		{ "interval", 1, NULL, 'i' },
+		{ "irq", 1, NULL, 'I' },
 		{ "mlockall", 0, NULL, 'm' },
 		{ "ms", 0, NULL, 'M' },
 		{ "prio", 1, NULL, 'p' },
 		{ "so-prio", 1, NULL, 'P' },
 		{ "tos", 1, NULL, 'P' },
 		{ "quiet", 0, NULL, 'q' },
+		{ "qdisc", 1, NULL, 'Q' },
+		{ "preflight", 1, NULL, 'R' },
 		{ "server", 0, NULL, 's' },
+		{ "sweep", 1, NULL, 'S' },
+		{ "selftest", 1, NULL, 'T' },
 		{ "use", 0, NULL, 'u' },
+		{ "client-use", 1, NULL, 'U' },
 		{ "verbose", 0, NULL, 'v' },
 		{ "version", 0, NULL, 'V' },
+		{ "timeout", 1, NULL, 'W' },
 		{ NULL, 0, NULL, 0 }
 	};
 
@@ -259,10 +367,17 @@ int parse_cfg(int argc, char *argv[], struct cyclicping_cfg *cfg)
 				opts->opt_affinity=optarg;
 				opts->affinity=atoi(opts->opt_affinity);
 				break;
+			case 'A' :
+				opts->opt_server_affinity=optarg;
+				opts->server_affinity=atoi(optarg);
+				break;
 			case 'b' :
 				opts->opt_breaktrace=optarg;
 				opts->breaktrace=atoi(opts->opt_breaktrace);
 				break;
+			case 'B' :
+				opts->opt_load=optarg;
+				break;
 			case 'c' :
 				opts->client=1;
 				break;
@@ -276,6 +391,13 @@ int parse_cfg(int argc, char *argv[], struct cyclicping_cfg *cfg)
 					(strlen(opts->opt_dumpfile)+1));
 				strcpy(opts->dumpfile,opts->opt_dumpfile);
 				break;
+			case 'e' :
+				if(perf_parse(cfg, optarg)) {
+					fprintf(stderr, "invalid perf window "
+						"%s\n", optarg);
+					exit(1);
+				}
+				break;
 			case 'f' :
 				opts->ftrace=1;
 				break;
@@ -293,6 +415,9 @@ int parse_cfg(int argc, char *argv[], struct cyclicping_cfg *cfg)
 				opts->opt_interval=optarg;
 				opts->interval=atoi(opts->opt_interval);
 				break;
+			case 'I' :
+				opts->opt_irq=optarg;
+				break;
 			case 'l' :
 				opts->opt_number=optarg;
 				opts->number=atoi(opts->opt_number);
@@ -318,22 +443,52 @@ int parse_cfg(int argc, char *argv[], struct cyclicping_cfg *cfg)
 			case 'q' :
 				opts->quiet=1;
 				break;
+			case 'Q' :
+				opts->opt_qdisc=optarg;
+				break;
+			case 'R' :
+				if(preflight_parse(cfg, optarg)) {
+					fprintf(stderr, "invalid preflight "
+						"policy %s\n", optarg);
+					exit(1);
+				}
+				break;
 			case 's' :
 				opts->server=1;
 				break;
+			case 'S' :
+				if(sweep_parse(cfg, optarg)) {
+					fprintf(stderr, "invalid sweep grid "
+						"%s\n", optarg);
+					exit(1);
+				}
+				break;
 			case 't' :
 				opts->opt_tos=optarg;
 				opts->tos=atoi(opts->opt_tos);
 				break;
+			case 'T' :
+				opts->selftest=optarg;
+				break;
 			case 'u' :
 				opts->opt_mod=optarg;
 				break;
+			case 'U' :
+				opts->opt_client_mod=optarg;
+				break;
 			case 'v' :
 				opts->verbose=1;
 				break;
 			case 'V' :
 				opts->version=1;
 				break;
+			case 'W' :
+				opts->opt_timeout=optarg;
+				if(strcmp(optarg, "auto")==0)
+					opts->timeout_auto=1;
+				else
+					opts->timeout=atoi(optarg);
+				break;
 			case '?' :
 				help(cfg);
 			case -1 :
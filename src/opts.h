@@ -55,6 +55,10 @@ struct cyclicping_opts {
 	char *dumpfile;
 	int breaktrace;
 	char gnuplot;
+	char *selftest;
+	int server_affinity;
+	int timeout;
+	char timeout_auto;
 
 	char *opt_interval;
 	char *opt_number;
@@ -68,6 +72,12 @@ struct cyclicping_opts {
 	char *opt_affinity;
 	char *opt_mod;
 	char *opt_breaktrace;
+	char *opt_client_mod;
+	char *opt_server_affinity;
+	char *opt_timeout;
+	char *opt_qdisc;
+	char *opt_irq;
+	char *opt_load;
 };
 
 void help();
@@ -0,0 +1,430 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+
+#include <cyclicping.h>
+#include <perf.h>
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} perf_events[PERF_NUM]={
+	[PERF_CYCLES]={ "cycles", PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_INSTRUCTIONS]={ "instructions", PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_CACHE_MISSES]={ "cache-misses", PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_CACHE_MISSES },
+	[PERF_CTX_SWITCHES]={ "ctx-switches", PERF_TYPE_SOFTWARE,
+		PERF_COUNT_SW_CONTEXT_SWITCHES },
+	[PERF_MIGRATIONS]={ "migrations", PERF_TYPE_SOFTWARE,
+		PERF_COUNT_SW_CPU_MIGRATIONS },
+	[PERF_PAGE_FAULTS]={ "page-faults", PERF_TYPE_SOFTWARE,
+		PERF_COUNT_SW_PAGE_FAULTS },
+	[PERF_INVOLUNTARY]={ "involuntary", 0, 0 },
+};
+
+/**
+ * Parse the perf option (window[:spike]).
+ *
+ * \param cfg Cyclicping config data.
+ * \param arg Option argument.
+ * \return 0 on success.
+ */
+int perf_parse(struct cyclicping_cfg *cfg, char *arg)
+{
+	struct perf_cfg *p=&cfg->perf;
+	char *window, *spike;
+	char *saveptr=NULL;
+	int n;
+
+	window=strtok_r(arg, ":", &saveptr);
+	spike=strtok_r(NULL, ":", &saveptr);
+
+	n=window?atoi(window):0;
+	if(n<=0)
+		return 1;
+	p->window=n;
+
+	n=spike?atoi(spike):0;
+	if(spike && n<=0)
+		return 1;
+	p->spike=n;
+
+	p->enabled=1;
+
+	return 0;
+}
+
+/**
+ * Open a counter for the calling thread.
+ *
+ * \param p Perf config.
+ * \param i Counter.
+ * \return 0 on success.
+ */
+static int perf_open_counter(struct perf_cfg *p, int i)
+{
+	struct perf_event_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size=sizeof(attr);
+	attr.type=perf_events[i].type;
+	attr.config=perf_events[i].config;
+	attr.read_format=PERF_FORMAT_GROUP;
+	attr.exclude_hv=1;
+
+	fd=syscall(__NR_perf_event_open, &attr, 0, -1, p->leader,
+		PERF_FLAG_FD_CLOEXEC);
+
+	/* kernel time needs perf_event_paranoid <= 1 or CAP_PERFMON */
+	if(fd<0) {
+		attr.exclude_kernel=1;
+		fd=syscall(__NR_perf_event_open, &attr, 0, -1, p->leader,
+			PERF_FLAG_FD_CLOEXEC);
+	}
+
+	if(fd<0)
+		return 1;
+
+	if(p->leader<0)
+		p->leader=fd;
+	p->fd[i]=fd;
+	p->pos[i]=p->nevents++;
+
+	return 0;
+}
+
+/**
+ * Open the counters for the measuring (calling) thread. They are read as
+ * one group, all with a single read. Counters the CPU or the virtual
+ * machine doesn't provide are left out.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success.
+ */
+int perf_open(struct cyclicping_cfg *cfg)
+{
+	struct perf_cfg *p=&cfg->perf;
+	char missing[128]="";
+	int i;
+
+	if(!p->enabled)
+		return 0;
+
+	p->leader=-1;
+	p->nevents=0;
+
+	for(i=0; i<PERF_INVOLUNTARY; i++) {
+		p->fd[i]=-1;
+		p->pos[i]=-1;
+
+		if(perf_open_counter(p, i))
+			snprintf(missing+strlen(missing), sizeof(missing)-
+				strlen(missing), " %s", perf_events[i].name);
+	}
+
+	if(!p->nevents) {
+		perror("failed to open perf counters");
+		return 1;
+	}
+
+	if(missing[0] && !cfg->opts.quiet)
+		printf("perf counters not available:%s\n", missing);
+
+	p->fd[PERF_INVOLUNTARY]=-1;
+	p->pos[PERF_INVOLUNTARY]=p->nevents;
+
+	p->windows=NULL;
+	p->nwindows=0;
+
+	return 0;
+}
+
+/**
+ * Read all counters.
+ *
+ * \param p Perf config.
+ * \param count Counter values, unavailable ones are zero.
+ * \return 0 on success.
+ */
+static int perf_read(struct perf_cfg *p, uint64_t *count)
+{
+	uint64_t buf[1+PERF_NUM];
+	struct rusage usage;
+	int i;
+
+	if(read(p->leader, buf, sizeof(buf))<(ssize_t)sizeof(uint64_t))
+		return 1;
+
+	if(getrusage(RUSAGE_THREAD, &usage))
+		return 1;
+
+	for(i=0; i<PERF_INVOLUNTARY; i++)
+		count[i]=p->pos[i]<0?0:buf[1+p->pos[i]];
+	count[PERF_INVOLUNTARY]=usage.ru_nivcsw;
+
+	return 0;
+}
+
+/**
+ * Take the counters before a request is sent. Called when the client
+ * wakes up for the next request.
+ *
+ * \param cfg Cyclicping config data.
+ */
+void perf_start(struct cyclicping_cfg *cfg)
+{
+	struct perf_cfg *p=&cfg->perf;
+
+	if(p->enabled && p->leader>=0)
+		p->started=!perf_read(p, p->start);
+}
+
+/**
+ * Keep a packet if it is among the worst.
+ *
+ * \param p Perf config.
+ * \param rtt Round trip time.
+ * \param count Counter deltas of the packet.
+ */
+static void perf_add_outlier(struct perf_cfg *p, uint32_t rtt,
+	const uint64_t *count)
+{
+	struct perf_outlier *o;
+	int i, best=0;
+
+	if(p->noutliers<PERF_OUTLIERS) {
+		o=&p->outliers[p->noutliers++];
+	} else {
+		/* replace the best of the worst */
+		for(i=1; i<PERF_OUTLIERS; i++)
+			if(p->outliers[i].rtt<p->outliers[best].rtt)
+				best=i;
+		if(rtt<=p->outliers[best].rtt)
+			return;
+		o=&p->outliers[best];
+	}
+
+	o->packet=p->packets;
+	o->rtt=rtt;
+	memcpy(o->count, count, sizeof(o->count));
+}
+
+/**
+ * Add the counters of a packet. Called after the reply was added to the
+ * statistics.
+ *
+ * \param cfg Cyclicping config data.
+ * \param rtt Round trip time in the output unit.
+ */
+void perf_packet(struct cyclicping_cfg *cfg, uint32_t rtt)
+{
+	struct perf_cfg *p=&cfg->perf;
+	struct tstats *all=&cfg->stat[STAT_ALL];
+	struct perf_window *w;
+	uint64_t count[PERF_NUM];
+	uint32_t spike;
+	int i;
+
+	if(!p->started || perf_read(p, count))
+		return;
+	p->started=0;
+
+	for(i=0; i<PERF_NUM; i++)
+		count[i]-=p->start[i];
+
+	spike=p->spike?p->spike:(uint32_t)(2*all->avg/all->cnt);
+
+	for(i=0; i<PERF_NUM; i++) {
+		p->sum[i]+=count[i];
+		p->cur.sum[i]+=count[i];
+		if(rtt>spike)
+			p->spike_sum[i]+=count[i];
+	}
+	if(rtt>spike)
+		p->spikes++;
+
+	p->cur.packets++;
+	if(rtt>p->cur.max)
+		p->cur.max=rtt;
+
+	perf_add_outlier(p, rtt, count);
+	p->packets++;
+
+	if(p->cur.packets<p->window)
+		return;
+
+	w=(struct perf_window*)realloc(p->windows, (p->nwindows+1)*
+		sizeof(struct perf_window));
+	if(w) {
+		p->windows=w;
+		p->windows[p->nwindows++]=p->cur;
+	}
+	memset(&p->cur, 0, sizeof(p->cur));
+}
+
+/**
+ * Close the counters.
+ *
+ * \param cfg Cyclicping config data.
+ */
+void perf_close(struct cyclicping_cfg *cfg)
+{
+	struct perf_cfg *p=&cfg->perf;
+	int i;
+
+	if(!p->enabled)
+		return;
+
+	for(i=0; i<PERF_INVOLUNTARY; i++) {
+		if(p->fd[i]>=0)
+			close(p->fd[i]);
+		p->fd[i]=-1;
+	}
+	p->leader=-1;
+}
+
+/**
+ * Print counter averages.
+ *
+ * \param p Perf config.
+ * \param f Output file.
+ * \param sum Counter sums.
+ * \param n Number of packets.
+ */
+static void perf_print_avg(struct perf_cfg *p, FILE *f, const uint64_t *sum,
+	uint64_t n)
+{
+	int i;
+
+	for(i=0; i<PERF_NUM; i++)
+		if(p->pos[i]>=0)
+			fprintf(f, " %.2f", n?(double)sum[i]/n:0.0);
+	fprintf(f, "\n");
+}
+
+/**
+ * Print the summary line: what the spikes had on average compared to the
+ * other packets. Many involuntary context switches point to preemption,
+ * many cache misses at a constant switch count to cache effects.
+ *
+ * \param cfg Cyclicping config data.
+ * \param f Output file.
+ */
+void perf_print_summary(struct cyclicping_cfg *cfg, FILE *f)
+{
+	struct perf_cfg *p=&cfg->perf;
+	uint64_t others=p->packets-p->spikes;
+	const char *unit=cfg->opts.ms?"ms":"us";
+	int i, first=1;
+
+	if(!p->enabled || !p->packets)
+		return;
+
+	if(p->spike)
+		fprintf(f, "# perf: %" PRIu64 " of %" PRIu64 " spikes above %u "
+			"%s had on average", p->spikes, p->packets, p->spike,
+			unit);
+	else
+		fprintf(f, "# perf: %" PRIu64 " of %" PRIu64 " spikes above "
+			"twice the average had on average", p->spikes,
+			p->packets);
+
+	for(i=0; i<PERF_NUM; i++) {
+		if(p->pos[i]<0)
+			continue;
+
+		fprintf(f, "%s %.2f %s", first?"":",", p->spikes?
+			(double)p->spike_sum[i]/p->spikes:0.0,
+			i==PERF_INVOLUNTARY?"involuntary context switches":
+			perf_events[i].name);
+		first=0;
+	}
+
+	fprintf(f, " (other packets:");
+	for(i=0; i<PERF_NUM; i++)
+		if(p->pos[i]>=0)
+			fprintf(f, " %.2f", others?(double)(p->sum[i]-
+				p->spike_sum[i])/others:0.0);
+	fprintf(f, ")\n");
+}
+
+/**
+ * Print the counters per packet: overall, per window and of the worst
+ * packets.
+ *
+ * \param cfg Cyclicping config data.
+ * \param f Output file.
+ */
+void perf_print(struct cyclicping_cfg *cfg, FILE *f)
+{
+	struct perf_cfg *p=&cfg->perf;
+	struct perf_outlier *o, tmp;
+	int i, j;
+
+	if(!p->enabled || !p->packets)
+		return;
+
+	fprintf(f, "# perf counters per packet:");
+	for(i=0; i<PERF_NUM; i++)
+		if(p->pos[i]>=0)
+			fprintf(f, " %s", perf_events[i].name);
+	fprintf(f, "\n# perf all: %" PRIu64 " packets,", p->packets);
+	perf_print_avg(p, f, p->sum, p->packets);
+
+	for(i=0; i<p->nwindows; i++) {
+		fprintf(f, "# perf window %d: max %u,", i, p->windows[i].max);
+		perf_print_avg(p, f, p->windows[i].sum,
+			p->windows[i].packets);
+	}
+	if(p->cur.packets) {
+		fprintf(f, "# perf window %d: max %u,", i, p->cur.max);
+		perf_print_avg(p, f, p->cur.sum, p->cur.packets);
+	}
+
+	/* worst first */
+	for(i=0; i<p->noutliers; i++) {
+		o=&p->outliers[i];
+		for(j=i+1; j<p->noutliers; j++) {
+			if(p->outliers[j].rtt>o->rtt) {
+				tmp=*o;
+				*o=p->outliers[j];
+				p->outliers[j]=tmp;
+			}
+		}
+
+		fprintf(f, "# perf outlier %" PRIu64 ": rtt %u,", o->packet,
+			o->rtt);
+		perf_print_avg(p, f, o->count, 1);
+	}
+
+	perf_print_summary(cfg, f);
+}
@@ -0,0 +1,89 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __PERF_H__
+#define __PERF_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* packets per window by default */
+#define PERF_WINDOW		1000
+/* worst packets kept with their counters */
+#define PERF_OUTLIERS		10
+
+struct cyclicping_cfg;
+
+enum perf_counter {
+	PERF_CYCLES=0,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_CTX_SWITCHES,
+	PERF_MIGRATIONS,
+	PERF_PAGE_FAULTS,
+	/* from getrusage(), perf only counts all context switches */
+	PERF_INVOLUNTARY,
+	PERF_NUM,
+};
+
+struct perf_window {
+	uint64_t packets;
+	uint32_t max;
+	uint64_t sum[PERF_NUM];
+};
+
+struct perf_outlier {
+	uint64_t packet;
+	uint32_t rtt;
+	uint64_t count[PERF_NUM];
+};
+
+struct perf_cfg {
+	int enabled;
+	/* group leader and all counter fds, -1 if not available */
+	int leader;
+	int fd[PERF_NUM];
+	/* position of a counter in the group read, -1 if not available */
+	int pos[PERF_NUM];
+	int nevents;
+	uint32_t window;
+	/* spike threshold in the output unit, 0 for twice the average */
+	uint32_t spike;
+	int started;
+	uint64_t start[PERF_NUM];
+	uint64_t packets;
+	uint64_t sum[PERF_NUM];
+	uint64_t spikes;
+	uint64_t spike_sum[PERF_NUM];
+	struct perf_window cur;
+	struct perf_window *windows;
+	int nwindows;
+	struct perf_outlier outliers[PERF_OUTLIERS];
+	int noutliers;
+};
+
+int perf_parse(struct cyclicping_cfg *cfg, char *arg);
+int perf_open(struct cyclicping_cfg *cfg);
+void perf_start(struct cyclicping_cfg *cfg);
+void perf_packet(struct cyclicping_cfg *cfg, uint32_t rtt);
+void perf_close(struct cyclicping_cfg *cfg);
+void perf_print(struct cyclicping_cfg *cfg, FILE *f);
+void perf_print_summary(struct cyclicping_cfg *cfg, FILE *f);
+
+#endif
@@ -0,0 +1,438 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include <net/if.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+
+#include <cyclicping.h>
+#include <preflight.h>
+
+extern int latency_target_fd;
+
+/**
+ * Parse the preflight policy.
+ *
+ * \param cfg Cyclicping config data.
+ * \param arg Policy (off, warn or strict).
+ * \return 0 on success.
+ */
+int preflight_parse(struct cyclicping_cfg *cfg, const char *arg)
+{
+	if(strcmp(arg, "off")==0)
+		cfg->preflight.policy=PREFLIGHT_OFF;
+	else if(strcmp(arg, "warn")==0)
+		cfg->preflight.policy=PREFLIGHT_WARN;
+	else if(strcmp(arg, "strict")==0)
+		cfg->preflight.policy=PREFLIGHT_STRICT;
+	else
+		return 1;
+
+	return 0;
+}
+
+/**
+ * Read the first line of a sysfs or procfs file.
+ *
+ * \param path File.
+ * \param buf Buffer.
+ * \param len Buffer size.
+ * \return 0 on success, else 1.
+ */
+static int preflight_read(const char *path, char *buf, int len)
+{
+	FILE *f;
+	int ret=0;
+
+	f=fopen(path, "r");
+	if(f==NULL)
+		return 1;
+
+	if(fgets(buf, len, f)==NULL)
+		ret=1;
+	else
+		buf[strcspn(buf, "\n")]=0;
+
+	fclose(f);
+
+	return ret;
+}
+
+/**
+ * Append a finding to the preflight info.
+ *
+ * \param cfg Cyclicping config data.
+ * \param ok 0 if the finding speaks against realtime operation.
+ * \param fmt Format of the finding.
+ */
+static void preflight_add(struct cyclicping_cfg *cfg, int ok,
+	const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+static void preflight_add(struct cyclicping_cfg *cfg, int ok,
+	const char *fmt, ...)
+{
+	struct preflight_cfg *p=&cfg->preflight;
+	size_t len=strlen(p->info);
+	char finding[128];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(finding, sizeof(finding), fmt, ap);
+	va_end(ap);
+
+	snprintf(p->info+len, sizeof(p->info)-len, "%s%s", len?", ":"",
+		finding);
+
+	if(!ok) {
+		p->failed++;
+		fprintf(stderr, "preflight: %s\n", finding);
+	}
+}
+
+/**
+ * Get the CPUs the measurement runs on: the ones the process may run on
+ * and the self-test server's CPU.
+ *
+ * \param cfg Cyclicping config data.
+ * \param set CPU set.
+ */
+static void preflight_cpus(struct cyclicping_cfg *cfg, cpu_set_t *set)
+{
+	if(sched_getaffinity(0, sizeof(*set), set)) {
+		CPU_ZERO(set);
+		CPU_SET(sched_getcpu(), set);
+	}
+
+	if(cfg->opts.selftest && cfg->opts.opt_server_affinity)
+		CPU_SET(cfg->opts.server_affinity, set);
+}
+
+/**
+ * Check if a CPU is in a CPU list as shown by sysfs (e.g. 1-3,5).
+ *
+ * \param list CPU list.
+ * \param cpu CPU.
+ * \return 1 if the CPU is in the list.
+ */
+static int preflight_in_list(const char *list, int cpu)
+{
+	const char *p=list;
+	char *end;
+	long from, to;
+
+	while(isdigit(*p)) {
+		from=to=strtol(p, &end, 10);
+		if(*end=='-')
+			to=strtol(end+1, &end, 10);
+		if(cpu>=from && cpu<=to)
+			return 1;
+		if(*end!=',')
+			break;
+		p=end+1;
+	}
+
+	return 0;
+}
+
+/**
+ * Check for a realtime kernel.
+ *
+ * \param cfg Cyclicping config data.
+ */
+static void preflight_rt_kernel(struct cyclicping_cfg *cfg)
+{
+	struct utsname uts;
+	char buf[8];
+	int rt=0;
+
+	if(!preflight_read("/sys/kernel/realtime", buf, sizeof(buf)))
+		rt=atoi(buf)==1;
+
+	if(!rt && !uname(&uts))
+		rt=strstr(uts.version, "PREEMPT_RT") ||
+			strstr(uts.version, "PREEMPT RT");
+
+	preflight_add(cfg, rt, "rt kernel %s", rt?"yes":"no");
+}
+
+/**
+ * Check the frequency governor of the CPUs in use.
+ *
+ * \param cfg Cyclicping config data.
+ * \param set CPUs in use.
+ */
+static void preflight_governor(struct cyclicping_cfg *cfg, cpu_set_t *set)
+{
+	char path[96], gov[32];
+	int cpu, known=0;
+
+	for(cpu=0; cpu<CPU_SETSIZE; cpu++) {
+		if(!CPU_ISSET(cpu, set))
+			continue;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/"
+			"cpufreq/scaling_governor", cpu);
+		if(preflight_read(path, gov, sizeof(gov)))
+			continue;
+		known=1;
+
+		if(strcmp(gov, "performance")) {
+			preflight_add(cfg, 0, "governor %s on cpu %d", gov,
+				cpu);
+			return;
+		}
+	}
+
+	preflight_add(cfg, 1, "governor %s", known?"performance":"n/a");
+}
+
+/**
+ * Check the idle states of the CPUs in use. cyclicping holds
+ * /dev/cpu_dma_latency at 0, which keeps the CPUs out of idle states
+ * with an exit latency while it runs.
+ *
+ * \param cfg Cyclicping config data.
+ * \param set CPUs in use.
+ */
+static void preflight_cstates(struct cyclicping_cfg *cfg, cpu_set_t *set)
+{
+	char path[128], buf[32];
+	int cpu, state;
+
+	if(latency_target_fd>0) {
+		preflight_add(cfg, 1, "c-states limited by cpu_dma_latency");
+		return;
+	}
+
+	for(cpu=0; cpu<CPU_SETSIZE; cpu++) {
+		if(!CPU_ISSET(cpu, set))
+			continue;
+
+		for(state=0; ; state++) {
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/"
+				"cpu%d/cpuidle/state%d/latency", cpu, state);
+			if(preflight_read(path, buf, sizeof(buf)))
+				break;
+			if(!atoi(buf))
+				continue;
+
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/"
+				"cpu%d/cpuidle/state%d/disable", cpu, state);
+			if(preflight_read(path, buf, sizeof(buf)) ||
+				atoi(buf))
+				continue;
+
+			preflight_add(cfg, 0, "c-state %d enabled on cpu %d",
+				state, cpu);
+			return;
+		}
+	}
+
+	preflight_add(cfg, 1, "c-states off");
+}
+
+/**
+ * Check for a running irqbalance daemon, which moves IRQs while
+ * measuring.
+ *
+ * \param cfg Cyclicping config data.
+ */
+static void preflight_irqbalance(struct cyclicping_cfg *cfg)
+{
+	char path[288], comm[32];
+	struct dirent *ent;
+	DIR *dir;
+	int running=0;
+
+	dir=opendir("/proc");
+	if(dir==NULL)
+		return;
+
+	while(!running && (ent=readdir(dir))) {
+		if(!isdigit(ent->d_name[0]))
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/%s/comm", ent->d_name);
+		if(!preflight_read(path, comm, sizeof(comm)))
+			running=strcmp(comm, "irqbalance")==0;
+	}
+
+	closedir(dir);
+
+	preflight_add(cfg, !running, "irqbalance %s",
+		running?"running":"not running");
+}
+
+/**
+ * Check transparent huge pages, khugepaged compacting memory in the
+ * background causes latency spikes.
+ *
+ * \param cfg Cyclicping config data.
+ */
+static void preflight_thp(struct cyclicping_cfg *cfg)
+{
+	char buf[64], *mode, *end;
+
+	if(preflight_read("/sys/kernel/mm/transparent_hugepage/enabled", buf,
+		sizeof(buf))) {
+		preflight_add(cfg, 1, "thp n/a");
+		return;
+	}
+
+	/* the selected mode is in brackets */
+	mode=strchr(buf, '[');
+	end=mode?strchr(mode, ']'):NULL;
+	if(end==NULL) {
+		preflight_add(cfg, 1, "thp unknown");
+		return;
+	}
+	*end=0;
+	mode++;
+
+	preflight_add(cfg, strcmp(mode, "always"), "thp %s", mode);
+}
+
+/**
+ * Check that the CPUs in use are isolated from the scheduler and run
+ * without scheduling clock ticks.
+ *
+ * \param cfg Cyclicping config data.
+ * \param set CPUs in use.
+ */
+static void preflight_isolation(struct cyclicping_cfg *cfg, cpu_set_t *set)
+{
+	const char *names[]={"isolated", "nohz_full"};
+	char path[64], list[256];
+	int i, cpu;
+
+	for(i=0; i<2; i++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/%s",
+			names[i]);
+		if(preflight_read(path, list, sizeof(list)))
+			list[0]=0;
+
+		for(cpu=0; cpu<CPU_SETSIZE; cpu++) {
+			if(CPU_ISSET(cpu, set) &&
+				!preflight_in_list(list, cpu))
+				break;
+		}
+
+		if(cpu<CPU_SETSIZE)
+			preflight_add(cfg, 0, "cpu %d not %s%s", cpu, names[i],
+				CPU_COUNT(set)>1?" (not pinned, use -a)":"");
+		else
+			preflight_add(cfg, 1, "%s", names[i]);
+	}
+}
+
+/**
+ * Check the interrupt coalescing of the interface in use, delayed
+ * interrupts add to the round trip time.
+ *
+ * \param cfg Cyclicping config data.
+ */
+static void preflight_coalescing(struct cyclicping_cfg *cfg)
+{
+	struct ethtool_coalesce ec;
+	struct ifreq ifr;
+	const char *ifname;
+	int fd, ret;
+
+	/* the interface is known from the options or the module */
+	if(cfg->irq.ifname[0])
+		ifname=cfg->irq.ifname;
+	else if(cfg->qdisc.mode)
+		ifname=cfg->qdisc.ifname;
+	else if(cfg->wire_ifname[0])
+		ifname=cfg->wire_ifname;
+	else
+		return;
+
+	fd=socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd<0)
+		return;
+
+	memset(&ifr, 0, sizeof(ifr));
+	memset(&ec, 0, sizeof(ec));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ-1);
+	ec.cmd=ETHTOOL_GCOALESCE;
+	ifr.ifr_data=(void*)&ec;
+	ret=ioctl(fd, SIOCETHTOOL, &ifr);
+	close(fd);
+
+	if(ret<0) {
+		preflight_add(cfg, 1, "%s coalescing n/a", ifname);
+		return;
+	}
+
+	preflight_add(cfg, !ec.rx_coalesce_usecs &&
+		!ec.use_adaptive_rx_coalesce, "%s rx-usecs %u%s", ifname,
+		ec.rx_coalesce_usecs, ec.use_adaptive_rx_coalesce?
+		" adaptive":"");
+}
+
+/**
+ * Audit the host for realtime operation: kernel, CPUs in use and the
+ * interface under test. Depending on the policy findings are warned
+ * about or refuse the start.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 to start the measurement.
+ */
+int preflight_check(struct cyclicping_cfg *cfg)
+{
+	struct preflight_cfg *p=&cfg->preflight;
+	cpu_set_t set;
+
+	if(p->policy==PREFLIGHT_OFF)
+		return 0;
+
+	p->failed=0;
+	p->info[0]=0;
+
+	preflight_cpus(cfg, &set);
+
+	preflight_rt_kernel(cfg);
+	preflight_governor(cfg, &set);
+	preflight_cstates(cfg, &set);
+	preflight_irqbalance(cfg);
+	preflight_thp(cfg);
+	preflight_isolation(cfg, &set);
+	preflight_coalescing(cfg);
+
+	if(p->failed && p->policy==PREFLIGHT_STRICT) {
+		fprintf(stderr, "host not configured for realtime, not "
+			"starting (use -R warn to run anyway)\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __PREFLIGHT_H__
+#define __PREFLIGHT_H__
+
+struct cyclicping_cfg;
+
+enum preflight_policy {
+	PREFLIGHT_WARN=0,
+	PREFLIGHT_OFF,
+	PREFLIGHT_STRICT,
+};
+
+struct preflight_cfg {
+	int policy;
+	/* number of findings against realtime operation */
+	int failed;
+	char info[512];
+};
+
+int preflight_parse(struct cyclicping_cfg *cfg, const char *arg);
+int preflight_check(struct cyclicping_cfg *cfg);
+
+#endif
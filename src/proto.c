@@ -0,0 +1,204 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <endian.h>
+#include <arpa/inet.h>
+
+#include <stats.h>
+#include <proto.h>
+
+/**
+ * Initialize the wire header at the start of a payload buffer.
+ *
+ * \param buffer Payload buffer.
+ * \param length Payload length in bytes (including the header).
+ */
+void hdr_init(char *buffer, int length)
+{
+	struct cp_hdr *hdr=(struct cp_hdr*)buffer;
+
+	memset(hdr, 0, sizeof(struct cp_hdr));
+	hdr->magic=htonl(CP_MAGIC);
+	hdr->version=CP_VERSION;
+	hdr->hdr_len=htons(sizeof(struct cp_hdr));
+	hdr->length=htonl(length);
+}
+
+/**
+ * Check if a received payload carries a valid wire header.
+ *
+ * \param buffer Payload buffer.
+ * \param length Number of valid bytes in buffer.
+ * \return 0 if the header is valid, else 1.
+ */
+int hdr_check(const char *buffer, int length)
+{
+	const struct cp_hdr *hdr=(const struct cp_hdr*)buffer;
+
+	if(length<sizeof(struct cp_hdr))
+		return 1;
+
+	if(ntohl(hdr->magic)!=CP_MAGIC)
+		return 1;
+
+	if(hdr->version!=CP_VERSION)
+		return 1;
+
+	if(ntohs(hdr->hdr_len)<sizeof(struct cp_hdr) ||
+		ntohs(hdr->hdr_len)>length)
+		return 1;
+
+	return 0;
+}
+
+/**
+ * Set sequence number of a packet.
+ *
+ * \param buffer Payload buffer.
+ * \param seq Sequence number.
+ */
+void hdr_set_seq(char *buffer, uint32_t seq)
+{
+	((struct cp_hdr*)buffer)->seq=htonl(seq);
+}
+
+/**
+ * Get sequence number of a packet.
+ *
+ * \param buffer Payload buffer.
+ * \return Sequence number.
+ */
+uint32_t hdr_get_seq(const char *buffer)
+{
+	return ntohl(((const struct cp_hdr*)buffer)->seq);
+}
+
+/**
+ * Set header flags.
+ *
+ * \param buffer Payload buffer.
+ * \param flags Flags to set.
+ */
+void hdr_set_flags(char *buffer, uint8_t flags)
+{
+	((struct cp_hdr*)buffer)->flags=flags;
+}
+
+/**
+ * Get header flags.
+ *
+ * \param buffer Payload buffer.
+ * \return Header flags.
+ */
+uint8_t hdr_get_flags(const char *buffer)
+{
+	return ((const struct cp_hdr*)buffer)->flags;
+}
+
+/**
+ * Set ID of the server answering a request.
+ *
+ * \param buffer Payload buffer.
+ * \param id Responder ID.
+ */
+void hdr_set_responder(char *buffer, uint32_t id)
+{
+	((struct cp_hdr*)buffer)->responder=htonl(id);
+}
+
+/**
+ * Get ID of the server which answered a request.
+ *
+ * \param buffer Payload buffer.
+ * \return Responder ID.
+ */
+uint32_t hdr_get_responder(const char *buffer)
+{
+	return ntohl(((const struct cp_hdr*)buffer)->responder);
+}
+
+/**
+ * Store time stamp in header.
+ *
+ * \param buffer Payload buffer.
+ * \param which Time stamp to set.
+ * \param tspec Time to store.
+ */
+void hdr_set_time(char *buffer, enum cp_time which,
+	const struct timespec *tspec)
+{
+	((struct cp_hdr*)buffer)->time[which]=htobe64(TSPEC_TO_NSEC(tspec));
+}
+
+/**
+ * Read time stamp from header.
+ *
+ * \param buffer Payload buffer.
+ * \param which Time stamp to read.
+ * \param tspec Resulting time.
+ * \return 0 if the time stamp was set by the peer, else 1.
+ */
+int hdr_get_time(const char *buffer, enum cp_time which,
+	struct timespec *tspec)
+{
+	uint64_t ns=be64toh(((const struct cp_hdr*)buffer)->time[which]);
+
+	tspec->tv_sec=(time_t)(ns/NSEC_PER_SEC);
+	tspec->tv_nsec=(long)(ns%NSEC_PER_SEC);
+
+	return ns==0;
+}
+
+/**
+ * Prepare a client request for sending. Sets the sequence number and takes
+ * the client send time stamp.
+ *
+ * \param buffer Payload buffer.
+ * \param seq Sequence number of the request.
+ * \param clock Clock to use for time stamping.
+ * \param tsend Send time stamp gets stored here.
+ */
+void hdr_stamp_request(char *buffer, uint32_t seq, int clock,
+	struct timespec *tsend)
+{
+	hdr_set_seq(buffer, seq);
+	hdr_set_flags(buffer, hdr_get_flags(buffer) & ~CP_FLAG_REPLY);
+	clock_gettime(clock, tsend);
+	hdr_set_time(buffer, CP_CLIENT_TX, tsend);
+}
+
+/**
+ * Turn a received request into a reply. Stores the server receive time
+ * stamp and takes the server send time stamp as late as possible.
+ *
+ * \param buffer Payload buffer.
+ * \param clock Clock to use for time stamping.
+ * \param trecv Time the request was received.
+ */
+void hdr_stamp_reply(char *buffer, int clock, const struct timespec *trecv)
+{
+	struct timespec tsend;
+
+	hdr_set_flags(buffer, hdr_get_flags(buffer) | CP_FLAG_REPLY);
+	hdr_set_time(buffer, CP_SERVER_RX, trecv);
+	clock_gettime(clock, &tsend);
+	hdr_set_time(buffer, CP_SERVER_TX, &tsend);
+}
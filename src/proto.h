@@ -0,0 +1,71 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __PROTO_H__
+#define __PROTO_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#define CP_MAGIC	0x4350494eU	/* "CPIN" */
+#define CP_VERSION	2
+
+/* header flags */
+#define CP_FLAG_REPLY	0x01
+
+/* time stamps carried in the header */
+enum cp_time {
+	CP_CLIENT_TX=0,
+	CP_SERVER_RX,
+	CP_SERVER_TX,
+};
+
+/* Wire header which is placed at the start of every cyclicping payload.
+ * All fields are stored in network byte order, so peers of different
+ * endianness can talk to each other. Time stamps are nanoseconds of the
+ * clock selected with -C. A zero time stamp means "not set". */
+struct cp_hdr {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t flags;
+	uint16_t hdr_len;
+	uint32_t seq;
+	uint32_t length;
+	uint64_t time[CP_SERVER_TX+1];
+	uint32_t responder;
+} __attribute__((__packed__));
+
+void hdr_init(char *buffer, int length);
+int hdr_check(const char *buffer, int length);
+void hdr_set_seq(char *buffer, uint32_t seq);
+uint32_t hdr_get_seq(const char *buffer);
+void hdr_set_flags(char *buffer, uint8_t flags);
+uint8_t hdr_get_flags(const char *buffer);
+void hdr_set_responder(char *buffer, uint32_t id);
+uint32_t hdr_get_responder(const char *buffer);
+void hdr_set_time(char *buffer, enum cp_time which,
+	const struct timespec *tspec);
+int hdr_get_time(const char *buffer, enum cp_time which,
+	struct timespec *tspec);
+void hdr_stamp_request(char *buffer, uint32_t seq, int clock,
+	struct timespec *tsend);
+void hdr_stamp_reply(char *buffer, int clock,
+	const struct timespec *trecv);
+
+#endif
@@ -0,0 +1,711 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/pkt_sched.h>
+
+#include <cyclicping.h>
+#include <qdisc.h>
+#include <frame.h>
+#include <wire.h>
+#include <nl.h>
+
+static const char *qdisc_names[]={
+	[QDISC_MQPRIO]="mqprio",
+	[QDISC_CBS]="cbs",
+	[QDISC_ETF]="etf",
+	[QDISC_TAPRIO]="taprio",
+};
+
+/**
+ * Parse comma separated qdisc flags.
+ *
+ * \param q Qdisc config.
+ * \param arg Flags argument.
+ * \return 0 on success.
+ */
+static int qdisc_parse_flags(struct qdisc_cfg *q, char *arg)
+{
+	char *saveptr=NULL;
+	char *flag;
+	int us;
+
+	for(flag=strtok_r(arg, ",", &saveptr); flag;
+		flag=strtok_r(NULL, ",", &saveptr)) {
+		if(strcmp(flag, "offload")==0) {
+			q->offload=1;
+		} else if(q->mode==QDISC_ETF &&
+			sscanf(flag, "delta=%d", &us)==1) {
+			if(us<=0) {
+				fprintf(stderr, "invalid etf delta\n");
+				return 1;
+			}
+			q->txtime=(uint64_t)us*1000;
+		} else if(q->mode==QDISC_TAPRIO &&
+			sscanf(flag, "window=%d", &us)==1) {
+			if(us<=0) {
+				fprintf(stderr, "invalid taprio window\n");
+				return 1;
+			}
+			q->window=(uint64_t)us*1000;
+		} else {
+			fprintf(stderr, "unknown qdisc flag %s\n", flag);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Parse the qdisc option (mode:interface[:flags]). Called before the
+ * interface module is initialized, as sockets sending to etf need launch
+ * times.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success.
+ */
+int qdisc_parse(struct cyclicping_cfg *cfg)
+{
+	struct qdisc_cfg *q=&cfg->qdisc;
+	char *args, *mode, *ifname, *flags;
+	char *saveptr=NULL;
+	int i, ret=1;
+
+	memset(q, 0, sizeof(*q));
+	q->fd=-1;
+
+	if(!cfg->opts.opt_qdisc)
+		return 0;
+
+	args=strdup(cfg->opts.opt_qdisc);
+	if(args==NULL) {
+		perror("failed to allocate memory for qdisc args");
+		return 1;
+	}
+
+	mode=strtok_r(args, ":", &saveptr);
+	ifname=strtok_r(NULL, ":", &saveptr);
+	flags=strtok_r(NULL, ":", &saveptr);
+
+	if(mode==NULL || ifname==NULL) {
+		fprintf(stderr, "qdisc and interface required\n");
+		goto out;
+	}
+
+	for(i=QDISC_MQPRIO; i<=QDISC_TAPRIO; i++) {
+		if(strcmp(mode, qdisc_names[i])==0)
+			q->mode=i;
+	}
+	if(!q->mode) {
+		fprintf(stderr, "unknown qdisc %s\n", mode);
+		goto out;
+	}
+
+	if(strlen(ifname)>=sizeof(q->ifname)) {
+		fprintf(stderr, "invalid qdisc interface %s\n", ifname);
+		goto out;
+	}
+	strcpy(q->ifname, ifname);
+
+	if(q->mode==QDISC_ETF)
+		q->txtime=QDISC_ETF_DELTA;
+
+	if(flags && qdisc_parse_flags(q, flags))
+		goto out;
+
+	ret=0;
+out:
+	free(args);
+	if(ret)
+		q->mode=QDISC_NONE;
+
+	return ret;
+}
+
+/**
+ * Link dump callback getting the number of tx queues of the interface.
+ *
+ * \param h Dumped link.
+ * \param arg Interface index followed by the number of tx queues.
+ * \return 0 to continue, 1 if found.
+ */
+static int qdisc_queues_cb(struct nlmsghdr *h, void *arg)
+{
+	int *queues=arg;
+	struct ifinfomsg *ifi=NLMSG_DATA(h);
+	struct rtattr *rta;
+	int len;
+
+	if(h->nlmsg_type!=RTM_NEWLINK || ifi->ifi_index!=queues[0])
+		return 0;
+
+	len=IFLA_PAYLOAD(h);
+	for(rta=IFLA_RTA(ifi); RTA_OK(rta, len); rta=RTA_NEXT(rta, len)) {
+		if(rta->rta_type==IFLA_NUM_TX_QUEUES) {
+			queues[1]=*(uint32_t*)RTA_DATA(rta);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Get the number of tx queues of an interface. Asked over netlink, sysfs
+ * shows the interfaces of the namespace it was mounted in.
+ *
+ * \param q Qdisc config.
+ * \return Number of tx queues, 0 if unknown.
+ */
+static int qdisc_tx_queues(struct qdisc_cfg *q)
+{
+	struct nl_req req;
+	int queues[2]={q->ifindex, 0};
+
+	nl_init(&req, RTM_GETLINK, 0);
+	req.ifi.ifi_family=AF_UNSPEC;
+
+	if(nl_dump(q->fd, &req.n, qdisc_queues_cb, queues)<0)
+		return 0;
+
+	return queues[1];
+}
+
+/**
+ * Dump callback keeping the root qdisc of the interface. Default qdiscs
+ * have no handle, they come back by themselves once ours is deleted.
+ *
+ * \param h Dumped qdisc.
+ * \param arg Qdisc config.
+ * \return 0 on success, else negative errno.
+ */
+static int qdisc_save_cb(struct nlmsghdr *h, void *arg)
+{
+	struct qdisc_cfg *q=arg;
+	struct tcmsg *tcm=NLMSG_DATA(h);
+	struct rtattr *rta;
+	int len, type;
+
+	if(h->nlmsg_type!=RTM_NEWQDISC || tcm->tcm_ifindex!=q->ifindex ||
+		tcm->tcm_parent!=TC_H_ROOT || !tcm->tcm_handle)
+		return 0;
+
+	q->prev=(struct nl_req*)malloc(sizeof(struct nl_req));
+	if(q->prev==NULL)
+		return -ENOMEM;
+
+	nl_init(q->prev, RTM_NEWQDISC, NLM_F_CREATE|NLM_F_REPLACE);
+	q->prev->tcm.tcm_family=AF_UNSPEC;
+	q->prev->tcm.tcm_ifindex=q->ifindex;
+	q->prev->tcm.tcm_handle=tcm->tcm_handle;
+	q->prev->tcm.tcm_parent=TC_H_ROOT;
+
+	/* the dumped options are the ones it was set up with */
+	len=RTM_PAYLOAD(h);
+	for(rta=TCA_RTA(tcm); RTA_OK(rta, len); rta=RTA_NEXT(rta, len)) {
+		type=rta->rta_type & NLA_TYPE_MASK;
+		if(type!=TCA_KIND && type!=TCA_OPTIONS)
+			continue;
+
+		if(nl_addattr(&q->prev->n, rta->rta_type, RTA_DATA(rta),
+			RTA_PAYLOAD(rta))) {
+			free(q->prev);
+			q->prev=NULL;
+			return -EMSGSIZE;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Initialize a request adding a qdisc to the interface.
+ *
+ * \param q Qdisc config.
+ * \param req Request.
+ * \param kind Qdisc kind.
+ * \param handle Handle of the new qdisc, 0 to let the kernel choose.
+ * \param parent Parent class.
+ * \return 0 on success.
+ */
+static int qdisc_req_init(struct qdisc_cfg *q, struct nl_req *req,
+	const char *kind, uint32_t handle, uint32_t parent)
+{
+	nl_init(req, RTM_NEWQDISC, NLM_F_CREATE|NLM_F_REPLACE);
+	req->tcm.tcm_family=AF_UNSPEC;
+	req->tcm.tcm_ifindex=q->ifindex;
+	req->tcm.tcm_handle=handle;
+	req->tcm.tcm_parent=parent;
+
+	return nl_addattr(&req->n, TCA_KIND, kind, strlen(kind)+1);
+}
+
+/**
+ * Send a qdisc request.
+ *
+ * \param q Qdisc config.
+ * \param req Request.
+ * \param kind Qdisc kind for the error message.
+ * \return 0 on success.
+ */
+static int qdisc_talk(struct qdisc_cfg *q, struct nl_req *req,
+	const char *kind)
+{
+	int ret;
+
+	ret=nl_talk(q->fd, &req->n);
+	if(ret) {
+		fprintf(stderr, "failed to set up %s qdisc on %s: %s\n", kind,
+			q->ifname, strerror(-ret));
+		if(ret==-ENOENT)
+			fprintf(stderr, "kernel lacks sch_%s\n", kind);
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Fill the traffic class mapping shared by mqprio and taprio. The socket
+ * priority of the stream selects its traffic class.
+ *
+ * \param cfg Cyclicping config data.
+ * \param opt Mapping.
+ * \param queues Number of tx queues.
+ */
+static void qdisc_priomap(struct cyclicping_cfg *cfg,
+	struct tc_mqprio_qopt *opt, int queues)
+{
+	int i;
+
+	memset(opt, 0, sizeof(*opt));
+	opt->num_tc=QDISC_NUM_TC;
+
+	for(i=0; i<=TC_QOPT_BITMASK; i++)
+		opt->prio_tc_map[i]=QDISC_TC_BEST_EFFORT;
+	opt->prio_tc_map[cfg->opts.sopriority & TC_QOPT_BITMASK]=
+		QDISC_TC_STREAM;
+
+	opt->count[QDISC_TC_STREAM]=1;
+	opt->offset[QDISC_TC_STREAM]=QDISC_STREAM_QUEUE;
+	opt->count[QDISC_TC_BEST_EFFORT]=queues-1;
+	opt->offset[QDISC_TC_BEST_EFFORT]=QDISC_STREAM_QUEUE+1;
+}
+
+/**
+ * Get the bytes a request takes on the wire. The stream might be UDP and
+ * tagged, which gives an upper bound for the other modules.
+ *
+ * \param cfg Cyclicping config data.
+ * \param frames Number of frames gets stored here.
+ * \return Bytes including preamble and inter frame gap.
+ */
+static uint64_t qdisc_stream_bytes(struct cyclicping_cfg *cfg, int *frames)
+{
+	return wire_eth_bytes(cfg->qdisc.ifname, sizeof(struct udphdr)+
+		cfg->opts.length, sizeof(struct ip), 8, FRAME_VLAN_LEN,
+		frames);
+}
+
+/**
+ * Set up mqprio as root qdisc, the stream gets a tx queue of its own.
+ *
+ * \param cfg Cyclicping config data.
+ * \param queues Number of tx queues.
+ * \return 0 on success.
+ */
+static int qdisc_add_mqprio(struct cyclicping_cfg *cfg, int queues)
+{
+	struct qdisc_cfg *q=&cfg->qdisc;
+	struct tc_mqprio_qopt opt;
+	struct nl_req req;
+
+	qdisc_priomap(cfg, &opt, queues);
+
+	if(qdisc_req_init(q, &req, "mqprio", TC_H_MAKE(QDISC_HANDLE<<16, 0),
+		TC_H_ROOT) ||
+		nl_addattr(&req.n, TCA_OPTIONS, &opt, sizeof(opt)))
+		return 1;
+
+	snprintf(q->info, sizeof(q->info), "mqprio on %s, socket priority "
+		"%d on queue %d of %d", q->ifname, cfg->opts.sopriority,
+		QDISC_STREAM_QUEUE, queues);
+
+	return qdisc_talk(q, &req, "mqprio");
+}
+
+/**
+ * Set up the credit based shaper on the stream's queue. The idle slope
+ * reserves the bandwidth of the stream, the credits follow from the
+ * largest interfering frame and the stream's frame (IEEE 802.1Q Annex L).
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success.
+ */
+static int qdisc_add_cbs(struct cyclicping_cfg *cfg)
+{
+	struct qdisc_cfg *q=&cfg->qdisc;
+	struct tc_cbs_qopt opt;
+	struct rtattr *nest;
+	struct nl_req req;
+	int64_t port, idle, bytes, max_frame;
+	int speed, frames;
+
+	speed=wire_link_speed(q->ifname);
+	if(!speed) {
+		fprintf(stderr, "no link speed for %s, can't set up cbs\n",
+			q->ifname);
+		return 1;
+	}
+
+	/* slopes are in kbit/s, credits in bytes */
+	port=(int64_t)speed*1000;
+	bytes=qdisc_stream_bytes(cfg, &frames);
+	idle=(bytes*8*1000+cfg->opts.interval-1)/cfg->opts.interval;
+	if(idle>=port) {
+		fprintf(stderr, "stream exceeds the link speed of %s\n",
+			q->ifname);
+		return 1;
+	}
+	max_frame=wire_mtu(q->ifname)+WIRE_ETH_HDR;
+
+	memset(&opt, 0, sizeof(opt));
+	opt.offload=q->offload;
+	opt.idleslope=idle;
+	opt.sendslope=idle-port;
+	opt.hicredit=(idle*max_frame+port-1)/port;
+	opt.locredit=opt.sendslope*(bytes/frames)/port;
+
+	if(qdisc_req_init(q, &req, "cbs", 0, TC_H_MAKE(QDISC_HANDLE<<16,
+		QDISC_STREAM_QUEUE+1)))
+		return 1;
+	nest=nl_nest_start(&req.n, TCA_OPTIONS);
+	if(nl_addattr(&req.n, TCA_CBS_PARMS, &opt, sizeof(opt)))
+		return 1;
+	nl_nest_end(&req.n, nest);
+
+	snprintf(q->info, sizeof(q->info), "cbs on %s queue %d, idleslope %d "
+		"sendslope %d hicredit %d locredit %d", q->ifname,
+		QDISC_STREAM_QUEUE, opt.idleslope, opt.sendslope,
+		opt.hicredit, opt.locredit);
+
+	return qdisc_talk(q, &req, "cbs");
+}
+
+/**
+ * Set up earliest txtime first on the stream's queue. Frames are handed
+ * to the device delta ns before their launch time.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success.
+ */
+static int qdisc_add_etf(struct cyclicping_cfg *cfg)
+{
+	struct qdisc_cfg *q=&cfg->qdisc;
+	struct tc_etf_qopt opt;
+	struct rtattr *nest;
+	struct nl_req req;
+
+	memset(&opt, 0, sizeof(opt));
+	opt.delta=q->txtime;
+	opt.clockid=CLOCK_TAI;
+	opt.flags=q->offload?TC_ETF_OFFLOAD_ON:0;
+
+	if(qdisc_req_init(q, &req, "etf", 0, TC_H_MAKE(QDISC_HANDLE<<16,
+		QDISC_STREAM_QUEUE+1)))
+		return 1;
+	nest=nl_nest_start(&req.n, TCA_OPTIONS);
+	if(nl_addattr(&req.n, TCA_ETF_PARMS, &opt, sizeof(opt)))
+		return 1;
+	nl_nest_end(&req.n, nest);
+
+	snprintf(q->info, sizeof(q->info), "etf on %s queue %d, delta %d ns",
+		q->ifname, QDISC_STREAM_QUEUE, opt.delta);
+
+	return qdisc_talk(q, &req, "etf");
+}
+
+/**
+ * Add a taprio schedule entry opening the gates of some traffic classes.
+ *
+ * \param n Request.
+ * \param gates Gate mask (bit per traffic class).
+ * \param interval Entry duration (ns).
+ * \return 0 on success.
+ */
+static int qdisc_taprio_entry(struct nlmsghdr *n, uint32_t gates,
+	uint32_t interval)
+{
+	struct rtattr *entry;
+	uint8_t cmd=TC_TAPRIO_CMD_SET_GATES;
+	int ret=0;
+
+	entry=nl_nest_start(n, TCA_TAPRIO_SCHED_ENTRY|NLA_F_NESTED);
+	ret|=nl_addattr(n, TCA_TAPRIO_SCHED_ENTRY_CMD, &cmd, sizeof(cmd));
+	ret|=nl_addattr(n, TCA_TAPRIO_SCHED_ENTRY_GATE_MASK, &gates,
+		sizeof(gates));
+	ret|=nl_addattr(n, TCA_TAPRIO_SCHED_ENTRY_INTERVAL, &interval,
+		sizeof(interval));
+	nl_nest_end(n, entry);
+
+	return ret;
+}
+
+/**
+ * Set up taprio as root qdisc. The gate cycle is the packet interval,
+ * the stream's gate is open for a window at the start of each cycle,
+ * best effort traffic for the rest. Cycles start at multiples of the
+ * cycle time in CLOCK_TAI, so both peers share them if their clocks are
+ * synchronized.
+ *
+ * \param cfg Cyclicping config data.
+ * \param queues Number of tx queues.
+ * \return 0 on success.
+ */
+static int qdisc_add_taprio(struct cyclicping_cfg *cfg, int queues)
+{
+	struct qdisc_cfg *q=&cfg->qdisc;
+	struct tc_mqprio_qopt opt;
+	struct rtattr *nest, *list;
+	struct nl_req req;
+	int64_t base, cycle;
+	int32_t clockid=CLOCK_TAI;
+	uint32_t flags=TCA_TAPRIO_ATTR_FLAG_FULL_OFFLOAD;
+	int speed, ret=0;
+
+	q->cycle_time=(uint64_t)cfg->opts.interval*1000;
+	q->base_time=0;
+
+	/* twice the time a request takes on the wire by default */
+	speed=wire_link_speed(q->ifname);
+	if(!q->window && speed)
+		q->window=2*qdisc_stream_bytes(cfg, NULL)*8*1000/speed;
+	if(q->window<QDISC_WINDOW_MIN)
+		q->window=QDISC_WINDOW_MIN;
+
+	if(q->window>=q->cycle_time || q->cycle_time>UINT32_MAX) {
+		fprintf(stderr, "taprio window doesn't fit the interval\n");
+		return 1;
+	}
+
+	qdisc_priomap(cfg, &opt, queues);
+	base=q->base_time;
+	cycle=q->cycle_time;
+
+	if(qdisc_req_init(q, &req, "taprio", TC_H_MAKE(QDISC_HANDLE<<16, 0),
+		TC_H_ROOT))
+		return 1;
+
+	nest=nl_nest_start(&req.n, TCA_OPTIONS|NLA_F_NESTED);
+	ret|=nl_addattr(&req.n, TCA_TAPRIO_ATTR_PRIOMAP, &opt, sizeof(opt));
+	ret|=nl_addattr(&req.n, TCA_TAPRIO_ATTR_SCHED_BASE_TIME, &base,
+		sizeof(base));
+	ret|=nl_addattr(&req.n, TCA_TAPRIO_ATTR_SCHED_CYCLE_TIME, &cycle,
+		sizeof(cycle));
+
+	/* the hardware runs the schedule on its own clock */
+	if(q->offload)
+		ret|=nl_addattr(&req.n, TCA_TAPRIO_ATTR_FLAGS, &flags,
+			sizeof(flags));
+	else
+		ret|=nl_addattr(&req.n, TCA_TAPRIO_ATTR_SCHED_CLOCKID,
+			&clockid, sizeof(clockid));
+
+	list=nl_nest_start(&req.n, TCA_TAPRIO_ATTR_SCHED_ENTRY_LIST|
+		NLA_F_NESTED);
+	ret|=qdisc_taprio_entry(&req.n, 1<<QDISC_TC_STREAM, q->window);
+	ret|=qdisc_taprio_entry(&req.n, 1<<QDISC_TC_BEST_EFFORT,
+		q->cycle_time-q->window);
+	nl_nest_end(&req.n, list);
+	nl_nest_end(&req.n, nest);
+
+	if(ret)
+		return 1;
+
+	snprintf(q->info, sizeof(q->info), "taprio on %s, cycle %" PRIu64
+		" ns, stream window %" PRIu64 " ns on queue %d of %d",
+		q->ifname, q->cycle_time, q->window, QDISC_STREAM_QUEUE,
+		queues);
+
+	return qdisc_talk(q, &req, "taprio");
+}
+
+/**
+ * Set up the requested qdisc. Called after the interface module was
+ * initialized. The current root qdisc is saved to be restored on exit.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success.
+ */
+int qdisc_setup(struct cyclicping_cfg *cfg)
+{
+	struct qdisc_cfg *q=&cfg->qdisc;
+	struct timespec tai, now;
+	struct nl_req req;
+	int queues, ret;
+
+	if(!q->mode)
+		return 0;
+
+	if(q->mode==QDISC_ETF && !q->txtime_set) {
+		fprintf(stderr, "etf requires launch times, which %s doesn't "
+			"send (supported by udp and stsn without mmap)\n",
+			cfg->current_mod->name);
+		return 1;
+	}
+
+	q->ifindex=if_nametoindex(q->ifname);
+	if(!q->ifindex) {
+		fprintf(stderr, "no such interface %s\n", q->ifname);
+		return 1;
+	}
+
+	q->fd=nl_open();
+	if(q->fd<0)
+		return 1;
+
+	queues=qdisc_tx_queues(q);
+	if(queues<QDISC_NUM_TC) {
+		fprintf(stderr, "%s qdisc requires at least %d tx queues on "
+			"%s\n", qdisc_names[q->mode], QDISC_NUM_TC, q->ifname);
+		goto err;
+	}
+
+	if(!cfg->opts.sopriority && !cfg->opts.quiet)
+		printf("socket priority 0 puts all default traffic into the "
+			"stream's traffic class, use -P\n");
+
+	nl_init(&req, RTM_GETQDISC, 0);
+	req.tcm.tcm_family=AF_UNSPEC;
+	req.tcm.tcm_ifindex=q->ifindex;
+	ret=nl_dump(q->fd, &req.n, qdisc_save_cb, q);
+	if(ret) {
+		fprintf(stderr, "failed to get qdisc of %s: %s\n", q->ifname,
+			strerror(-ret));
+		goto err;
+	}
+
+	/* from here on ours is deleted on exit, even if set up partially */
+	q->installed=1;
+
+	switch(q->mode) {
+		case QDISC_MQPRIO :
+			ret=qdisc_add_mqprio(cfg, queues);
+			break;
+		case QDISC_CBS :
+			ret=qdisc_add_mqprio(cfg, queues) ||
+				qdisc_add_cbs(cfg);
+			break;
+		case QDISC_ETF :
+			ret=qdisc_add_mqprio(cfg, queues) ||
+				qdisc_add_etf(cfg);
+			break;
+		case QDISC_TAPRIO :
+			ret=qdisc_add_taprio(cfg, queues);
+			break;
+	}
+
+	if(ret) {
+		qdisc_restore(cfg);
+		q->cycle_time=0;
+		return 1;
+	}
+
+	/* gate phases are computed from the measuring clock */
+	clock_gettime(CLOCK_TAI, &tai);
+	clock_gettime(cfg->opts.clock, &now);
+	q->tai_offset=(int64_t)TSPEC_TO_NSEC((&tai))-
+		(int64_t)TSPEC_TO_NSEC((&now));
+
+	if(!cfg->opts.quiet)
+		printf("qdisc: %s\n", q->info);
+
+	return 0;
+err:
+	close(q->fd);
+	q->fd=-1;
+	return 1;
+}
+
+/**
+ * Delete our qdisc and recreate the previous root qdisc.
+ *
+ * \param cfg Cyclicping config data.
+ */
+void qdisc_restore(struct cyclicping_cfg *cfg)
+{
+	struct qdisc_cfg *q=&cfg->qdisc;
+	struct nl_req req;
+	int ret;
+
+	if(q->installed) {
+		nl_init(&req, RTM_DELQDISC, 0);
+		req.tcm.tcm_family=AF_UNSPEC;
+		req.tcm.tcm_ifindex=q->ifindex;
+		req.tcm.tcm_handle=TC_H_MAKE(QDISC_HANDLE<<16, 0);
+		req.tcm.tcm_parent=TC_H_ROOT;
+
+		/* not there if setting it up failed */
+		ret=nl_talk(q->fd, &req.n);
+		if(ret && ret!=-ENOENT && ret!=-EINVAL)
+			fprintf(stderr, "failed to delete qdisc of %s: %s\n",
+				q->ifname, strerror(-ret));
+
+		if(q->prev) {
+			ret=nl_talk(q->fd, &q->prev->n);
+			if(ret)
+				fprintf(stderr, "failed to restore previous "
+					"qdisc of %s: %s\n", q->ifname,
+					strerror(-ret));
+		}
+
+		q->installed=0;
+	}
+
+	free(q->prev);
+	q->prev=NULL;
+
+	if(q->fd>=0)
+		close(q->fd);
+	q->fd=-1;
+}
+
+/**
+ * Get the taprio gate cycle phase of a time stamp.
+ *
+ * \param cfg Cyclicping config data.
+ * \param t Time stamp of the measuring clock.
+ * \return Time since the start of the gate cycle (ns).
+ */
+uint64_t qdisc_gate_phase(struct cyclicping_cfg *cfg,
+	const struct timespec *t)
+{
+	struct qdisc_cfg *q=&cfg->qdisc;
+
+	return (TSPEC_TO_NSEC(t)+q->tai_offset-q->base_time)%q->cycle_time;
+}
@@ -0,0 +1,84 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __QDISC_H__
+#define __QDISC_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/* handle of the root qdisc set up by cyclicping */
+#define QDISC_HANDLE		0x100
+/* traffic classes: the stream gets its own queue, the remaining queues
+ * carry best effort traffic */
+#define QDISC_TC_STREAM		0
+#define QDISC_TC_BEST_EFFORT	1
+#define QDISC_NUM_TC		2
+#define QDISC_STREAM_QUEUE	0
+/* default etf delta, frames are sent with a launch time this far ahead
+ * (ns) */
+#define QDISC_ETF_DELTA		100000
+/* minimum taprio gate window of the stream (ns) */
+#define QDISC_WINDOW_MIN	10000
+#define QDISC_IFNAMSIZ		16
+
+struct cyclicping_cfg;
+struct nl_req;
+
+enum qdisc_mode {
+	QDISC_NONE=0,
+	QDISC_MQPRIO,
+	QDISC_CBS,
+	QDISC_ETF,
+	QDISC_TAPRIO,
+};
+
+struct qdisc_cfg {
+	int mode;
+	char ifname[QDISC_IFNAMSIZ];
+	int ifindex;
+	int offload;
+	/* launch time of sent frames ahead of now for etf (ns), 0 without
+	 * etf */
+	uint64_t txtime;
+	/* set by modules whose sockets send with launch times */
+	int txtime_set;
+	/* taprio gate window of the stream (ns), 0 for the default */
+	uint64_t window;
+	/* taprio gate cycle (ns), 0 without taprio */
+	uint64_t cycle_time;
+	uint64_t base_time;
+	/* CLOCK_TAI minus the measuring clock (ns) */
+	int64_t tai_offset;
+	/* netlink socket, kept for restoring in the same namespace */
+	int fd;
+	int installed;
+	/* request recreating the previous root qdisc, NULL for the default
+	 * one */
+	struct nl_req *prev;
+	char info[128];
+};
+
+int qdisc_parse(struct cyclicping_cfg *cfg);
+int qdisc_setup(struct cyclicping_cfg *cfg);
+void qdisc_restore(struct cyclicping_cfg *cfg);
+uint64_t qdisc_gate_phase(struct cyclicping_cfg *cfg,
+	const struct timespec *t);
+
+#endif
@@ -0,0 +1,691 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/veth.h>
+
+#include <cyclicping.h>
+#include <selftest.h>
+#include <nl.h>
+
+extern int run;
+extern int abort_fd;
+
+/* time to wait for the server thread per wakeup attempt */
+#define SELFTEST_JOIN_NS	100000000
+#define SELFTEST_JOIN_TRIES	10
+
+static const unsigned char selftest_mac[SELFTEST_CLIENT+1][6] = {
+	{ 0x02, 0x43, 0x50, 0x53, 0x54, 0x01 },
+	{ 0x02, 0x43, 0x50, 0x53, 0x54, 0x02 },
+};
+
+/**
+ * Handler for SIGUSR1, only used to interrupt blocking calls of the
+ * server thread.
+ *
+ * \param signum Signal number.
+ */
+static void selftest_wakeup_handler(int signum)
+{
+}
+
+/**
+ * Replace self-test placeholders in module arguments.
+ *
+ * \param args Module arguments containing placeholders.
+ * \param ep Local endpoint.
+ * \param peer Remote endpoint.
+ * \return Allocated argument string or NULL on error.
+ */
+static char *selftest_expand(const char *args,
+	struct selftest_endpoint *ep, struct selftest_endpoint *peer)
+{
+	const char *value;
+	char *res;
+	size_t len=0, size;
+
+	/* every placeholder is replaced by at most sizeof(device) chars */
+	size=strlen(args)*sizeof(ep->device)+1;
+	res=(char*)malloc(size);
+	if(res==NULL) {
+		perror("failed to allocate memory for module arguments");
+		return NULL;
+	}
+
+	for(; *args; args++) {
+		if(*args!='%') {
+			res[len++]=*args;
+			continue;
+		}
+
+		switch(*++args) {
+			case 'i' :
+				value=ep->iface;
+				break;
+			case 'm' :
+				value=peer->mac;
+				break;
+			case 'a' :
+				value=peer->addr;
+				break;
+			case 'd' :
+				value=ep->device;
+				break;
+			case '%' :
+				value="%";
+				break;
+			default :
+				fprintf(stderr, "invalid self-test placeholder "
+					"%%%c\n", *args?*args:' ');
+				free(res);
+				return NULL;
+		}
+
+		strcpy(res+len, value);
+		len+=strlen(value);
+	}
+	res[len]=0;
+
+	return res;
+}
+
+/**
+ * Set up self-test over the loopback interface.
+ *
+ * \param env Self-test environment.
+ * \return 0 on success.
+ */
+static int selftest_setup_lo(struct selftest_env *env)
+{
+	int i;
+
+	for(i=SELFTEST_SERVER; i<=SELFTEST_CLIENT; i++) {
+		strcpy(env->ep[i].iface, "lo");
+		strcpy(env->ep[i].mac, "00-00-00-00-00-00");
+		strcpy(env->ep[i].addr, "127.0.0.1");
+	}
+
+	return 0;
+}
+
+/**
+ * Bring up interface in the current network namespace.
+ *
+ * \param fd Netlink socket.
+ * \param iface Interface name.
+ * \return 0 on success.
+ */
+static int selftest_link_up(int fd, const char *iface)
+{
+	struct nl_req req;
+	int ret;
+
+	nl_init(&req, RTM_NEWLINK, 0);
+	req.ifi.ifi_family=AF_UNSPEC;
+	req.ifi.ifi_index=if_nametoindex(iface);
+	req.ifi.ifi_change=IFF_UP;
+	req.ifi.ifi_flags=IFF_UP;
+
+	if(!req.ifi.ifi_index) {
+		fprintf(stderr, "no such interface %s\n", iface);
+		return 1;
+	}
+
+	ret=nl_talk(fd, &req.n);
+	if(ret) {
+		fprintf(stderr, "failed to bring up %s: %s\n", iface,
+			strerror(-ret));
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Add IPv4 address to interface in the current network namespace.
+ *
+ * \param fd Netlink socket.
+ * \param iface Interface name.
+ * \param addr Address.
+ * \return 0 on success.
+ */
+static int selftest_addr_add(int fd, const char *iface, const char *addr)
+{
+	struct nl_req req;
+	struct in_addr in;
+	int ret;
+
+	nl_init(&req, RTM_NEWADDR, NLM_F_CREATE|NLM_F_EXCL);
+	req.ifa.ifa_family=AF_INET;
+	req.ifa.ifa_prefixlen=SELFTEST_PREFIX;
+	req.ifa.ifa_index=if_nametoindex(iface);
+
+	inet_aton(addr, &in);
+	if(nl_addattr(&req.n, IFA_LOCAL, &in, sizeof(in)) ||
+		nl_addattr(&req.n, IFA_ADDRESS, &in, sizeof(in)))
+		return 1;
+
+	ret=nl_talk(fd, &req.n);
+	if(ret) {
+		fprintf(stderr, "failed to add address to %s: %s\n", iface,
+			strerror(-ret));
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Create veth pair with one end in each self-test network namespace.
+ * Qdiscs for the stream need multiple tx queues, veth has a single one by
+ * default.
+ *
+ * \param fd Netlink socket.
+ * \param env Self-test environment with namespaces.
+ * \return 0 on success.
+ */
+static int selftest_veth_create(int fd, struct selftest_env *env)
+{
+	struct nl_req req;
+	struct rtattr *linkinfo, *data, *peer;
+	struct selftest_endpoint *ep;
+	int ret=0;
+
+	nl_init(&req, RTM_NEWLINK, NLM_F_CREATE|NLM_F_EXCL);
+	req.ifi.ifi_family=AF_UNSPEC;
+
+	ep=&env->ep[SELFTEST_SERVER];
+	ret|=nl_addattr(&req.n, IFLA_IFNAME, ep->iface, strlen(ep->iface)+1);
+	ret|=nl_addattr(&req.n, IFLA_ADDRESS, selftest_mac[SELFTEST_SERVER],
+		6);
+	ret|=nl_addattr(&req.n, IFLA_NET_NS_FD, &ep->netns, sizeof(int));
+	if(env->queues) {
+		ret|=nl_addattr(&req.n, IFLA_NUM_TX_QUEUES, &env->queues,
+			sizeof(int));
+		ret|=nl_addattr(&req.n, IFLA_NUM_RX_QUEUES, &env->queues,
+			sizeof(int));
+	}
+
+	linkinfo=nl_nest_start(&req.n, IFLA_LINKINFO);
+	ret|=nl_addattr(&req.n, IFLA_INFO_KIND, "veth", strlen("veth"));
+	data=nl_nest_start(&req.n, IFLA_INFO_DATA);
+	peer=nl_nest_start(&req.n, VETH_INFO_PEER);
+
+	/* the peer attribute starts with an ifinfomsg, already zeroed by
+	 * nl_init() */
+	req.n.nlmsg_len+=NLMSG_ALIGN(sizeof(struct ifinfomsg));
+
+	ep=&env->ep[SELFTEST_CLIENT];
+	ret|=nl_addattr(&req.n, IFLA_IFNAME, ep->iface, strlen(ep->iface)+1);
+	ret|=nl_addattr(&req.n, IFLA_ADDRESS, selftest_mac[SELFTEST_CLIENT],
+		6);
+	ret|=nl_addattr(&req.n, IFLA_NET_NS_FD, &ep->netns, sizeof(int));
+	if(env->queues) {
+		ret|=nl_addattr(&req.n, IFLA_NUM_TX_QUEUES, &env->queues,
+			sizeof(int));
+		ret|=nl_addattr(&req.n, IFLA_NUM_RX_QUEUES, &env->queues,
+			sizeof(int));
+	}
+
+	nl_nest_end(&req.n, peer);
+	nl_nest_end(&req.n, data);
+	nl_nest_end(&req.n, linkinfo);
+
+	if(ret)
+		return 1;
+
+	ret=nl_talk(fd, &req.n);
+	if(ret) {
+		fprintf(stderr, "failed to create veth pair: %s\n",
+			strerror(-ret));
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Set up self-test over a veth pair. Server and client get their own
+ * network namespace, so the traffic has to pass the veth pair instead of
+ * being short-circuited over the local routing table. The namespaces and
+ * with them the veth pair vanish when the last reference is closed.
+ *
+ * \param env Self-test environment.
+ * \return 0 on success.
+ */
+static int selftest_setup_veth(struct selftest_env *env)
+{
+	struct selftest_endpoint *ep;
+	int i, fd, ret=0;
+
+	env->orig_netns=open("/proc/thread-self/ns/net", O_RDONLY|O_CLOEXEC);
+	if(env->orig_netns<0) {
+		perror("failed to open network namespace");
+		return 1;
+	}
+
+	for(i=SELFTEST_SERVER; i<=SELFTEST_CLIENT; i++) {
+		ep=&env->ep[i];
+		strcpy(ep->iface, i==SELFTEST_SERVER?SELFTEST_VETH_SERVER:
+			SELFTEST_VETH_CLIENT);
+		strcpy(ep->addr, i==SELFTEST_SERVER?SELFTEST_ADDR_SERVER:
+			SELFTEST_ADDR_CLIENT);
+		sprintf(ep->mac, "%02x-%02x-%02x-%02x-%02x-%02x",
+			selftest_mac[i][0], selftest_mac[i][1],
+			selftest_mac[i][2], selftest_mac[i][3],
+			selftest_mac[i][4], selftest_mac[i][5]);
+
+		if(unshare(CLONE_NEWNET)) {
+			perror("failed to create network namespace");
+			return 1;
+		}
+
+		ep->netns=open("/proc/thread-self/ns/net", O_RDONLY|O_CLOEXEC);
+		if(ep->netns<0) {
+			perror("failed to open network namespace");
+			return 1;
+		}
+
+		if(setns(env->orig_netns, CLONE_NEWNET)) {
+			perror("failed to switch network namespace");
+			return 1;
+		}
+	}
+
+	fd=nl_open();
+	if(fd<0)
+		return 1;
+	ret=selftest_veth_create(fd, env);
+	close(fd);
+	if(ret)
+		return 1;
+
+	for(i=SELFTEST_SERVER; i<=SELFTEST_CLIENT && !ret; i++) {
+		ep=&env->ep[i];
+
+		if(setns(ep->netns, CLONE_NEWNET)) {
+			perror("failed to switch network namespace");
+			return 1;
+		}
+
+		fd=nl_open();
+		if(fd<0)
+			return 1;
+		ret=selftest_link_up(fd, "lo") ||
+			selftest_link_up(fd, ep->iface) ||
+			selftest_addr_add(fd, ep->iface, ep->addr);
+		close(fd);
+	}
+
+	if(setns(env->orig_netns, CLONE_NEWNET)) {
+		perror("failed to switch network namespace");
+		return 1;
+	}
+
+	return ret;
+}
+
+/**
+ * Set up self-test over a pseudo terminal. The server uses the master
+ * side, passed as /dev/fd/<nr>, the client opens the slave.
+ *
+ * \param env Self-test environment.
+ * \return 0 on success.
+ */
+static int selftest_setup_pty(struct selftest_env *env)
+{
+	char *slave;
+
+	env->pty=posix_openpt(O_RDWR|O_NOCTTY);
+	if(env->pty<0) {
+		perror("failed to open pty");
+		return 1;
+	}
+
+	if(grantpt(env->pty) || unlockpt(env->pty) ||
+		(slave=ptsname(env->pty))==NULL) {
+		perror("failed to set up pty");
+		return 1;
+	}
+
+	snprintf(env->ep[SELFTEST_SERVER].device,
+		sizeof(env->ep[SELFTEST_SERVER].device), "/dev/fd/%d",
+		env->pty);
+	snprintf(env->ep[SELFTEST_CLIENT].device,
+		sizeof(env->ep[SELFTEST_CLIENT].device), "%s", slave);
+
+	return 0;
+}
+
+/**
+ * Release self-test environment.
+ *
+ * \param env Self-test environment.
+ */
+static void selftest_cleanup_env(struct selftest_env *env)
+{
+	int i;
+
+	if(env->orig_netns>=0) {
+		if(setns(env->orig_netns, CLONE_NEWNET))
+			perror("failed to switch network namespace");
+		close(env->orig_netns);
+	}
+
+	for(i=SELFTEST_SERVER; i<=SELFTEST_CLIENT; i++)
+		if(env->ep[i].netns>=0)
+			close(env->ep[i].netns);
+
+	if(env->pty>=0)
+		close(env->pty);
+}
+
+/**
+ * Server thread. Initializes the server side of the interface module in
+ * the server namespace and runs the server loop until the client is done.
+ *
+ * \param arg Server thread data.
+ * \return NULL.
+ */
+static void *selftest_server_thread(void *arg)
+{
+	struct selftest_server *srv=arg;
+	struct selftest_endpoint *ep=&srv->env->ep[SELFTEST_SERVER];
+	sigset_t set;
+	int ret=0;
+
+	/* SIGINT and SIGTERM are handled by the client thread */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	if(ep->netns>=0 && setns(ep->netns, CLONE_NEWNET)) {
+		perror("failed to switch network namespace");
+		ret=1;
+	}
+
+	if(!ret) {
+		ret=init_module(&srv->cfg);
+
+		/* abort_fd is the client's from now on */
+		srv->abort_fd=abort_fd;
+		abort_fd=0;
+	}
+
+	if(!ret)
+		allocate_stats(&srv->cfg);
+
+	pthread_mutex_lock(&srv->lock);
+	srv->ret=ret;
+	srv->ready=1;
+	pthread_cond_signal(&srv->cond);
+	pthread_mutex_unlock(&srv->lock);
+
+	while(run && !ret)
+		ret=srv->cfg.current_mod->run_server(&srv->cfg);
+
+	return NULL;
+}
+
+/**
+ * Start server thread and wait until the server side is initialized.
+ *
+ * \param srv Server thread data, cfg has to be set up.
+ * \return 0 on success, the thread is joined on failure.
+ */
+static int selftest_start_server(struct selftest_server *srv)
+{
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int ret;
+
+	pthread_mutex_init(&srv->lock, NULL);
+	pthread_cond_init(&srv->cond, NULL);
+
+	pthread_attr_init(&attr);
+	if(srv->cfg.opts.opt_server_affinity) {
+		CPU_ZERO(&cpus);
+		CPU_SET(srv->cfg.opts.server_affinity, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+
+	ret=pthread_create(&srv->thread, &attr, selftest_server_thread, srv);
+	pthread_attr_destroy(&attr);
+	if(ret) {
+		fprintf(stderr, "failed to start server thread: %s\n",
+			strerror(ret));
+		return 1;
+	}
+
+	pthread_mutex_lock(&srv->lock);
+	while(!srv->ready)
+		pthread_cond_wait(&srv->cond, &srv->lock);
+	pthread_mutex_unlock(&srv->lock);
+
+	if(srv->ret) {
+		pthread_join(srv->thread, NULL);
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Stop server thread and release the server side of the interface module.
+ * The thread is interrupted by SIGUSR1 until it notices the end of the
+ * test, cancelled if it doesn't.
+ *
+ * \param srv Server thread data.
+ */
+static void selftest_stop_server(struct selftest_server *srv)
+{
+	struct timespec deadline;
+	int i;
+
+	run=0;
+
+	for(i=0; i<SELFTEST_JOIN_TRIES; i++) {
+		pthread_kill(srv->thread, SIGUSR1);
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec+=SELFTEST_JOIN_NS;
+		if(deadline.tv_nsec>=1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec-=1000000000;
+		}
+
+		if(!pthread_timedjoin_np(srv->thread, NULL, &deadline))
+			break;
+	}
+
+	if(i==SELFTEST_JOIN_TRIES) {
+		pthread_cancel(srv->thread);
+		pthread_join(srv->thread, NULL);
+	}
+
+	if(srv->abort_fd)
+		close(srv->abort_fd);
+
+	if(srv->mod.deinit)
+		srv->mod.deinit(&srv->cfg);
+
+	qdisc_restore(&srv->cfg);
+
+	cleanup_cfg(&srv->cfg);
+}
+
+/**
+ * Run server and client in one process. The server runs in a thread of
+ * its own, the client in the calling thread.
+ *
+ * \param cfg Cyclicping config data of the client.
+ * \return 0 on success.
+ */
+int run_selftest(struct cyclicping_cfg *cfg)
+{
+	struct selftest_env env;
+	struct selftest_server *srv;
+	struct sigaction new_action;
+	char *server_args=NULL, *client_args=NULL;
+	char *server_qdisc=NULL, *client_qdisc=NULL, *client_irq=NULL;
+	char *client_load=NULL;
+	const char *name=cfg->current_mod->name;
+	int i, ret=1;
+
+	memset(&env, 0, sizeof(env));
+	env.orig_netns=-1;
+	env.pty=-1;
+	for(i=SELFTEST_SERVER; i<=SELFTEST_CLIENT; i++)
+		env.ep[i].netns=-1;
+
+	srv=(struct selftest_server*)calloc(1, sizeof(*srv));
+	if(srv==NULL) {
+		perror("failed to allocate memory for self-test");
+		return 1;
+	}
+
+	if(cfg->opts.opt_client_mod && (strncmp(cfg->opts.opt_client_mod,
+		name, strlen(name)) || (cfg->opts.opt_client_mod[strlen(name)]
+		&& cfg->opts.opt_client_mod[strlen(name)]!=':'))) {
+		fprintf(stderr, "self-test client has to use module %s\n",
+			name);
+		goto out;
+	}
+
+	if(cfg->opts.opt_qdisc)
+		env.queues=SELFTEST_QUEUES;
+
+	if(!strcmp(cfg->opts.selftest, "lo"))
+		ret=selftest_setup_lo(&env);
+	else if(!strcmp(cfg->opts.selftest, "veth"))
+		ret=selftest_setup_veth(&env);
+	else if(!strcmp(cfg->opts.selftest, "pty"))
+		ret=selftest_setup_pty(&env);
+	else
+		fprintf(stderr, "unknown self-test environment %s\n",
+			cfg->opts.selftest);
+	if(ret)
+		goto out;
+	ret=1;
+
+	server_args=selftest_expand(cfg->opts.opt_mod,
+		&env.ep[SELFTEST_SERVER], &env.ep[SELFTEST_CLIENT]);
+	if(server_args==NULL)
+		goto out;
+	client_args=selftest_expand(cfg->opts.opt_client_mod?
+		cfg->opts.opt_client_mod:cfg->opts.opt_mod,
+		&env.ep[SELFTEST_CLIENT], &env.ep[SELFTEST_SERVER]);
+	if(client_args==NULL)
+		goto out;
+
+	/* both sides set up the qdisc on their own interface */
+	if(cfg->opts.opt_qdisc) {
+		server_qdisc=selftest_expand(cfg->opts.opt_qdisc,
+			&env.ep[SELFTEST_SERVER], &env.ep[SELFTEST_CLIENT]);
+		client_qdisc=selftest_expand(cfg->opts.opt_qdisc,
+			&env.ep[SELFTEST_CLIENT], &env.ep[SELFTEST_SERVER]);
+		if(server_qdisc==NULL || client_qdisc==NULL)
+			goto out;
+	}
+
+	/* IRQs are set up by the client only, for the whole host */
+	if(cfg->opts.opt_irq) {
+		client_irq=selftest_expand(cfg->opts.opt_irq,
+			&env.ep[SELFTEST_CLIENT], &env.ep[SELFTEST_SERVER]);
+		if(client_irq==NULL)
+			goto out;
+	}
+
+	/* background load comes from the client side */
+	if(cfg->opts.opt_load) {
+		client_load=selftest_expand(cfg->opts.opt_load,
+			&env.ep[SELFTEST_CLIENT], &env.ep[SELFTEST_SERVER]);
+		if(client_load==NULL)
+			goto out;
+	}
+
+	new_action.sa_handler=selftest_wakeup_handler;
+	sigemptyset(&new_action.sa_mask);
+	new_action.sa_flags=0;
+	sigaction(SIGUSR1, &new_action, NULL);
+
+	/* server side gets its own copy of config, buffers and module */
+	srv->env=&env;
+	srv->cfg=*cfg;
+	srv->mod=*cfg->current_mod;
+	srv->cfg.current_mod=&srv->mod;
+	srv->cfg.opts.server=1;
+	srv->cfg.opts.client=0;
+	srv->cfg.opts.quiet=1;
+	srv->cfg.opts.ftrace=0;
+	srv->cfg.opts.dumpfile=NULL;
+	srv->cfg.opts.opt_mod=server_args;
+	srv->cfg.opts.opt_qdisc=server_qdisc;
+	srv->cfg.stat=NULL;
+	srv->cfg.dump=NULL;
+	srv->cfg.sweep.points=NULL;
+	allocate_buffers(&srv->cfg);
+
+	if(selftest_start_server(srv)) {
+		cleanup_cfg(&srv->cfg);
+		goto out;
+	}
+
+	if(env.ep[SELFTEST_CLIENT].netns>=0 &&
+		setns(env.ep[SELFTEST_CLIENT].netns, CLONE_NEWNET)) {
+		perror("failed to switch network namespace");
+		selftest_stop_server(srv);
+		goto out;
+	}
+
+	cfg->opts.opt_mod=client_args;
+	cfg->opts.opt_qdisc=client_qdisc;
+	cfg->opts.opt_irq=client_irq;
+	cfg->opts.opt_load=client_load;
+	ret=run_cyclicping(cfg);
+
+	selftest_stop_server(srv);
+
+out:
+	selftest_cleanup_env(&env);
+	free(server_args);
+	free(client_args);
+	free(server_qdisc);
+	free(client_qdisc);
+	free(client_irq);
+	free(client_load);
+	free(srv);
+
+	return ret;
+}
@@ -0,0 +1,69 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __SELFTEST_H__
+#define __SELFTEST_H__
+
+#include <pthread.h>
+
+/* names and addresses of the veth environment */
+#define SELFTEST_VETH_SERVER	"cpst0"
+#define SELFTEST_VETH_CLIENT	"cpst1"
+#define SELFTEST_ADDR_SERVER	"10.203.0.1"
+#define SELFTEST_ADDR_CLIENT	"10.203.0.2"
+#define SELFTEST_PREFIX		24
+/* tx and rx queues of the veth pair if a qdisc is set up */
+#define SELFTEST_QUEUES		4
+
+enum selftest_side {
+	SELFTEST_SERVER=0,
+	SELFTEST_CLIENT,
+};
+
+/* values substituted into the module arguments of one side */
+struct selftest_endpoint {
+	char iface[16];
+	char mac[18];
+	char addr[16];
+	char device[64];
+	int netns;
+};
+
+struct selftest_env {
+	struct selftest_endpoint ep[SELFTEST_CLIENT+1];
+	int orig_netns;
+	int pty;
+	int queues;
+};
+
+struct selftest_server {
+	struct cyclicping_cfg cfg;
+	struct cyclicping_module mod;
+	struct selftest_env *env;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int ready;
+	int ret;
+	int abort_fd;
+};
+
+int run_selftest(struct cyclicping_cfg *cfg);
+
+#endif
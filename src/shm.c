@@ -0,0 +1,393 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cyclicping.h>
+#include <opts.h>
+#include <stats.h>
+#include <proto.h>
+#include <futex.h>
+#include <shm.h>
+
+extern int run;
+extern int abort_fd;
+
+/**
+ * Get message slot of a ring.
+ *
+ * \param scfg Shm module config.
+ * \param dir Ring.
+ * \param idx Ring index.
+ * \return Pointer to the slot.
+ */
+static char *shm_slot(struct shm_cfg *scfg, enum shm_dir dir, uint32_t idx)
+{
+	return (char*)(scfg->seg+1)+
+		((size_t)dir*SHM_RING_SLOTS+idx%SHM_RING_SLOTS)*scfg->slot_size;
+}
+
+/**
+ * Get slot the producer writes next.
+ *
+ * \param scfg Shm module config.
+ * \param dir Ring.
+ * \return Pointer to the slot or NULL if the ring is full.
+ */
+static char *shm_produce_slot(struct shm_cfg *scfg, enum shm_dir dir)
+{
+	struct shm_ring *ring=&scfg->seg->ring[dir];
+	uint32_t tail=ring->tail;
+
+	if(tail-__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)>=
+		SHM_RING_SLOTS)
+		return NULL;
+
+	return shm_slot(scfg, dir, tail);
+}
+
+/**
+ * Publish the slot written last and wake the consumer if it sleeps.
+ *
+ * \param scfg Shm module config.
+ * \param dir Ring.
+ */
+static void shm_produce(struct shm_cfg *scfg, enum shm_dir dir)
+{
+	struct shm_ring *ring=&scfg->seg->ring[dir];
+
+	__atomic_store_n(&ring->tail, ring->tail+1, __ATOMIC_SEQ_CST);
+
+	if(__atomic_load_n(&ring->waiters, __ATOMIC_SEQ_CST))
+		futex_wake(&ring->tail, 1);
+}
+
+/**
+ * Release the slot read last back to the producer.
+ *
+ * \param scfg Shm module config.
+ * \param dir Ring.
+ */
+static void shm_consume(struct shm_cfg *scfg, enum shm_dir dir)
+{
+	struct shm_ring *ring=&scfg->seg->ring[dir];
+
+	__atomic_store_n(&ring->head, ring->head+1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Wait for a message on a ring. Depending on the wait mode the consumer
+ * spins on the tail, sleeps on it as futex or spins for SHM_SPIN_NS before
+ * going to sleep.
+ *
+ * \param scfg Shm module config.
+ * \param dir Ring.
+ * \param timeout Timeout in ms, -1 to wait forever.
+ * \return Pointer to the message slot, NULL on timeout or abort.
+ */
+static char *shm_wait(struct shm_cfg *scfg, enum shm_dir dir, int timeout)
+{
+	struct shm_ring *ring=&scfg->seg->ring[dir];
+	uint32_t head=ring->head;
+	struct timespec now, rel;
+	uint64_t tnow, tend, tspin;
+
+	if(__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)!=head)
+		return shm_slot(scfg, dir, head);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	tnow=TSPEC_TO_NSEC((&now));
+	tend=tnow+(uint64_t)timeout*1000000;
+	tspin=tnow+SHM_SPIN_NS;
+
+	while(run) {
+		if(__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)!=head)
+			return shm_slot(scfg, dir, head);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		tnow=TSPEC_TO_NSEC((&now));
+		if(timeout>=0 && tnow>=tend)
+			return NULL;
+
+		if(scfg->wait_mode==SHM_WAIT_SPIN ||
+			(scfg->wait_mode==SHM_WAIT_HYBRID && tnow<tspin)) {
+			cpu_relax();
+			continue;
+		}
+
+		/* announce that we sleep, the producer checks this after
+		 * publishing the tail */
+		__atomic_store_n(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST)==head) {
+			if(timeout>=0) {
+				rel.tv_sec=(tend-tnow)/NSEC_PER_SEC;
+				rel.tv_nsec=(tend-tnow)%NSEC_PER_SEC;
+				futex_wait(&ring->tail, head, &rel);
+			} else {
+				futex_wait(&ring->tail, head, NULL);
+			}
+		}
+		__atomic_store_n(&ring->waiters, 0, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+/**
+ * Init shm module. Parse module args. The server creates and initializes
+ * the shared memory segment, the client attaches to it.
+ *
+ * \param cfg Cyclicping config data.
+ * \param argv Interface module arguments.
+ * \param argc Interface module count.
+ * \return 0 on success.
+ */
+int shm_init(struct cyclicping_cfg *cfg, char **argv, int argc)
+{
+	struct shm_cfg *scfg;
+	struct stat st;
+	int fd;
+
+	scfg=(struct shm_cfg*)calloc(1, sizeof(struct shm_cfg));
+	if(scfg==NULL) {
+		perror("failed to allocate memory for shm cfg");
+		return 1;
+	}
+
+	cfg->current_mod->modcfg=scfg;
+	scfg->wait_mode=SHM_WAIT_HYBRID;
+
+	if(argc>=2) {
+		if(strcmp(argv[1], "spin")==0) {
+			scfg->wait_mode=SHM_WAIT_SPIN;
+		} else if(strcmp(argv[1], "futex")==0) {
+			scfg->wait_mode=SHM_WAIT_FUTEX;
+		} else if(strcmp(argv[1], "hybrid")==0) {
+			scfg->wait_mode=SHM_WAIT_HYBRID;
+		} else {
+			fprintf(stderr, "unknown shm wait mode %s\n", argv[1]);
+			return 1;
+		}
+	}
+
+	snprintf(scfg->name, sizeof(scfg->name), "/%s",
+		argc>=3?argv[2]:SHM_DEFAULT_NAME);
+
+	/* every message starts on its own cache line */
+	scfg->slot_size=(cfg->opts.length+SHM_CACHE_LINE-1)&
+		~(SHM_CACHE_LINE-1);
+	scfg->seg_len=sizeof(struct shm_segment)+
+		2*SHM_RING_SLOTS*(size_t)scfg->slot_size;
+
+	if(cfg->opts.server) {
+		fd=shm_open(scfg->name, O_RDWR|O_CREAT|O_TRUNC, 0600);
+		if(fd<0) {
+			perror("failed to create shared memory");
+			return 1;
+		}
+		if(ftruncate(fd, scfg->seg_len)<0) {
+			perror("failed to size shared memory");
+			close(fd);
+			return 1;
+		}
+	} else {
+		fd=shm_open(scfg->name, O_RDWR, 0);
+		if(fd<0) {
+			perror("failed to open shared memory, server running?");
+			return 1;
+		}
+		if(fstat(fd, &st)<0 || st.st_size!=scfg->seg_len) {
+			fprintf(stderr, "shared memory size mismatch, check "
+				"packet length\n");
+			close(fd);
+			return 1;
+		}
+	}
+
+	scfg->seg=mmap(NULL, scfg->seg_len, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, fd, 0);
+	close(fd);
+	if(scfg->seg==MAP_FAILED) {
+		scfg->seg=NULL;
+		perror("failed to map shared memory");
+		return 1;
+	}
+
+	if(cfg->opts.server) {
+		scfg->seg->slot_size=scfg->slot_size;
+		__atomic_store_n(&scfg->seg->magic, SHM_MAGIC,
+			__ATOMIC_RELEASE);
+	} else {
+		if(__atomic_load_n(&scfg->seg->magic, __ATOMIC_ACQUIRE)!=
+			SHM_MAGIC || scfg->seg->slot_size!=scfg->slot_size) {
+			fprintf(stderr, "shared memory not initialized\n");
+			return 1;
+		}
+
+		/* drop replies a previous client left behind */
+		__atomic_store_n(&scfg->seg->ring[SHM_REPLY].head,
+			__atomic_load_n(&scfg->seg->ring[SHM_REPLY].tail,
+				__ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	}
+
+	hdr_init(cfg->send_packet, cfg->opts.length);
+
+	return 0;
+}
+
+/**
+ * Shm client.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+int shm_client(struct cyclicping_cfg *cfg)
+{
+	struct shm_cfg *scfg=cfg->current_mod->modcfg;
+	struct timespec tsend, trecv;
+	char *msg;
+
+	msg=shm_produce_slot(scfg, SHM_REQUEST);
+	if(msg==NULL) {
+		fprintf(stderr, "shm client request ring full\n");
+		return 1;
+	}
+	memcpy(msg, cfg->send_packet, cfg->opts.length);
+
+	/* take timestamp and copy it to send packet */
+	hdr_stamp_request(msg, cfg->seq, cfg->opts.clock, &tsend);
+
+	shm_produce(scfg, SHM_REQUEST);
+
+	/* replies to requests of a previous client, which the server was
+	 * still working on when this one attached, are skipped, as is
+	 * anything else that does not answer the current request */
+	while(1) {
+		msg=shm_wait(scfg, SHM_REPLY, 1000);
+		if(msg==NULL) {
+			if(!run)
+				return 0;
+			fprintf(stderr, "shm client timeout receiving "
+				"message\n");
+			return 1;
+		}
+		clock_gettime(cfg->opts.clock, &trecv);
+
+		if(!hdr_check(msg, cfg->opts.length) &&
+			match_reply(cfg, hdr_get_seq(msg))==REPLY_CURRENT)
+			break;
+
+		shm_consume(scfg, SHM_REPLY);
+	}
+
+	/* add packet time to statistics */
+	if(add_packet_stats(cfg, &tsend, msg, &trecv)) {
+		shm_consume(scfg, SHM_REPLY);
+		return 1;
+	}
+
+	shm_consume(scfg, SHM_REPLY);
+
+	cfg->seq++;
+
+	/* wait until next inverval */
+	return client_wait(cfg, tsend);
+}
+
+/**
+ * Shm server.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+int shm_server(struct cyclicping_cfg *cfg)
+{
+	struct shm_cfg *scfg=cfg->current_mod->modcfg;
+	struct timespec trecv;
+	char *msg, *reply;
+
+	/* wait for message */
+	msg=shm_wait(scfg, SHM_REQUEST, -1);
+	if(msg==NULL)
+		return run?1:0;
+
+	clock_gettime(cfg->opts.clock, &trecv);
+
+	if(hdr_check(msg, cfg->opts.length)) {
+		shm_consume(scfg, SHM_REQUEST);
+		return 0;
+	}
+
+	reply=shm_produce_slot(scfg, SHM_REPLY);
+	if(reply==NULL) {
+		/* client is gone, drop request */
+		shm_consume(scfg, SHM_REQUEST);
+		return 0;
+	}
+	memcpy(reply, msg, cfg->opts.length);
+	shm_consume(scfg, SHM_REQUEST);
+
+	/* copy timestamps to reply */
+	hdr_stamp_reply(reply, cfg->opts.clock, &trecv);
+
+	shm_produce(scfg, SHM_REPLY);
+
+	return 0;
+}
+
+/**
+ * Clean up shm module ressources.
+ *
+ * \param cfg Cyclicping config data.
+ */
+void shm_deinit(struct cyclicping_cfg *cfg)
+{
+	struct shm_cfg *scfg=cfg->current_mod->modcfg;
+
+	if(scfg->seg)
+		munmap(scfg->seg, scfg->seg_len);
+
+	if(cfg->opts.server)
+		shm_unlink(scfg->name);
+
+	free(scfg);
+}
+
+/**
+ * Ouput shm interface module usage.
+ */
+void shm_usage(void)
+{
+	printf("  shm - Use a message ring in shared memory\n");
+	printf("    shm[:wait[:name]]   shm server and client\n");
+	printf("    wait is spin, futex or hybrid (default), name of the "
+		"segment defaults\n");
+	printf("    to %s\n", SHM_DEFAULT_NAME);
+}
@@ -0,0 +1,75 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __SHM_H__
+#define __SHM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHM_CACHE_LINE	64
+#define SHM_RING_SLOTS	16
+#define SHM_MAGIC	0x43505348U	/* "CPSH" */
+#define SHM_DEFAULT_NAME	"cyclicping"
+
+/* time the hybrid wait spins before going to sleep */
+#define SHM_SPIN_NS	50000
+
+enum shm_wait_mode {
+	SHM_WAIT_SPIN=0,
+	SHM_WAIT_FUTEX,
+	SHM_WAIT_HYBRID,
+};
+
+/* direction of the rings */
+enum shm_dir {
+	SHM_REQUEST=0,
+	SHM_REPLY,
+};
+
+/* Single producer single consumer ring. Producer and consumer owned indices
+ * are kept on separate cache lines. The tail doubles as futex word. */
+struct shm_ring {
+	uint32_t tail __attribute__((aligned(SHM_CACHE_LINE)));
+	uint32_t head __attribute__((aligned(SHM_CACHE_LINE)));
+	uint32_t waiters;
+} __attribute__((aligned(SHM_CACHE_LINE)));
+
+/* start of the shared memory segment, followed by the slots of both rings */
+struct shm_segment {
+	uint32_t magic;
+	uint32_t slot_size;
+	struct shm_ring ring[SHM_REPLY+1];
+} __attribute__((aligned(SHM_CACHE_LINE)));
+
+struct shm_cfg {
+	char name[64];
+	enum shm_wait_mode wait_mode;
+	struct shm_segment *seg;
+	size_t seg_len;
+	uint32_t slot_size;
+};
+
+int shm_init(struct cyclicping_cfg *cfg, char **argv, int argc);
+int shm_client(struct cyclicping_cfg *cfg);
+int shm_server(struct cyclicping_cfg *cfg);
+void shm_deinit(struct cyclicping_cfg *cfg);
+void shm_usage(void);
+
+#endif
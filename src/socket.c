@@ -18,9 +18,14 @@
 ******************************************************************************/
 
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <linux/net_tstamp.h>
+
+#include <socket.h>
 
 int set_socket_tos(int sockfd, int tos)
 {
@@ -73,3 +78,116 @@ int set_socket_priority(int sockfd, int soprio)
 
 	return 0;
 }
+
+/**
+ * Attach a classic BPF filter to a socket. Frames not passing the filter
+ * are dropped by the kernel and never wake up the receiver. Frames queued
+ * before the filter took effect are discarded.
+ *
+ * \param sockfd Socket.
+ * \param code Filter program.
+ * \param len Number of filter instructions.
+ * \return 0 on success, else 1.
+ */
+int set_socket_filter(int sockfd, struct sock_filter *code, int len)
+{
+	struct sock_fprog prog;
+	char c;
+
+	prog.len=len;
+	prog.filter=code;
+
+	if(setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+		sizeof(prog))<0) {
+		perror("failed to attach socket filter");
+		return 1;
+	}
+
+	while(recv(sockfd, &c, sizeof(c), MSG_DONTWAIT)>=0);
+
+	return 0;
+}
+
+/**
+ * Enable launch times for frames sent on a socket. The etf qdisc holds
+ * them back until shortly before their launch time.
+ *
+ * \param sockfd Socket.
+ * \return 0 on success, else 1.
+ */
+int set_socket_txtime(int sockfd)
+{
+	struct sock_txtime txtime;
+
+	memset(&txtime, 0, sizeof(txtime));
+	txtime.clockid=CLOCK_TAI;
+
+	if(setsockopt(sockfd, SOL_SOCKET, SO_TXTIME, &txtime,
+		sizeof(txtime))<0) {
+		perror("failed to enable SO_TXTIME");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Add a launch time to a message.
+ *
+ * \param msg Message.
+ * \param control Control buffer of SOCKET_TXTIME_CONTROL bytes.
+ * \param offset Launch time ahead of now (ns).
+ */
+void socket_msg_txtime(struct msghdr *msg, char *control, uint64_t offset)
+{
+	struct cmsghdr *cmsg;
+	struct timespec now;
+	uint64_t txtime;
+
+	clock_gettime(CLOCK_TAI, &now);
+	txtime=(uint64_t)now.tv_sec*1000000000+now.tv_nsec+offset;
+
+	memset(control, 0, SOCKET_TXTIME_CONTROL);
+	msg->msg_control=control;
+	msg->msg_controllen=SOCKET_TXTIME_CONTROL;
+
+	cmsg=CMSG_FIRSTHDR(msg);
+	cmsg->cmsg_level=SOL_SOCKET;
+	cmsg->cmsg_type=SCM_TXTIME;
+	cmsg->cmsg_len=CMSG_LEN(sizeof(txtime));
+	memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+}
+
+/**
+ * Send a datagram with a launch time.
+ *
+ * \param sockfd Socket.
+ * \param buf Data.
+ * \param len Data length.
+ * \param addr Destination address.
+ * \param addrlen Address length.
+ * \param offset Launch time ahead of now (ns), 0 sends right away.
+ * \return Bytes sent or -1 on error.
+ */
+ssize_t sendto_txtime(int sockfd, const void *buf, size_t len,
+	const struct sockaddr *addr, socklen_t addrlen, uint64_t offset)
+{
+	char control[SOCKET_TXTIME_CONTROL];
+	struct msghdr msg;
+	struct iovec iov;
+
+	if(!offset)
+		return sendto(sockfd, buf, len, 0, addr, addrlen);
+
+	iov.iov_base=(void*)buf;
+	iov.iov_len=len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name=(void*)addr;
+	msg.msg_namelen=addrlen;
+	msg.msg_iov=&iov;
+	msg.msg_iovlen=1;
+	socket_msg_txtime(&msg, control, offset);
+
+	return sendmsg(sockfd, &msg, 0);
+}
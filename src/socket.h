@@ -20,7 +20,19 @@
 #ifndef __SOCKET_H__
 #define __SOCKET_H__
 
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+/* control buffer size for a launch time */
+#define SOCKET_TXTIME_CONTROL	CMSG_SPACE(sizeof(uint64_t))
+
 int set_socket_tos(int sockfd, int tos);
 int set_socket_priority(int sockfd, int soprio);
+int set_socket_filter(int sockfd, struct sock_filter *code, int len);
+int set_socket_txtime(int sockfd);
+void socket_msg_txtime(struct msghdr *msg, char *control, uint64_t offset);
+ssize_t sendto_txtime(int sockfd, const void *buf, size_t len,
+	const struct sockaddr *addr, socklen_t addrlen, uint64_t offset);
 
 #endif
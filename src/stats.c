@@ -25,51 +25,92 @@
 #include <sys/utsname.h>
 
 #include <cyclicping.h>
+#include <proto.h>
 #include <ftrace.h>
 
+const char *stat_names[STAT_ALL+1]={
+	[STAT_SEND]="send",
+	[STAT_RECV]="recv",
+	[STAT_SERVER]="server",
+	[STAT_FIRST]="first",
+	[STAT_FRAME]="frame",
+	[STAT_STACK]="stack",
+	[STAT_PHASE]="phase",
+	[STAT_ALL]="all",
+};
+
 /**
- * Convert serialized timespec struct from buffer back.
+ * Select the statistics which will be collected and reset min values.
  *
- * \param buffer Input buffer for conversion.
- * \param tspec Resulting time.
+ * \param cfg Cyclicping config data.
  */
-void buffer2tspec(const char *buffer, struct timespec *tspec)
+void init_stats(struct cyclicping_cfg *cfg)
 {
-	uint64_t cp[2];
+	int i;
+
+	for(i=0; i<cfg->nstats; i++) {
+		cfg->stat[i].min=UINT32_MAX;
+	}
+
+	cfg->stat[STAT_ALL].active=1;
+
+	/* time until the first byte of the reply arrived and from the
+	 * first to the last byte, for byte stream interfaces */
+	cfg->stat[STAT_FIRST].active=cfg->frame_timing;
+	cfg->stat[STAT_FRAME].active=cfg->frame_timing;
+
+	/* round trip time without the time the request and the reply take
+	 * on the wire */
+	cfg->stat[STAT_STACK].active=cfg->wire_time>0;
+
+	/* send time within the taprio gate cycle */
+	cfg->stat[STAT_PHASE].active=cfg->qdisc.cycle_time>0;
+
+	/* in fan-out mode "all" is the time until the last responder
+	 * replied, followed by the round trip time of each responder */
+	if(cfg->responders) {
+		for(i=0; i<cfg->responders; i++)
+			cfg->stat[STAT_RESPONDER(i)].active=1;
+		return;
+	}
 
-	cp[0]=*(uint64_t*)(buffer);
-	cp[1]=*(uint64_t*)(buffer+sizeof(uint64_t));
+	/* plain echo peers don't put time stamps into the reply */
+	if(cfg->echo_only)
+		return;
 
-	tspec->tv_sec=(time_t)cp[0];
-	tspec->tv_nsec=(long)cp[1];
+	cfg->stat[STAT_SERVER].active=1;
+	cfg->stat[STAT_SEND].active=cfg->opts.two_way;
+	cfg->stat[STAT_RECV].active=cfg->opts.two_way;
 }
 
 /**
- * Serialize timespec to buffer.
+ * Get name of a statistic.
  *
- * \param tspec Timespec to convert.
- * \param buffer Result is stored here.
+ * \param type Type of statistic.
+ * \return Name, only valid until the next call for responder statistics.
  */
-void tspec2buffer(const struct timespec *tspec, char *buffer)
+const char *stat_name(int type)
 {
-	uint64_t cp[2];
+	static char name[16];
+
+	if(type<=STAT_ALL)
+		return stat_names[type];
 
-	cp[0]=(uint64_t)tspec->tv_sec;
-	cp[1]=(uint64_t)tspec->tv_nsec;
+	snprintf(name, sizeof(name), "resp%d", type-STAT_RESPONDER(0));
 
-	memcpy(buffer, &cp, 2*sizeof(uint64_t));
+	return name;
 }
 
 /**
  * Add packet time data to statistics.
  *
  * \param cfg Cyclicping config data.
- * \param type Type of statistic (send, recv, all).
+ * \param type Type of statistic (send, recv, all, responder).
  * \param start Start time.
  * \param end End time.
  * \return 0 on success, else 1.
  */
-int add_stats(struct cyclicping_cfg *cfg, enum stat_type type,
+int add_stats(struct cyclicping_cfg *cfg, int type,
 	const struct timespec *start, const struct timespec *end)
 {
 	int64_t ndelta;
@@ -77,8 +118,13 @@ int add_stats(struct cyclicping_cfg *cfg, enum stat_type type,
 	/* calculate delta in ns */
 	ndelta=TSPEC_TO_NSEC(end)-TSPEC_TO_NSEC(start);
 
-	/* sanity check delta value */
-	if(ndelta<=0 || ndelta>NSEC_PER_SEC) {
+	/* sanity check delta value, the server might be fast enough to
+	 * process a packet within the clock resolution, a frame might
+	 * arrive at once */
+	if(ndelta<0 || (ndelta==0 && type!=STAT_SERVER &&
+		type!=STAT_FRAME && type!=STAT_STACK &&
+		type!=STAT_PHASE) ||
+		ndelta>NSEC_PER_SEC) {
 		if(ndelta<=0)
 			fprintf(stderr, "packet receive time equal or before "
 				"transmit time\n");
@@ -86,7 +132,7 @@ int add_stats(struct cyclicping_cfg *cfg, enum stat_type type,
 		if(ndelta>NSEC_PER_SEC)
 			fprintf(stderr, "packet round trip time to large\n");
 
-		if(type!=STAT_ALL) {
+		if(type==STAT_SEND || type==STAT_RECV) {
 			fprintf(stderr, "check time synchronization between "
 				"client and server\n");
 		}
@@ -114,6 +160,8 @@ int add_stats(struct cyclicping_cfg *cfg, enum stat_type type,
 			cfg->stat[type].histogram_data[ndelta]++;
 	}
 
+	cfg->stat[type].act=ndelta;
+
 	/* new max or min? */
 	if(ndelta<cfg->stat[type].min)
 		cfg->stat[type].min=ndelta;
@@ -122,7 +170,7 @@ int add_stats(struct cyclicping_cfg *cfg, enum stat_type type,
 
 	/* store to dump space if requested */
 	if(cfg->dump)
-		cfg->dump[cfg->stat[type].cnt].time[type]=ndelta;
+		cfg->dump[cfg->stat[type].cnt*cfg->nstats+type]=ndelta;
 
 	cfg->stat[type].cnt++;
 	cfg->stat[type].avg+=(double)ndelta;
@@ -130,51 +178,434 @@ int add_stats(struct cyclicping_cfg *cfg, enum stat_type type,
 	return 0;
 }
 
+/**
+ * Add the round trip time without the wire time. The wire time is a
+ * theoretical value, a shorter round trip time (e.g. clock resolution)
+ * counts as zero.
+ *
+ * \param cfg Cyclicping config data.
+ * \param send Client send timestamp.
+ * \param recv Client receive timestamp.
+ * \return 0 on success, else 1.
+ */
+static int add_stack_stats(struct cyclicping_cfg *cfg,
+	const struct timespec *send, const struct timespec *recv)
+{
+	struct timespec end=*send;
+	uint64_t rtt;
+
+	if(!cfg->wire_time)
+		return 0;
+
+	rtt=TSPEC_TO_NSEC(recv)-TSPEC_TO_NSEC(send);
+	if(rtt>cfg->wire_time)
+		rtt-=cfg->wire_time;
+	else
+		rtt=0;
+
+	end.tv_sec+=rtt/NSEC_PER_SEC;
+	end.tv_nsec+=rtt%NSEC_PER_SEC;
+	if(end.tv_nsec>=NSEC_PER_SEC) {
+		end.tv_sec++;
+		end.tv_nsec-=NSEC_PER_SEC;
+	}
+
+	return add_stats(cfg, STAT_STACK, send, &end);
+}
+
+/**
+ * Add the time the request was sent after the start of the taprio gate
+ * cycle.
+ *
+ * \param cfg Cyclicping config data.
+ * \param send Client send timestamp.
+ * \return 0 on success, else 1.
+ */
+static int add_phase_stats(struct cyclicping_cfg *cfg,
+	const struct timespec *send)
+{
+	struct timespec start;
+	uint64_t phase;
+
+	if(!cfg->qdisc.cycle_time)
+		return 0;
+
+	phase=qdisc_gate_phase(cfg, send);
+	start=*send;
+	start.tv_sec-=phase/NSEC_PER_SEC;
+	start.tv_nsec-=phase%NSEC_PER_SEC;
+	if(start.tv_nsec<0) {
+		start.tv_sec--;
+		start.tv_nsec+=NSEC_PER_SEC;
+	}
+
+	return add_stats(cfg, STAT_PHASE, &start, send);
+}
+
+/**
+ * Update the smoothed round trip time and its variation the adaptive reply
+ * timeout is based on (as TCP does, RFC 6298).
+ *
+ * \param cfg Cyclicping config data.
+ * \param send Client send timestamp.
+ * \param recv Client receive timestamp.
+ */
+static void update_rtt_estimate(struct cyclicping_cfg *cfg,
+	const struct timespec *send, const struct timespec *recv)
+{
+	struct seq_stats *s=&cfg->seqs;
+	double rtt=(double)(TSPEC_TO_NSEC(recv)-TSPEC_TO_NSEC(send));
+
+	if(s->srtt==0.0) {
+		s->srtt=rtt;
+		s->rttvar=rtt/2;
+		return;
+	}
+
+	s->rttvar=0.75*s->rttvar+0.25*fabs(s->srtt-rtt);
+	s->srtt=0.875*s->srtt+0.125*rtt;
+}
+
+/**
+ * Finish the outstanding request. The window slot of the next request
+ * still holds the state of a request SEQ_WINDOW back, clear it.
+ *
+ * \param cfg Cyclicping config data.
+ */
+static void seq_complete(struct cyclicping_cfg *cfg)
+{
+	struct seq_stats *s=&cfg->seqs;
+	uint32_t bit=(cfg->seq+1)%SEQ_WINDOW;
+
+	s->seen[bit/8]&=~(1<<(bit%8));
+	s->requests++;
+}
+
+/**
+ * Match the sequence number of a received reply against the outstanding
+ * request. A reply to an earlier request, which has been counted as lost
+ * on its timeout, is counted as late instead. It is reordered if a reply
+ * to a later request arrived before.
+ *
+ * \param cfg Cyclicping config data.
+ * \param seq Sequence number of the reply.
+ * \return REPLY_CURRENT for the outstanding request, REPLY_LATE,
+ * REPLY_DUPLICATE or REPLY_INVALID for a sequence number never sent.
+ */
+int match_reply(struct cyclicping_cfg *cfg, uint32_t seq)
+{
+	struct seq_stats *s=&cfg->seqs;
+	uint32_t age=cfg->seq-seq;
+	uint32_t bit=seq%SEQ_WINDOW;
+
+	/* not sent (yet), e.g. a reply to a previous run */
+	if(age>s->requests)
+		return REPLY_INVALID;
+
+	/* older replies are too far back to tell duplicates apart */
+	if(age<SEQ_WINDOW) {
+		if(s->seen[bit/8] & 1<<(bit%8)) {
+			s->duplicate++;
+			return REPLY_DUPLICATE;
+		}
+		s->seen[bit/8]|=1<<(bit%8);
+	}
+
+	if(age==0) {
+		s->highest=seq;
+		seq_complete(cfg);
+		return REPLY_CURRENT;
+	}
+
+	s->late++;
+	if(s->lost)
+		s->lost--;
+	if((int32_t)(s->highest-seq)>0)
+		s->reordered++;
+
+	return REPLY_LATE;
+}
+
+/**
+ * Count the outstanding request as lost, after its reply timed out.
+ *
+ * \param cfg Cyclicping config data.
+ */
+void reply_lost(struct cyclicping_cfg *cfg)
+{
+	cfg->seqs.lost++;
+	seq_complete(cfg);
+}
+
+/**
+ * Finish the outstanding fan-out request. Every responder counts as a
+ * request of its own, those that didn't reply in time as lost.
+ *
+ * \param cfg Cyclicping config data.
+ * \param replies Number of responders that replied.
+ */
+void fanout_complete(struct cyclicping_cfg *cfg, int replies)
+{
+	struct seq_stats *s=&cfg->seqs;
+	uint32_t bit=cfg->seq%SEQ_WINDOW;
+	int i;
+
+	if(replies)
+		s->highest=cfg->seq;
+
+	/* with all replies in, any further one is a duplicate. Otherwise
+	 * a reply to this request that comes later is taken as the late
+	 * reply of a missing responder. */
+	if(replies==cfg->responders)
+		s->seen[bit/8]|=1<<(bit%8);
+
+	for(i=0; i<replies; i++)
+		seq_complete(cfg);
+	for(i=replies; i<cfg->responders; i++)
+		reply_lost(cfg);
+}
+
+/**
+ * Get the time left to wait for the reply to the outstanding request. The
+ * timeout is fixed (-W) or follows the observed round trip time.
+ *
+ * \param cfg Cyclicping config data.
+ * \param send Client send timestamp.
+ * \param left Time left gets stored here.
+ * \return 0 if there is time left, 1 if the request timed out.
+ */
+int reply_timeout(struct cyclicping_cfg *cfg, const struct timespec *send,
+	struct timespec *left)
+{
+	struct seq_stats *s=&cfg->seqs;
+	struct timespec now;
+	uint64_t timeout, elapsed;
+
+	if(cfg->opts.timeout_auto && s->srtt>0.0) {
+		timeout=(uint64_t)(s->srtt+4*s->rttvar);
+		if(timeout<REPLY_TIMEOUT_MIN)
+			timeout=REPLY_TIMEOUT_MIN;
+		if(timeout>REPLY_TIMEOUT)
+			timeout=REPLY_TIMEOUT;
+	} else if(cfg->opts.timeout) {
+		timeout=(uint64_t)cfg->opts.timeout*1000;
+	} else {
+		timeout=REPLY_TIMEOUT;
+	}
+
+	clock_gettime(cfg->opts.clock, &now);
+	elapsed=TSPEC_TO_NSEC((&now))-TSPEC_TO_NSEC(send);
+	if(elapsed>=timeout)
+		return 1;
+
+	left->tv_sec=(timeout-elapsed)/NSEC_PER_SEC;
+	left->tv_nsec=(timeout-elapsed)%NSEC_PER_SEC;
+
+	return 0;
+}
+
+/**
+ * Add all statistics of a received reply. The server time stamps are taken
+ * from the wire header of the payload.
+ *
+ * \param cfg Cyclicping config data.
+ * \param send Client send timestamp.
+ * \param payload Received payload starting with the wire header.
+ * \param recv Client receive timestamp.
+ * \return 0 on success, else 1.
+ */
+int add_packet_stats(struct cyclicping_cfg *cfg, const struct timespec *send,
+	const char *payload, const struct timespec *recv)
+{
+	struct timespec server_rx, server_tx;
+	int have_server;
+
+	/* add packet time to statistics */
+	if(add_stats(cfg, STAT_ALL, send, recv))
+		return 1;
+
+	if(add_stack_stats(cfg, send, recv))
+		return 1;
+
+	if(add_phase_stats(cfg, send))
+		return 1;
+
+	update_rtt_estimate(cfg, send, recv);
+	perf_packet(cfg, cfg->stat[STAT_ALL].act);
+
+	have_server=!hdr_get_time(payload, CP_SERVER_RX, &server_rx) &&
+		!hdr_get_time(payload, CP_SERVER_TX, &server_tx);
+
+	if(have_server) {
+		if(add_stats(cfg, STAT_SERVER, &server_rx, &server_tx))
+			return 1;
+
+		if(cfg->opts.two_way) {
+			if(add_stats(cfg, STAT_SEND, send, &server_rx))
+				return 1;
+			if(add_stats(cfg, STAT_RECV, &server_tx, recv))
+				return 1;
+		}
+	}
+
+	print_stats(cfg, send, have_server?&server_rx:NULL,
+		have_server?&server_tx:NULL, recv);
+
+	return 0;
+}
+
+/**
+ * Add statistics of a fan-out cycle. Every responder gets its own round
+ * trip time, the time until the last reply arrived is the cycle time. A
+ * cycle some responders didn't reply to only adds to the statistics of
+ * the others.
+ *
+ * \param cfg Cyclicping config data.
+ * \param send Client send timestamp.
+ * \param recv Client receive timestamps, one per responder, zero for a
+ *             missing reply.
+ * \return 0 on success, else 1.
+ */
+int add_fanout_stats(struct cyclicping_cfg *cfg, const struct timespec *send,
+	const struct timespec *recv)
+{
+	const struct timespec *last=NULL;
+	int i, missing=0;
+
+	for(i=0; i<cfg->responders; i++) {
+		if(!recv[i].tv_sec && !recv[i].tv_nsec) {
+			missing++;
+			continue;
+		}
+
+		if(add_stats(cfg, STAT_RESPONDER(i), send, &recv[i]))
+			return 1;
+
+		if(last==NULL || TSPEC_TO_NSEC((&recv[i]))>TSPEC_TO_NSEC(last))
+			last=&recv[i];
+	}
+
+	if(missing)
+		return 0;
+
+	if(add_stats(cfg, STAT_ALL, send, last))
+		return 1;
+
+	if(add_stack_stats(cfg, send, last))
+		return 1;
+
+	if(add_phase_stats(cfg, send))
+		return 1;
+
+	update_rtt_estimate(cfg, send, last);
+	perf_packet(cfg, cfg->stat[STAT_ALL].act);
+
+	print_stats(cfg, send, NULL, NULL, last);
+
+	return 0;
+}
+
 /**
  * Runtime statistic.
  *
  * \param cfg Cyclicping config data.
- * \param send Client Send timestamp.
- * \param server Server receive timestamp.
+ * \param send Client send timestamp.
+ * \param server_rx Server receive timestamp (or NULL).
+ * \param server_tx Server send timestamp (or NULL).
  * \param recv Client receive timestamp.
  */
-void print_stats(struct cyclicping_cfg *cfg,
-	const struct timespec *send, const struct timespec *server,
+void print_stats(struct cyclicping_cfg *cfg, const struct timespec *send,
+	const struct timespec *server_rx, const struct timespec *server_tx,
 	const struct timespec *recv)
 {
+	const struct timespec *from[STAT_ALL+1]={
+		[STAT_SEND]=send,
+		[STAT_RECV]=server_tx,
+		[STAT_SERVER]=server_rx,
+		[STAT_ALL]=send,
+	};
+	const struct timespec *to[STAT_ALL+1]={
+		[STAT_SEND]=server_rx,
+		[STAT_RECV]=recv,
+		[STAT_SERVER]=server_tx,
+		[STAT_ALL]=recv,
+	};
+	struct tstats *stat;
 	uint64_t tdelta;
+	char name[16];
+	int i, lines=0;
 
 	if(cfg->opts.quiet)
 		return;
 
+	stat=&cfg->stat[STAT_ALL];
 	tdelta=TSPEC_TO_NSEC(recv)-TSPEC_TO_NSEC(send);
 	tdelta/=cfg->opts.ms?1000000:1000;
 	printf("Cnt:%8" PRIu64 " (all)  Min:%8u Act:%10u Avg:%10u Max:%10u\n",
-		cfg->stat[STAT_ALL].cnt, cfg->stat[STAT_ALL].min,
-		(uint32_t)tdelta, (uint32_t)(cfg->stat[STAT_ALL].avg/
-		(double)cfg->stat[STAT_ALL].cnt), cfg->stat[STAT_ALL].max);
-
-	if(cfg->opts.two_way) {
-		tdelta=TSPEC_TO_NSEC(server)-TSPEC_TO_NSEC(send);
-		tdelta/=cfg->opts.ms?1000000:1000;
-		printf("             (send) Min:%8u Act:%10u Avg:%10u "
-			"Max:%10u\n", cfg->stat[STAT_SEND].min,
-			(uint32_t)tdelta, (uint32_t)(cfg->stat[STAT_SEND].avg/
-			(double)cfg->stat[STAT_SEND].cnt),
-			cfg->stat[STAT_SEND].max);
-
-		tdelta=TSPEC_TO_NSEC(recv)-TSPEC_TO_NSEC(server);
-		tdelta/=cfg->opts.ms?1000000:1000;
-		printf("             (recv) Min:%8u Act:%10u Avg:%10u "
-			"Max:%10u\n", cfg->stat[STAT_RECV].min,
-			(uint32_t)tdelta, (uint32_t)(cfg->stat[STAT_RECV].avg/
-			(double)cfg->stat[STAT_RECV].cnt),
-			cfg->stat[STAT_RECV].max);
-
-		printf("\033[%dA", 3);
-	} else {
-		printf("\033[%dA", 1);
+		stat->cnt, stat->min, (uint32_t)tdelta,
+		(uint32_t)(stat->avg/(double)stat->cnt), stat->max);
+	lines++;
+
+	for(i=0; i<STAT_ALL; i++) {
+		stat=&cfg->stat[i];
+
+		if(!stat->active)
+			continue;
+
+		if(from[i] && to[i]) {
+			tdelta=TSPEC_TO_NSEC(to[i])-TSPEC_TO_NSEC(from[i]);
+			tdelta/=cfg->opts.ms?1000000:1000;
+		} else {
+			tdelta=stat->act;
+		}
+
+		snprintf(name, sizeof(name), "(%s)", stat_names[i]);
+		printf("%19s Min:%8u Act:%10u Avg:%10u Max:%10u\n",
+			name, stat->min, (uint32_t)tdelta,
+			stat->cnt?(uint32_t)(stat->avg/(double)stat->cnt):0,
+			stat->max);
+		lines++;
+	}
+
+	for(i=STAT_RESPONDER(0); i<cfg->nstats; i++) {
+		stat=&cfg->stat[i];
+
+		snprintf(name, sizeof(name), "(%s)", stat_name(i));
+		printf("%19s Min:%8u Act:%10u Avg:%10u Max:%10u\n",
+			name, stat->min, stat->act,
+			stat->cnt?(uint32_t)(stat->avg/(double)stat->cnt):0,
+			stat->max);
+		lines++;
 	}
+
+	printf("%19s Lost:%7" PRIu64 " Late:%9" PRIu64 " Dup:%10" PRIu64
+		" Reord:%8" PRIu64 "\n", "(seq)", cfg->seqs.lost,
+		cfg->seqs.late, cfg->seqs.duplicate, cfg->seqs.reordered);
+	lines++;
+
+	printf("\033[%dA", lines);
+}
+
+/**
+ * Get the active statistics in output order. The overall round trip time
+ * always comes first.
+ *
+ * \param cfg Cyclicping config data.
+ * \param order Receives the statistic types.
+ * \return Number of active statistics.
+ */
+static int stat_order(struct cyclicping_cfg *cfg, int *order)
+{
+	int i, n=0;
+
+	order[n++]=STAT_ALL;
+
+	for(i=0; i<cfg->nstats; i++) {
+		if(i!=STAT_ALL && cfg->stat[i].active)
+			order[n++]=i;
+	}
+
+	return n;
 }
 
 /**
@@ -215,7 +646,8 @@ void print_histogram_header(struct cyclicping_cfg *cfg, int argc, char *argv[])
 {
 	struct cyclicping_opts *opts=&cfg->opts;
 	char tstr[26];
-	int i;
+	int i, n;
+	int order[cfg->nstats];
 	struct utsname uts;
 
 	uname (&uts);
@@ -233,31 +665,51 @@ void print_histogram_header(struct cyclicping_cfg *cfg, int argc, char *argv[])
 	tv_to_str(cfg->test_end, tstr);
 	printf("# end: %s\n", tstr);
 	printf("# interface: %s\n", cfg->current_mod->name);
+	if(opts->selftest)
+		printf("# self-test: %s\n", opts->selftest);
 	printf("# packet interval (us): %d\n", opts->interval);
 	printf("# packet length (bytes): %d\n", opts->length);
 	printf("# unit: %s\n", opts->ms?"ms":"us");
 	printf("# packet count: %" PRIu64 "\n", cfg->stat[STAT_ALL].cnt);
+	printf("# packets sent: %" PRIu64 "\n", cfg->seqs.requests);
+	printf("# lost packets: %" PRIu64 "\n", cfg->seqs.lost);
+	printf("# late packets: %" PRIu64 "\n", cfg->seqs.late);
+	printf("# duplicate packets: %" PRIu64 "\n", cfg->seqs.duplicate);
+	printf("# reordered packets: %" PRIu64 "\n", cfg->seqs.reordered);
 	printf("# two-way mode: %d\n", cfg->opts.two_way);
-	if(cfg->opts.two_way) {
-		printf("# minimum rtt: %d %d %d\n", cfg->stat[STAT_ALL].min,
-			cfg->stat[STAT_SEND].min, cfg->stat[STAT_RECV].min);
-		printf("# average rtt: %d %d %d\n",
-			(uint32_t)(cfg->stat[STAT_ALL].avg/
-				(double)cfg->stat[STAT_ALL].cnt),
-			(uint32_t)(cfg->stat[STAT_SEND].avg/
-				(double)cfg->stat[STAT_SEND].cnt),
-			(uint32_t)(cfg->stat[STAT_RECV].avg/
-				(double)cfg->stat[STAT_RECV].cnt));
-		printf("# maximum rtt: %d %d %d\n", cfg->stat[STAT_ALL].max,
-			cfg->stat[STAT_SEND].max, cfg->stat[STAT_RECV].max);
-	} else {
-		printf("# minimum rtt: %d\n", cfg->stat[STAT_ALL].min);
-		printf("# average rtt: %d\n",
-				(uint32_t)(cfg->stat[STAT_ALL].avg/
-				(double)cfg->stat[STAT_ALL].cnt));
-		printf("# maximum rtt: %d\n", cfg->stat[STAT_ALL].max);
+	if(cfg->responders)
+		printf("# responders: %d\n", cfg->responders);
+	if(cfg->wire_time)
+		printf("# wire time (ns): %" PRIu64 " (%s)\n", cfg->wire_time,
+			cfg->wire_info);
+	if(cfg->qdisc.mode)
+		printf("# qdisc: %s\n", cfg->qdisc.info);
+	if(cfg->irq.info[0])
+		printf("# irq: %s\n", cfg->irq.info);
+	if(cfg->preflight.info[0]) {
+		printf("# realtime host: %s\n", cfg->preflight.failed?"no":
+			"yes");
+		printf("# preflight: %s\n", cfg->preflight.info);
 	}
-	printf("\n");
+	if(cfg->load.info[0])
+		printf("# load: %s\n", cfg->load.info);
+	perf_print(cfg, stdout);
+
+	n=stat_order(cfg, order);
+	printf("# statistics:");
+	for(i=0; i<n; i++)
+		printf(" %s", stat_name(order[i]));
+	printf("\n# minimum rtt:");
+	for(i=0; i<n; i++)
+		printf(" %d", cfg->stat[order[i]].min);
+	printf("\n# average rtt:");
+	for(i=0; i<n; i++)
+		printf(" %d", (uint32_t)(cfg->stat[order[i]].avg/
+			(double)cfg->stat[order[i]].cnt));
+	printf("\n# maximum rtt:");
+	for(i=0; i<n; i++)
+		printf(" %d", cfg->stat[order[i]].max);
+	printf("\n\n");
 }
 
 /*
@@ -267,21 +719,22 @@ void print_histogram_header(struct cyclicping_cfg *cfg, int argc, char *argv[])
  */
 void print_histogram_data(struct cyclicping_cfg *cfg)
 {
-	int i;
+	int i, j, n;
+	int order[cfg->nstats];
 	struct cyclicping_opts *opts=&cfg->opts;
 
-	printf("#  rtt  number of packets (sum, send, recv)\n");
+	n=stat_order(cfg, order);
+
+	printf("#  rtt  number of packets (");
+	for(j=0; j<n; j++)
+		printf("%s%s", j?", ":"", j?stat_name(order[j]):"sum");
+	printf(")\n");
 
 	for(i=0; i<opts->histogram; i++) {
-		printf("% 6d: %6d", i,
-			cfg->stat[STAT_ALL].histogram_data[i]);
-		if(cfg->opts.two_way) {
-			printf(" %6d %6d\n",
-			cfg->stat[STAT_SEND].histogram_data[i],
-			cfg->stat[STAT_RECV].histogram_data[i]);
-		} else {
-			printf("\n");
-		}
+		printf("% 6d:", i);
+		for(j=0; j<n; j++)
+			printf(" %6d", cfg->stat[order[j]].histogram_data[i]);
+		printf("\n");
 	}
 }
 
@@ -307,6 +760,8 @@ void print_histogram(struct cyclicping_cfg *cfg, int argc, char *argv[]) {
 void print_gnuplot_histogram(struct cyclicping_cfg *cfg, int argc, char *argv[])
 {
 	char tstr[26];
+	int i, n;
+	int order[cfg->nstats];
 	uint64_t ymax=(uint64_t)pow(10.0f,
 		1+floor(log10((double)cfg->stat[STAT_ALL].cnt)));
 
@@ -321,14 +776,21 @@ void print_gnuplot_histogram(struct cyclicping_cfg *cfg, int argc, char *argv[])
 	tv_to_str(cfg->test_start, tstr);
 
 	printf("ymax=%" PRIu64 "\n", ymax);
+	n=stat_order(cfg, order);
 	printf("plotname1=\"%s Latency\"\n", cfg->current_mod->name);
-	printf("plotname2=\"%s Latency (send)\"\n", cfg->current_mod->name);
-	printf("plotname3=\"%s Latency (receive)\"\n", cfg->current_mod->name);
+	for(i=1; i<n; i++) {
+		printf("plotname%d=\"%s Latency (%s)\"\n", i+1,
+			cfg->current_mod->name, stat_name(order[i]));
+	}
 	printf("set title \"cyclicping latency plot - %s\"\n", tstr);
 	printf("set xlabel \"Latency (%s)\"\n", cfg->opts.ms?"ms":"us");
 	printf("set xrange [0:%d]\n", cfg->opts.histogram);
 	printf("%s", GNUPLOT_HEADER);
-	printf("%s", cfg->opts.two_way?GNUPLOT_MULTI_PLOT:GNUPLOT_SINGLE_PLOT);
+	printf("plot ");
+	for(i=0; i<n; i++) {
+		printf(GNUPLOT_PLOT, i+2, i+2, i+2, i+1);
+		printf("%s", i<n-1?", \\\n":"\n");
+	}
 	printf("pause -1\n");
 }
 
@@ -342,6 +804,8 @@ int write_dump(struct cyclicping_cfg *cfg)
 {
 	FILE *f;
 	uint64_t i;
+	int j, n;
+	int order[cfg->nstats];
 
 	f=fopen(cfg->opts.dumpfile, "w");
 	if(f==NULL) {
@@ -349,20 +813,27 @@ int write_dump(struct cyclicping_cfg *cfg)
 		return 1;
 	}
 
-	if(cfg->opts.two_way) {
-		for(i=0; i<cfg->stat[STAT_ALL].cnt; i++) {
-			fprintf(f, "%8" PRIu64 ", %8u, %8u, %8u\n", i,
-				cfg->dump[i].time[STAT_ALL],
-				cfg->dump[i].time[STAT_SEND],
-				cfg->dump[i].time[STAT_RECV]);
-		}
-	} else {
-		for(i=0; i<cfg->stat[STAT_ALL].cnt; i++) {
-			fprintf(f, "%8" PRIu64 ", %8u\n", i,
-				cfg->dump[i].time[STAT_ALL]);
-		}
+	n=stat_order(cfg, order);
+
+	for(i=0; i<cfg->stat[STAT_ALL].cnt; i++) {
+		fprintf(f, "%8" PRIu64, i);
+		for(j=0; j<n; j++)
+			fprintf(f, ", %8u",
+				cfg->dump[i*cfg->nstats+order[j]]);
+		fprintf(f, "\n");
 	}
 
+	fprintf(f, "# sent: %" PRIu64 ", lost: %" PRIu64 ", late: %" PRIu64
+		", duplicate: %" PRIu64 ", reordered: %" PRIu64 "\n",
+		cfg->seqs.requests, cfg->seqs.lost, cfg->seqs.late,
+		cfg->seqs.duplicate, cfg->seqs.reordered);
+	if(cfg->preflight.info[0])
+		fprintf(f, "# realtime host: %s, preflight: %s\n",
+			cfg->preflight.failed?"no":"yes", cfg->preflight.info);
+	if(cfg->load.info[0])
+		fprintf(f, "# load: %s\n", cfg->load.info);
+	perf_print_summary(cfg, f);
+
 	fclose(f);
 
 	return 0;
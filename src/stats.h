@@ -31,27 +31,73 @@ struct cyclicping_cfg;
 enum stat_type {
 	STAT_SEND=0,
 	STAT_RECV,
+	STAT_SERVER,
+	STAT_FIRST,
+	STAT_FRAME,
+	STAT_STACK,
+	STAT_PHASE,
 	STAT_ALL,
 };
 
+/* round trip time of a single responder in fan-out mode, these follow the
+ * fixed statistics */
+#define STAT_RESPONDER(x)	(STAT_ALL+1+(x))
+
+/* replies tracked for late and duplicate detection */
+#define SEQ_WINDOW		4096
+/* default reply timeout and limits of the adaptive timeout (ns) */
+#define REPLY_TIMEOUT		NSEC_PER_SEC
+#define REPLY_TIMEOUT_MIN	200000ULL
+
+/* classification of a received reply */
+enum reply_match {
+	REPLY_CURRENT=0,
+	REPLY_LATE,
+	REPLY_DUPLICATE,
+	REPLY_INVALID,
+};
+
+struct seq_stats {
+	uint64_t requests;
+	uint64_t lost;
+	uint64_t late;
+	uint64_t duplicate;
+	uint64_t reordered;
+	uint32_t highest;
+	uint8_t seen[SEQ_WINDOW/8];
+	/* smoothed round trip time and its variation (ns) for the adaptive
+	 * timeout */
+	double srtt;
+	double rttvar;
+};
+
 struct tstats {
+	char active;
 	uint32_t *histogram_data;
 	uint32_t min;
 	uint32_t max;
+	uint32_t act;
 	double avg;
 	uint64_t cnt;
 };
 
-struct pdump {
-	uint32_t time[STAT_ALL+1];
-};
+extern const char *stat_names[STAT_ALL+1];
 
-void buffer2tspec(const char *buffer, struct timespec *tspec);
-void tspec2buffer(const struct timespec *tspec, char *buffer);
-int add_stats(struct cyclicping_cfg *cfg, enum stat_type type,
+void init_stats(struct cyclicping_cfg *cfg);
+const char *stat_name(int type);
+int add_stats(struct cyclicping_cfg *cfg, int type,
 	const struct timespec *start, const struct timespec *end);
-void print_stats(struct cyclicping_cfg *cfg,
-	const struct timespec *send, const struct timespec *server,
+int add_packet_stats(struct cyclicping_cfg *cfg, const struct timespec *send,
+	const char *payload, const struct timespec *recv);
+int add_fanout_stats(struct cyclicping_cfg *cfg, const struct timespec *send,
+	const struct timespec *recv);
+int match_reply(struct cyclicping_cfg *cfg, uint32_t seq);
+void reply_lost(struct cyclicping_cfg *cfg);
+void fanout_complete(struct cyclicping_cfg *cfg, int replies);
+int reply_timeout(struct cyclicping_cfg *cfg, const struct timespec *send,
+	struct timespec *left);
+void print_stats(struct cyclicping_cfg *cfg, const struct timespec *send,
+	const struct timespec *server_rx, const struct timespec *server_tx,
 	const struct timespec *recv);
 void print_histogram(struct cyclicping_cfg *cfg, int argc, char *argv[]);
 void print_gnuplot_histogram(struct cyclicping_cfg *cfg,
@@ -76,15 +122,7 @@ set for [i=1:log10(ymax)] for [j=2:9] ytics add (\"\" log10(10**i*j) 1)\n\
 set for [j=1:9] ytics add (\"\" j/10. 1) # Add minor tics between 0 and 1\n\
 "
 
-#define GNUPLOT_SINGLE_PLOT "\
-plot $histogram using ($2 < 1 ? $2 : log10($2)+1) with boxes title plotname1\n\
-"
-
-#define GNUPLOT_MULTI_PLOT "\
-plot $histogram using ($2 < 1 ? $2 : log10($2)+1) with boxes title \
-plotname1, \\\n\
-$histogram using ($3 < 1 ? $3 : log10($3)+1) with boxes title plotname2, \\\n\
-$histogram using ($4 < 1 ? $4 : log10($4)+1) with boxes title plotname3 \n\
-"
+#define GNUPLOT_PLOT "\
+$histogram using ($%d < 1 ? $%d : log10($%d)+1) with boxes title plotname%d"
 
 #endif
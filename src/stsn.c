@@ -20,6 +20,7 @@
 * USA.
 ******************************************************************************/
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <time.h>
 #include <string.h>
@@ -27,10 +28,13 @@
 #include <signal.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <linux/if.h>
 #include <linux/if_ether.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
 
 #include <sys/select.h>
 
@@ -38,11 +42,353 @@
 #include <opts.h>
 #include <stats.h>
 #include <socket.h>
+#include <proto.h>
 #include <stsn.h>
+#include <wire.h>
 
 extern int run;
 extern int abort_fd;
 
+/**
+ * Parse comma separated stsn module flags.
+ *
+ * \param scfg STSN module config.
+ * \param arg Flags argument.
+ * \return 0 on success.
+ */
+static int stsn_parse_flags(struct stsn_cfg *scfg, char *arg)
+{
+	char *saveptr=NULL;
+	char *flag;
+	int ret;
+
+	for(flag=strtok_r(arg, ",", &saveptr); flag;
+		flag=strtok_r(NULL, ",", &saveptr)) {
+		if(strcmp(flag, "mmap")==0) {
+			scfg->use_mmap=1;
+		} else if(strcmp(flag, "bypass")==0) {
+			scfg->qdisc_bypass=1;
+		} else if(sscanf(flag, "stream=%u", &scfg->stream_id)==1) {
+			if(scfg->stream_id>STSN_MAX_STREAM) {
+				fprintf(stderr, "invalid stsn stream id\n");
+				return 1;
+			}
+		} else if((ret=vlan_parse_flag(&scfg->vlan, flag))) {
+			if(ret<0)
+				return 1;
+		} else {
+			fprintf(stderr, "unknown stsn flag %s\n", flag);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Set up PACKET_MMAP rx and tx rings. TPACKET_V2 is used, as TPACKET_V3
+ * only hands rx blocks to user space once they are full or their retire
+ * timer expired, which adds up to a millisecond to every cycle.
+ *
+ * \param scfg STSN module config.
+ * \param length Packet length.
+ * \return 0 on success.
+ */
+static int stsn_setup_rings(struct stsn_cfg *scfg, int length)
+{
+	struct tpacket_req req;
+	int version=TPACKET_V2;
+	unsigned int frame_size=TPACKET_ALIGNMENT;
+	unsigned int block_size=getpagesize();
+	size_t ring_size;
+
+	if(setsockopt(scfg->socket, SOL_PACKET, PACKET_VERSION, &version,
+		sizeof(version))<0) {
+		perror("failed to set packet version");
+		return 1;
+	}
+
+	/* frame header, room for the link layer header and the payload */
+	while(frame_size<TPACKET_ALIGN(TPACKET2_HDRLEN+ETH_HLEN)+length)
+		frame_size<<=1;
+	if(block_size<frame_size)
+		block_size=frame_size;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size=block_size;
+	req.tp_frame_size=frame_size;
+	req.tp_frame_nr=STSN_RING_FRAMES;
+	req.tp_block_nr=STSN_RING_FRAMES*frame_size/block_size;
+	if(req.tp_block_nr==0) {
+		req.tp_block_nr=1;
+		req.tp_frame_nr=block_size/frame_size;
+	}
+
+	if(setsockopt(scfg->socket, SOL_PACKET, PACKET_RX_RING, &req,
+		sizeof(req))<0) {
+		perror("failed to set up rx ring");
+		return 1;
+	}
+
+	if(setsockopt(scfg->socket, SOL_PACKET, PACKET_TX_RING, &req,
+		sizeof(req))<0) {
+		perror("failed to set up tx ring");
+		return 1;
+	}
+
+	/* rx ring is followed by tx ring in the mapping */
+	ring_size=(size_t)req.tp_block_nr*req.tp_block_size;
+	scfg->map_len=2*ring_size;
+	scfg->map=mmap(NULL, scfg->map_len, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, scfg->socket, 0);
+	if(scfg->map==MAP_FAILED) {
+		scfg->map=NULL;
+		perror("failed to map packet rings");
+		return 1;
+	}
+
+	scfg->rx.map=scfg->map;
+	scfg->tx.map=(char*)scfg->map+ring_size;
+	scfg->rx.frame_size=scfg->tx.frame_size=frame_size;
+	scfg->rx.frame_nr=scfg->tx.frame_nr=req.tp_frame_nr;
+
+	return 0;
+}
+
+/**
+ * Get current frame of a ring.
+ */
+static struct tpacket2_hdr *stsn_ring_frame(struct stsn_ring *ring)
+{
+	return (struct tpacket2_hdr*)(ring->map+
+		(size_t)ring->idx*ring->frame_size);
+}
+
+/**
+ * Get next rx frame handed over by the kernel.
+ *
+ * \param scfg STSN module config.
+ * \return Frame or NULL if the ring is empty.
+ */
+static struct tpacket2_hdr *stsn_rx_frame(struct stsn_cfg *scfg)
+{
+	struct tpacket2_hdr *hdr=stsn_ring_frame(&scfg->rx);
+
+	if(!(__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) &
+		TP_STATUS_USER))
+		return NULL;
+
+	return hdr;
+}
+
+/**
+ * Hand an rx frame back to the kernel.
+ *
+ * \param scfg STSN module config.
+ * \param hdr Frame to release.
+ */
+static void stsn_rx_release(struct stsn_cfg *scfg, struct tpacket2_hdr *hdr)
+{
+	__atomic_store_n(&hdr->tp_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+	scfg->rx.idx=(scfg->rx.idx+1)%scfg->rx.frame_nr;
+}
+
+/**
+ * Wait for a frame on the rx ring.
+ *
+ * \param scfg STSN module config.
+ * \param timeout Timeout in ms, -1 to wait forever.
+ * \return Frame, NULL on timeout or error.
+ */
+static struct tpacket2_hdr *stsn_wait_rx(struct stsn_cfg *scfg, int timeout)
+{
+	struct tpacket2_hdr *hdr;
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd=scfg->socket;
+	pfd.events=POLLIN;
+
+	while(!(hdr=stsn_rx_frame(scfg))) {
+		ret=poll(&pfd, 1, timeout);
+		if(ret<=0 || pfd.revents & (POLLERR|POLLNVAL))
+			return NULL;
+	}
+
+	return hdr;
+}
+
+/**
+ * Get the payload of the next free tx frame.
+ *
+ * \param scfg STSN module config.
+ * \return Payload buffer or NULL if the frame is still in use.
+ */
+static char *stsn_tx_buffer(struct stsn_cfg *scfg)
+{
+	struct tpacket2_hdr *hdr=stsn_ring_frame(&scfg->tx);
+	char *packet;
+
+	if(__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE)!=
+		TP_STATUS_AVAILABLE)
+		return NULL;
+
+	/* for SOCK_DGRAM the payload follows the header directly, the tag
+	 * of tagged frames goes first */
+	packet=(char*)hdr+TPACKET2_HDRLEN-sizeof(struct sockaddr_ll);
+	memcpy(packet, scfg->tag, scfg->tag_len);
+
+	return packet+scfg->tag_len;
+}
+
+/**
+ * Queue current tx frame and let the kernel send it.
+ *
+ * \param scfg STSN module config.
+ * \param length Payload length without tag.
+ * \return 0 on success.
+ */
+static int stsn_tx_send(struct stsn_cfg *scfg, int length)
+{
+	struct tpacket2_hdr *hdr=stsn_ring_frame(&scfg->tx);
+
+	hdr->tp_len=scfg->tag_len+length;
+	__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST,
+		__ATOMIC_RELEASE);
+	scfg->tx.idx=(scfg->tx.idx+1)%scfg->tx.frame_nr;
+
+	if(sendto(scfg->socket, NULL, 0, 0,
+		(const struct sockaddr *)&scfg->tx_addr,
+		sizeof(scfg->tx_addr))<0)
+		return 1;
+
+	if(__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE)==
+		TP_STATUS_WRONG_FORMAT) {
+		errno=EINVAL;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Send a frame without the tx ring. The tag of tagged frames is put in
+ * front of the payload, the launch time for etf into the control data.
+ *
+ * \param scfg STSN module config.
+ * \param packet Frame payload.
+ * \param length Payload length.
+ * \return 0 on success.
+ */
+static int stsn_send(struct stsn_cfg *scfg, char *packet, int length)
+{
+	char control[SOCKET_TXTIME_CONTROL];
+	struct iovec iov[2];
+	struct msghdr msg;
+
+	iov[0].iov_base=scfg->tag;
+	iov[0].iov_len=scfg->tag_len;
+	iov[1].iov_base=packet;
+	iov[1].iov_len=length;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name=&scfg->tx_addr;
+	msg.msg_namelen=sizeof(scfg->tx_addr);
+	msg.msg_iov=iov;
+	msg.msg_iovlen=2;
+	if(scfg->txtime)
+		socket_msg_txtime(&msg, control, scfg->txtime);
+
+	return sendmsg(scfg->socket, &msg, 0)<0;
+}
+
+/**
+ * Get the stream header (magic and stream id) of a frame.
+ *
+ * \param packet Frame payload.
+ * \return Stream header in host byte order.
+ */
+static uint32_t stsn_stream_header(const char *packet)
+{
+	uint32_t hdr;
+
+	memcpy(&hdr, packet, sizeof(hdr));
+
+	return ntohl(hdr);
+}
+
+/**
+ * Attach a socket filter, which only passes frames of our stream sent by
+ * the peer. The kernel removes the tag of received frames before the
+ * socket sees them, so tagged frames are checked by the protocol and vlan
+ * id it recorded.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+static int stsn_attach_filter(struct cyclicping_cfg *cfg)
+{
+	struct stsn_cfg *scfg=cfg->current_mod->modcfg;
+	const uint8_t *mac=scfg->sk_addr.sll_addr;
+	struct sock_filter code[]={
+		/* tagged frames only, failing checks jump to the final drop */
+		BPF_STMT(BPF_LD|BPF_H|BPF_ABS, SKF_AD_OFF+SKF_AD_PROTOCOL),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_TSN, 0, 13),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			SKF_AD_OFF+SKF_AD_VLAN_TAG_PRESENT),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 1, 0, 11),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_AD_OFF+SKF_AD_VLAN_TAG),
+		BPF_STMT(BPF_ALU|BPF_AND|BPF_K, FRAME_VLAN_VID_MASK),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K,
+			scfg->tci & FRAME_VLAN_VID_MASK, 0, 8),
+		/* stream header, the socket delivers the payload */
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 0),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K,
+			(STSN_MAGIC<<24)|scfg->stream_id, 0, 6),
+		/* source address of the link layer header */
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_LL_OFF+ETH_ALEN),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, (uint32_t)mac[0]<<24|
+			mac[1]<<16|mac[2]<<8|mac[3], 0, 4),
+		BPF_STMT(BPF_LD|BPF_H|BPF_ABS, SKF_LL_OFF+ETH_ALEN+4),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, mac[4]<<8|mac[5], 0, 2),
+		/* short frames are padded */
+		BPF_STMT(BPF_LD|BPF_W|BPF_LEN, 0),
+		BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, cfg->opts.length, 1, 0),
+		BPF_STMT(BPF_RET|BPF_K, 0),
+		BPF_STMT(BPF_RET|BPF_K, UINT32_MAX),
+	};
+
+	int skip=scfg->tci<0?STSN_FILTER_TAG_LEN:0;
+
+	return set_socket_filter(scfg->socket, code+skip,
+		sizeof(code)/sizeof(code[0])-skip);
+}
+
+/**
+ * Check if a received frame is a cyclicping packet. Ethernet pads short
+ * frames, the payload might be longer than the packet, only the packet
+ * length is looked at.
+ *
+ * \param cfg Cyclicping config data.
+ * \param packet Received frame payload.
+ * \param length Payload length.
+ * \param reply 1 if a reply is expected, 0 for a request.
+ * \return 1 if the packet is valid.
+ */
+static int stsn_valid(struct cyclicping_cfg *cfg, const char *packet,
+	int length, int reply)
+{
+	if(length<cfg->opts.length ||
+		stsn_stream_header(packet)!=stsn_stream_header(
+		cfg->send_packet))
+		return 0;
+
+	if(hdr_check(packet+STSN_HDR_LEN, cfg->opts.length-STSN_HDR_LEN))
+		return 0;
+
+	return !(hdr_get_flags(packet+STSN_HDR_LEN) & CP_FLAG_REPLY)==!reply;
+}
+
 /**
  * Init STSN connection module. Parse module args. Open socket. Set socket
  * priority.
@@ -65,12 +411,28 @@ int stsn_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 	}
 
 	cfg->current_mod->modcfg=scfg;
+	vlan_cfg_init(&scfg->vlan);
 
-	if(argc<2) {
+	if(argc<3) {
 		fprintf(stderr, "interface and mac address required\n");
 		return 1;
 	}
 
+	if(argc>=4 && stsn_parse_flags(scfg, argv[3]))
+		return 1;
+
+	scfg->tci=vlan_tci(&scfg->vlan);
+	if(scfg->tci>=0) {
+		scfg->tag[0]=htons(scfg->tci);
+		scfg->tag[1]=htons(ETH_P_TSN);
+		scfg->tag_len=sizeof(scfg->tag);
+	}
+
+	if(cfg->opts.length<STSN_HDR_LEN+sizeof(struct cp_hdr)) {
+		fprintf(stderr, "packet length too small for stsn\n");
+		return 1;
+	}
+
 	if(sscanf(argv[2], "%hhx-%hhx-%hhx-%hhx-%hhx-%hhx",
 		&mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5])!=6) {
 		fprintf(stderr, "failed to convert mac address\n");
@@ -78,12 +440,26 @@ int stsn_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 	}
 	memcpy(&scfg->sk_addr.sll_addr, mac, ETH_ALEN);
 
-	scfg->socket=socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_TSN));
+	/* tagged frames are untagged by the kernel before they are handed to
+	 * protocol handlers, only ETH_P_ALL sockets still see the tag */
+	scfg->sk_addr.sll_protocol=htons(scfg->tci<0?ETH_P_TSN:ETH_P_ALL);
+	scfg->socket=socket(AF_PACKET, SOCK_DGRAM, scfg->sk_addr.sll_protocol);
 	if(scfg->socket<0) {
 		fprintf(stderr, "failed to open socket\n");
 		return 1;
 	}
 
+	/* vendor specific stream */
+	cfg->send_packet[0]=STSN_MAGIC;
+	/* stream id */
+	cfg->send_packet[1]=scfg->stream_id>>16;
+	cfg->send_packet[2]=scfg->stream_id>>8;
+	cfg->send_packet[3]=scfg->stream_id;
+
+	/* the socket receives TSN frames of all interfaces right away */
+	if(stsn_attach_filter(cfg))
+		return 1;
+
 	strncpy(req.ifr_name, argv[1], sizeof(req.ifr_name));
 	if(ioctl(scfg->socket, SIOCGIFINDEX, &req) < 0) {
 		fprintf(stderr, "failed to get interface index\n");
@@ -93,25 +469,129 @@ int stsn_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 
 	scfg->sk_addr.sll_ifindex = req.ifr_ifindex;
 	scfg->sk_addr.sll_family = AF_PACKET;
-	scfg->sk_addr.sll_protocol = htons(ETH_P_TSN);
 	scfg->sk_addr.sll_halen = ETH_ALEN;
 
+	scfg->tx_addr=scfg->sk_addr;
+	scfg->tx_addr.sll_protocol=htons(scfg->tci<0?ETH_P_TSN:ETH_P_8021Q);
+
+	/* only receive frames from the given interface */
+	if(bind(scfg->socket, (const struct sockaddr *)&scfg->sk_addr,
+		sizeof(scfg->sk_addr))<0) {
+		perror("failed to bind socket to interface");
+		return 1;
+	}
+
 	if(set_socket_priority(scfg->socket, cfg->opts.sopriority)) {
 		return 1;
 	}
 
 	abort_fd=scfg->socket;
 
-	/* vendor specific stream */
-	cfg->send_packet[0]=0x6f;
-	/* type specific data, version, etc */
-	cfg->send_packet[1]=0x0;
-	cfg->send_packet[2]=0x0;
-	cfg->send_packet[3]=0x0;
+	if(scfg->qdisc_bypass && setsockopt(scfg->socket, SOL_PACKET,
+		PACKET_QDISC_BYPASS, &scfg->qdisc_bypass,
+		sizeof(scfg->qdisc_bypass))<0) {
+		perror("failed to enable qdisc bypass");
+		return 1;
+	}
+
+	if(scfg->qdisc_bypass && cfg->qdisc.mode) {
+		fprintf(stderr, "qdisc bypass skips the qdisc set up for the "
+			"stream\n");
+		return 1;
+	}
+
+	/* the tx ring has no control data for launch times */
+	if(cfg->qdisc.txtime && !scfg->use_mmap) {
+		if(set_socket_txtime(scfg->socket))
+			return 1;
+		scfg->txtime=cfg->qdisc.txtime;
+		cfg->qdisc.txtime_set=1;
+	}
+
+	if(scfg->use_mmap && stsn_setup_rings(scfg,
+		scfg->tag_len+cfg->opts.length))
+		return 1;
+
+	hdr_init(cfg->send_packet+STSN_HDR_LEN,
+		cfg->opts.length-STSN_HDR_LEN);
+
+	if(cfg->opts.client)
+		wire_set_eth(cfg, argv[1], cfg->opts.length, 0, 1,
+			scfg->tag_len);
 
 	return 0;
 }
 
+/**
+ * TSN client using the PACKET_MMAP rings. The reply is evaluated directly
+ * in the rx ring.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+static int stsn_client_mmap(struct cyclicping_cfg *cfg)
+{
+	struct stsn_cfg *scfg=cfg->current_mod->modcfg;
+	struct tpacket2_hdr *hdr;
+	struct timespec tsend, trecv, left;
+	char *packet;
+
+	packet=stsn_tx_buffer(scfg);
+	if(packet==NULL) {
+		fprintf(stderr, "stsn client tx ring full\n");
+		return 1;
+	}
+	memcpy(packet, cfg->send_packet, cfg->opts.length);
+
+	/* take timestamp and copy it to send packet */
+	hdr_stamp_request(packet+STSN_HDR_LEN, cfg->seq, cfg->opts.clock,
+		&tsend);
+
+	/* send packet to server */
+	if(stsn_tx_send(scfg, cfg->opts.length)) {
+		perror("stsn client failed to send packet");
+		return 1;
+	}
+
+	/* wait for the reply to this request, late replies to earlier
+	 * requests are counted and skipped */
+	while(run) {
+		if(reply_timeout(cfg, &tsend, &left)) {
+			reply_lost(cfg);
+			break;
+		}
+
+		hdr=stsn_wait_rx(scfg, left.tv_sec*1000+
+			(left.tv_nsec+999999)/1000000);
+		if(hdr==NULL)
+			continue;
+		clock_gettime(cfg->opts.clock, &trecv);
+
+		packet=(char*)hdr+hdr->tp_mac;
+		if(!stsn_valid(cfg, packet, hdr->tp_snaplen, 1) ||
+			match_reply(cfg, hdr_get_seq(packet+STSN_HDR_LEN))!=
+			REPLY_CURRENT) {
+			stsn_rx_release(scfg, hdr);
+			continue;
+		}
+
+		/* add packet time to statistics */
+		if(add_packet_stats(cfg, &tsend, packet+STSN_HDR_LEN,
+			&trecv)) {
+			stsn_rx_release(scfg, hdr);
+			return 1;
+		}
+
+		stsn_rx_release(scfg, hdr);
+		break;
+	}
+
+	cfg->seq++;
+
+	/* wait until next inverval */
+	return client_wait(cfg, tsend);
+}
+
 /**
  * TSN client.
  *
@@ -122,77 +602,124 @@ int stsn_client(struct cyclicping_cfg *cfg)
 {
 	struct stsn_cfg *scfg=cfg->current_mod->modcfg;
 	int selectResult;
-	struct timespec tsend, trecv, tserver;
+	ssize_t len=0;
+	struct timespec tsend, trecv, left;
 	struct timeval timeout;
 	fd_set set;
-	socklen_t dest_addr_len=sizeof(scfg->sk_addr);
-
-	FD_ZERO(&set);
-	FD_SET(scfg->socket, &set);
 
-	timeout.tv_sec=1;
-	timeout.tv_usec=0;
+	if(scfg->use_mmap)
+		return stsn_client_mmap(cfg);
 
 	/* take timestamp and copy it to send packet */
-	clock_gettime(cfg->opts.clock, &tsend);
-	tspec2buffer(&tsend, cfg->send_packet+4);
+	hdr_stamp_request(cfg->send_packet+STSN_HDR_LEN, cfg->seq,
+		cfg->opts.clock, &tsend);
 
 	/* send packet to server */
-	if(sendto(scfg->socket, cfg->send_packet, cfg->opts.length, 0,
-		(const struct sockaddr *)&scfg->sk_addr,
-		dest_addr_len)==-1) {
+	if(stsn_send(scfg, cfg->send_packet, cfg->opts.length)) {
 		perror("stsn client failed to send packet");
 		return 1;
 	}
 
-	do {
+	/* wait for the reply to this request, late replies to earlier
+	 * requests are counted and skipped */
+	while(run) {
+		if(reply_timeout(cfg, &tsend, &left)) {
+			reply_lost(cfg);
+			break;
+		}
+		timeout.tv_sec=left.tv_sec;
+		timeout.tv_usec=left.tv_nsec/1000;
+
+		FD_ZERO(&set);
+		FD_SET(scfg->socket, &set);
+
 		/* monitor socket fd via select */
-		selectResult = select(scfg->socket+1, &set, NULL, NULL,
+		selectResult=select(scfg->socket+1, &set, NULL, NULL,
 			&timeout);
-		if (selectResult > 0) {
-			/* receive packet and take timestamp */
-			if(recv(scfg->socket, cfg->recv_packet,
-				cfg->opts.length, 0)==-1) {
-				perror("stsn client failed to receive packet");
-				return 1;
-			}
-			clock_gettime(cfg->opts.clock, &trecv);
-		} else if(selectResult == 0) {
-			fprintf(stderr,
-				"stsn client timeout receiving packet\n");
-			return 1;
-		}
-		else {
+		if(selectResult==0)
+			continue;
+		if(selectResult<0) {
+			if(errno==EINTR)
+				continue;
 			fprintf(stderr, "stsn client select failed\n");
 			return 1;
 		}
-	} while(cfg->recv_packet[0]!=0x6f);
 
-	if(cfg->send_packet[3]!=cfg->recv_packet[3]) {
-		fprintf(stderr, "sequence number missmatch\n");
-		return 1;
-	}
+		/* receive packet and take timestamp */
+		len=recv(scfg->socket, cfg->recv_packet, cfg->opts.length, 0);
+		if(len==-1) {
+			perror("stsn client failed to receive packet");
+			return 1;
+		}
+		clock_gettime(cfg->opts.clock, &trecv);
 
-	/* add packet time to statistics */
-	if(add_stats(cfg, STAT_ALL, &tsend, &trecv))
-		return 1;
+		if(!stsn_valid(cfg, cfg->recv_packet, len, 1) ||
+			match_reply(cfg, hdr_get_seq(cfg->recv_packet+
+			STSN_HDR_LEN))!=REPLY_CURRENT)
+			continue;
 
-	if(cfg->opts.two_way) {
-		buffer2tspec(cfg->recv_packet+2*sizeof(uint64_t)+4, &tserver);
-		if(add_stats(cfg, STAT_SEND, &tsend, &tserver))
+		/* add packet time to statistics */
+		if(add_packet_stats(cfg, &tsend,
+			cfg->recv_packet+STSN_HDR_LEN, &trecv))
 			return 1;
-		if(add_stats(cfg, STAT_RECV, &tserver, &trecv))
-			return 1;
-	}
 
-	print_stats(cfg, &tsend, &tserver, &trecv);
+		break;
+	}
 
-	cfg->send_packet[3]++;
+	cfg->seq++;
 
 	/* wait until next inverval */
 	return client_wait(cfg, tsend);
 }
 
+/**
+ * STSN server using the PACKET_MMAP rings. The request is copied from the
+ * rx ring straight into the tx ring.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+static int stsn_server_mmap(struct cyclicping_cfg *cfg)
+{
+	struct stsn_cfg *scfg=cfg->current_mod->modcfg;
+	struct tpacket2_hdr *hdr;
+	struct timespec trecv;
+	char *packet, *reply;
+
+	/* wait for packet */
+	hdr=stsn_wait_rx(scfg, -1);
+	if(hdr==NULL)
+		return run?1:0;
+
+	clock_gettime(cfg->opts.clock, &trecv);
+
+	packet=(char*)hdr+hdr->tp_mac;
+	if(!stsn_valid(cfg, packet, hdr->tp_snaplen, 0)) {
+		stsn_rx_release(scfg, hdr);
+		return 0;
+	}
+
+	reply=stsn_tx_buffer(scfg);
+	if(reply==NULL) {
+		fprintf(stderr, "stsn server tx ring full\n");
+		stsn_rx_release(scfg, hdr);
+		return 1;
+	}
+	memcpy(reply, packet, cfg->opts.length);
+	stsn_rx_release(scfg, hdr);
+
+	/* copy timestamps to reply packet */
+	hdr_stamp_reply(reply+STSN_HDR_LEN, cfg->opts.clock, &trecv);
+
+	/* send packet back to the client */
+	if(stsn_tx_send(scfg, cfg->opts.length)) {
+		perror("stsn server failed to send packet");
+		return 1;
+	}
+
+	return 0;
+}
+
 /**
  * STSN server.
  *
@@ -202,26 +729,32 @@ int stsn_client(struct cyclicping_cfg *cfg)
 int stsn_server(struct cyclicping_cfg *cfg)
 {
 	struct stsn_cfg *scfg=cfg->current_mod->modcfg;
-	struct timespec tsend;
-	socklen_t dest_addr_len=sizeof(scfg->sk_addr);
+	struct timespec trecv;
+
+	if(scfg->use_mmap)
+		return stsn_server_mmap(cfg);
 
 	/* wait for packet */
 	if(recv(scfg->socket, cfg->recv_packet, cfg->opts.length, 0)!=
 		cfg->opts.length) {
+		/* interrupted at the end of the test */
+		if(errno==EINTR && !run)
+			return 0;
 		perror("stsn server failed to receive packet");
 		return 1;
 	}
 
-	if(cfg->recv_packet[0]!=0x6f)
+	clock_gettime(cfg->opts.clock, &trecv);
+
+	if(!stsn_valid(cfg, cfg->recv_packet, cfg->opts.length, 0))
 		return 0;
 
-	/* take timestamp and copy it to received packet */
-	clock_gettime(cfg->opts.clock, &tsend);
-	tspec2buffer(&tsend, cfg->recv_packet+2*sizeof(uint64_t)+4);
+	/* copy timestamps to received packet */
+	hdr_stamp_reply(cfg->recv_packet+STSN_HDR_LEN, cfg->opts.clock,
+		&trecv);
 
 	/* send received packet back to the server */
-	if(sendto(scfg->socket, cfg->recv_packet, cfg->opts.length, 0,
-		(const struct sockaddr *)&scfg->sk_addr, dest_addr_len)==-1) {
+	if(stsn_send(scfg, cfg->recv_packet, cfg->opts.length)) {
 		perror("stsn server failed to send packet");
 		return 1;
 	}
@@ -238,6 +771,9 @@ void stsn_deinit(struct cyclicping_cfg *cfg)
 {
 	struct stsn_cfg *scfg=cfg->current_mod->modcfg;
 
+	if(scfg->map)
+		munmap(scfg->map, scfg->map_len);
+
 	free(scfg);
 }
 
@@ -247,6 +783,12 @@ void stsn_deinit(struct cyclicping_cfg *cfg)
 void stsn_usage(void)
 {
 	printf("  stsn - Use a socket based TSN connection\n");
-	printf("    stsn:interface:clientmac   STSN server\n");
-	printf("    stsn:interface:servermac   STSN client\n");
+	printf("    stsn:interface:clientmac[:flags]   STSN server\n");
+	printf("    stsn:interface:servermac[:flags]   STSN client\n");
+	printf("    flags: comma separated list of mmap (use PACKET_MMAP "
+		"rings),\n");
+	printf("    bypass (bypass the qdisc layer), stream=<id> (24 bit "
+		"stream id),\n");
+	printf("    vlan=<id> and pcp=<priority> (send and expect 802.1Q "
+		"tagged frames)\n");
 }
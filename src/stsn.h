@@ -22,10 +22,50 @@
 
 #include <linux/if_packet.h>
 
+#include <frame.h>
+
+/* length of the vendor specific stream header preceding the wire header */
+#define STSN_HDR_LEN	4
+/* first byte of the stream header, followed by the 24 bit stream id */
+#define STSN_MAGIC	0x6f
+#define STSN_MAX_STREAM	0xffffff
+
+/* socket filter instructions checking the tag of tagged frames */
+#define STSN_FILTER_TAG_LEN	7
+
+/* number of frames of the rx and tx ring each */
+#define STSN_RING_FRAMES	64
+
+/* PACKET_MMAP ring (TPACKET_V2) */
+struct stsn_ring {
+	char *map;
+	unsigned int frame_size;
+	unsigned int frame_nr;
+	unsigned int idx;
+};
+
 struct stsn_cfg {
 	struct sockaddr_ll sk_addr;
 	int socket;
 	char *device;
+	int use_mmap;
+	int qdisc_bypass;
+	uint32_t stream_id;
+	struct vlan_cfg vlan;
+	/* tag control information, -1 for untagged frames */
+	int tci;
+	/* tag control information and inner ethertype, they precede the
+	 * payload of tagged frames */
+	uint16_t tag[2];
+	int tag_len;
+	/* destination of sent frames, the ethertype differs when tagged */
+	struct sockaddr_ll tx_addr;
+	/* launch time of sent frames ahead of now for etf (ns) */
+	uint64_t txtime;
+	void *map;
+	size_t map_len;
+	struct stsn_ring rx;
+	struct stsn_ring tx;
 };
 
 int stsn_init(struct cyclicping_cfg *cfg, char **argv, int argc);
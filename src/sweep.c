@@ -0,0 +1,519 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <cyclicping.h>
+#include <selftest.h>
+#include <proto.h>
+#include <sweep.h>
+
+extern int run, terminated;
+
+static const char *sweep_names[SWEEP_AXES]={
+	[SWEEP_LENGTH]="length",
+	[SWEEP_INTERVAL]="interval",
+	[SWEEP_BAUD]="baud",
+};
+
+/* percentiles in 1/1000 */
+static const int sweep_permille[SWEEP_PERCENTILES]={
+	[SWEEP_P50]=500,
+	[SWEEP_P90]=900,
+	[SWEEP_P99]=990,
+	[SWEEP_P999]=999,
+};
+
+/**
+ * Parse a comma separated list of values and ranges. A range is either
+ * linear (<from>-<to>+<step>) or geometric (<from>-<to>*<factor>).
+ *
+ * \param list List argument.
+ * \param values Parsed values.
+ * \param nvalues Number of parsed values.
+ * \return 0 on success.
+ */
+static int sweep_parse_list(char *list, int *values, int *nvalues)
+{
+	char *saveptr=NULL;
+	char *item;
+	int from, to, step, n;
+	int64_t v;
+	char op;
+
+	for(item=strtok_r(list, ",", &saveptr); item;
+		item=strtok_r(NULL, ",", &saveptr)) {
+		n=sscanf(item, "%d-%d%c%d", &from, &to, &op, &step);
+		if(n==1) {
+			to=from;
+			op='+';
+			step=1;
+		} else if(n!=4 || to<from || step<=0 ||
+			(op=='*' && step<2) || (op!='*' && op!='+')) {
+			return 1;
+		}
+
+		if(from<=0)
+			return 1;
+
+		for(v=from; v<=to; v=op=='*'?v*step:v+step) {
+			if(*nvalues==SWEEP_MAX_POINTS)
+				return 1;
+			values[(*nvalues)++]=v;
+		}
+	}
+
+	return *nvalues==0;
+}
+
+/**
+ * Parse the sweep option (<lengths>[:<intervals>[:<bauds>]]) and set up
+ * the grid. Empty fields keep the value given by -L and -i.
+ *
+ * \param cfg Cyclicping config data.
+ * \param arg Option argument.
+ * \return 0 on success.
+ */
+int sweep_parse(struct cyclicping_cfg *cfg, const char *arg)
+{
+	struct sweep_cfg *s=&cfg->sweep;
+	static int values[SWEEP_AXES][SWEEP_MAX_POINTS];
+	int nvalues[SWEEP_AXES];
+	int idx[SWEEP_AXES];
+	char *args, *field, *next;
+	int i, axis, npoints=1, ret=1;
+
+	/* the option stays intact for the command line in the output */
+	args=strdup(arg);
+	if(args==NULL)
+		return 1;
+	field=args;
+
+	for(axis=0; axis<SWEEP_AXES; axis++) {
+		nvalues[axis]=0;
+		if(field) {
+			next=strchr(field, ':');
+			if(next)
+				*next++='\0';
+
+			if(*field) {
+				if(sweep_parse_list(field, values[axis],
+					&nvalues[axis]))
+					goto out;
+				s->swept[axis]=1;
+			}
+			field=next;
+		}
+
+		/* not swept, 0 keeps the value of the options */
+		if(!nvalues[axis])
+			values[axis][nvalues[axis]++]=0;
+
+		npoints*=nvalues[axis];
+		if(npoints>SWEEP_MAX_POINTS)
+			goto out;
+	}
+
+	if(field || !(s->swept[SWEEP_LENGTH] || s->swept[SWEEP_INTERVAL] ||
+		s->swept[SWEEP_BAUD]))
+		goto out;
+
+	for(i=0; i<nvalues[SWEEP_LENGTH]; i++) {
+		if(values[SWEEP_LENGTH][i] && (values[SWEEP_LENGTH][i]<
+			sizeof(struct cp_hdr) || values[SWEEP_LENGTH][i]>1<<20))
+			goto out;
+	}
+
+	s->points=(struct sweep_point*)calloc(npoints,
+		sizeof(struct sweep_point));
+	if(s->points==NULL)
+		goto out;
+
+	/* length varies fastest, so the rows of a fit are adjacent */
+	memset(idx, 0, sizeof(idx));
+	for(i=0; i<npoints; i++) {
+		for(axis=0; axis<SWEEP_AXES; axis++)
+			s->points[i].value[axis]=values[axis][idx[axis]];
+
+		for(axis=0; axis<SWEEP_AXES; axis++) {
+			if(++idx[axis]<nvalues[axis])
+				break;
+			idx[axis]=0;
+		}
+	}
+
+	s->npoints=npoints;
+	s->enabled=1;
+	ret=0;
+
+out:
+	free(args);
+
+	return ret;
+}
+
+/**
+ * Replace the baud rate in the arguments of the uart module.
+ *
+ * \param args Module arguments (uart:device[:baud[:...]]).
+ * \param baud Baud rate, 0 to keep the arguments.
+ * \return Allocated arguments or NULL on error.
+ */
+static char *sweep_mod_args(const char *args, int baud)
+{
+	const char *p, *end;
+	char *s;
+	int ret;
+
+	if(!baud)
+		return strdup(args);
+
+	/* baud rate is the field after the device */
+	p=strchr(args, ':');
+	if(p)
+		p=strchr(p+1, ':');
+
+	if(p==NULL) {
+		ret=asprintf(&s, "%s:%d", args, baud);
+	} else {
+		end=strchr(p+1, ':');
+		ret=asprintf(&s, "%.*s:%d%s", (int)(p-args), args, baud,
+			end?end:"");
+	}
+
+	return ret<0?NULL:s;
+}
+
+/**
+ * Take a percentile from the histogram of a statistic.
+ *
+ * \param cfg Cyclicping config data.
+ * \param stat Statistic.
+ * \param permille Percentile in 1/1000.
+ * \return Percentile in the output unit.
+ */
+static uint32_t sweep_percentile(struct cyclicping_cfg *cfg,
+	struct tstats *stat, int permille)
+{
+	uint64_t rank=(stat->cnt*permille+999)/1000, sum=0;
+	int i;
+
+	for(i=0; i<cfg->opts.histogram; i++) {
+		sum+=stat->histogram_data[i];
+		if(sum>=rank)
+			break;
+	}
+
+	/* the last bin also counts everything beyond the histogram */
+	if(i>=cfg->opts.histogram-1)
+		return stat->max;
+
+	return i;
+}
+
+/**
+ * Reset the state of the previous point and set up the buffers for the
+ * packet length of the next one.
+ *
+ * \param cfg Cyclicping config data.
+ */
+static void sweep_reset(struct cyclicping_cfg *cfg)
+{
+	int i;
+
+	free(cfg->send_packet);
+	free(cfg->recv_packet);
+	allocate_buffers(cfg);
+
+	for(i=0; i<cfg->nstats; i++)
+		free(cfg->stat[i].histogram_data);
+	free(cfg->stat);
+	cfg->stat=NULL;
+	cfg->nstats=0;
+
+	cfg->cnt=0;
+	cfg->seq=0;
+	memset(&cfg->seqs, 0, sizeof(cfg->seqs));
+	cfg->responders=0;
+	cfg->echo_only=0;
+	cfg->frame_timing=0;
+	cfg->wire_time=0;
+	cfg->wire_info[0]='\0';
+	cfg->wire_ifname[0]='\0';
+}
+
+/**
+ * Keep the statistic of a point.
+ *
+ * \param cfg Cyclicping config data.
+ * \param pt Grid point.
+ */
+static void sweep_collect(struct cyclicping_cfg *cfg, struct sweep_point *pt)
+{
+	struct tstats *stat;
+	int i;
+
+	/* failed before the test started */
+	if(cfg->stat==NULL)
+		return;
+
+	stat=&cfg->stat[STAT_ALL];
+	pt->cnt=stat->cnt;
+	pt->lost=cfg->seqs.lost;
+	if(!stat->cnt)
+		return;
+
+	pt->min=stat->min;
+	pt->max=stat->max;
+	pt->avg=stat->avg/(double)stat->cnt;
+	for(i=0; i<SWEEP_PERCENTILES; i++)
+		pt->pct[i]=sweep_percentile(cfg, stat, sweep_permille[i]);
+}
+
+/**
+ * Run the test for each point of the grid. The interface module is set up
+ * again for every point, in self-test mode together with the server.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 if at least one point was measured.
+ */
+int run_sweep(struct cyclicping_cfg *cfg)
+{
+	struct sweep_cfg *s=&cfg->sweep;
+	struct cyclicping_opts opts=cfg->opts;
+	struct sweep_point *pt;
+	char *mod, *client_mod;
+	int i, measured=0;
+
+	if(s->swept[SWEEP_BAUD] && strcmp(cfg->current_mod->name, "uart")) {
+		fprintf(stderr, "baud rates can only be swept with the uart "
+			"module\n");
+		return 1;
+	}
+
+	for(i=0; i<s->npoints && !terminated; i++) {
+		pt=&s->points[i];
+
+		/* every point starts from the options given */
+		cfg->opts=opts;
+		if(pt->value[SWEEP_LENGTH])
+			cfg->opts.length=pt->value[SWEEP_LENGTH];
+		if(pt->value[SWEEP_INTERVAL])
+			cfg->opts.interval=pt->value[SWEEP_INTERVAL];
+		pt->value[SWEEP_LENGTH]=cfg->opts.length;
+		pt->value[SWEEP_INTERVAL]=cfg->opts.interval;
+
+		mod=sweep_mod_args(opts.opt_mod, pt->value[SWEEP_BAUD]);
+		client_mod=opts.opt_client_mod?sweep_mod_args(
+			opts.opt_client_mod, pt->value[SWEEP_BAUD]):NULL;
+		if(mod==NULL || (opts.opt_client_mod && client_mod==NULL)) {
+			perror("failed to allocate module arguments");
+			free(mod);
+			break;
+		}
+		cfg->opts.opt_mod=mod;
+		cfg->opts.opt_client_mod=client_mod;
+
+		sweep_reset(cfg);
+
+		if(!opts.quiet) {
+			printf("# sweep %d/%d: length %d, interval %d",
+				i+1, s->npoints, cfg->opts.length,
+				cfg->opts.interval);
+			if(pt->value[SWEEP_BAUD])
+				printf(", baud %d", pt->value[SWEEP_BAUD]);
+			printf("\n");
+		}
+
+		run=1;
+		if(cfg->opts.selftest)
+			pt->ret=run_selftest(cfg);
+		else
+			pt->ret=run_cyclicping(cfg);
+
+		if(!opts.quiet)
+			printf("\n");
+
+		sweep_collect(cfg, pt);
+		if(!pt->ret && pt->cnt)
+			measured++;
+
+		/* the host is audited once, before the first point */
+		if(!pt->ret)
+			cfg->preflight.policy=PREFLIGHT_OFF;
+
+		free(mod);
+		free(client_mod);
+	}
+
+	/* points not run due to an error or signal aren't reported */
+	s->npoints=i;
+	cfg->opts=opts;
+
+	return !measured;
+}
+
+/**
+ * Least squares fit of a fixed overhead and a cost per byte to the points
+ * with the interval and baud rate of a point.
+ *
+ * \param s Sweep config.
+ * \param first Point of the series.
+ * \param pct Percentile to fit, SWEEP_PERCENTILES for the average.
+ * \param fixed Fixed overhead in the output unit.
+ * \param per_byte Cost per byte in the output unit.
+ * \param r2 Coefficient of determination.
+ * \return 0 on success, 1 if there are less than two lengths.
+ */
+static int sweep_fit(struct sweep_cfg *s, int first, int pct, double *fixed,
+	double *per_byte, double *r2)
+{
+	struct sweep_point *pt;
+	double n=0, sx=0, sy=0, sxx=0, sxy=0, syy=0, x, y, d;
+	int i;
+
+	for(i=first; i<s->npoints; i++) {
+		pt=&s->points[i];
+		if(pt->value[SWEEP_INTERVAL]!=
+			s->points[first].value[SWEEP_INTERVAL] ||
+			pt->value[SWEEP_BAUD]!=
+			s->points[first].value[SWEEP_BAUD] ||
+			pt->ret || !pt->cnt)
+			continue;
+
+		x=pt->value[SWEEP_LENGTH];
+		y=pct<SWEEP_PERCENTILES?pt->pct[pct]:pt->avg;
+		n++;
+		sx+=x;
+		sy+=y;
+		sxx+=x*x;
+		sxy+=x*y;
+		syy+=y*y;
+	}
+
+	d=n*sxx-sx*sx;
+	if(n<2 || d<=0)
+		return 1;
+
+	*per_byte=(n*sxy-sx*sy)/d;
+	*fixed=(sy-*per_byte*sx)/n;
+
+	/* all points equal are explained by the model as well */
+	d=(n*sxx-sx*sx)*(n*syy-sy*sy);
+	*r2=d>0?(n*sxy-sx*sy)*(n*sxy-sx*sy)/d:1.0;
+
+	return 0;
+}
+
+/**
+ * Print the percentile matrix of all points and the model fitted to each
+ * series of lengths.
+ *
+ * \param cfg Cyclicping config data.
+ * \param f Output file.
+ * \param argc Main argument count.
+ * \param argv Main arguments.
+ */
+void sweep_print(struct cyclicping_cfg *cfg, FILE *f, int argc,
+	char *argv[])
+{
+	struct sweep_cfg *s=&cfg->sweep;
+	struct sweep_point *pt;
+	const char *unit=cfg->opts.ms?"ms":"us";
+	/* ns per output unit */
+	double ns=cfg->opts.ms?1000000.0:1000.0;
+	double fixed[2], per_byte[2], r2[2];
+	int i, j;
+
+	fprintf(f, "# cyclicping %s sweep\n", VERSION);
+	fprintf(f, "# cmdline: ");
+	for(i=1; i<argc; i++)
+		fprintf(f, "%s ", argv[i]);
+	fprintf(f, "\n# interface: %s\n", cfg->current_mod->name);
+	if(cfg->opts.selftest)
+		fprintf(f, "# self-test: %s\n", cfg->opts.selftest);
+	fprintf(f, "# packets per point: %d\n", cfg->opts.number);
+	if(cfg->qdisc.mode)
+		fprintf(f, "# qdisc: %s\n", cfg->qdisc.info);
+	if(cfg->irq.info[0])
+		fprintf(f, "# irq: %s\n", cfg->irq.info);
+	if(cfg->preflight.info[0]) {
+		fprintf(f, "# realtime host: %s\n", cfg->preflight.failed?
+			"no":"yes");
+		fprintf(f, "# preflight: %s\n", cfg->preflight.info);
+	}
+	if(cfg->load.info[0])
+		fprintf(f, "# load: %s\n", cfg->load.info);
+	fprintf(f, "# unit: %s\n", unit);
+	fprintf(f, "# %s %s %s cnt lost min p50 p90 p99 p99.9 max avg\n",
+		sweep_names[SWEEP_LENGTH], sweep_names[SWEEP_INTERVAL],
+		sweep_names[SWEEP_BAUD]);
+
+	for(i=0; i<s->npoints; i++) {
+		pt=&s->points[i];
+		fprintf(f, "%7d %8d", pt->value[SWEEP_LENGTH],
+			pt->value[SWEEP_INTERVAL]);
+		if(pt->value[SWEEP_BAUD])
+			fprintf(f, " %7d", pt->value[SWEEP_BAUD]);
+		else
+			fprintf(f, " %7s", "-");
+
+		if(pt->ret || !pt->cnt) {
+			fprintf(f, " %7" PRIu64 " %6" PRIu64 " failed\n",
+				pt->cnt, pt->lost);
+			continue;
+		}
+
+		fprintf(f, " %7" PRIu64 " %6" PRIu64 " %6u", pt->cnt,
+			pt->lost, pt->min);
+		for(j=0; j<SWEEP_PERCENTILES; j++)
+			fprintf(f, " %6u", pt->pct[j]);
+		fprintf(f, " %6u %8.2f\n", pt->max, pt->avg);
+	}
+
+	/* one fit per interval and baud rate, at its first point */
+	for(i=0; i<s->npoints; i++) {
+		pt=&s->points[i];
+		for(j=0; j<i; j++)
+			if(s->points[j].value[SWEEP_INTERVAL]==
+				pt->value[SWEEP_INTERVAL] &&
+				s->points[j].value[SWEEP_BAUD]==
+				pt->value[SWEEP_BAUD])
+				break;
+		if(j<i)
+			continue;
+
+		if(sweep_fit(s, i, SWEEP_P50, &fixed[0], &per_byte[0],
+			&r2[0]) || sweep_fit(s, i, SWEEP_PERCENTILES,
+			&fixed[1], &per_byte[1], &r2[1]))
+			continue;
+
+		fprintf(f, "# fit interval %d us", pt->value[SWEEP_INTERVAL]);
+		if(pt->value[SWEEP_BAUD])
+			fprintf(f, ", baud %d", pt->value[SWEEP_BAUD]);
+		fprintf(f, ": p50 %.2f %s %+.3f ns/byte (r^2 %.3f), "
+			"avg %.2f %s %+.3f ns/byte (r^2 %.3f)\n",
+			fixed[0], unit, per_byte[0]*ns, r2[0],
+			fixed[1], unit, per_byte[1]*ns, r2[1]);
+	}
+}
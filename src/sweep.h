@@ -0,0 +1,73 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __SWEEP_H__
+#define __SWEEP_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* upper limit of grid points */
+#define SWEEP_MAX_POINTS	1024
+/* histogram depth the percentiles are taken from if -H isn't given */
+#define SWEEP_HISTOGRAM		100000
+
+struct cyclicping_cfg;
+
+enum sweep_axis {
+	SWEEP_LENGTH=0,
+	SWEEP_INTERVAL,
+	SWEEP_BAUD,
+	SWEEP_AXES,
+};
+
+enum sweep_percentile {
+	SWEEP_P50=0,
+	SWEEP_P90,
+	SWEEP_P99,
+	SWEEP_P999,
+	SWEEP_PERCENTILES,
+};
+
+struct sweep_point {
+	/* value of each axis, 0 if the axis isn't swept */
+	int value[SWEEP_AXES];
+	int ret;
+	uint64_t cnt;
+	uint64_t lost;
+	uint32_t min;
+	uint32_t max;
+	double avg;
+	uint32_t pct[SWEEP_PERCENTILES];
+};
+
+struct sweep_cfg {
+	int enabled;
+	/* axes with values given */
+	int swept[SWEEP_AXES];
+	int npoints;
+	struct sweep_point *points;
+};
+
+int sweep_parse(struct cyclicping_cfg *cfg, const char *arg);
+int run_sweep(struct cyclicping_cfg *cfg);
+void sweep_print(struct cyclicping_cfg *cfg, FILE *f, int argc,
+	char *argv[]);
+
+#endif
@@ -23,18 +23,181 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <errno.h>
 
 #include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/ip.h>
+#include <net/if.h>
 
 #include <cyclicping.h>
 #include <opts.h>
 #include <stats.h>
 #include <socket.h>
+#include <proto.h>
 #include <tcp.h>
+#include <wire.h>
 
 extern int run;
 extern int abort_fd;
 
+/**
+ * Parse comma separated tcp module flags.
+ *
+ * \param tcfg TCP module config.
+ * \param arg Flags argument.
+ * \param length Message length.
+ * \return 0 on success.
+ */
+static int tcp_parse_flags(struct tcp_cfg *tcfg, char *arg, int length)
+{
+	char *saveptr=NULL;
+	char *flag;
+	int value;
+
+	for(flag=strtok_r(arg, ",", &saveptr); flag;
+		flag=strtok_r(NULL, ",", &saveptr)) {
+		if(strcmp(flag, "tuned")==0) {
+			tcfg->nodelay=1;
+			tcfg->quickack=1;
+			tcfg->busy_poll=TCP_TUNED_BUSY_POLL;
+			tcfg->notsent_lowat=length;
+		} else if(strcmp(flag, "nodelay")==0) {
+			tcfg->nodelay=1;
+		} else if(strcmp(flag, "quickack")==0) {
+			tcfg->quickack=1;
+		} else if(sscanf(flag, "busypoll=%d", &value)==1 && value>0) {
+			tcfg->busy_poll=value;
+		} else if(sscanf(flag, "lowat=%d", &value)==1 && value>0) {
+			tcfg->notsent_lowat=value;
+		} else if(sscanf(flag, "sndbuf=%d", &value)==1 && value>0) {
+			tcfg->sndbuf=value;
+		} else if(sscanf(flag, "rcvbuf=%d", &value)==1 && value>0) {
+			tcfg->rcvbuf=value;
+		} else {
+			fprintf(stderr, "unknown tcp flag %s\n", flag);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Apply the requested socket tuning. Failures are not fatal, the settings
+ * in effect get reported instead.
+ *
+ * \param cfg Cyclicping config data.
+ * \param socket Socket to tune.
+ * \param report 1 to report the resulting settings.
+ */
+static void tcp_tune(struct cyclicping_cfg *cfg, int socket, int report)
+{
+	struct tcp_cfg *tcfg=cfg->current_mod->modcfg;
+	const struct {
+		const char *name;
+		int level;
+		int optname;
+		int value;
+	} opts[] = {
+		{ "TCP_NODELAY", IPPROTO_TCP, TCP_NODELAY, tcfg->nodelay },
+		{ "TCP_QUICKACK", IPPROTO_TCP, TCP_QUICKACK, tcfg->quickack },
+		{ "SO_BUSY_POLL", SOL_SOCKET, SO_BUSY_POLL, tcfg->busy_poll },
+		{ "TCP_NOTSENT_LOWAT", IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+			tcfg->notsent_lowat },
+		{ "SO_SNDBUF", SOL_SOCKET, SO_SNDBUF, tcfg->sndbuf },
+		{ "SO_RCVBUF", SOL_SOCKET, SO_RCVBUF, tcfg->rcvbuf },
+	};
+	socklen_t len;
+	int i, ret, err, value;
+
+	for(i=0; i<sizeof(opts)/sizeof(opts[0]); i++) {
+		if(!opts[i].value)
+			continue;
+
+		ret=setsockopt(socket, opts[i].level, opts[i].optname,
+			&opts[i].value, sizeof(opts[i].value));
+		err=errno;
+
+		if(!report)
+			continue;
+
+		if(ret) {
+			fprintf(stderr, "tcp: %s=%d not set: %s\n",
+				opts[i].name, opts[i].value, strerror(err));
+			continue;
+		}
+
+		/* the kernel may adjust the value (buffer sizes get
+		 * doubled), report what is in effect */
+		len=sizeof(value);
+		if(getsockopt(socket, opts[i].level, opts[i].optname, &value,
+			&len))
+			value=-1;
+		if(!cfg->opts.quiet)
+			printf("tcp: %s=%d in effect (requested %d)\n",
+				opts[i].name, value, opts[i].value);
+	}
+}
+
+/**
+ * Read a complete message. The stream may deliver it in pieces.
+ *
+ * \param cfg Cyclicping config data.
+ * \param socket Socket to read from.
+ * \param buffer Message buffer.
+ * \param length Message length.
+ * \return Number of bytes read, 0 on end of file or -1 on error.
+ */
+static int tcp_read(struct cyclicping_cfg *cfg, int socket, char *buffer,
+	int length)
+{
+	struct tcp_cfg *tcfg=cfg->current_mod->modcfg;
+	int ret, done=0;
+
+	do {
+		ret=read(socket, buffer+done, length-done);
+		if(ret<0 && errno==EINTR && run)
+			continue;
+		if(ret<=0)
+			return ret;
+		done+=ret;
+	} while(done<length);
+
+	/* quick ack mode is left by the kernel again, so re-arm it */
+	if(tcfg->quickack)
+		setsockopt(socket, IPPROTO_TCP, TCP_QUICKACK, &tcfg->quickack,
+			sizeof(tcfg->quickack));
+
+	return done;
+}
+
+/**
+ * Write a complete message.
+ *
+ * \param socket Socket to write to.
+ * \param buffer Message buffer.
+ * \param length Message length.
+ * \return Number of bytes written or -1 on error.
+ */
+static int tcp_write(int socket, const char *buffer, int length)
+{
+	int ret, done=0;
+
+	do {
+		ret=write(socket, buffer+done, length-done);
+		if(ret<0 && errno==EINTR && run)
+			continue;
+		if(ret<0)
+			return ret;
+		done+=ret;
+	} while(done<length);
+
+	return done;
+}
+
 /**
  * Init TCP connection module. Parse module args. Open and bind socket. Set
  * socket priority.
@@ -48,6 +211,7 @@ int tcp_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 {
 	struct tcp_cfg *tcfg;
 	int port_arg_idx=1;
+	char ifname[IFNAMSIZ];
 
 	tcfg=(struct tcp_cfg*)calloc(1, sizeof(struct tcp_cfg));
 	if(tcfg==NULL) {
@@ -81,6 +245,10 @@ int tcp_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 		tcfg->port=DEFAULT_PORT;
 	}
 
+	if(argc>=port_arg_idx+2 && tcp_parse_flags(tcfg,
+		argv[port_arg_idx+1], cfg->opts.length))
+		return 1;
+
 	if ((tcfg->socket=socket(AF_INET, SOCK_STREAM, 0))==-1) {
 		perror("failed to create socket");
 		return 1;
@@ -94,6 +262,10 @@ int tcp_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 		return 1;
 	}
 
+	/* buffer sizes have to be set before connecting or listening to
+	 * take effect on the window */
+	tcp_tune(cfg, tcfg->socket, 0);
+
 	abort_fd=tcfg->socket;
 
 	tcfg->dest_addr.sin_family = AF_INET;
@@ -109,6 +281,21 @@ int tcp_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 		return 1;
 	}
 
+	/* listen right away, so a client can connect as soon as the server
+	 * is initialized */
+	if(cfg->opts.server && listen(tcfg->socket, 1)==-1) {
+		perror("failed to listen on socket");
+		return 1;
+	}
+
+	/* data segments only, with IP and TCP header including the time
+	 * stamp option, ACKs ride on the reply */
+	if(cfg->opts.client && !wire_route_ifname(&tcfg->dest_addr, ifname))
+		wire_set_eth(cfg, ifname, cfg->opts.length,
+			sizeof(struct ip)+sizeof(struct tcphdr)+
+			TCPOLEN_TSTAMP_APPA, 1, 0);
+
+	hdr_init(cfg->send_packet, cfg->opts.length);
 
 	return 0;
 }
@@ -123,7 +310,7 @@ int tcp_client(struct cyclicping_cfg *cfg)
 {
 	struct tcp_cfg *tcfg=cfg->current_mod->modcfg;
 	int selectResult;
-	struct timespec tsend, trecv, tserver;
+	struct timespec tsend, trecv;
 	struct timeval timeout;
 	fd_set set;
 	socklen_t dest_addr_len=sizeof(tcfg->dest_addr);
@@ -134,6 +321,8 @@ int tcp_client(struct cyclicping_cfg *cfg)
 		return 1;
 	}
 
+	tcp_tune(cfg, tcfg->socket, 1);
+
 	while(run) {
 		timeout.tv_sec=1;
 		timeout.tv_usec=0;
@@ -142,11 +331,11 @@ int tcp_client(struct cyclicping_cfg *cfg)
 		FD_SET(tcfg->socket, &set);
 
 		/* take timestamp and copy it to send packet */
-		clock_gettime(cfg->opts.clock, &tsend);
-		tspec2buffer(&tsend, cfg->send_packet);
+		hdr_stamp_request(cfg->send_packet, cfg->seq, cfg->opts.clock,
+			&tsend);
 
 		/* send packet to server */
-		if(write(tcfg->socket, cfg->send_packet, cfg->opts.length)!=
+		if(tcp_write(tcfg->socket, cfg->send_packet, cfg->opts.length)!=
 			cfg->opts.length) {
 			fprintf(stderr, "failed to send packet\n");
 			return 1;
@@ -157,7 +346,7 @@ int tcp_client(struct cyclicping_cfg *cfg)
 			&timeout);
 		if (selectResult > 0) {
 			/* read packet and take timestamp */
-			if(read(tcfg->socket, cfg->recv_packet,
+			if(tcp_read(cfg, tcfg->socket, cfg->recv_packet,
 				cfg->opts.length)!=cfg->opts.length) {
 				perror("failed to receive packet");
 				return 1;
@@ -172,21 +361,17 @@ int tcp_client(struct cyclicping_cfg *cfg)
 			return 1;
 		}
 
-		/* add packet time to statistics */
-		if(add_stats(cfg, STAT_ALL, &tsend, &trecv))
+		if(hdr_check(cfg->recv_packet, cfg->opts.length)) {
+			fprintf(stderr, "received invalid packet\n");
 			return 1;
-
-		if(cfg->opts.two_way) {
-			buffer2tspec(cfg->recv_packet+2*sizeof(uint64_t),
-				&tserver);
-			if(add_stats(cfg, STAT_SEND, &tsend, &tserver))
-				return 1;
-			if(add_stats(cfg, STAT_RECV, &tserver, &trecv))
-				return 1;
 		}
 
-		/* print out runtime stats */
-		print_stats(cfg, &tsend, &tserver, &trecv);
+		/* add packet time to statistics and print out runtime
+		 * stats */
+		if(add_packet_stats(cfg, &tsend, cfg->recv_packet, &trecv))
+			return 1;
+
+		cfg->seq++;
 
 		/* wait until start of next interval */
 		if(client_wait(cfg, tsend))
@@ -206,15 +391,13 @@ int tcp_server(struct cyclicping_cfg *cfg)
 {
 	struct tcp_cfg *tcfg=cfg->current_mod->modcfg;
 	int socket;
-	struct timespec tsend;
+	struct timespec trecv;
 	struct sockaddr_in client_addr;
 	socklen_t client_addr_len=sizeof(struct sockaddr_in);
 
 	if(cfg->opts.verbose)
 		printf("listening for connections\n");
 
-	listen(tcfg->socket, 1);
-
 	socket=accept(tcfg->socket,
 		(struct sockaddr*)&client_addr, &client_addr_len);
 	if(socket<0) {
@@ -225,21 +408,29 @@ int tcp_server(struct cyclicping_cfg *cfg)
 	if(cfg->opts.verbose)
 		printf("accepted connection\n");
 
+	tcp_tune(cfg, socket, 1);
+
 	while(run) {
 		/* wait for incoming packet */
-		if(read(socket, cfg->recv_packet, cfg->opts.length)!=
+		if(tcp_read(cfg, socket, cfg->recv_packet, cfg->opts.length)!=
 			cfg->opts.length) {
 			if(cfg->opts.verbose)
 				fprintf(stderr, "failed to read packet\n");
 			break;
 		}
 
-		/* take timestamp and copy to receive buffer */
-		clock_gettime(cfg->opts.clock, &tsend);
-		tspec2buffer(&tsend, cfg->recv_packet+2*sizeof(uint64_t));
+		clock_gettime(cfg->opts.clock, &trecv);
+
+		if(hdr_check(cfg->recv_packet, cfg->opts.length)) {
+			fprintf(stderr, "received invalid packet\n");
+			break;
+		}
+
+		/* copy timestamps to receive buffer */
+		hdr_stamp_reply(cfg->recv_packet, cfg->opts.clock, &trecv);
 
 		/* send received packet back to client */
-		if(write(socket, cfg->recv_packet, cfg->opts.length)!=
+		if(tcp_write(socket, cfg->recv_packet, cfg->opts.length)!=
 			cfg->opts.length) {
 			fprintf(stderr, "failed to write packet\n");
 			break;
@@ -272,6 +463,12 @@ void tcp_deinit(struct cyclicping_cfg *cfg)
 void tcp_usage(void)
 {
 	printf("  tcp - Use a TCP connection\n");
-	printf("    tcp[:port]	        TCP server\n");
-	printf("    tcp:serverip[:port] TCP client\n");
+	printf("    tcp[:port[:flags]]          TCP server\n");
+	printf("    tcp:serverip[:port[:flags]] TCP client\n");
+	printf("    flags: comma separated list of nodelay, quickack (re-armed "
+		"after every read),\n");
+	printf("    busypoll=<us>, lowat=<bytes> (TCP_NOTSENT_LOWAT), "
+		"sndbuf=<bytes>, rcvbuf=<bytes>\n");
+	printf("    or tuned (nodelay, quickack, busypoll=%d, "
+		"lowat=<length>)\n", TCP_TUNED_BUSY_POLL);
 }
@@ -22,11 +22,22 @@
 
 struct cyclicping_cfg;
 
+/* busy poll time of the tuning profile (us) */
+#define TCP_TUNED_BUSY_POLL	50
+
 struct tcp_cfg {
 	struct sockaddr_in dest_addr;
 	struct sockaddr_in local_addr;
 	int port;
 	int socket;
+
+	/* socket tuning, 0 keeps the kernel default */
+	int nodelay;
+	int quickack;
+	int busy_poll;
+	int notsent_lowat;
+	int sndbuf;
+	int rcvbuf;
 };
 
 int tcp_init(struct cyclicping_cfg *cfg, char **argv, int argc);
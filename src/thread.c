@@ -0,0 +1,535 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <inttypes.h>
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include <cyclicping.h>
+#include <opts.h>
+#include <stats.h>
+#include <proto.h>
+#include <futex.h>
+#include <thread.h>
+
+extern int run;
+extern int abort_fd;
+
+static const char *prim_names[]={
+	[THREAD_EVENTFD]="eventfd",
+	[THREAD_FUTEX]="futex",
+	[THREAD_PIPE]="pipe",
+	[THREAD_SOCKETPAIR]="socketpair",
+	[THREAD_CONDVAR]="condvar",
+};
+
+/**
+ * Pin a thread to a CPU.
+ *
+ * \param thread Thread to pin.
+ * \param cpu CPU number, -1 to keep the current affinity.
+ * \return 0 on success.
+ */
+static int thread_pin(pthread_t thread, int cpu)
+{
+	cpu_set_t set;
+
+	if(cpu<0)
+		return 0;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+/**
+ * Read a complete message from a file descriptor.
+ *
+ * \return 0 on success, -1 on error or end of file.
+ */
+static int read_full(int fd, char *buf, int length)
+{
+	int ret, done=0;
+
+	while(done<length) {
+		ret=read(fd, buf+done, length-done);
+		if(ret<=0)
+			return -1;
+		done+=ret;
+	}
+
+	return 0;
+}
+
+/**
+ * Pass a message to the other thread.
+ *
+ * \param tcfg Thread module config.
+ * \param dir Channel.
+ * \param msg Message.
+ * \param length Message length.
+ * \return 0 on success.
+ */
+static int thread_send(struct thread_cfg *tcfg, enum thread_dir dir,
+	const char *msg, int length)
+{
+	struct thread_chan *chan=&tcfg->chan[dir];
+	uint64_t one=1;
+
+	switch(tcfg->prim) {
+	case THREAD_EVENTFD:
+		memcpy(chan->slot, msg, length);
+		if(write(chan->wfd, &one, sizeof(one))!=sizeof(one))
+			return 1;
+		break;
+	case THREAD_FUTEX:
+		memcpy(chan->slot, msg, length);
+		__atomic_add_fetch(&chan->futex, 1, __ATOMIC_RELEASE);
+		futex_wake(&chan->futex, 1);
+		break;
+	case THREAD_PIPE:
+	case THREAD_SOCKETPAIR:
+		if(write(chan->wfd, msg, length)!=length)
+			return 1;
+		break;
+	case THREAD_CONDVAR:
+		pthread_mutex_lock(&chan->mutex);
+		memcpy(chan->slot, msg, length);
+		chan->futex++;
+		pthread_cond_signal(&chan->cond);
+		pthread_mutex_unlock(&chan->mutex);
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * Wait for a message from the other thread.
+ *
+ * \param tcfg Thread module config.
+ * \param dir Channel.
+ * \param msg Buffer for the message.
+ * \param length Message length.
+ * \param timeout Timeout in ms, -1 to wait forever.
+ * \return 0 on success, 1 on timeout, -1 on error or abort.
+ */
+static int thread_recv(struct thread_cfg *tcfg, enum thread_dir dir,
+	char *msg, int length, int timeout)
+{
+	struct thread_chan *chan=&tcfg->chan[dir];
+	struct timespec ts, end;
+	struct pollfd pfd;
+	uint64_t val;
+	int64_t left;
+	int ret;
+
+	switch(tcfg->prim) {
+	case THREAD_EVENTFD:
+	case THREAD_PIPE:
+	case THREAD_SOCKETPAIR:
+		if(timeout>=0) {
+			pfd.fd=chan->rfd;
+			pfd.events=POLLIN;
+			ret=poll(&pfd, 1, timeout);
+			if(ret==0)
+				return 1;
+			if(ret<0)
+				return -1;
+		}
+
+		if(tcfg->prim!=THREAD_EVENTFD)
+			return read_full(chan->rfd, msg, length);
+
+		if(read(chan->rfd, &val, sizeof(val))!=sizeof(val))
+			return -1;
+		memcpy(msg, chan->slot, length);
+		break;
+	case THREAD_FUTEX:
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		end.tv_sec+=timeout/1000;
+		end.tv_nsec+=(timeout%1000)*1000000;
+		if(end.tv_nsec>=NSEC_PER_SEC) {
+			end.tv_nsec-=NSEC_PER_SEC;
+			end.tv_sec++;
+		}
+
+		while(__atomic_load_n(&chan->futex, __ATOMIC_ACQUIRE)==
+			chan->seen) {
+			/* the futex timeout is relative, take what is left
+			 * after a spurious wakeup */
+			if(timeout>=0) {
+				clock_gettime(CLOCK_MONOTONIC, &ts);
+				left=(int64_t)(TSPEC_TO_NSEC((&end))-
+					TSPEC_TO_NSEC((&ts)));
+				if(left<=0)
+					return 1;
+				ts.tv_sec=left/NSEC_PER_SEC;
+				ts.tv_nsec=left%NSEC_PER_SEC;
+			}
+
+			if(futex_wait(&chan->futex, chan->seen,
+				timeout>=0?&ts:NULL)<0) {
+				if(errno==ETIMEDOUT)
+					return 1;
+				if(errno==EINTR && !run)
+					return -1;
+			}
+		}
+		chan->seen++;
+		memcpy(msg, chan->slot, length);
+		break;
+	case THREAD_CONDVAR:
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_sec+=timeout/1000;
+		ts.tv_nsec+=(timeout%1000)*1000000;
+		if(ts.tv_nsec>=NSEC_PER_SEC) {
+			ts.tv_nsec-=NSEC_PER_SEC;
+			ts.tv_sec++;
+		}
+
+		pthread_mutex_lock(&chan->mutex);
+		while(chan->futex==chan->seen) {
+			if(timeout<0) {
+				pthread_cond_wait(&chan->cond, &chan->mutex);
+			} else if(pthread_cond_timedwait(&chan->cond,
+				&chan->mutex, &ts)==ETIMEDOUT) {
+				pthread_mutex_unlock(&chan->mutex);
+				return 1;
+			}
+		}
+		chan->seen++;
+		memcpy(msg, chan->slot, length);
+		pthread_mutex_unlock(&chan->mutex);
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * Server thread. Reflects requests until stopped by thread_deinit().
+ *
+ * \param arg Thread module config.
+ * \return NULL.
+ */
+static void *thread_server_main(void *arg)
+{
+	struct thread_cfg *tcfg=arg;
+	struct cyclicping_cfg *cfg=tcfg->cfg;
+	struct timespec trecv;
+
+	while(1) {
+		if(thread_recv(tcfg, THREAD_REQUEST, tcfg->buffer,
+			cfg->opts.length, -1))
+			break;
+
+		clock_gettime(cfg->opts.clock, &trecv);
+
+		if(__atomic_load_n(&tcfg->stop, __ATOMIC_ACQUIRE))
+			break;
+
+		if(hdr_check(tcfg->buffer, cfg->opts.length))
+			continue;
+
+		/* copy timestamps to reply */
+		hdr_stamp_reply(tcfg->buffer, cfg->opts.clock, &trecv);
+
+		if(thread_send(tcfg, THREAD_REPLY, tcfg->buffer,
+			cfg->opts.length))
+			break;
+	}
+
+	return NULL;
+}
+
+/**
+ * Set up the channels of the selected primitive.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success.
+ */
+static int thread_setup_chans(struct cyclicping_cfg *cfg)
+{
+	struct thread_cfg *tcfg=cfg->current_mod->modcfg;
+	pthread_condattr_t attr;
+	int i, fds[2];
+
+	for(i=THREAD_REQUEST; i<=THREAD_REPLY; i++) {
+		struct thread_chan *chan=&tcfg->chan[i];
+
+		if(posix_memalign((void**)&chan->slot, THREAD_CACHE_LINE,
+			cfg->opts.length)) {
+			fprintf(stderr, "failed to allocate message slot\n");
+			return 1;
+		}
+
+		switch(tcfg->prim) {
+		case THREAD_EVENTFD:
+			chan->rfd=chan->wfd=eventfd(0, 0);
+			if(chan->rfd<0) {
+				perror("failed to create eventfd");
+				return 1;
+			}
+			tcfg->fds[tcfg->nfds++]=chan->rfd;
+			break;
+		case THREAD_PIPE:
+			if(pipe(fds)<0) {
+				perror("failed to create pipe");
+				return 1;
+			}
+			chan->rfd=fds[0];
+			chan->wfd=fds[1];
+			tcfg->fds[tcfg->nfds++]=fds[0];
+			tcfg->fds[tcfg->nfds++]=fds[1];
+			break;
+		case THREAD_SOCKETPAIR:
+			/* one pair carries both directions */
+			if(i==THREAD_REPLY) {
+				chan->rfd=tcfg->chan[THREAD_REQUEST].wfd;
+				chan->wfd=tcfg->chan[THREAD_REQUEST].rfd;
+				break;
+			}
+			if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds)<0) {
+				perror("failed to create socketpair");
+				return 1;
+			}
+			chan->rfd=fds[0];
+			chan->wfd=fds[1];
+			tcfg->fds[tcfg->nfds++]=fds[0];
+			tcfg->fds[tcfg->nfds++]=fds[1];
+			break;
+		case THREAD_CONDVAR:
+			pthread_mutex_init(&chan->mutex, NULL);
+			pthread_condattr_init(&attr);
+			pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+			pthread_cond_init(&chan->cond, &attr);
+			pthread_condattr_destroy(&attr);
+			break;
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Init thread module. Parse module args. Set up the primitive and start
+ * the server thread.
+ *
+ * \param cfg Cyclicping config data.
+ * \param argv Interface module arguments.
+ * \param argc Interface module count.
+ * \return 0 on success.
+ */
+int thread_init(struct cyclicping_cfg *cfg, char **argv, int argc)
+{
+	struct thread_cfg *tcfg;
+	sigset_t set, oldset;
+	int i;
+
+	tcfg=(struct thread_cfg*)calloc(1, sizeof(struct thread_cfg));
+	if(tcfg==NULL) {
+		perror("failed to allocate memory for thread cfg");
+		return 1;
+	}
+
+	cfg->current_mod->modcfg=tcfg;
+	tcfg->cfg=cfg;
+	tcfg->client_cpu=tcfg->server_cpu=-1;
+
+	if(cfg->opts.server) {
+		fprintf(stderr, "thread module runs client and server in one "
+			"process, use client mode\n");
+		return 1;
+	}
+
+	if(argc<2) {
+		fprintf(stderr, "thread primitive required\n");
+		return 1;
+	}
+
+	for(i=THREAD_EVENTFD; i<=THREAD_CONDVAR; i++) {
+		if(strcmp(argv[1], prim_names[i])==0)
+			break;
+	}
+	if(i>THREAD_CONDVAR) {
+		fprintf(stderr, "unknown thread primitive %s\n", argv[1]);
+		return 1;
+	}
+	tcfg->prim=i;
+
+	if(argc>=4) {
+		tcfg->client_cpu=atoi(argv[2]);
+		tcfg->server_cpu=atoi(argv[3]);
+		if(tcfg->client_cpu<0 || tcfg->server_cpu<0) {
+			fprintf(stderr, "invalid thread cpu\n");
+			return 1;
+		}
+	} else if(argc==3) {
+		fprintf(stderr, "client and server cpu required\n");
+		return 1;
+	}
+
+	if(posix_memalign((void**)&tcfg->buffer, THREAD_CACHE_LINE,
+		cfg->opts.length)) {
+		fprintf(stderr, "failed to allocate server buffer\n");
+		return 1;
+	}
+
+	if(thread_setup_chans(cfg))
+		return 1;
+
+	if(thread_pin(pthread_self(), tcfg->client_cpu)) {
+		fprintf(stderr, "failed to pin client thread\n");
+		return 1;
+	}
+
+	/* signals are handled by the client thread only */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, &oldset);
+	i=pthread_create(&tcfg->server, NULL, thread_server_main, tcfg);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if(i) {
+		fprintf(stderr, "failed to create server thread\n");
+		return 1;
+	}
+	tcfg->server_started=1;
+
+	if(thread_pin(tcfg->server, tcfg->server_cpu)) {
+		fprintf(stderr, "failed to pin server thread\n");
+		return 1;
+	}
+
+	hdr_init(cfg->send_packet, cfg->opts.length);
+
+	return 0;
+}
+
+/**
+ * Thread client.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+int thread_client(struct cyclicping_cfg *cfg)
+{
+	struct thread_cfg *tcfg=cfg->current_mod->modcfg;
+	struct timespec tsend, trecv;
+	int ret;
+
+	/* take timestamp and copy it to send packet */
+	hdr_stamp_request(cfg->send_packet, cfg->seq, cfg->opts.clock, &tsend);
+
+	if(thread_send(tcfg, THREAD_REQUEST, cfg->send_packet,
+		cfg->opts.length)) {
+		perror("thread client failed to send message");
+		return 1;
+	}
+
+	ret=thread_recv(tcfg, THREAD_REPLY, cfg->recv_packet,
+		cfg->opts.length, 1000);
+	if(ret<0) {
+		if(!run)
+			return 0;
+		perror("thread client failed to receive message");
+		return 1;
+	} else if(ret) {
+		if(!run)
+			return 0;
+		fprintf(stderr, "thread client timeout receiving message\n");
+		return 1;
+	}
+
+	clock_gettime(cfg->opts.clock, &trecv);
+
+	if(hdr_check(cfg->recv_packet, cfg->opts.length) ||
+		hdr_get_seq(cfg->recv_packet)!=cfg->seq) {
+		fprintf(stderr, "thread client received invalid message\n");
+		return 1;
+	}
+
+	/* add packet time to statistics */
+	if(add_packet_stats(cfg, &tsend, cfg->recv_packet, &trecv))
+		return 1;
+
+	cfg->seq++;
+
+	/* wait until next inverval */
+	return client_wait(cfg, tsend);
+}
+
+/**
+ * Stop server thread and clean up thread module ressources.
+ *
+ * \param cfg Cyclicping config data.
+ */
+void thread_deinit(struct cyclicping_cfg *cfg)
+{
+	struct thread_cfg *tcfg=cfg->current_mod->modcfg;
+	int i;
+
+	if(tcfg->server_started) {
+		__atomic_store_n(&tcfg->stop, 1, __ATOMIC_RELEASE);
+		thread_send(tcfg, THREAD_REQUEST, cfg->send_packet,
+			cfg->opts.length);
+		pthread_join(tcfg->server, NULL);
+	}
+
+	for(i=0; i<tcfg->nfds; i++)
+		close(tcfg->fds[i]);
+
+	for(i=THREAD_REQUEST; i<=THREAD_REPLY; i++) {
+		if(tcfg->prim==THREAD_CONDVAR) {
+			pthread_mutex_destroy(&tcfg->chan[i].mutex);
+			pthread_cond_destroy(&tcfg->chan[i].cond);
+		}
+		free(tcfg->chan[i].slot);
+	}
+
+	free(tcfg->buffer);
+	free(tcfg);
+}
+
+/**
+ * Ouput thread interface module usage.
+ */
+void thread_usage(void)
+{
+	printf("  thread - Ping-pong between two threads of the client "
+		"process\n");
+	printf("    thread:primitive[:clientcpu:servercpu]   thread client\n");
+	printf("    primitive is eventfd, futex, pipe, socketpair or "
+		"condvar\n");
+}
@@ -0,0 +1,73 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __THREAD_H__
+#define __THREAD_H__
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define THREAD_CACHE_LINE	64
+
+enum thread_prim {
+	THREAD_EVENTFD=0,
+	THREAD_FUTEX,
+	THREAD_PIPE,
+	THREAD_SOCKETPAIR,
+	THREAD_CONDVAR,
+};
+
+/* direction of a channel */
+enum thread_dir {
+	THREAD_REQUEST=0,
+	THREAD_REPLY,
+};
+
+/* One direction of the ping-pong. Primitives which only signal pass the
+ * message through the slot, the others transfer it through the fds. */
+struct thread_chan {
+	uint32_t futex __attribute__((aligned(THREAD_CACHE_LINE)));
+	uint32_t seen __attribute__((aligned(THREAD_CACHE_LINE)));
+	int rfd;
+	int wfd;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	char *slot;
+};
+
+struct thread_cfg {
+	struct thread_chan chan[THREAD_REPLY+1];
+	enum thread_prim prim;
+	int client_cpu;
+	int server_cpu;
+	int fds[4];
+	int nfds;
+	int stop;
+	int server_started;
+	pthread_t server;
+	char *buffer;
+	struct cyclicping_cfg *cfg;
+};
+
+int thread_init(struct cyclicping_cfg *cfg, char **argv, int argc);
+int thread_client(struct cyclicping_cfg *cfg);
+void thread_deinit(struct cyclicping_cfg *cfg);
+void thread_usage(void);
+
+#endif
@@ -26,6 +26,9 @@
 #include <inttypes.h>
 #include <termios.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
 
 #include <termio.h>
 #include <linux/serial.h>
@@ -35,7 +38,9 @@
 #include <cyclicping.h>
 #include <opts.h>
 #include <stats.h>
+#include <proto.h>
 #include <uart.h>
+#include <wire.h>
 
 extern int run;
 extern int abort_fd;
@@ -59,6 +64,181 @@ static int rate_to_constant(int baudrate) {
 #undef B
 }
 
+/**
+ * Parse comma separated uart module flags.
+ *
+ * \param ucfg UART module config.
+ * \param arg Flags argument.
+ * \return 0 on success.
+ */
+static int uart_parse_flags(struct uart_cfg *ucfg, char *arg)
+{
+	char *saveptr=NULL;
+	char *flag;
+
+	for(flag=strtok_r(arg, ",", &saveptr); flag;
+		flag=strtok_r(NULL, ",", &saveptr)) {
+		if(strcmp(flag, "lowlat")==0) {
+			ucfg->low_latency=1;
+		} else if(strcmp(flag, "bytetime")==0) {
+			ucfg->byte_timing=1;
+		} else if(sscanf(flag, "fifo=%d", &ucfg->fifo_trigger)==1 &&
+			ucfg->fifo_trigger>0) {
+		} else {
+			fprintf(stderr, "unknown uart flag %s\n", flag);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Set the ASYNC_LOW_LATENCY flag of the serial driver. The original flags
+ * get restored by uart_deinit().
+ *
+ * \param ucfg UART module config.
+ * \return 0 on success.
+ */
+static int uart_set_low_latency(struct uart_cfg *ucfg)
+{
+	struct serial_struct serinfo;
+
+	if(ioctl(ucfg->fd, TIOCGSERIAL, &serinfo)<0) {
+		perror("failed to retrieve uart port info for low latency "
+			"mode");
+		return 1;
+	}
+
+	ucfg->serial_flags=serinfo.flags;
+	serinfo.flags|=ASYNC_LOW_LATENCY;
+	if(ioctl(ucfg->fd, TIOCSSERIAL, &serinfo)<0) {
+		perror("failed to set uart low latency mode");
+		return 1;
+	}
+	ucfg->restore_serial=1;
+
+	return 0;
+}
+
+/**
+ * Read or write the rx FIFO trigger level of a uart (8250 driver sysfs
+ * attribute).
+ *
+ * \param path Path of the rx_trig_bytes attribute.
+ * \param value Value to write or NULL to read.
+ * \return Trigger level or -1 on error.
+ */
+static int uart_fifo_trigger(const char *path, const int *value)
+{
+	FILE *f;
+	int level=-1;
+
+	f=fopen(path, value?"w":"r");
+	if(f==NULL)
+		return -1;
+
+	if(value) {
+		if(fprintf(f, "%d\n", *value)>0)
+			level=*value;
+	} else if(fscanf(f, "%d", &level)!=1) {
+		level=-1;
+	}
+
+	if(fclose(f))
+		level=-1;
+
+	return level;
+}
+
+/**
+ * Set the rx FIFO trigger level. The driver rounds to the next supported
+ * level, the level in effect gets reported. The original level gets
+ * restored by uart_deinit().
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success.
+ */
+static int uart_set_fifo_trigger(struct cyclicping_cfg *cfg)
+{
+	struct uart_cfg *ucfg=cfg->current_mod->modcfg;
+	char path[PATH_MAX];
+	int level;
+
+	if(realpath(ucfg->device, path)==NULL) {
+		perror("failed to resolve uart device");
+		return 1;
+	}
+	snprintf(ucfg->trigger_path, sizeof(ucfg->trigger_path),
+		"/sys/class/tty/%s/rx_trig_bytes", basename(path));
+
+	ucfg->orig_trigger=uart_fifo_trigger(ucfg->trigger_path, NULL);
+	if(ucfg->orig_trigger<0 || uart_fifo_trigger(ucfg->trigger_path,
+		&ucfg->fifo_trigger)<0) {
+		ucfg->trigger_path[0]=0;
+		fprintf(stderr, "uart %s has no configurable rx fifo trigger\n",
+			ucfg->device);
+		return 1;
+	}
+
+	level=uart_fifo_trigger(ucfg->trigger_path, NULL);
+	if(!cfg->opts.quiet)
+		printf("uart rx fifo trigger: %d bytes (requested %d)\n",
+			level, ucfg->fifo_trigger);
+
+	return 0;
+}
+
+/**
+ * Read a frame in chunks, as a single read can't wait for more than
+ * UART_MAX_VMIN bytes.
+ *
+ * \param ucfg UART module config.
+ * \param buffer Frame buffer.
+ * \param length Frame length.
+ * \param clock Clock to use for time stamping.
+ * \param tfirst Time the first byte arrived gets stored here (or NULL).
+ * \return Number of bytes read, 0 on end of file or -1 on error.
+ */
+static int uart_read(struct uart_cfg *ucfg, char *buffer, int length,
+	int clock, struct timespec *tfirst)
+{
+	int ret, done=0;
+
+	do {
+		ret=read(ucfg->fd, buffer+done, length-done);
+		if(ret<0 && errno==EINTR && run)
+			continue;
+		if(ret<=0)
+			return ret;
+		if(!done && tfirst)
+			clock_gettime(clock, tfirst);
+		done+=ret;
+	} while(done<length);
+
+	return done;
+}
+
+/**
+ * Get the number of bits a character takes on the wire.
+ *
+ * \param ti UART settings.
+ * \return Start, data, parity and stop bits.
+ */
+static int uart_char_bits(const struct termios *ti)
+{
+	int bits;
+
+	switch(ti->c_cflag & CSIZE) {
+	case CS5: bits=5; break;
+	case CS6: bits=6; break;
+	case CS7: bits=7; break;
+	default: bits=8; break;
+	}
+
+	return 1+bits+(ti->c_cflag & PARENB?1:0)+(ti->c_cflag & CSTOPB?2:1);
+}
+
 /**
  * Init UART connection module. Parse module args. Set UART options. Open
  * UART fd.
@@ -105,7 +285,18 @@ int uart_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 		ucfg->flow_ctrl=atoi(argv[3]);
 	}
 
-	ucfg->fd=open(ucfg->device, O_RDWR | O_NOCTTY);
+	if(argc>4 && uart_parse_flags(ucfg, argv[4]))
+		return 1;
+
+	/* client reports first byte and frame time */
+	cfg->frame_timing=cfg->opts.client && ucfg->byte_timing;
+
+	/* an already open descriptor (self-test pty master) is duplicated,
+	 * reopening it through /dev/fd would allocate a new pty */
+	if(!strncmp(ucfg->device, "/dev/fd/", strlen("/dev/fd/")))
+		ucfg->fd=dup(atoi(ucfg->device+strlen("/dev/fd/")));
+	else
+		ucfg->fd=open(ucfg->device, O_RDWR | O_NOCTTY);
 	if(ucfg->fd<=0)
 	{
 		perror("open");
@@ -115,6 +306,12 @@ int uart_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 
 	tcflush(ucfg->fd, TCIOFLUSH);
 
+	if(ucfg->low_latency && uart_set_low_latency(ucfg))
+		return 1;
+
+	if(ucfg->fifo_trigger && uart_set_fifo_trigger(cfg))
+		return 1;
+
 	if(!ucfg->baud_rate) {
 		/* Custom divisor */
 		serinfo.reserved_char[0] = 0;
@@ -159,8 +356,12 @@ int uart_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 	else
 		ti.c_cflag &= ~CRTSCTS;
 
-	/* minimal packet length, read will return */
-	ti.c_cc[VMIN]=cfg->opts.length;
+	/* minimal packet length, read will return. Longer frames are read
+	 * in chunks, with byte timing every byte is picked up as soon as it
+	 * arrives. */
+	ti.c_cc[VMIN]=ucfg->byte_timing?1:(cfg->opts.length<UART_MAX_VMIN?
+		cfg->opts.length:UART_MAX_VMIN);
+	ti.c_cc[VTIME]=0;
 
 	/* set input and output speed */
 	if(cfsetispeed(&ti, ucfg->baud_rate)) {
@@ -186,6 +387,13 @@ int uart_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 
 	tcflush(ucfg->fd, TCIOFLUSH);
 
+	/* only a real uart has a wire time, a pty or a USB device without
+	 * serial port info transfers at its own speed */
+	if(cfg->opts.client && !ioctl(ucfg->fd, TIOCGSERIAL, &serinfo))
+		wire_set_uart(cfg, rate, uart_char_bits(&ti));
+
+	hdr_init(cfg->send_packet, cfg->opts.length);
+
 	return 0;
 }
 
@@ -199,7 +407,7 @@ int uart_client(struct cyclicping_cfg *cfg)
 {
 	struct uart_cfg *ucfg=cfg->current_mod->modcfg;
 	int selectResult;
-	struct timespec tsend, trecv, tserver;
+	struct timespec tsend, trecv, tfirst;
 	struct timeval timeout;
 	fd_set set;
 
@@ -210,8 +418,7 @@ int uart_client(struct cyclicping_cfg *cfg)
 	timeout.tv_usec=0;
 
 	/* take timestamp and copy it to send packet */
-	clock_gettime(cfg->opts.clock, &tsend);
-	tspec2buffer(&tsend, cfg->send_packet);
+	hdr_stamp_request(cfg->send_packet, cfg->seq, cfg->opts.clock, &tsend);
 
 	/* send packet to server */
 	if(write(ucfg->fd, cfg->send_packet, cfg->opts.length)!=
@@ -224,8 +431,8 @@ int uart_client(struct cyclicping_cfg *cfg)
 	selectResult = select(ucfg->fd+1, &set, NULL, NULL, &timeout);
 	if (selectResult > 0) {
 		/* receive packet and take timestamp */
-		if(read(ucfg->fd, cfg->recv_packet,
-			cfg->opts.length)!=cfg->opts.length) {
+		if(uart_read(ucfg, cfg->recv_packet, cfg->opts.length,
+			cfg->opts.clock, &tfirst)!=cfg->opts.length) {
 			perror("uart client failed to receive packet");
 			return 1;
 		}
@@ -239,19 +446,23 @@ int uart_client(struct cyclicping_cfg *cfg)
 		return 1;
 	}
 
-	/* add packet time to statistics */
-	if(add_stats(cfg, STAT_ALL, &tsend, &trecv))
+	if(hdr_check(cfg->recv_packet, cfg->opts.length)) {
+		fprintf(stderr, "uart client received invalid packet\n");
 		return 1;
+	}
 
-	if(cfg->opts.two_way) {
-		buffer2tspec(cfg->recv_packet+2*sizeof(uint64_t), &tserver);
-		if(add_stats(cfg, STAT_SEND, &tsend, &tserver))
-			return 1;
-		if(add_stats(cfg, STAT_RECV, &tserver, &trecv))
+	/* separate driver and wire time of the reply */
+	if(ucfg->byte_timing) {
+		if(add_stats(cfg, STAT_FIRST, &tsend, &tfirst) ||
+			add_stats(cfg, STAT_FRAME, &tfirst, &trecv))
 			return 1;
 	}
 
-	print_stats(cfg, &tsend, &tserver, &trecv);
+	/* add packet time to statistics */
+	if(add_packet_stats(cfg, &tsend, cfg->recv_packet, &trecv))
+		return 1;
+
+	cfg->seq++;
 
 	/* wait until next inverval */
 	return client_wait(cfg, tsend);
@@ -266,18 +477,27 @@ int uart_client(struct cyclicping_cfg *cfg)
 int uart_server(struct cyclicping_cfg *cfg)
 {
 	struct uart_cfg *ucfg=cfg->current_mod->modcfg;
-	struct timespec tsend;
+	struct timespec trecv;
 
 	/* wait for packet */
-	if(read(ucfg->fd, cfg->recv_packet, cfg->opts.length)!=
-		cfg->opts.length) {
+	if(uart_read(ucfg, cfg->recv_packet, cfg->opts.length,
+		cfg->opts.clock, NULL)!=cfg->opts.length) {
+		/* interrupted at the end of the test */
+		if(errno==EINTR && !run)
+			return 0;
 		perror("uart server failed to receive packet");
 		return 1;
 	}
+	clock_gettime(cfg->opts.clock, &trecv);
+
+	if(hdr_check(cfg->recv_packet, cfg->opts.length)) {
+		fprintf(stderr, "uart server received invalid packet\n");
+		tcflush(ucfg->fd, TCIFLUSH);
+		return 0;
+	}
 
-	/* take timestamp and copy it to received packet */
-	clock_gettime(cfg->opts.clock, &tsend);
-	tspec2buffer(&tsend, cfg->recv_packet+2*sizeof(uint64_t));
+	/* copy timestamps to received packet */
+	hdr_stamp_reply(cfg->recv_packet, cfg->opts.clock, &trecv);
 
 	/* send received packet back to the server */
 	if(write(ucfg->fd, cfg->recv_packet, cfg->opts.length)!=
@@ -297,6 +517,18 @@ int uart_server(struct cyclicping_cfg *cfg)
 void uart_deinit(struct cyclicping_cfg *cfg)
 {
 	struct uart_cfg *ucfg=cfg->current_mod->modcfg;
+	struct serial_struct serinfo;
+
+	if(ucfg->trigger_path[0])
+		uart_fifo_trigger(ucfg->trigger_path, &ucfg->orig_trigger);
+
+	if(ucfg->restore_serial && !ioctl(ucfg->fd, TIOCGSERIAL, &serinfo)) {
+		serinfo.flags=ucfg->serial_flags;
+		ioctl(ucfg->fd, TIOCSSERIAL, &serinfo);
+	}
+
+	if(ucfg->fd>0)
+		close(ucfg->fd);
 
 	free(ucfg);
 }
@@ -307,6 +539,10 @@ void uart_deinit(struct cyclicping_cfg *cfg)
 void uart_usage(void)
 {
 	printf("  uart - Use UART connection\n");
-	printf("    uart:device[:baud[:flow]] UART server\n");
-	printf("    uart:device[:baud[:flow]] UART client\n");
+	printf("    uart:device[:baud[:flow[:flags]]] UART server\n");
+	printf("    uart:device[:baud[:flow[:flags]]] UART client\n");
+	printf("    flags: comma separated list of lowlat (driver low latency "
+		"mode),\n");
+	printf("    fifo=<bytes> (rx fifo trigger level), bytetime (time "
+		"first and last byte)\n");
 }
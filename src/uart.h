@@ -20,11 +20,24 @@
 #ifndef __UART_H__
 #define __UART_H__
 
+/* largest read chunk, VMIN is a cc_t */
+#define UART_MAX_VMIN	255
+
 struct uart_cfg {
 	int fd;
 	int flow_ctrl;
 	int baud_rate;
 	char *device;
+
+	int low_latency;
+	int fifo_trigger;
+	int byte_timing;
+
+	/* settings to restore on exit */
+	int serial_flags;
+	int restore_serial;
+	char trigger_path[128];
+	int orig_trigger;
 };
 
 int uart_init(struct cyclicping_cfg *cfg, char **argv, int argc);
@@ -24,18 +24,114 @@
 #include <signal.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <errno.h>
 
 #include <sys/select.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
 
 #include <cyclicping.h>
 #include <opts.h>
 #include <stats.h>
 #include <socket.h>
+#include <proto.h>
 #include <udp.h>
+#include <wire.h>
 
 extern int run;
 extern int abort_fd;
 
+/**
+ * Parse multicast arguments and set up the socket for multicast. The client
+ * sends to the group, servers join it and reply with their responder ID.
+ *
+ * \param cfg Cyclicping config data.
+ * \param argv Remaining module arguments (client: responders, server:
+ *             group and id, both optionally followed by the interface
+ *             address).
+ * \param argc Remaining module argument count.
+ * \return 0 on success.
+ */
+static int udp_multicast_init(struct cyclicping_cfg *cfg, char **argv,
+	int argc)
+{
+	struct udp_cfg *ucfg=cfg->current_mod->modcfg;
+	int one=1, ifaddr_idx;
+
+	if(cfg->opts.client) {
+		cfg->responders=argc>=1?atoi(argv[0]):1;
+		if(cfg->responders<=0) {
+			fprintf(stderr, "invalid number of responders\n");
+			return 1;
+		}
+		ifaddr_idx=1;
+
+		ucfg->recv_time=(struct timespec*)calloc(cfg->responders,
+			sizeof(struct timespec));
+		if(ucfg->recv_time==NULL) {
+			perror("failed to allocate responder memory");
+			return 1;
+		}
+	} else {
+		if(argc<2) {
+			fprintf(stderr, "multicast group and responder id "
+				"required\n");
+			return 1;
+		}
+		if(inet_aton(argv[0], &ucfg->mreq.imr_multiaddr)==0 ||
+			!IN_MULTICAST(ntohl(ucfg->mreq.imr_multiaddr.s_addr))) {
+			fprintf(stderr, "invalid multicast group\n");
+			return 1;
+		}
+		ucfg->responder=atoi(argv[1]);
+		if(ucfg->responder<0) {
+			fprintf(stderr, "invalid responder id\n");
+			return 1;
+		}
+		ifaddr_idx=2;
+
+		/* several responders may share a host */
+		setsockopt(ucfg->socket, SOL_SOCKET, SO_REUSEADDR, &one,
+			sizeof(one));
+	}
+
+	ucfg->mreq.imr_interface.s_addr=htonl(INADDR_ANY);
+	if(argc>ifaddr_idx && inet_aton(argv[ifaddr_idx],
+		&ucfg->mreq.imr_interface)==0) {
+		fprintf(stderr, "invalid multicast interface address\n");
+		return 1;
+	}
+
+	if(cfg->opts.client && argc>ifaddr_idx && setsockopt(ucfg->socket,
+		IPPROTO_IP, IP_MULTICAST_IF, &ucfg->mreq.imr_interface,
+		sizeof(ucfg->mreq.imr_interface))<0) {
+		perror("failed to set multicast interface");
+		return 1;
+	}
+
+	ucfg->multicast=1;
+
+	return 0;
+}
+
+/**
+ * Join the multicast group on the server.
+ *
+ * \param ucfg UDP module config.
+ * \return 0 on success.
+ */
+static int udp_multicast_join(struct udp_cfg *ucfg)
+{
+	if(setsockopt(ucfg->socket, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+		&ucfg->mreq, sizeof(ucfg->mreq))<0) {
+		perror("failed to join multicast group");
+		return 1;
+	}
+
+	return 0;
+}
+
 /**
  * Init UDP connection module. Parse module args. Open socket. Set socket
  * priority.
@@ -49,6 +145,7 @@ int udp_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 {
 	struct udp_cfg *ucfg;
 	int port_arg_idx=1;
+	char ifname[IFNAMSIZ];
 
 	ucfg=(struct udp_cfg*)calloc(1, sizeof(struct udp_cfg));
 	if(ucfg==NULL) {
@@ -87,6 +184,18 @@ int udp_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 		return 1;
 	}
 
+	/* client sending to a group address or server given a group */
+	if((cfg->opts.client &&
+		IN_MULTICAST(ntohl(ucfg->dest_addr.sin_addr.s_addr))) ||
+		(cfg->opts.server && argc>port_arg_idx+1)) {
+		if(udp_multicast_init(cfg, argv+port_arg_idx+1,
+			argc-port_arg_idx-1))
+			return 1;
+	} else if(argc>port_arg_idx+1) {
+		fprintf(stderr, "too many udp arguments\n");
+		return 1;
+	}
+
 	if(set_socket_priority(ucfg->socket, cfg->opts.sopriority)) {
 		return 1;
 	}
@@ -95,6 +204,13 @@ int udp_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 		return 1;
 	}
 
+	/* etf sends frames at their launch time */
+	if(cfg->qdisc.txtime) {
+		if(set_socket_txtime(ucfg->socket))
+			return 1;
+		cfg->qdisc.txtime_set=1;
+	}
+
 	abort_fd=ucfg->socket;
 
 	ucfg->dest_addr.sin_family = AF_INET;
@@ -110,75 +226,195 @@ int udp_init(struct cyclicping_cfg *cfg, char **argv, int argc)
 		return 1;
 	}
 
+	if(ucfg->multicast && cfg->opts.server && udp_multicast_join(ucfg))
+		return 1;
+
+	/* IP and UDP header, IP fragments carry multiples of 8 bytes */
+	if(cfg->opts.client && !wire_route_ifname(&ucfg->dest_addr, ifname))
+		wire_set_eth(cfg, ifname, sizeof(struct udphdr)+
+			cfg->opts.length, sizeof(struct ip), 8, 0);
+
+	hdr_init(cfg->send_packet, cfg->opts.length);
 
 	return 0;
 }
 
 /**
- * UDP client.
+ * UDP multicast client. Sends a request to the group and collects the
+ * replies of all responders.
  *
  * \param cfg Cyclicping config data.
  * \return 0 on success, else 1.
  */
-int udp_client(struct cyclicping_cfg *cfg)
+static int udp_multicast_client(struct cyclicping_cfg *cfg)
 {
 	struct udp_cfg *ucfg=cfg->current_mod->modcfg;
-	int selectResult;
-	struct timespec tsend, trecv, tserver;
+	int selectResult, len, i, replies=0;
+	struct timespec tsend, trecv, left;
 	struct timeval timeout;
+	uint32_t id, seq;
 	fd_set set;
-	socklen_t dest_addr_len=sizeof(ucfg->dest_addr);
-
-	FD_ZERO(&set);
-	FD_SET(ucfg->socket, &set);
 
-	timeout.tv_sec=1;
-	timeout.tv_usec=0;
+	for(i=0; i<cfg->responders; i++)
+		ucfg->recv_time[i].tv_sec=ucfg->recv_time[i].tv_nsec=0;
 
 	/* take timestamp and copy it to send packet */
-	clock_gettime(cfg->opts.clock, &tsend);
-	tspec2buffer(&tsend, cfg->send_packet);
+	hdr_stamp_request(cfg->send_packet, cfg->seq, cfg->opts.clock, &tsend);
 
-	/* send packet to server */
-	if(sendto(ucfg->socket, cfg->send_packet, cfg->opts.length, 0,
+	/* send packet to the group */
+	if(sendto_txtime(ucfg->socket, cfg->send_packet, cfg->opts.length,
 		(const struct sockaddr *)&ucfg->dest_addr,
-		dest_addr_len)==-1) {
+		sizeof(ucfg->dest_addr), cfg->qdisc.txtime)==-1) {
 		perror("udp client failed to send packet");
 		return 1;
 	}
 
-	/* monitor socket fd via select */
-	selectResult = select(ucfg->socket+1, &set, NULL, NULL, &timeout);
-	if (selectResult > 0) {
+	/* collect the replies until all responders replied or the request
+	 * timed out, late replies to earlier requests are counted and
+	 * skipped */
+	while(run && replies<cfg->responders) {
+		if(reply_timeout(cfg, &tsend, &left))
+			break;
+		timeout.tv_sec=left.tv_sec;
+		timeout.tv_usec=left.tv_nsec/1000;
+
+		FD_ZERO(&set);
+		FD_SET(ucfg->socket, &set);
+
+		selectResult=select(ucfg->socket+1, &set, NULL, NULL,
+			&timeout);
+		if(selectResult==0)
+			continue;
+		if(selectResult<0) {
+			if(errno==EINTR)
+				continue;
+			fprintf(stderr, "udp client select failed\n");
+			return 1;
+		}
+
 		/* receive packet and take timestamp */
-		if(recv(ucfg->socket, cfg->recv_packet,
-			cfg->opts.length, 0)==-1) {
+		if((len=recv(ucfg->socket, cfg->recv_packet,
+			cfg->opts.length, 0))==-1) {
 			perror("udp client failed to receive packet");
 			return 1;
 		}
 		clock_gettime(cfg->opts.clock, &trecv);
-	} else if(selectResult == 0) {
-		fprintf(stderr, "udp client timeout receiving packet\n");
-		return 1;
+
+		if(hdr_check(cfg->recv_packet, len) ||
+			!(hdr_get_flags(cfg->recv_packet) & CP_FLAG_REPLY))
+			continue;
+
+		seq=hdr_get_seq(cfg->recv_packet);
+		if(seq!=cfg->seq) {
+			match_reply(cfg, seq);
+			continue;
+		}
+
+		id=hdr_get_responder(cfg->recv_packet);
+		if(id>=cfg->responders) {
+			fprintf(stderr, "udp client reply from unexpected "
+				"responder %u\n", id);
+			continue;
+		}
+
+		if(ucfg->recv_time[id].tv_sec || ucfg->recv_time[id].tv_nsec) {
+			cfg->seqs.duplicate++;
+			continue;
+		}
+
+		ucfg->recv_time[id]=trecv;
+		replies++;
 	}
-	else {
-		fprintf(stderr, "udp client select failed\n");
+
+	/* add packet times to statistics, of a partial cycle too */
+	if(replies && add_fanout_stats(cfg, &tsend, ucfg->recv_time))
 		return 1;
-	}
 
-	/* add packet time to statistics */
-	if(add_stats(cfg, STAT_ALL, &tsend, &trecv))
+	fanout_complete(cfg, replies);
+
+	cfg->seq++;
+
+	/* wait until next inverval */
+	return client_wait(cfg, tsend);
+}
+
+/**
+ * UDP client.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+int udp_client(struct cyclicping_cfg *cfg)
+{
+	struct udp_cfg *ucfg=cfg->current_mod->modcfg;
+	int selectResult, len=0;
+	struct timespec tsend, trecv, left;
+	struct timeval timeout;
+	fd_set set;
+	socklen_t dest_addr_len=sizeof(ucfg->dest_addr);
+
+	if(ucfg->multicast)
+		return udp_multicast_client(cfg);
+
+	/* take timestamp and copy it to send packet */
+	hdr_stamp_request(cfg->send_packet, cfg->seq, cfg->opts.clock, &tsend);
+
+	/* send packet to server */
+	if(sendto_txtime(ucfg->socket, cfg->send_packet, cfg->opts.length,
+		(const struct sockaddr *)&ucfg->dest_addr, dest_addr_len,
+		cfg->qdisc.txtime)==-1) {
+		perror("udp client failed to send packet");
 		return 1;
+	}
 
-	if(cfg->opts.two_way) {
-		buffer2tspec(cfg->recv_packet+2*sizeof(uint64_t), &tserver);
-		if(add_stats(cfg, STAT_SEND, &tsend, &tserver))
+	/* wait for the reply to this request, late replies to earlier
+	 * requests are counted and skipped */
+	while(run) {
+		if(reply_timeout(cfg, &tsend, &left)) {
+			reply_lost(cfg);
+			break;
+		}
+		timeout.tv_sec=left.tv_sec;
+		timeout.tv_usec=left.tv_nsec/1000;
+
+		FD_ZERO(&set);
+		FD_SET(ucfg->socket, &set);
+
+		/* monitor socket fd via select */
+		selectResult=select(ucfg->socket+1, &set, NULL, NULL,
+			&timeout);
+		if(selectResult==0)
+			continue;
+		if(selectResult<0) {
+			if(errno==EINTR)
+				continue;
+			fprintf(stderr, "udp client select failed\n");
 			return 1;
-		if(add_stats(cfg, STAT_RECV, &tserver, &trecv))
+		}
+
+		/* receive packet and take timestamp */
+		if((len=recv(ucfg->socket, cfg->recv_packet,
+			cfg->opts.length, 0))==-1) {
+			perror("udp client failed to receive packet");
+			return 1;
+		}
+		clock_gettime(cfg->opts.clock, &trecv);
+
+		if(hdr_check(cfg->recv_packet, len))
+			continue;
+
+		if(match_reply(cfg, hdr_get_seq(cfg->recv_packet))!=
+			REPLY_CURRENT)
+			continue;
+
+		/* add packet time to statistics */
+		if(add_packet_stats(cfg, &tsend, cfg->recv_packet, &trecv))
 			return 1;
+
+		break;
 	}
 
-	print_stats(cfg, &tsend, &tserver, &trecv);
+	cfg->seq++;
 
 	/* wait until next inverval */
 	return client_wait(cfg, tsend);
@@ -193,24 +429,40 @@ int udp_client(struct cyclicping_cfg *cfg)
 int udp_server(struct cyclicping_cfg *cfg)
 {
 	struct udp_cfg *ucfg=cfg->current_mod->modcfg;
-	struct timespec tsend;
+	struct timespec trecv;
 	struct sockaddr_storage peer_addr;
 	socklen_t peer_addr_len=sizeof(struct sockaddr_storage);
+	int len;
 
 	/* wait for packet */
-	if(recvfrom(ucfg->socket, cfg->recv_packet, cfg->opts.length, 0,
-		(struct sockaddr*)&peer_addr, &peer_addr_len)==-1) {
+	if((len=recvfrom(ucfg->socket, cfg->recv_packet, cfg->opts.length, 0,
+		(struct sockaddr*)&peer_addr, &peer_addr_len))==-1) {
+		/* interrupted at the end of the test */
+		if(errno==EINTR && !run)
+			return 0;
 		perror("udp server failed to receive packet");
 		return 1;
 	}
+	clock_gettime(cfg->opts.clock, &trecv);
+
+	/* not a cyclicping packet, ignore it */
+	if(hdr_check(cfg->recv_packet, len))
+		return 0;
 
-	/* take timestamp and copy it to received packet */
-	clock_gettime(cfg->opts.clock, &tsend);
-	tspec2buffer(&tsend, cfg->recv_packet+2*sizeof(uint64_t));
+	/* requests only, other responders' replies might be looped back */
+	if(hdr_get_flags(cfg->recv_packet) & CP_FLAG_REPLY)
+		return 0;
 
-	/* send received packet back to the server */
-	if(sendto(ucfg->socket, cfg->recv_packet, cfg->opts.length, 0,
-		(const struct sockaddr *)&peer_addr, peer_addr_len)==-1) {
+	hdr_set_responder(cfg->recv_packet, ucfg->responder);
+
+	/* copy timestamps to received packet */
+	hdr_stamp_reply(cfg->recv_packet, cfg->opts.clock, &trecv);
+
+	/* send received packet back with the length it came with, a
+	 * sweeping client changes the length */
+	if(sendto_txtime(ucfg->socket, cfg->recv_packet, len,
+		(const struct sockaddr *)&peer_addr, peer_addr_len,
+		cfg->qdisc.txtime)==-1) {
 		perror("udp server failed to send packet");
 		return 1;
 	}
@@ -227,6 +479,9 @@ void udp_deinit(struct cyclicping_cfg *cfg)
 {
 	struct udp_cfg *ucfg=cfg->current_mod->modcfg;
 
+	if(ucfg->recv_time)
+		free(ucfg->recv_time);
+
 	free(ucfg);
 }
 
@@ -238,4 +493,8 @@ void udp_usage(void)
 	printf("  udp - Use a UDP connection\n");
 	printf("    udp[:port]          UDP server\n");
 	printf("    udp:serverip[:port] UDP client\n");
+	printf("    udp:port:group:id[:ifaddr]              "
+		"UDP multicast responder\n");
+	printf("    udp:group:port[:responders[:ifaddr]]    "
+		"UDP multicast client\n");
 }
@@ -23,8 +23,12 @@
 struct udp_cfg {
 	struct sockaddr_in dest_addr;
 	struct sockaddr_in local_addr;
+	struct ip_mreq mreq;
 	int port;
 	int socket;
+	int multicast;
+	int responder;
+	struct timespec *recv_time;
 };
 
 int udp_init(struct cyclicping_cfg *cfg, char **argv, int argc);
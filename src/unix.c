@@ -0,0 +1,360 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include <cyclicping.h>
+#include <opts.h>
+#include <stats.h>
+#include <socket.h>
+#include <proto.h>
+#include <unix.h>
+
+extern int run;
+extern int abort_fd;
+
+/**
+ * Read a message. Stream sockets may return it in pieces.
+ *
+ * \param socket Socket to read from.
+ * \param type Socket type.
+ * \param buffer Message buffer.
+ * \param length Message length.
+ * \return Number of bytes read, 0 on end of file or -1 on error.
+ */
+static int unix_read(int socket, int type, char *buffer, int length)
+{
+	int ret, done=0;
+
+	do {
+		ret=read(socket, buffer+done, length-done);
+		if(ret<=0)
+			return ret;
+		done+=ret;
+	} while(type==SOCK_STREAM && done<length);
+
+	return done;
+}
+
+/**
+ * Init unix domain socket module. Parse module args. Open socket. The
+ * server binds to the given address, the client connects to it.
+ *
+ * \param cfg Cyclicping config data.
+ * \param argv Interface module arguments.
+ * \param argc Interface module count.
+ * \return 0 on success.
+ */
+int unix_init(struct cyclicping_cfg *cfg, char **argv, int argc)
+{
+	struct unix_cfg *ucfg;
+	sa_family_t family=AF_UNIX;
+	size_t path_len;
+
+	ucfg=(struct unix_cfg*)calloc(1, sizeof(struct unix_cfg));
+	if(ucfg==NULL) {
+		perror("failed to allocate memory for unix cfg");
+		return 1;
+	}
+
+	cfg->current_mod->modcfg=ucfg;
+
+	if(argc<3) {
+		fprintf(stderr, "socket type and path required\n");
+		return 1;
+	}
+
+	if(strcmp(argv[1], "dgram")==0) {
+		ucfg->type=SOCK_DGRAM;
+	} else if(strcmp(argv[1], "seqpacket")==0) {
+		ucfg->type=SOCK_SEQPACKET;
+	} else if(strcmp(argv[1], "stream")==0) {
+		ucfg->type=SOCK_STREAM;
+	} else {
+		fprintf(stderr, "unknown unix socket type %s\n", argv[1]);
+		return 1;
+	}
+
+	/* a leading '@' selects the abstract namespace */
+	path_len=strlen(argv[2]);
+	if(path_len>=sizeof(ucfg->addr.sun_path)) {
+		fprintf(stderr, "unix socket path too long\n");
+		return 1;
+	}
+	ucfg->abstract=argv[2][0]=='@';
+	ucfg->addr.sun_family=AF_UNIX;
+	memcpy(ucfg->addr.sun_path, argv[2], path_len);
+	if(ucfg->abstract) {
+		ucfg->addr.sun_path[0]='\0';
+		ucfg->addr_len=offsetof(struct sockaddr_un, sun_path)+path_len;
+	} else {
+		ucfg->addr_len=sizeof(struct sockaddr_un);
+	}
+
+	if((ucfg->socket=socket(AF_UNIX, ucfg->type, 0))==-1) {
+		perror("failed to create socket");
+		return 1;
+	}
+
+	if(set_socket_priority(ucfg->socket, cfg->opts.sopriority)) {
+		return 1;
+	}
+
+	abort_fd=ucfg->socket;
+
+	if(cfg->opts.server) {
+		if(!ucfg->abstract)
+			unlink(ucfg->addr.sun_path);
+
+		if(bind(ucfg->socket, (const struct sockaddr*)&ucfg->addr,
+			ucfg->addr_len)==-1) {
+			perror("failed to bind socket");
+			return 1;
+		}
+
+		if(ucfg->type!=SOCK_DGRAM && listen(ucfg->socket, 1)<0) {
+			perror("failed to listen");
+			return 1;
+		}
+	} else {
+		/* datagram replies need a client address, let the kernel
+		 * pick an abstract one */
+		if(ucfg->type==SOCK_DGRAM && bind(ucfg->socket,
+			(const struct sockaddr*)&family, sizeof(family))==-1) {
+			perror("failed to bind socket");
+			return 1;
+		}
+
+		if(connect(ucfg->socket, (const struct sockaddr*)&ucfg->addr,
+			ucfg->addr_len)<0) {
+			perror("failed to connect");
+			return 1;
+		}
+	}
+
+	hdr_init(cfg->send_packet, cfg->opts.length);
+
+	return 0;
+}
+
+/**
+ * Unix domain socket client.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+int unix_client(struct cyclicping_cfg *cfg)
+{
+	struct unix_cfg *ucfg=cfg->current_mod->modcfg;
+	int selectResult, len=0;
+	struct timespec tsend, trecv;
+	struct timeval timeout;
+	fd_set set;
+
+	FD_ZERO(&set);
+	FD_SET(ucfg->socket, &set);
+
+	timeout.tv_sec=1;
+	timeout.tv_usec=0;
+
+	/* take timestamp and copy it to send packet */
+	hdr_stamp_request(cfg->send_packet, cfg->seq, cfg->opts.clock, &tsend);
+
+	/* send packet to server */
+	if(write(ucfg->socket, cfg->send_packet, cfg->opts.length)!=
+		cfg->opts.length) {
+		perror("unix client failed to send packet");
+		return 1;
+	}
+
+	/* monitor socket fd via select */
+	selectResult = select(ucfg->socket+1, &set, NULL, NULL, &timeout);
+	if (selectResult > 0) {
+		/* receive packet and take timestamp */
+		if((len=unix_read(ucfg->socket, ucfg->type, cfg->recv_packet,
+			cfg->opts.length))<=0) {
+			perror("unix client failed to receive packet");
+			return 1;
+		}
+		clock_gettime(cfg->opts.clock, &trecv);
+	} else if(selectResult == 0) {
+		fprintf(stderr, "unix client timeout receiving packet\n");
+		return 1;
+	}
+	else {
+		fprintf(stderr, "unix client select failed\n");
+		return 1;
+	}
+
+	if(hdr_check(cfg->recv_packet, len)) {
+		fprintf(stderr, "unix client received invalid packet\n");
+		return 1;
+	}
+
+	/* add packet time to statistics */
+	if(add_packet_stats(cfg, &tsend, cfg->recv_packet, &trecv))
+		return 1;
+
+	cfg->seq++;
+
+	/* wait until next inverval */
+	return client_wait(cfg, tsend);
+}
+
+/**
+ * Unix domain socket server for datagrams.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+static int unix_server_dgram(struct cyclicping_cfg *cfg)
+{
+	struct unix_cfg *ucfg=cfg->current_mod->modcfg;
+	struct timespec trecv;
+	struct sockaddr_un peer_addr;
+	socklen_t peer_addr_len=sizeof(peer_addr);
+	int len;
+
+	/* wait for packet */
+	if((len=recvfrom(ucfg->socket, cfg->recv_packet, cfg->opts.length, 0,
+		(struct sockaddr*)&peer_addr, &peer_addr_len))==-1) {
+		if(!run)
+			return 0;
+		perror("unix server failed to receive packet");
+		return 1;
+	}
+	clock_gettime(cfg->opts.clock, &trecv);
+
+	/* not a cyclicping packet, ignore it */
+	if(hdr_check(cfg->recv_packet, len))
+		return 0;
+
+	/* copy timestamps to received packet */
+	hdr_stamp_reply(cfg->recv_packet, cfg->opts.clock, &trecv);
+
+	/* send received packet back to the client */
+	if(sendto(ucfg->socket, cfg->recv_packet, len, 0,
+		(const struct sockaddr *)&peer_addr, peer_addr_len)==-1) {
+		perror("unix server failed to send packet");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Unix domain socket server. Connection oriented types serve one client
+ * until it disconnects.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+int unix_server(struct cyclicping_cfg *cfg)
+{
+	struct unix_cfg *ucfg=cfg->current_mod->modcfg;
+	struct timespec trecv;
+	int socket;
+
+	if(ucfg->type==SOCK_DGRAM)
+		return unix_server_dgram(cfg);
+
+	if(cfg->opts.verbose)
+		printf("listening for connections\n");
+
+	socket=accept(ucfg->socket, NULL, NULL);
+	if(socket<0) {
+		if(!run)
+			return 0;
+		fprintf(stderr, "failed to accept connection\n");
+		return 1;
+	}
+
+	if(cfg->opts.verbose)
+		printf("accepted connection\n");
+
+	while(run) {
+		/* wait for incoming packet */
+		if(unix_read(socket, ucfg->type, cfg->recv_packet,
+			cfg->opts.length)!=cfg->opts.length) {
+			if(cfg->opts.verbose)
+				fprintf(stderr, "failed to read packet\n");
+			break;
+		}
+
+		clock_gettime(cfg->opts.clock, &trecv);
+
+		if(hdr_check(cfg->recv_packet, cfg->opts.length)) {
+			fprintf(stderr, "received invalid packet\n");
+			break;
+		}
+
+		/* copy timestamps to receive buffer */
+		hdr_stamp_reply(cfg->recv_packet, cfg->opts.clock, &trecv);
+
+		/* send received packet back to client */
+		if(write(socket, cfg->recv_packet, cfg->opts.length)!=
+			cfg->opts.length) {
+			fprintf(stderr, "failed to write packet\n");
+			break;
+		}
+	}
+
+	if(cfg->opts.verbose)
+		printf("closing connection\n");
+
+	close(socket);
+
+	return 0;
+}
+
+/**
+ * Clean up unix domain socket module ressources.
+ *
+ * \param cfg Cyclicping config data.
+ */
+void unix_deinit(struct cyclicping_cfg *cfg)
+{
+	struct unix_cfg *ucfg=cfg->current_mod->modcfg;
+
+	if(cfg->opts.server && !ucfg->abstract && ucfg->addr_len)
+		unlink(ucfg->addr.sun_path);
+
+	free(ucfg);
+}
+
+/**
+ * Ouput unix domain socket interface module usage.
+ */
+void unix_usage(void)
+{
+	printf("  unix - Use a unix domain socket\n");
+	printf("    unix:type:path      unix server and client\n");
+	printf("    type is dgram, seqpacket or stream, a path starting "
+		"with @ is abstract\n");
+}
@@ -0,0 +1,777 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#include <cyclicping.h>
+#include <opts.h>
+#include <stats.h>
+#include <socket.h>
+#include <proto.h>
+#include <uring.h>
+
+/* completion tags */
+#define UD_WRITE	1
+#define UD_READ		2
+#define UD_TIMEOUT	3
+
+/* index of the registered buffers and files */
+#define BUF_SEND	0
+#define BUF_RECV	1
+#define FILE_SOCKET	0
+
+#define SQPOLL_IDLE_MS	1000
+
+extern int run;
+extern int abort_fd;
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+	unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void *arg,
+	unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Set up io_uring instance and map submission and completion queues.
+ *
+ * \param q Queue to set up.
+ * \param sqpoll_cpu CPU of the kernel submission queue poller thread, -1 to
+ *                   disable SQPOLL.
+ * \return 0 on success.
+ */
+static int uring_queue_init(struct uring_queue *q, int sqpoll_cpu)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	if(sqpoll_cpu>=0) {
+		p.flags=IORING_SETUP_SQPOLL|IORING_SETUP_SQ_AFF;
+		p.sq_thread_cpu=sqpoll_cpu;
+		p.sq_thread_idle=SQPOLL_IDLE_MS;
+	}
+
+	q->fd=io_uring_setup(URING_ENTRIES, &p);
+	if(q->fd<0) {
+		perror("failed to set up io_uring");
+		return 1;
+	}
+	q->setup_flags=p.flags;
+
+	q->sq_map_len=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+	q->cq_map_len=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(q->cq_map_len>q->sq_map_len)
+			q->sq_map_len=q->cq_map_len;
+		q->cq_map_len=q->sq_map_len;
+	}
+
+	q->sq_map=mmap(NULL, q->sq_map_len, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, q->fd, IORING_OFF_SQ_RING);
+	if(q->sq_map==MAP_FAILED) {
+		q->sq_map=NULL;
+		perror("failed to map submission queue");
+		return 1;
+	}
+
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		q->cq_map=q->sq_map;
+	} else {
+		q->cq_map=mmap(NULL, q->cq_map_len, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, q->fd, IORING_OFF_CQ_RING);
+		if(q->cq_map==MAP_FAILED) {
+			q->cq_map=NULL;
+			perror("failed to map completion queue");
+			return 1;
+		}
+	}
+
+	q->sqes_len=p.sq_entries*sizeof(struct io_uring_sqe);
+	q->sqes=mmap(NULL, q->sqes_len, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, q->fd, IORING_OFF_SQES);
+	if(q->sqes==MAP_FAILED) {
+		q->sqes=NULL;
+		perror("failed to map submission queue entries");
+		return 1;
+	}
+
+	q->sq_head=(unsigned*)((char*)q->sq_map+p.sq_off.head);
+	q->sq_tail=(unsigned*)((char*)q->sq_map+p.sq_off.tail);
+	q->sq_mask=(unsigned*)((char*)q->sq_map+p.sq_off.ring_mask);
+	q->sq_flags=(unsigned*)((char*)q->sq_map+p.sq_off.flags);
+	q->sq_array=(unsigned*)((char*)q->sq_map+p.sq_off.array);
+	q->sqe_tail=*q->sq_tail;
+
+	q->cq_head=(unsigned*)((char*)q->cq_map+p.cq_off.head);
+	q->cq_tail=(unsigned*)((char*)q->cq_map+p.cq_off.tail);
+	q->cq_mask=(unsigned*)((char*)q->cq_map+p.cq_off.ring_mask);
+	q->cqes=(struct io_uring_cqe*)((char*)q->cq_map+p.cq_off.cqes);
+
+	return 0;
+}
+
+/**
+ * Get next free submission queue entry.
+ *
+ * \param q Queue.
+ * \return Cleared submission queue entry.
+ */
+static struct io_uring_sqe *uring_get_sqe(struct uring_queue *q)
+{
+	struct io_uring_sqe *sqe=&q->sqes[q->sqe_tail & *q->sq_mask];
+
+	memset(sqe, 0, sizeof(*sqe));
+	q->sqe_tail++;
+
+	return sqe;
+}
+
+/**
+ * Prepare a read or write on the registered socket using a registered
+ * buffer.
+ */
+static void uring_prep_rw(struct uring_queue *q, int op, char *buf,
+	int buf_index, int len, int link, uint64_t tag)
+{
+	struct io_uring_sqe *sqe=uring_get_sqe(q);
+
+	sqe->opcode=op;
+	sqe->fd=FILE_SOCKET;
+	sqe->flags=IOSQE_FIXED_FILE|(link?IOSQE_IO_LINK:0);
+	sqe->addr=(uint64_t)(unsigned long)buf;
+	sqe->len=len;
+	sqe->buf_index=buf_index;
+	sqe->user_data=tag;
+}
+
+/**
+ * Prepare a recvmsg or sendmsg on the registered socket.
+ */
+static void uring_prep_msg(struct uring_queue *q, int op, struct msghdr *msg,
+	int link, uint64_t tag)
+{
+	struct io_uring_sqe *sqe=uring_get_sqe(q);
+
+	sqe->opcode=op;
+	sqe->fd=FILE_SOCKET;
+	sqe->flags=IOSQE_FIXED_FILE|(link?IOSQE_IO_LINK:0);
+	sqe->addr=(uint64_t)(unsigned long)msg;
+	sqe->len=1;
+	sqe->user_data=tag;
+}
+
+/**
+ * Prepare a timeout for the previous (linked) submission queue entry.
+ */
+static void uring_prep_link_timeout(struct uring_queue *q,
+	struct __kernel_timespec *ts)
+{
+	struct io_uring_sqe *sqe=uring_get_sqe(q);
+
+	sqe->opcode=IORING_OP_LINK_TIMEOUT;
+	sqe->fd=-1;
+	sqe->addr=(uint64_t)(unsigned long)ts;
+	sqe->len=1;
+	sqe->user_data=UD_TIMEOUT;
+}
+
+/**
+ * Publish prepared entries to the kernel. With SQPOLL the kernel thread
+ * picks them up and we only need a syscall if it went to sleep.
+ *
+ * \param q Queue.
+ * \return 0 on success.
+ */
+static int uring_submit(struct uring_queue *q)
+{
+	unsigned tail=*q->sq_tail;
+	unsigned n=q->sqe_tail-tail;
+	int ret;
+
+	for(; tail!=q->sqe_tail; tail++)
+		q->sq_array[tail & *q->sq_mask]=tail & *q->sq_mask;
+
+	__atomic_store_n(q->sq_tail, q->sqe_tail, __ATOMIC_RELEASE);
+
+	if(q->setup_flags & IORING_SETUP_SQPOLL) {
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(!(__atomic_load_n(q->sq_flags, __ATOMIC_RELAXED) &
+			IORING_SQ_NEED_WAKEUP))
+			return 0;
+		ret=io_uring_enter(q->fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+	} else {
+		ret=io_uring_enter(q->fd, n, 0, 0);
+	}
+
+	if(ret<0) {
+		perror("io_uring submit failed");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Wait for and consume the next completion.
+ *
+ * \param q Queue.
+ * \param cqe Completion gets copied here.
+ * \return 0 on success.
+ */
+static int uring_wait_cqe(struct uring_queue *q, struct io_uring_cqe *cqe)
+{
+	unsigned head=*q->cq_head;
+
+	while(head==__atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE)) {
+		if(io_uring_enter(q->fd, 0, 1, IORING_ENTER_GETEVENTS)<0) {
+			if(errno==EINTR && run)
+				continue;
+			if(run)
+				perror("io_uring wait failed");
+			return 1;
+		}
+	}
+
+	*cqe=q->cqes[head & *q->cq_mask];
+	__atomic_store_n(q->cq_head, head+1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/**
+ * Register the data socket with the ring.
+ *
+ * \param ucfg io_uring module config.
+ * \param fd Socket to register.
+ * \return 0 on success.
+ */
+static int uring_register_socket(struct uring_cfg *ucfg, int fd)
+{
+	if(io_uring_register(ucfg->q.fd, IORING_REGISTER_FILES, &fd, 1)<0) {
+		perror("failed to register socket");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Init io_uring module. Parse module args. Open socket, set up ring and
+ * register packet buffers.
+ *
+ * \param cfg Cyclicping config data.
+ * \param argv Interface module arguments.
+ * \param argc Interface module count.
+ * \return 0 on success.
+ */
+int uring_init(struct cyclicping_cfg *cfg, char **argv, int argc)
+{
+	struct uring_cfg *ucfg;
+	struct iovec iov[2];
+	int port_arg_idx=2;
+
+	ucfg=(struct uring_cfg*)calloc(1, sizeof(struct uring_cfg));
+	if(ucfg==NULL) {
+		perror("failed to allocate memory for uring cfg");
+		return 1;
+	}
+
+	cfg->current_mod->modcfg=ucfg;
+	ucfg->sqpoll_cpu=-1;
+	ucfg->q.fd=-1;
+
+	if(argc<2 || (strcmp(argv[1], "udp") && strcmp(argv[1], "tcp"))) {
+		fprintf(stderr, "uring requires udp or tcp as protocol\n");
+		return 1;
+	}
+	ucfg->tcp=strcmp(argv[1], "tcp")==0;
+
+	if(cfg->opts.client) {
+		if(argc<3) {
+			fprintf(stderr, "destination address requiered for "
+				"uring client mode\n");
+			return 1;
+		}
+		if(inet_aton(argv[2], &ucfg->dest_addr.sin_addr)==0) {
+			fprintf(stderr, "failed to convert destination "
+				"address\n");
+			return 1;
+		}
+		port_arg_idx++;
+	}
+
+	if(argc>=port_arg_idx+1) {
+		ucfg->port=atoi(argv[port_arg_idx]);
+		if(ucfg->port<=0 || ucfg->port>0xffff) {
+			fprintf(stderr, "invalid port number for uring "
+				"destination port\n");
+			return 1;
+		}
+	} else {
+		ucfg->port=DEFAULT_PORT;
+	}
+
+	if(argc>=port_arg_idx+2) {
+		ucfg->sqpoll_cpu=atoi(argv[port_arg_idx+1]);
+		if(ucfg->sqpoll_cpu<0) {
+			fprintf(stderr, "invalid sqpoll cpu\n");
+			return 1;
+		}
+	}
+
+	if(ucfg->tcp)
+		ucfg->socket=socket(AF_INET, SOCK_STREAM, 0);
+	else
+		ucfg->socket=socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if(ucfg->socket==-1) {
+		perror("failed to create socket");
+		return 1;
+	}
+
+	if(set_socket_priority(ucfg->socket, cfg->opts.sopriority)) {
+		return 1;
+	}
+
+	if(set_socket_tos(ucfg->socket, cfg->opts.tos)) {
+		return 1;
+	}
+
+	abort_fd=ucfg->socket;
+
+	ucfg->dest_addr.sin_family = AF_INET;
+	ucfg->dest_addr.sin_port = htons(ucfg->port);
+
+	ucfg->local_addr.sin_family = AF_INET;
+	ucfg->local_addr.sin_port = cfg->opts.server?htons(ucfg->port):0;
+	ucfg->local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if(bind(ucfg->socket, (const struct sockaddr*)&ucfg->local_addr,
+		sizeof(struct sockaddr_in))==-1) {
+		perror("failed to bind socket");
+		return 1;
+	}
+
+	if(uring_queue_init(&ucfg->q, ucfg->sqpoll_cpu))
+		return 1;
+
+	iov[BUF_SEND].iov_base=cfg->send_packet;
+	iov[BUF_SEND].iov_len=cfg->opts.length;
+	iov[BUF_RECV].iov_base=cfg->recv_packet;
+	iov[BUF_RECV].iov_len=cfg->opts.length;
+	if(io_uring_register(ucfg->q.fd, IORING_REGISTER_BUFFERS, iov, 2)<0) {
+		perror("failed to register buffers");
+		return 1;
+	}
+
+	/* the UDP server receives and replies through one message header,
+	 * the reply is linked to the read of the next request which then
+	 * overwrites the peer address only after the reply left */
+	ucfg->peer_iov.iov_base=cfg->recv_packet;
+	ucfg->peer_iov.iov_len=cfg->opts.length;
+	ucfg->peer_msg.msg_name=&ucfg->peer_addr;
+	ucfg->peer_msg.msg_namelen=sizeof(ucfg->peer_addr);
+	ucfg->peer_msg.msg_iov=&ucfg->peer_iov;
+	ucfg->peer_msg.msg_iovlen=1;
+
+	/* a connected socket saves the route lookup for each packet, the
+	 * UDP server stays unconnected to answer any client */
+	if(cfg->opts.client) {
+		if(connect(ucfg->socket,
+			(const struct sockaddr *)&ucfg->dest_addr,
+			sizeof(ucfg->dest_addr))<0) {
+			perror("failed to connect");
+			return 1;
+		}
+
+		if(uring_register_socket(ucfg, ucfg->socket))
+			return 1;
+	}
+
+	hdr_init(cfg->send_packet, cfg->opts.length);
+
+	return 0;
+}
+
+/**
+ * Set the linked timeout of the next read to the time left for the reply.
+ *
+ * \param ucfg io_uring module config.
+ * \param left Time left.
+ */
+static void uring_set_timeout(struct uring_cfg *ucfg,
+	const struct timespec *left)
+{
+	ucfg->timeout.tv_sec=left->tv_sec;
+	ucfg->timeout.tv_nsec=left->tv_nsec;
+}
+
+/**
+ * io_uring client. Write and read are submitted as one linked chain with a
+ * timeout for the read, so there is a single syscall per packet (none with
+ * SQPOLL except for waiting).
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+int uring_client(struct cyclicping_cfg *cfg)
+{
+	struct uring_cfg *ucfg=cfg->current_mod->modcfg;
+	struct timespec tsend, trecv, left;
+	struct io_uring_cqe cqe;
+	int pending=3, received=0, replied=0;
+
+	/* take timestamp and copy it to send packet */
+	hdr_stamp_request(cfg->send_packet, cfg->seq, cfg->opts.clock, &tsend);
+
+	reply_timeout(cfg, &tsend, &left);
+	uring_set_timeout(ucfg, &left);
+
+	uring_prep_rw(&ucfg->q, IORING_OP_WRITE_FIXED, cfg->send_packet,
+		BUF_SEND, cfg->opts.length, 1, UD_WRITE);
+	uring_prep_rw(&ucfg->q, IORING_OP_READ_FIXED, cfg->recv_packet,
+		BUF_RECV, cfg->opts.length, 1, UD_READ);
+	uring_prep_link_timeout(&ucfg->q, &ucfg->timeout);
+
+	if(uring_submit(&ucfg->q))
+		return 1;
+
+	while(pending) {
+		if(uring_wait_cqe(&ucfg->q, &cqe))
+			return 1;
+		pending--;
+
+		switch(cqe.user_data) {
+		case UD_WRITE:
+			/* an ICMP error of an earlier request fails the
+			 * write, the read gets cancelled and counts as lost */
+			if(cqe.res==-ECONNREFUSED && !ucfg->tcp)
+				break;
+			if(cqe.res!=cfg->opts.length) {
+				fprintf(stderr, "uring client failed to send "
+					"packet: %s\n", strerror(-cqe.res));
+				return 1;
+			}
+			break;
+		case UD_READ:
+			/* the reply timed out, a stream can't continue after
+			 * that */
+			if(cqe.res==-ECANCELED && !ucfg->tcp) {
+				reply_lost(cfg);
+				break;
+			}
+			if(cqe.res==-ECANCELED) {
+				fprintf(stderr, "uring client timeout receiving "
+					"packet\n");
+				return 1;
+			}
+			/* an ICMP error of an earlier request, the reply to
+			 * this one is still awaited */
+			if(cqe.res==-ECONNREFUSED && !ucfg->tcp)
+				cqe.res=0;
+			else if(cqe.res<=0) {
+				fprintf(stderr, "uring client failed to receive "
+					"packet: %s\n", strerror(-cqe.res));
+				return 1;
+			}
+			clock_gettime(cfg->opts.clock, &trecv);
+
+			/* a stream socket might return partial messages */
+			if(ucfg->tcp) {
+				received+=cqe.res;
+				if(received<cfg->opts.length) {
+					if(reply_timeout(cfg, &tsend, &left)) {
+						fprintf(stderr, "uring client "
+							"timeout receiving "
+							"packet\n");
+						return 1;
+					}
+					uring_set_timeout(ucfg, &left);
+					uring_prep_rw(&ucfg->q,
+						IORING_OP_READ_FIXED,
+						cfg->recv_packet+received,
+						BUF_RECV, cfg->opts.length-
+						received, 1, UD_READ);
+					uring_prep_link_timeout(&ucfg->q,
+						&ucfg->timeout);
+					if(uring_submit(&ucfg->q))
+						return 1;
+					pending+=2;
+					break;
+				}
+				received=0;
+			}
+
+			/* short datagrams aren't cyclicping packets, late
+			 * replies to earlier requests are counted and
+			 * skipped */
+			if(cqe.res>0 && (ucfg->tcp ||
+				cqe.res==cfg->opts.length) &&
+				!hdr_check(cfg->recv_packet,
+				cfg->opts.length) && match_reply(cfg,
+				hdr_get_seq(cfg->recv_packet))==REPLY_CURRENT) {
+				replied=1;
+				break;
+			}
+
+			/* wait for the reply to this request */
+			if(reply_timeout(cfg, &tsend, &left)) {
+				reply_lost(cfg);
+				break;
+			}
+			uring_set_timeout(ucfg, &left);
+			uring_prep_rw(&ucfg->q, IORING_OP_READ_FIXED,
+				cfg->recv_packet, BUF_RECV, cfg->opts.length,
+				1, UD_READ);
+			uring_prep_link_timeout(&ucfg->q, &ucfg->timeout);
+			if(uring_submit(&ucfg->q))
+				return 1;
+			pending+=2;
+			break;
+		default:
+			break;
+		}
+	}
+
+	/* add packet time to statistics */
+	if(replied && add_packet_stats(cfg, &tsend, cfg->recv_packet, &trecv))
+		return 1;
+
+	cfg->seq++;
+
+	/* wait until next inverval */
+	return client_wait(cfg, tsend);
+}
+
+/**
+ * Wait for a TCP client and accept it. The UDP socket stays unconnected,
+ * each reply is sent to the sender of its request, so any client is
+ * served.
+ *
+ * \param cfg Cyclicping config data.
+ * \return Data socket or -1 on error.
+ */
+static int uring_server_connect(struct cyclicping_cfg *cfg)
+{
+	struct uring_cfg *ucfg=cfg->current_mod->modcfg;
+	struct sockaddr_in peer_addr;
+	socklen_t peer_addr_len=sizeof(peer_addr);
+	int sock;
+
+	if(ucfg->tcp) {
+		listen(ucfg->socket, 1);
+		sock=accept(ucfg->socket, (struct sockaddr*)&peer_addr,
+			&peer_addr_len);
+		if(sock<0) {
+			if(run)
+				fprintf(stderr, "failed to accept "
+					"connection\n");
+			return -1;
+		}
+
+		if(cfg->opts.verbose)
+			printf("serving %s:%d\n",
+				inet_ntoa(peer_addr.sin_addr),
+				ntohs(peer_addr.sin_port));
+	} else {
+		sock=ucfg->socket;
+	}
+
+	if(uring_register_socket(ucfg, sock)) {
+		if(sock!=ucfg->socket)
+			close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+/**
+ * Prepare the read of the next request, at offset received of a partial
+ * TCP message.
+ *
+ * \param cfg Cyclicping config data.
+ * \param received Bytes of the request received so far.
+ */
+static void uring_server_prep_read(struct cyclicping_cfg *cfg, int received)
+{
+	struct uring_cfg *ucfg=cfg->current_mod->modcfg;
+
+	if(ucfg->tcp) {
+		uring_prep_rw(&ucfg->q, IORING_OP_READ_FIXED,
+			cfg->recv_packet+received, BUF_RECV,
+			cfg->opts.length-received, 0, UD_READ);
+		return;
+	}
+
+	ucfg->peer_msg.msg_namelen=sizeof(ucfg->peer_addr);
+	uring_prep_msg(&ucfg->q, IORING_OP_RECVMSG, &ucfg->peer_msg, 0,
+		UD_READ);
+}
+
+/**
+ * io_uring server. The reply is sent with the read for the next request
+ * linked to it, both submitted at once.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+int uring_server(struct cyclicping_cfg *cfg)
+{
+	struct uring_cfg *ucfg=cfg->current_mod->modcfg;
+	struct io_uring_cqe cqe;
+	struct timespec trecv;
+	int sock, received=0, ret=0;
+
+	sock=uring_server_connect(cfg);
+	if(sock<0)
+		return run?1:0;
+
+	uring_server_prep_read(cfg, 0);
+	if(uring_submit(&ucfg->q))
+		return 1;
+
+	while(run) {
+		if(uring_wait_cqe(&ucfg->q, &cqe)) {
+			ret=run?1:0;
+			break;
+		}
+
+		if(cqe.user_data==UD_WRITE) {
+			if(cqe.res!=cfg->opts.length) {
+				fprintf(stderr, "uring server failed to send "
+					"packet: %s\n", strerror(-cqe.res));
+				ret=1;
+				break;
+			}
+			continue;
+		}
+
+		if(cqe.res<=0) {
+			if(cfg->opts.verbose)
+				fprintf(stderr, "failed to read packet\n");
+			break;
+		}
+
+		/* reassemble partial messages of stream sockets, drop short
+		 * datagrams */
+		if(ucfg->tcp)
+			received+=cqe.res;
+		else if(cqe.res==cfg->opts.length)
+			received=cqe.res;
+		if(received<cfg->opts.length) {
+			uring_server_prep_read(cfg, received);
+			if(uring_submit(&ucfg->q)) {
+				ret=1;
+				break;
+			}
+			continue;
+		}
+		clock_gettime(cfg->opts.clock, &trecv);
+		received=0;
+
+		if(!hdr_check(cfg->recv_packet, cfg->opts.length)) {
+			/* copy timestamps to received packet */
+			hdr_stamp_reply(cfg->recv_packet, cfg->opts.clock,
+				&trecv);
+
+			if(ucfg->tcp)
+				uring_prep_rw(&ucfg->q, IORING_OP_WRITE_FIXED,
+					cfg->recv_packet, BUF_RECV,
+					cfg->opts.length, 1, UD_WRITE);
+			else
+				uring_prep_msg(&ucfg->q, IORING_OP_SENDMSG,
+					&ucfg->peer_msg, 1, UD_WRITE);
+		}
+		uring_server_prep_read(cfg, 0);
+
+		if(uring_submit(&ucfg->q)) {
+			ret=1;
+			break;
+		}
+	}
+
+	io_uring_register(ucfg->q.fd, IORING_UNREGISTER_FILES, NULL, 0);
+
+	if(sock!=ucfg->socket) {
+		if(cfg->opts.verbose)
+			printf("closing connection\n");
+		close(sock);
+	}
+
+	return ret;
+}
+
+/**
+ * Clean up io_uring module ressources.
+ *
+ * \param cfg Cyclicping config data.
+ */
+void uring_deinit(struct cyclicping_cfg *cfg)
+{
+	struct uring_cfg *ucfg=cfg->current_mod->modcfg;
+	struct uring_queue *q=&ucfg->q;
+
+	if(q->sqes)
+		munmap(q->sqes, q->sqes_len);
+	if(q->cq_map && q->cq_map!=q->sq_map)
+		munmap(q->cq_map, q->cq_map_len);
+	if(q->sq_map)
+		munmap(q->sq_map, q->sq_map_len);
+	if(q->fd>=0)
+		close(q->fd);
+
+	free(ucfg);
+}
+
+/**
+ * Ouput io_uring interface module usage.
+ */
+void uring_usage(void)
+{
+	printf("  uring - Use a UDP or TCP connection driven by io_uring\n");
+	printf("    uring:proto[:port[:sqpollcpu]]          "
+		"io_uring server\n");
+	printf("    uring:proto:serverip[:port[:sqpollcpu]] "
+		"io_uring client\n");
+	printf("    proto is udp or tcp, sqpollcpu enables a kernel "
+		"submission poller\n");
+	printf("    thread on the given cpu\n");
+}
@@ -0,0 +1,73 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES	8
+
+/* user space view of the submission and completion queue */
+struct uring_queue {
+	int fd;
+	unsigned setup_flags;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_flags;
+	unsigned *sq_array;
+	unsigned sqe_tail;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_map;
+	void *cq_map;
+	size_t sq_map_len;
+	size_t cq_map_len;
+	size_t sqes_len;
+};
+
+struct uring_cfg {
+	struct sockaddr_in dest_addr;
+	struct sockaddr_in local_addr;
+	int port;
+	int tcp;
+	int socket;
+	int sqpoll_cpu;
+	struct uring_queue q;
+	struct __kernel_timespec timeout;
+	/* UDP server: sender of the request, the reply goes back to it */
+	struct sockaddr_in peer_addr;
+	struct iovec peer_iov;
+	struct msghdr peer_msg;
+};
+
+int uring_init(struct cyclicping_cfg *cfg, char **argv, int argc);
+int uring_client(struct cyclicping_cfg *cfg);
+int uring_server(struct cyclicping_cfg *cfg);
+void uring_deinit(struct cyclicping_cfg *cfg);
+void uring_usage(void);
+
+#endif
@@ -0,0 +1,233 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+
+#include <cyclicping.h>
+#include <wire.h>
+
+/**
+ * Get the link speed of an interface (like ethtool does).
+ *
+ * \param ifname Interface name.
+ * \return Speed in Mbit/s, 0 if unknown.
+ */
+int wire_link_speed(const char *ifname)
+{
+	struct ethtool_cmd ecmd;
+	struct ifreq ifr;
+	uint32_t speed;
+	int fd;
+
+	fd=socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd<0)
+		return 0;
+
+	memset(&ifr, 0, sizeof(ifr));
+	memset(&ecmd, 0, sizeof(ecmd));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ-1);
+	ecmd.cmd=ETHTOOL_GSET;
+	ifr.ifr_data=(void*)&ecmd;
+
+	if(ioctl(fd, SIOCETHTOOL, &ifr)<0)
+		speed=0;
+	else
+		speed=ethtool_cmd_speed(&ecmd);
+
+	close(fd);
+
+	/* no link or a virtual device without a speed */
+	if(speed==0 || speed==(uint32_t)SPEED_UNKNOWN || speed==UINT16_MAX)
+		return 0;
+
+	return speed;
+}
+
+/**
+ * Get the interface packets to a destination leave on.
+ *
+ * \param dest Destination address.
+ * \param ifname Receives the interface name (IFNAMSIZ bytes).
+ * \return 0 on success, else 1.
+ */
+int wire_route_ifname(const struct sockaddr_in *dest, char *ifname)
+{
+	struct sockaddr_in local, peer=*dest;
+	socklen_t len=sizeof(local);
+	struct ifaddrs *ifaddr, *ifa;
+	int fd, ret=1;
+
+	/* connecting a datagram socket only does the route lookup */
+	fd=socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd<0)
+		return 1;
+
+	if(!peer.sin_port)
+		peer.sin_port=htons(9);
+
+	if(connect(fd, (const struct sockaddr*)&peer, sizeof(peer))<0 ||
+		getsockname(fd, (struct sockaddr*)&local, &len)<0) {
+		close(fd);
+		return 1;
+	}
+	close(fd);
+
+	if(getifaddrs(&ifaddr)<0)
+		return 1;
+
+	for(ifa=ifaddr; ifa; ifa=ifa->ifa_next) {
+		if(ifa->ifa_addr==NULL || ifa->ifa_addr->sa_family!=AF_INET)
+			continue;
+
+		if(((struct sockaddr_in*)ifa->ifa_addr)->sin_addr.s_addr==
+			local.sin_addr.s_addr) {
+			strncpy(ifname, ifa->ifa_name, IFNAMSIZ-1);
+			ifname[IFNAMSIZ-1]=0;
+			ret=0;
+			break;
+		}
+	}
+
+	freeifaddrs(ifaddr);
+
+	return ret;
+}
+
+/**
+ * Get the MTU of an interface.
+ *
+ * \param ifname Interface name.
+ * \return MTU, 1500 if unknown.
+ */
+int wire_mtu(const char *ifname)
+{
+	struct ifreq ifr;
+	int fd, mtu=1500;
+
+	fd=socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd<0)
+		return mtu;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ-1);
+	if(ioctl(fd, SIOCGIFMTU, &ifr)==0 && ifr.ifr_mtu>0)
+		mtu=ifr.ifr_mtu;
+
+	close(fd);
+
+	return mtu;
+}
+
+/**
+ * Get the bytes a message takes on an Ethernet link. The message is split
+ * into frames of at most MTU bytes, each carrying its own protocol
+ * headers.
+ *
+ * \param ifname Interface the message is sent on.
+ * \param payload Bytes per message above the protocol headers.
+ * \param hdr Protocol header bytes per frame (IP, UDP, ...).
+ * \param align Fragment alignment (8 for IP fragments).
+ * \param tag 802.1Q tag bytes per frame, they don't count against the MTU.
+ * \param nframes Number of frames gets stored here (or NULL).
+ * \return Bytes including preamble and inter frame gap.
+ */
+uint64_t wire_eth_bytes(const char *ifname, int payload, int hdr, int align,
+	int tag, int *nframes)
+{
+	int mtu, max, chunk, frame, frames=0;
+	uint64_t bytes=0;
+
+	mtu=wire_mtu(ifname);
+	max=(mtu-hdr)/align*align;
+
+	do {
+		chunk=payload>max?max:payload;
+		payload-=chunk;
+
+		frame=hdr+chunk+WIRE_ETH_HDR+tag;
+		if(frame<WIRE_ETH_MIN_FRAME)
+			frame=WIRE_ETH_MIN_FRAME;
+
+		bytes+=frame+WIRE_ETH_GAP;
+		frames++;
+	} while(payload>0);
+
+	if(nframes)
+		*nframes=frames;
+
+	return bytes;
+}
+
+/**
+ * Set the wire time of a request and its reply over an Ethernet link.
+ *
+ * \param cfg Cyclicping config data.
+ * \param ifname Interface the messages are sent on.
+ * \param payload Bytes per message above the protocol headers.
+ * \param hdr Protocol header bytes per frame (IP, UDP, ...).
+ * \param align Fragment alignment (8 for IP fragments).
+ * \param tag 802.1Q tag bytes per frame, they don't count against the MTU.
+ */
+void wire_set_eth(struct cyclicping_cfg *cfg, const char *ifname,
+	int payload, int hdr, int align, int tag)
+{
+	int speed, frames;
+	uint64_t bytes;
+
+	snprintf(cfg->wire_ifname, sizeof(cfg->wire_ifname), "%s", ifname);
+
+	speed=wire_link_speed(ifname);
+	if(!speed) {
+		if(!cfg->opts.quiet)
+			printf("no link speed for %s, no wire time\n", ifname);
+		return;
+	}
+
+	bytes=wire_eth_bytes(ifname, payload, hdr, align, tag, &frames);
+
+	/* request and reply, speed is in Mbit/s */
+	cfg->wire_time=2*bytes*8*1000/speed;
+	snprintf(cfg->wire_info, sizeof(cfg->wire_info),
+		"%s %d Mbit/s, %d frame(s) of %" PRIu64 " bytes per direction",
+		ifname, speed, frames, bytes);
+}
+
+/**
+ * Set the wire time of a request and its reply over a UART.
+ *
+ * \param cfg Cyclicping config data.
+ * \param rate Baud rate.
+ * \param bits Bits per character including start, parity and stop bits.
+ */
+void wire_set_uart(struct cyclicping_cfg *cfg, int rate, int bits)
+{
+	cfg->wire_time=2ULL*cfg->opts.length*bits*NSEC_PER_SEC/rate;
+	snprintf(cfg->wire_info, sizeof(cfg->wire_info),
+		"%d baud, %d bits per character", rate, bits);
+}
@@ -0,0 +1,43 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __WIRE_H__
+#define __WIRE_H__
+
+#include <netinet/in.h>
+
+/* MAC header and FCS of an Ethernet frame */
+#define WIRE_ETH_HDR		(14+4)
+/* shorter frames get padded (MAC header to FCS) */
+#define WIRE_ETH_MIN_FRAME	64
+/* preamble, start delimiter and inter frame gap */
+#define WIRE_ETH_GAP		(8+12)
+
+struct cyclicping_cfg;
+
+int wire_link_speed(const char *ifname);
+int wire_mtu(const char *ifname);
+int wire_route_ifname(const struct sockaddr_in *dest, char *ifname);
+uint64_t wire_eth_bytes(const char *ifname, int payload, int hdr, int align,
+	int tag, int *nframes);
+void wire_set_eth(struct cyclicping_cfg *cfg, const char *ifname,
+	int payload, int hdr, int align, int tag);
+void wire_set_uart(struct cyclicping_cfg *cfg, int rate, int bits);
+
+#endif
@@ -0,0 +1,981 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <net/if.h>
+#include <netinet/ether.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include <cyclicping.h>
+#include <opts.h>
+#include <stats.h>
+#include <proto.h>
+#include <xdp.h>
+#include <wire.h>
+
+#ifndef AF_XDP
+#define AF_XDP			44
+#endif
+
+#ifndef SOL_XDP
+#define SOL_XDP			283
+#endif
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL	69
+#endif
+
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET	70
+#endif
+
+#define XDP_BUSY_POLL_USEC	20
+#define XDP_BUSY_POLL_BUDGET	64
+
+/* minimal set of eBPF instruction macros, see the kernels
+ * samples/bpf/bpf_insn.h */
+#define INSN(c, d, s, o, i) \
+	((struct bpf_insn){ .code=(c), .dst_reg=(d), .src_reg=(s), \
+		.off=(o), .imm=(i) })
+#define MOV64_REG(d, s)		INSN(BPF_ALU64|BPF_MOV|BPF_X, d, s, 0, 0)
+#define MOV64_IMM(d, i)		INSN(BPF_ALU64|BPF_MOV|BPF_K, d, 0, 0, i)
+#define ALU64_IMM(op, d, i)	INSN(BPF_ALU64|BPF_OP(op)|BPF_K, d, 0, 0, i)
+#define LDX_MEM(sz, d, s, o)	INSN(BPF_LDX|BPF_SIZE(sz)|BPF_MEM, d, s, o, 0)
+#define JMP_REG(op, d, s, o)	INSN(BPF_JMP|BPF_OP(op)|BPF_X, d, s, o, 0)
+#define JMP_IMM(op, d, i, o)	INSN(BPF_JMP|BPF_OP(op)|BPF_K, d, 0, o, i)
+#define LD_MAP_FD(d, fd) \
+	INSN(BPF_LD|BPF_DW|BPF_IMM, d, BPF_PSEUDO_MAP_FD, 0, fd), \
+	INSN(0, 0, 0, 0, 0)
+#define CALL(f)			INSN(BPF_JMP|BPF_CALL, 0, 0, 0, f)
+#define EXIT()			INSN(BPF_JMP|BPF_EXIT, 0, 0, 0, 0)
+
+extern int run;
+extern int abort_fd;
+
+static int bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/**
+ * Create the map holding the AF_XDP socket of each receive queue.
+ *
+ * \param xcfg XDP module config.
+ * \return 0 on success.
+ */
+static int xdp_create_map(struct xdp_cfg *xcfg)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type=BPF_MAP_TYPE_XSKMAP;
+	attr.key_size=sizeof(int);
+	attr.value_size=sizeof(int);
+	attr.max_entries=xcfg->queue+1;
+	xcfg->map_fd=bpf(BPF_MAP_CREATE, &attr);
+	if(xcfg->map_fd<0) {
+		perror("failed to create xsk map");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Steer the packets of our receive queue to the AF_XDP socket.
+ *
+ * \param xcfg XDP module config.
+ * \return 0 on success.
+ */
+static int xdp_add_socket(struct xdp_cfg *xcfg)
+{
+	union bpf_attr attr;
+	int key=xcfg->queue;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd=xcfg->map_fd;
+	attr.key=(uint64_t)(unsigned long)&key;
+	attr.value=(uint64_t)(unsigned long)&xcfg->fd;
+	attr.flags=BPF_ANY;
+	if(bpf(BPF_MAP_UPDATE_ELEM, &attr)) {
+		perror("failed to add xdp socket to map");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Load XDP program which redirects our UDP packets to the AF_XDP socket
+ * bound to the receive queue. All other traffic is passed to the kernel
+ * network stack. Jump offsets are relative to the next instruction, all
+ * non matching packets jump to the "pass" label. The tag checks are
+ * removed from the program for untagged frames.
+ *
+ * \param xcfg XDP module config.
+ * \return 0 on success.
+ */
+static int xdp_load_prog(struct xdp_cfg *xcfg)
+{
+	union bpf_attr attr;
+	char log[4096];
+	struct bpf_insn prog[]={
+		/* r6 = ctx, r2 = data, r3 = data_end */
+		MOV64_REG(BPF_REG_6, BPF_REG_1),
+		LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_6,
+			offsetof(struct xdp_md, data)),
+		LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_6,
+			offsetof(struct xdp_md, data_end)),
+		/* tagged frames: 802.1Q tag with our vlan id, r2 is moved
+		 * past the tag, so the ethertype below is the inner one */
+		MOV64_REG(BPF_REG_4, BPF_REG_2),
+		ALU64_IMM(BPF_ADD, BPF_REG_4, 2*ETH_ALEN+FRAME_VLAN_LEN),
+		JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, 23),
+		LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2, 2*ETH_ALEN),
+		JMP_IMM(BPF_JNE, BPF_REG_5, htons(ETHERTYPE_VLAN), 21),
+		LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2,
+			2*ETH_ALEN+offsetof(struct vlan_tag, tci)),
+		ALU64_IMM(BPF_AND, BPF_REG_5, htons(FRAME_VLAN_VID_MASK)),
+		JMP_IMM(BPF_JNE, BPF_REG_5,
+			htons(xcfg->tci & FRAME_VLAN_VID_MASK), 18),
+		ALU64_IMM(BPF_ADD, BPF_REG_2, FRAME_VLAN_LEN),
+		/* bounds check for ethernet, ip and udp header */
+		MOV64_REG(BPF_REG_4, BPF_REG_2),
+		ALU64_IMM(BPF_ADD, BPF_REG_4, sizeof(struct pkt)),
+		JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, 14),
+		/* IPv4 without options carrying UDP to our port */
+		LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2,
+			offsetof(struct pkt, eh.ether_type)),
+		JMP_IMM(BPF_JNE, BPF_REG_5, htons(ETHERTYPE_IP), 12),
+		LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_2,
+			sizeof(struct ether_header)),
+		JMP_IMM(BPF_JNE, BPF_REG_5, 0x45, 10),
+		LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_2,
+			offsetof(struct pkt, ip.ip_p)),
+		JMP_IMM(BPF_JNE, BPF_REG_5, IPPROTO_UDP, 8),
+		LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2,
+			offsetof(struct pkt, udp.uh_dport)),
+		JMP_IMM(BPF_JNE, BPF_REG_5, htons(xcfg->port), 6),
+		/* return bpf_redirect_map(&xsks, rx_queue_index, XDP_PASS) */
+		LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_6,
+			offsetof(struct xdp_md, rx_queue_index)),
+		LD_MAP_FD(BPF_REG_1, xcfg->map_fd),
+		MOV64_IMM(BPF_REG_3, XDP_PASS),
+		CALL(BPF_FUNC_redirect_map),
+		EXIT(),
+		/* pass: */
+		MOV64_IMM(BPF_REG_0, XDP_PASS),
+		EXIT(),
+	};
+	int insn_cnt=sizeof(prog)/sizeof(prog[0]);
+
+	if(xcfg->tci<0) {
+		insn_cnt-=XDP_PROG_TAG_LEN;
+		memmove(&prog[XDP_PROG_TAG_START],
+			&prog[XDP_PROG_TAG_START+XDP_PROG_TAG_LEN],
+			(insn_cnt-XDP_PROG_TAG_START)*sizeof(prog[0]));
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type=BPF_PROG_TYPE_XDP;
+	attr.expected_attach_type=BPF_XDP;
+	attr.insns=(uint64_t)(unsigned long)prog;
+	attr.insn_cnt=insn_cnt;
+	attr.license=(uint64_t)(unsigned long)"GPL";
+	attr.log_buf=(uint64_t)(unsigned long)log;
+	attr.log_size=sizeof(log);
+	attr.log_level=1;
+	log[0]=0;
+
+	xcfg->prog_fd=bpf(BPF_PROG_LOAD, &attr);
+	if(xcfg->prog_fd<0) {
+		perror("failed to load xdp program");
+		fprintf(stderr, "%s\n", log);
+		return 1;
+	}
+
+	/* attach program, it is detached again when the link fd gets
+	 * closed */
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd=xcfg->prog_fd;
+	attr.link_create.target_ifindex=xcfg->ifindex;
+	attr.link_create.attach_type=BPF_XDP;
+	attr.link_create.flags=xcfg->attach_flags;
+
+	xcfg->link_fd=bpf(BPF_LINK_CREATE, &attr);
+	if(xcfg->link_fd<0) {
+		perror("failed to attach xdp program");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Map one of the AF_XDP rings into our address space.
+ *
+ * \param fd AF_XDP socket.
+ * \param ring Ring to set up.
+ * \param off Ring offsets reported by the kernel.
+ * \param pgoff Mmap offset selecting the ring.
+ * \param desc_size Size of a ring entry.
+ * \return 0 on success.
+ */
+static int xdp_map_ring(int fd, struct xdp_ring *ring,
+	const struct xdp_ring_offset *off, off_t pgoff, size_t desc_size)
+{
+	ring->size=XDP_RING_SIZE;
+	ring->mask=XDP_RING_SIZE-1;
+	ring->map_len=off->desc+XDP_RING_SIZE*desc_size;
+	ring->map=mmap(NULL, ring->map_len, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, fd, pgoff);
+	if(ring->map==MAP_FAILED) {
+		ring->map=NULL;
+		perror("failed to map xdp ring");
+		return 1;
+	}
+
+	ring->producer=(uint32_t*)((char*)ring->map+off->producer);
+	ring->consumer=(uint32_t*)((char*)ring->map+off->consumer);
+	ring->flags=(uint32_t*)((char*)ring->map+off->flags);
+	ring->desc=(char*)ring->map+off->desc;
+
+	return 0;
+}
+
+/**
+ * Number of entries which can be consumed from a ring (rx, completion).
+ */
+static inline uint32_t ring_avail(struct xdp_ring *ring)
+{
+	return __atomic_load_n(ring->producer, __ATOMIC_ACQUIRE)-
+		*ring->consumer;
+}
+
+/**
+ * Number of free entries in a ring we produce to (fill, tx).
+ */
+static inline uint32_t ring_free(struct xdp_ring *ring)
+{
+	return ring->size-(*ring->producer-
+		__atomic_load_n(ring->consumer, __ATOMIC_ACQUIRE));
+}
+
+static inline void ring_produce(struct xdp_ring *ring, uint32_t n)
+{
+	__atomic_store_n(ring->producer, *ring->producer+n, __ATOMIC_RELEASE);
+}
+
+static inline void ring_consume(struct xdp_ring *ring, uint32_t n)
+{
+	__atomic_store_n(ring->consumer, *ring->consumer+n, __ATOMIC_RELEASE);
+}
+
+/**
+ * Put free frames to the fill ring so the kernel can receive into them.
+ *
+ * \param xcfg XDP module config.
+ */
+static void xdp_refill(struct xdp_cfg *xcfg)
+{
+	uint64_t *addr=xcfg->fill.desc;
+	uint32_t n, i, idx=*xcfg->fill.producer;
+	uint32_t avail;
+
+	/* keep half of the frames for sending */
+	avail=xcfg->nfree>XDP_NUM_FRAMES/2?xcfg->nfree-XDP_NUM_FRAMES/2:0;
+	n=ring_free(&xcfg->fill);
+	if(n>avail)
+		n=avail;
+
+	for(i=0; i<n; i++)
+		addr[(idx+i)&xcfg->fill.mask]=xcfg->free_frames[--xcfg->nfree];
+
+	if(n)
+		ring_produce(&xcfg->fill, n);
+}
+
+/**
+ * Return frames of completed transmissions to the free list.
+ *
+ * \param xcfg XDP module config.
+ */
+static void xdp_complete(struct xdp_cfg *xcfg)
+{
+	uint64_t *addr=xcfg->comp.desc;
+	uint32_t n, i, idx=*xcfg->comp.consumer;
+
+	n=ring_avail(&xcfg->comp);
+	for(i=0; i<n; i++)
+		xcfg->free_frames[xcfg->nfree++]=addr[(idx+i)&xcfg->comp.mask];
+
+	if(n)
+		ring_consume(&xcfg->comp, n);
+}
+
+/**
+ * Create AF_XDP socket, register UMEM, set up and map all four rings and
+ * bind the socket to the interface queue.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success.
+ */
+static int xdp_open_socket(struct cyclicping_cfg *cfg)
+{
+	struct xdp_cfg *xcfg=cfg->current_mod->modcfg;
+	struct xdp_umem_reg mr;
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp;
+	socklen_t optlen;
+	int ndesc=XDP_RING_SIZE;
+	int i, val;
+
+	xcfg->fd=socket(AF_XDP, SOCK_RAW, 0);
+	if(xcfg->fd<0) {
+		perror("failed to create xdp socket");
+		return 1;
+	}
+
+	xcfg->umem=mmap(NULL, XDP_NUM_FRAMES*XDP_FRAME_SIZE,
+		PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE,
+		-1, 0);
+	if(xcfg->umem==MAP_FAILED) {
+		xcfg->umem=NULL;
+		perror("failed to allocate umem");
+		return 1;
+	}
+
+	memset(&mr, 0, sizeof(mr));
+	mr.addr=(uint64_t)(unsigned long)xcfg->umem;
+	mr.len=XDP_NUM_FRAMES*XDP_FRAME_SIZE;
+	mr.chunk_size=XDP_FRAME_SIZE;
+	mr.headroom=0;
+	if(setsockopt(xcfg->fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr))) {
+		perror("failed to register umem");
+		return 1;
+	}
+
+	if(setsockopt(xcfg->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ndesc,
+		sizeof(ndesc)) ||
+		setsockopt(xcfg->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ndesc,
+		sizeof(ndesc)) ||
+		setsockopt(xcfg->fd, SOL_XDP, XDP_RX_RING, &ndesc,
+		sizeof(ndesc)) ||
+		setsockopt(xcfg->fd, SOL_XDP, XDP_TX_RING, &ndesc,
+		sizeof(ndesc))) {
+		perror("failed to set xdp ring size");
+		return 1;
+	}
+
+	optlen=sizeof(off);
+	if(getsockopt(xcfg->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen)) {
+		perror("failed to get xdp ring offsets");
+		return 1;
+	}
+
+	if(xdp_map_ring(xcfg->fd, &xcfg->fill, &off.fr,
+		XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t)) ||
+		xdp_map_ring(xcfg->fd, &xcfg->comp, &off.cr,
+		XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(uint64_t)) ||
+		xdp_map_ring(xcfg->fd, &xcfg->rx, &off.rx,
+		XDP_PGOFF_RX_RING, sizeof(struct xdp_desc)) ||
+		xdp_map_ring(xcfg->fd, &xcfg->tx, &off.tx,
+		XDP_PGOFF_TX_RING, sizeof(struct xdp_desc)))
+		return 1;
+
+	/* all frames are free, give the receive share to the kernel */
+	for(i=0; i<XDP_NUM_FRAMES; i++)
+		xcfg->free_frames[xcfg->nfree++]=
+			(uint64_t)(XDP_NUM_FRAMES-1-i)*XDP_FRAME_SIZE;
+	xdp_refill(xcfg);
+
+	if(xcfg->busy_poll) {
+		val=1;
+		if(setsockopt(xcfg->fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &val,
+			sizeof(val)))
+			perror("WARN: setting SO_PREFER_BUSY_POLL failed");
+		val=XDP_BUSY_POLL_USEC;
+		if(setsockopt(xcfg->fd, SOL_SOCKET, SO_BUSY_POLL, &val,
+			sizeof(val)))
+			perror("WARN: setting SO_BUSY_POLL failed");
+		val=XDP_BUSY_POLL_BUDGET;
+		if(setsockopt(xcfg->fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &val,
+			sizeof(val)))
+			perror("WARN: setting SO_BUSY_POLL_BUDGET failed");
+	}
+
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family=AF_XDP;
+	sxdp.sxdp_ifindex=xcfg->ifindex;
+	sxdp.sxdp_queue_id=xcfg->queue;
+	sxdp.sxdp_flags=xcfg->bind_flags;
+	if(bind(xcfg->fd, (struct sockaddr *)&sxdp, sizeof(sxdp))) {
+		perror("failed to bind xdp socket");
+		return 1;
+	}
+
+	if(cfg->opts.verbose) {
+		struct xdp_options xopts;
+
+		optlen=sizeof(xopts);
+		if(!getsockopt(xcfg->fd, SOL_XDP, XDP_OPTIONS, &xopts,
+			&optlen)) {
+			printf("xdp socket bound in %s mode\n",
+				xopts.flags & XDP_OPTIONS_ZEROCOPY?
+				"zero-copy":"copy");
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Parse comma separated XDP mode flags.
+ *
+ * \param xcfg XDP module config.
+ * \param arg Flags argument.
+ * \return 0 on success.
+ */
+static int xdp_parse_flags(struct xdp_cfg *xcfg, char *arg)
+{
+	char *saveptr=NULL;
+	char *flag;
+	int ret;
+
+	for(flag=strtok_r(arg, ",", &saveptr); flag;
+		flag=strtok_r(NULL, ",", &saveptr)) {
+		if(strcmp(flag, "skb")==0) {
+			xcfg->attach_flags|=XDP_FLAGS_SKB_MODE;
+		} else if(strcmp(flag, "drv")==0) {
+			xcfg->attach_flags|=XDP_FLAGS_DRV_MODE;
+		} else if(strcmp(flag, "copy")==0) {
+			xcfg->bind_flags|=XDP_COPY;
+		} else if(strcmp(flag, "zc")==0) {
+			xcfg->bind_flags|=XDP_ZEROCOPY;
+		} else if(strcmp(flag, "wakeup")==0) {
+			xcfg->bind_flags|=XDP_USE_NEED_WAKEUP;
+		} else if(strcmp(flag, "busy")==0) {
+			xcfg->busy_poll=1;
+		} else if((ret=vlan_parse_flag(&xcfg->vlan, flag))) {
+			if(ret<0)
+				return 1;
+		} else {
+			fprintf(stderr, "unknown xdp flag %s\n", flag);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Parse module args. Load and attach XDP program, create AF_XDP socket.
+ * Init packet.
+ *
+ * \param cfg Cyclicping config data.
+ * \param argv Interface module arguments.
+ * \param argc Interface module count.
+ * \return 0 on success.
+ */
+static int xdp_setup(struct cyclicping_cfg *cfg, char **argv, int argc)
+{
+	struct xdp_cfg *xcfg=cfg->current_mod->modcfg;
+	int port_arg_idx=2;
+	int i;
+
+	if(argc<2) {
+		fprintf(stderr, "interface name requiered for xdp mode\n");
+		return 1;
+	}
+
+	xcfg->device=argv[1];
+	xcfg->ifindex=if_nametoindex(xcfg->device);
+	if(!xcfg->ifindex) {
+		fprintf(stderr, "no such interface %s\n", xcfg->device);
+		return 1;
+	}
+
+	if(cfg->opts.client) {
+		if(argc<4) {
+			fprintf(stderr, "ip and hw address required for "
+				"xdp client mode\n");
+			return 1;
+		}
+
+		/* prepare hw address */
+		for(i=0; i<strlen(argv[2]); i++)
+			if(argv[2][i]=='-')
+				argv[2][i]=':';
+
+		if(ether_aton_r(argv[2], &xcfg->dest_hwaddr)==NULL) {
+			perror("failed to convert destination hw address");
+			return 1;
+		}
+
+		/* convert destination address */
+		if(inet_aton(argv[3], &xcfg->dest_addr.sin_addr)==0) {
+			perror("failed to convert destination address");
+			return 1;
+		}
+		port_arg_idx=4;
+	}
+
+	if(argc>=port_arg_idx+1) {
+		xcfg->port=atoi(argv[port_arg_idx]);
+		if(xcfg->port<=0 || xcfg->port>0xffff) {
+			fprintf(stderr, "invalid port number for xdp "
+				"destination port\n");
+			return 1;
+		}
+	} else {
+		xcfg->port=DEFAULT_PORT;
+	}
+
+	if(argc>=port_arg_idx+2) {
+		xcfg->queue=atoi(argv[port_arg_idx+1]);
+		if(xcfg->queue<0) {
+			fprintf(stderr, "invalid xdp queue\n");
+			return 1;
+		}
+	}
+
+	if(argc>=port_arg_idx+3) {
+		if(xdp_parse_flags(xcfg, argv[port_arg_idx+2]))
+			return 1;
+	}
+	xcfg->tci=vlan_tci(&xcfg->vlan);
+
+	if(FRAME_VLAN_LEN+sizeof(struct pkt)+cfg->opts.length>
+		XDP_FRAME_SIZE) {
+		fprintf(stderr, "packet length too large for xdp\n");
+		return 1;
+	}
+
+	if(frame_interface_info(xcfg->device, &xcfg->out_pkt_header))
+		return 1;
+
+	frame_init(&xcfg->out_pkt_header, &xcfg->dest_hwaddr,
+		&xcfg->dest_addr.sin_addr, xcfg->port, cfg->opts.length);
+
+	hdr_init(cfg->send_packet, cfg->opts.length);
+
+	if(cfg->opts.client)
+		wire_set_eth(cfg, xcfg->device, sizeof(struct udphdr)+
+			cfg->opts.length, sizeof(struct ip), 8,
+			xcfg->tci<0?0:FRAME_VLAN_LEN);
+
+	if(xdp_create_map(xcfg) || xdp_open_socket(cfg) ||
+		xdp_add_socket(xcfg) || xdp_load_prog(xcfg))
+		return 1;
+
+	abort_fd=xcfg->fd;
+	xcfg->fd_abort=1;
+
+	return 0;
+}
+
+/**
+ * Init XDP connection module. Everything set up so far is released if a
+ * step fails.
+ *
+ * \param cfg Cyclicping config data.
+ * \param argv Interface module arguments.
+ * \param argc Interface module count.
+ * \return 0 on success.
+ */
+int xdp_init(struct cyclicping_cfg *cfg, char **argv, int argc)
+{
+	struct xdp_cfg *xcfg;
+
+	xcfg=(struct xdp_cfg*)calloc(1, sizeof(struct xdp_cfg));
+	if(xcfg==NULL) {
+		perror("failed to allocate memory for xdp cfg");
+		return 1;
+	}
+
+	cfg->current_mod->modcfg=xcfg;
+	xcfg->fd=xcfg->prog_fd=xcfg->map_fd=xcfg->link_fd=-1;
+	vlan_cfg_init(&xcfg->vlan);
+
+	if(xdp_setup(cfg, argv, argc)) {
+		xdp_deinit(cfg);
+		cfg->current_mod->modcfg=NULL;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Put a frame on the tx ring.
+ *
+ * \param xcfg XDP module config.
+ * \param addr UMEM address of the frame.
+ * \param len Frame length.
+ * \return 0 on success, 1 if the tx ring is full.
+ */
+static int xdp_tx_put(struct xdp_cfg *xcfg, uint64_t addr, uint32_t len)
+{
+	struct xdp_desc *desc=xcfg->tx.desc;
+	uint32_t idx=*xcfg->tx.producer;
+
+	if(!ring_free(&xcfg->tx))
+		return 1;
+
+	desc[idx&xcfg->tx.mask].addr=addr;
+	desc[idx&xcfg->tx.mask].len=len;
+	desc[idx&xcfg->tx.mask].options=0;
+	ring_produce(&xcfg->tx, 1);
+
+	return 0;
+}
+
+/**
+ * Make the kernel process the tx ring. With need_wakeup this is only done
+ * if the driver asks for it.
+ *
+ * \param xcfg XDP module config.
+ * \return 0 on success.
+ */
+static int xdp_tx_kick(struct xdp_cfg *xcfg)
+{
+	if((xcfg->bind_flags & XDP_USE_NEED_WAKEUP) &&
+		!(__atomic_load_n(xcfg->tx.flags, __ATOMIC_ACQUIRE) &
+		XDP_RING_NEED_WAKEUP))
+		return 0;
+
+	if(sendto(xcfg->fd, NULL, 0, MSG_DONTWAIT, NULL, 0)<0) {
+		if(errno==EAGAIN || errno==EBUSY || errno==ENOBUFS)
+			return 0;
+		perror("xdp failed to send packet");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Wait for packets on the rx ring. Either sleeps in poll() or busy polls
+ * the socket.
+ *
+ * \param cfg Cyclicping config data.
+ * \param timeout Timeout in ms, -1 to wait forever.
+ * \return 0 if packets are available, 1 on timeout, -1 on error.
+ */
+static int xdp_wait_rx(struct cyclicping_cfg *cfg, int timeout)
+{
+	struct xdp_cfg *xcfg=cfg->current_mod->modcfg;
+	struct pollfd pfd;
+	struct timespec now, end;
+	int ret;
+
+	if(ring_avail(&xcfg->rx))
+		return 0;
+
+	if(xcfg->busy_poll) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		end.tv_sec+=timeout/1000;
+		end.tv_nsec+=(timeout%1000)*1000000;
+
+		while(run) {
+			if(recvfrom(xcfg->fd, NULL, 0, MSG_DONTWAIT, NULL,
+				NULL)<0 && errno==EBADF)
+				return -1;
+
+			if(ring_avail(&xcfg->rx))
+				return 0;
+
+			if(timeout<0)
+				continue;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if(TSPEC_TO_NSEC((&now))>TSPEC_TO_NSEC((&end)))
+				return 1;
+		}
+
+		return -1;
+	}
+
+	pfd.fd=xcfg->fd;
+	pfd.events=POLLIN;
+
+	do {
+		ret=poll(&pfd, 1, timeout);
+		if(ret==0)
+			return 1;
+		if(ret<0 || pfd.revents & (POLLERR|POLLNVAL))
+			return -1;
+	} while(!ring_avail(&xcfg->rx));
+
+	return 0;
+}
+
+/**
+ * Check if a received frame is a cyclicping packet for us. The tag of
+ * tagged frames is removed in place.
+ *
+ * \param cfg Cyclicping config data.
+ * \param desc Rx descriptor of the frame.
+ * \param reply 1 if a reply is expected, 0 for a request.
+ * \return Pointer to the untagged frame or NULL.
+ */
+static struct pkt *xdp_frame(struct cyclicping_cfg *cfg,
+	const struct xdp_desc *desc, int reply)
+{
+	struct xdp_cfg *xcfg=cfg->current_mod->modcfg;
+	int len=desc->len;
+	struct pkt *pkt;
+	char *payload;
+
+	pkt=frame_vlan_pop(xcfg->umem+desc->addr, &len, xcfg->tci);
+	if(!pkt || !frame_match(pkt, len, xcfg->port, cfg->opts.length))
+		return NULL;
+
+	payload=(char*)pkt+sizeof(struct pkt);
+
+	if(hdr_check(payload, cfg->opts.length))
+		return NULL;
+
+	if(((hdr_get_flags(payload) & CP_FLAG_REPLY)!=0)!=reply)
+		return NULL;
+
+	return pkt;
+}
+
+/**
+ * XDP client.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+int xdp_client(struct cyclicping_cfg *cfg)
+{
+	struct xdp_cfg *xcfg=cfg->current_mod->modcfg;
+	struct xdp_desc *desc=xcfg->rx.desc;
+	struct timespec tsend, trecv, left;
+	struct pkt *pkt;
+	uint64_t addr;
+	uint32_t n, i, idx;
+	char *payload;
+	int ret, found=0;
+	int tag_len=xcfg->tci<0?0:FRAME_VLAN_LEN;
+
+	/* get a free frame and build the request in place */
+	xdp_complete(xcfg);
+	if(!xcfg->nfree) {
+		fprintf(stderr, "xdp client out of tx frames\n");
+		return 1;
+	}
+	addr=xcfg->free_frames[--xcfg->nfree];
+
+	/* leave room for the tag, it's inserted after the MAC addresses */
+	pkt=(struct pkt*)(xcfg->umem+addr+tag_len);
+	payload=(char*)pkt+sizeof(struct pkt);
+	memcpy(pkt, &xcfg->out_pkt_header, sizeof(struct pkt));
+	memcpy(payload, cfg->send_packet, cfg->opts.length);
+	hdr_stamp_request(payload, cfg->seq, cfg->opts.clock, &tsend);
+	frame_udp_checksum(pkt, cfg->opts.length);
+	frame_vlan_push(pkt, xcfg->tci);
+
+	if(xdp_tx_put(xcfg, addr, tag_len+sizeof(struct pkt)+
+		cfg->opts.length)) {
+		fprintf(stderr, "xdp client tx ring full\n");
+		return 1;
+	}
+	if(xdp_tx_kick(xcfg))
+		return 1;
+
+	/* receive until we get our reply or a timeout, late replies to
+	 * earlier requests are counted and skipped */
+	while(!found && run) {
+		if(reply_timeout(cfg, &tsend, &left)) {
+			reply_lost(cfg);
+			break;
+		}
+
+		ret=xdp_wait_rx(cfg, left.tv_sec*1000+
+			(left.tv_nsec+999999)/1000000);
+		if(ret>0 || (ret<0 && !run))
+			continue;
+		if(ret<0)
+			return 1;
+		clock_gettime(cfg->opts.clock, &trecv);
+
+		n=ring_avail(&xcfg->rx);
+		idx=*xcfg->rx.consumer;
+
+		for(i=0; i<n; i++) {
+			pkt=xdp_frame(cfg, &desc[(idx+i)&xcfg->rx.mask], 1);
+			if(pkt && match_reply(cfg, hdr_get_seq((char*)pkt+
+				sizeof(struct pkt)))==REPLY_CURRENT) {
+				memcpy(cfg->recv_packet, (char*)pkt+
+					sizeof(struct pkt), cfg->opts.length);
+				found=1;
+			}
+
+			xcfg->free_frames[xcfg->nfree++]=
+				desc[(idx+i)&xcfg->rx.mask].addr &
+				~(uint64_t)(XDP_FRAME_SIZE-1);
+		}
+
+		ring_consume(&xcfg->rx, n);
+		xdp_refill(xcfg);
+	}
+
+	/* add packet time to statistics */
+	if(found && add_packet_stats(cfg, &tsend, cfg->recv_packet, &trecv))
+		return 1;
+
+	cfg->seq++;
+
+	/* wait until next inverval */
+	return client_wait(cfg, tsend);
+}
+
+/**
+ * XDP server. Received requests are turned into replies in place and sent
+ * back from the same UMEM frame, so no payload gets copied.
+ *
+ * \param cfg Cyclicping config data.
+ * \return 0 on success, else 1.
+ */
+int xdp_server(struct cyclicping_cfg *cfg)
+{
+	struct xdp_cfg *xcfg=cfg->current_mod->modcfg;
+	struct xdp_desc *desc=xcfg->rx.desc;
+	struct timespec trecv;
+	struct pkt *pkt;
+	struct cp_hdr old;
+	uint64_t addr;
+	uint32_t n, i, idx;
+	int ret;
+
+	ret=xdp_wait_rx(cfg, -1);
+	if(ret)
+		return run?1:0;
+	clock_gettime(cfg->opts.clock, &trecv);
+
+	xdp_complete(xcfg);
+
+	n=ring_avail(&xcfg->rx);
+	idx=*xcfg->rx.consumer;
+
+	for(i=0; i<n; i++) {
+		addr=desc[(idx+i)&xcfg->rx.mask].addr;
+		pkt=xdp_frame(cfg, &desc[(idx+i)&xcfg->rx.mask], 0);
+
+		if(pkt) {
+			/* swapping keeps the checksums, only the changed
+			 * wire header has to be accounted for */
+			frame_swap(pkt);
+			memcpy(&old, pkt+1, sizeof(old));
+			hdr_stamp_reply((char*)pkt+sizeof(struct pkt),
+				cfg->opts.clock, &trecv);
+			frame_udp_update(pkt, &old, pkt+1, sizeof(old));
+			/* the reply carries our own priority */
+			frame_vlan_push(pkt, xcfg->tci);
+			if(!xdp_tx_put(xcfg, addr,
+				desc[(idx+i)&xcfg->rx.mask].len))
+				continue;
+		}
+
+		xcfg->free_frames[xcfg->nfree++]=
+			addr & ~(uint64_t)(XDP_FRAME_SIZE-1);
+	}
+
+	ring_consume(&xcfg->rx, n);
+
+	if(xdp_tx_kick(xcfg))
+		return 1;
+
+	xdp_refill(xcfg);
+
+	return 0;
+}
+
+/**
+ * Clean up XDP module ressources. Closing the link detaches the XDP
+ * program from the interface.
+ *
+ * \param cfg Cyclicping config data.
+ */
+void xdp_deinit(struct cyclicping_cfg *cfg)
+{
+	struct xdp_cfg *xcfg=cfg->current_mod->modcfg;
+	struct xdp_ring *rings[]={ &xcfg->fill, &xcfg->comp, &xcfg->rx,
+		&xcfg->tx };
+	int i;
+
+	if(xcfg->link_fd>=0)
+		close(xcfg->link_fd);
+	if(xcfg->prog_fd>=0)
+		close(xcfg->prog_fd);
+	if(xcfg->map_fd>=0)
+		close(xcfg->map_fd);
+
+	/* once it is abort_fd, the socket is closed as such at the end of
+	 * the test, unless the test didn't get that far */
+	if(xcfg->fd>=0 && (!xcfg->fd_abort || abort_fd==xcfg->fd)) {
+		if(abort_fd==xcfg->fd)
+			abort_fd=0;
+		close(xcfg->fd);
+	}
+
+	for(i=0; i<4; i++) {
+		if(rings[i]->map)
+			munmap(rings[i]->map, rings[i]->map_len);
+	}
+
+	if(xcfg->umem)
+		munmap(xcfg->umem, XDP_NUM_FRAMES*XDP_FRAME_SIZE);
+
+	free(xcfg);
+}
+
+/**
+ * Ouput XDP interface module usage.
+ */
+void xdp_usage(void)
+{
+	printf("  xdp - Use an AF_XDP socket\n");
+	printf("    xdp:interface[:port[:queue[:flags]]]          "
+		"XDP server\n");
+	printf("    xdp:interface:servermac:serverip[:port[:queue[:flags]]] "
+		"XDP client\n");
+	printf("    flags: comma separated list of skb, drv (attach mode), "
+		"copy, zc (bind mode),\n");
+	printf("    wakeup (use need_wakeup), busy (busy polling), vlan=<id> "
+		"and pcp=<priority>\n");
+	printf("    (send and expect 802.1Q tagged frames)\n");
+}
@@ -0,0 +1,85 @@
+/******************************************************************************
+* Copyright (C) 2016-2017 IMMS GmbH, Thomas Elste <thomas.elste@imms.de>
+
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+* USA.
+******************************************************************************/
+
+#ifndef __XDP_H__
+#define __XDP_H__
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include <net/ethernet.h>
+
+#include <frame.h>
+
+#define XDP_NUM_FRAMES	4096
+#define XDP_FRAME_SIZE	4096
+#define XDP_RING_SIZE	2048
+
+/* XDP program instructions checking and skipping the tag of tagged frames,
+ * they follow the data pointer loads */
+#define XDP_PROG_TAG_START	3
+#define XDP_PROG_TAG_LEN	9
+
+/* user space view of an AF_XDP ring */
+struct xdp_ring {
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void *desc;
+	void *map;
+	size_t map_len;
+	uint32_t mask;
+	uint32_t size;
+};
+
+struct xdp_cfg {
+	char *device;
+	int ifindex;
+	struct ether_addr dest_hwaddr;
+	struct sockaddr_in dest_addr;
+	int port;
+	int queue;
+	int fd;
+	/* fd has been handed over as abort_fd */
+	int fd_abort;
+	int prog_fd;
+	int map_fd;
+	int link_fd;
+	uint32_t bind_flags;
+	uint32_t attach_flags;
+	int busy_poll;
+	char *umem;
+	struct xdp_ring fill;
+	struct xdp_ring comp;
+	struct xdp_ring rx;
+	struct xdp_ring tx;
+	uint64_t free_frames[XDP_NUM_FRAMES];
+	int nfree;
+	struct pkt out_pkt_header;
+	struct vlan_cfg vlan;
+	/* tag control information, -1 for untagged frames */
+	int tci;
+};
+
+int xdp_init(struct cyclicping_cfg *cfg, char **argv, int argc);
+int xdp_client(struct cyclicping_cfg *cfg);
+int xdp_server(struct cyclicping_cfg *cfg);
+void xdp_deinit(struct cyclicping_cfg *cfg);
+void xdp_usage(void);
+
+#endif